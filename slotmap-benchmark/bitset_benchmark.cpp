@@ -66,6 +66,34 @@ struct FixedBitsetTraits
 };
 
 
+template<size_t BitsetSize>
+struct HierarchicalBitsetTraits
+{
+   static constexpr size_t Size = BitsetSize;
+   using BitsetType = slotmap::HierarchicalBitset<BitsetSize>;
+
+   static inline void Clear(BitsetType& bitset)
+   {
+      bitset.Clear();
+   }
+
+   static inline void Set(BitsetType& bitset, size_t index, bool value)
+   {
+      bitset.Set(index, value);
+   }
+
+   static inline bool Get(BitsetType& bitset, size_t index)
+   {
+      return bitset.Get(index);
+   }
+   
+   static inline size_t FindNextBitSet(const BitsetType& bitset, size_t start)
+   {
+      return bitset.FindNextBitSet(start);
+   }
+};
+
+
 template<typename Traits>
 size_t SetRandomBits(typename Traits::BitsetType& bitset, float fillRatio)
 {
@@ -175,6 +203,26 @@ void BM_Bitset_Iteration_ForEach(benchmark::State& state, float fillRatio)
 }
 
 
+template<typename Traits>
+void BM_Bitset_Iteration_ForEach_Simd(benchmark::State& state)
+{
+   const float fillRatio = static_cast<float>(state.range(0)) / 100.0f;
+   const slotmap::SimdLevel requestedLevel = static_cast<slotmap::SimdLevel>(state.range(1));
+
+   const slotmap::SimdLevel originalLevel = slotmap::GetSimdLevel();
+   if (slotmap::SetMaxSimdLevel(requestedLevel) != requestedLevel)
+   {
+      slotmap::SetMaxSimdLevel(originalLevel);
+      state.SkipWithError("SIMD level not supported by the CPU");
+      return;
+   }
+
+   BM_Bitset_Iteration_ForEach<Traits>(state, fillRatio);
+
+   slotmap::SetMaxSimdLevel(originalLevel);
+}
+
+
 template<typename Traits>
 void BM_Bitset_Iteration(benchmark::State& state)
 {
@@ -193,14 +241,23 @@ void BM_Bitset_Iteration_ForEach(benchmark::State& state)
 
 BENCHMARK_TEMPLATE(BM_Bitset_Set, StdBitsetTraits<1000000>);
 BENCHMARK_TEMPLATE(BM_Bitset_Set, FixedBitsetTraits<1000000>);
+BENCHMARK_TEMPLATE(BM_Bitset_Set, HierarchicalBitsetTraits<1000000>);
 
 BENCHMARK_TEMPLATE(BM_Bitset_Clear, StdBitsetTraits<1000000>)->Iterations(100);
 BENCHMARK_TEMPLATE(BM_Bitset_Clear, FixedBitsetTraits<1000000>)->Iterations(100);
+BENCHMARK_TEMPLATE(BM_Bitset_Clear, HierarchicalBitsetTraits<1000000>)->Iterations(100);
 
 BENCHMARK_TEMPLATE(BM_Bitset_Iteration, StdBitsetTraits<1000000>)
-   ->DenseRange(0, 100, 10);
+   ->Arg(1)->DenseRange(0, 100, 10);
 BENCHMARK_TEMPLATE(BM_Bitset_Iteration, FixedBitsetTraits<1000000>)
-   ->DenseRange(0, 100, 10);
+   ->Arg(1)->DenseRange(0, 100, 10);
+BENCHMARK_TEMPLATE(BM_Bitset_Iteration, HierarchicalBitsetTraits<1000000>)
+   ->Arg(1)->DenseRange(0, 100, 10);
 BENCHMARK_TEMPLATE(BM_Bitset_Iteration_ForEach, FixedBitsetTraits<1000000>)
-   ->DenseRange(0, 100, 10);
+   ->Arg(1)->DenseRange(0, 100, 10);
+BENCHMARK_TEMPLATE(BM_Bitset_Iteration_ForEach, HierarchicalBitsetTraits<1000000>)
+   ->Arg(1)->DenseRange(0, 100, 10);
 
+BENCHMARK_TEMPLATE(BM_Bitset_Iteration_ForEach_Simd, FixedBitsetTraits<1000000>)
+   ->ArgsProduct({{0, 1, 10, 50, 90, 100}, {0, 1, 2, 3}})
+   ->ArgNames({"fill", "simd"});
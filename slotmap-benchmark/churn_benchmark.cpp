@@ -0,0 +1,100 @@
+// Copyright (c) 2024, Jan Milik (jan.milik@gmail.com) - All rights reserved.
+
+#include <benchmark/benchmark.h>
+
+#include <slotmap/slotmap.h>
+
+#include <random>
+#include <vector>
+
+
+struct ChurnValue
+{
+   uint64_t m_data[8] = {};
+};
+
+
+using ChurnMap = slotmap::SlotMap<ChurnValue>;
+
+
+/**
+ * Erases `count` random elements of the map.
+ */
+void EraseRandom(ChurnMap& map, std::vector<uint32_t>& keys, size_t count, std::mt19937& random)
+{
+   for (size_t i = 0; i < count; ++i)
+   {
+      const size_t index = std::uniform_int_distribution<size_t>(0, keys.size() - 1)(random);
+      map.Erase(keys[index]);
+      keys[index] = keys.back();
+      keys.pop_back();
+   }
+}
+
+
+/**
+ * Reports the number of chunks by the fraction of their slots in use.
+ */
+void ReportChunkFill(benchmark::State& state, const ChurnMap& map)
+{
+   const slotmap::ChunkOccupancyHistogram histogram = map.GetStorage().OccupancyHistogram();
+
+   state.counters["chunks"] = static_cast<double>(histogram.m_chunkCount);
+   state.counters["empty"] = static_cast<double>(histogram.m_chunkCounts[0]);
+   state.counters["<25%"] = static_cast<double>(histogram.m_chunkCounts[1]);
+   state.counters["<50%"] = static_cast<double>(histogram.m_chunkCounts[2]);
+   state.counters["<75%"] = static_cast<double>(histogram.m_chunkCounts[3]);
+   state.counters["<100%"] = static_cast<double>(histogram.m_chunkCounts[4]);
+   state.counters["full"] = static_cast<double>(histogram.m_chunkCounts[5]);
+   state.counters["fragmentation"] = histogram.GetFragmentation();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+void BM_Churn_ChunkFill(benchmark::State& state)
+{
+   const auto policy = static_cast<slotmap::ChunkAllocationPolicy>(state.range(0));
+   const size_t rounds = static_cast<size_t>(state.range(1));
+   constexpr size_t Count = 1000000;
+   constexpr size_t ChurnCount = Count / 20;
+
+   ChurnMap map;
+   std::vector<uint32_t> keys;
+   std::mt19937 random(239480239);
+
+   for (auto _ : state)
+   {
+      // Half of the elements are erased at random, then each round replaces
+      // another 10% of the live elements.
+      state.PauseTiming();
+      map.Clear();
+      map.ShrinkToFit();
+      map.GetStorage().SetChunkAllocationPolicy(policy);
+      keys.clear();
+      for (size_t i = 0; i < Count; ++i)
+      {
+         keys.push_back(map.Emplace());
+      }
+      EraseRandom(map, keys, Count / 2, random);
+      state.ResumeTiming();
+
+      for (size_t round = 0; round < rounds; ++round)
+      {
+         EraseRandom(map, keys, ChurnCount, random);
+         for (size_t i = 0; i < ChurnCount; ++i)
+         {
+            keys.push_back(map.Emplace());
+         }
+      }
+   }
+
+   state.SetItemsProcessed(state.iterations() * rounds * ChurnCount * 2);
+   ReportChunkFill(state, map);
+}
+
+
+BENCHMARK(BM_Churn_ChunkFill)
+   ->ArgNames({"policy", "rounds"})
+   ->ArgsProduct({{0, 1}, {0, 10, 100, 1000}})
+   ->Unit(benchmark::kMillisecond)
+   ->Iterations(1);
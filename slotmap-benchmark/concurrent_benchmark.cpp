@@ -0,0 +1,215 @@
+// Copyright (c) 2024, Jan Milik (jan.milik@gmail.com) - All rights reserved.
+
+#include <benchmark/benchmark.h>
+
+#include <slotmap/concurrent_slotmap.h>
+
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+template<typename T>
+class LockedSlotMapContainer
+{
+public:
+   using ContainerType = slotmap::SlotMap<T>;
+   using ValueType = T;
+   using KeyType = typename ContainerType::KeyType;
+
+   inline KeyType Insert(T value)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_slotmap.Emplace(value);
+   }
+
+   inline bool Erase(KeyType key)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_slotmap.Erase(key);
+   }
+
+   inline const ValueType* Find(KeyType key)
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      return m_slotmap.GetPtr(key);
+   }
+
+   inline void Reserve(size_t count)
+   {
+      m_slotmap.Reserve(count);
+   }
+
+   std::mutex m_mutex;
+   ContainerType m_slotmap;
+};
+
+
+template<typename T>
+class ConcurrentSlotMapContainer
+{
+public:
+   using ContainerType = slotmap::ConcurrentSlotMap<T>;
+   using ValueType = T;
+   using KeyType = typename ContainerType::KeyType;
+
+   inline KeyType Insert(T value)
+   {
+      return m_slotmap.Emplace(value);
+   }
+
+   inline bool Erase(KeyType key)
+   {
+      return m_slotmap.Erase(key);
+   }
+
+   inline const ValueType* Find(KeyType key)
+   {
+      return m_slotmap.GetPtr(key);
+   }
+
+   inline void Reserve(size_t count)
+   {
+      m_slotmap.Reserve(count);
+   }
+
+   ContainerType m_slotmap;
+};
+
+
+#define THREADS ->Threads(1)->Threads(2)->Threads(4)->Threads(8)->UseRealTime()
+
+#define MY_BENCHMARK(name_, traits_, traitsName_) \
+   BENCHMARK_TEMPLATE(name_, traits_)->Name(#name_ "/" #traitsName_)THREADS
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Every thread inserts a batch of elements into a shared map and then erases
+ * them again.
+ */
+template<typename TContainer>
+void BM_Concurrent_InsertErase(benchmark::State& state)
+{
+   using KeyType = typename TContainer::KeyType;
+
+   constexpr size_t BatchSize = 1000;
+
+   // Recreated by the first thread of the next run, other threads may still
+   // be using the container after their timing loop ends.
+   static std::unique_ptr<TContainer> container;
+   if (state.thread_index() == 0)
+   {
+      container = std::make_unique<TContainer>();
+   }
+
+   std::vector<KeyType> keys;
+   keys.reserve(BatchSize);
+
+   for (auto _ : state)
+   {
+      for (size_t i = 0; i < BatchSize; ++i)
+      {
+         keys.push_back(container->Insert(i));
+      }
+      for (KeyType key : keys)
+      {
+         container->Erase(key);
+      }
+      keys.clear();
+   }
+
+   state.SetItemsProcessed(state.iterations() * BatchSize * 2);
+}
+MY_BENCHMARK(BM_Concurrent_InsertErase, LockedSlotMapContainer<uint64_t>, LockedSlotMap);
+MY_BENCHMARK(BM_Concurrent_InsertErase, ConcurrentSlotMapContainer<uint64_t>, ConcurrentSlotMap);
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Same as \ref BM_Concurrent_InsertErase, but every thread goes through its
+ * own \ref slotmap::ConcurrentSlotCache.
+ */
+template<typename TContainer>
+void BM_Concurrent_InsertErase_Cached(benchmark::State& state)
+{
+   using KeyType = typename TContainer::KeyType;
+
+   constexpr size_t BatchSize = 1000;
+
+   // Recreated by the first thread of the next run, other threads may still
+   // be using the container after their timing loop ends.
+   static std::unique_ptr<TContainer> container;
+   if (state.thread_index() == 0)
+   {
+      container = std::make_unique<TContainer>();
+   }
+
+   std::vector<KeyType> keys;
+   keys.reserve(BatchSize);
+
+   {
+      slotmap::ConcurrentSlotCache cache(container->m_slotmap);
+
+      for (auto _ : state)
+      {
+         for (size_t i = 0; i < BatchSize; ++i)
+         {
+            keys.push_back(cache.Emplace(i));
+         }
+         for (KeyType key : keys)
+         {
+            cache.Erase(key);
+         }
+         keys.clear();
+      }
+   }
+
+   state.SetItemsProcessed(state.iterations() * BatchSize * 2);
+}
+MY_BENCHMARK(BM_Concurrent_InsertErase_Cached, ConcurrentSlotMapContainer<uint64_t>, ConcurrentSlotMap);
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Thread 0 keeps inserting and erasing while the other threads look up
+ * elements that stay in the map.
+ */
+template<typename TContainer>
+void BM_Concurrent_Lookup(benchmark::State& state)
+{
+   using KeyType = typename TContainer::KeyType;
+
+   constexpr size_t Count = 100000;
+
+   static TContainer* container = nullptr;
+   static std::vector<KeyType> keys;
+   if (state.thread_index() == 0)
+   {
+      container = new TContainer();
+      container->Reserve(Count * 2);
+      keys.clear();
+      for (size_t i = 0; i < Count; ++i)
+      {
+         keys.push_back(container->Insert(i));
+      }
+   }
+
+   size_t index = static_cast<size_t>(state.thread_index()) * 7919;
+   for (auto _ : state)
+   {
+      if (state.thread_index() == 0)
+      {
+         container->Erase(container->Insert(index));
+      }
+      else
+      {
+         benchmark::DoNotOptimize(container->Find(keys[index % Count]));
+      }
+      index += 97;
+   }
+
+   state.SetItemsProcessed(state.iterations());
+}
+MY_BENCHMARK(BM_Concurrent_Lookup, LockedSlotMapContainer<uint64_t>, LockedSlotMap);
+MY_BENCHMARK(BM_Concurrent_Lookup, ConcurrentSlotMapContainer<uint64_t>, ConcurrentSlotMap);
@@ -0,0 +1,56 @@
+// Copyright (c) 2024, Jan Milik (jan.milik@gmail.com) - All rights reserved.
+
+#include <benchmark/benchmark.h>
+
+#include <slotmap/slotmap.h>
+
+#include <random>
+#include <vector>
+
+
+struct CopyValue
+{
+   uint64_t m_data[8] = {};
+};
+
+
+using CopyMap = slotmap::SlotMap<CopyValue>;
+
+
+//////////////////////////////////////////////////////////////////////////
+void BM_Copy_Snapshot(benchmark::State& state)
+{
+   const bool isCopyOnWrite = state.range(0) != 0;
+   const size_t count = static_cast<size_t>(state.range(1));
+   const size_t writeCount = static_cast<size_t>(state.range(2));
+
+   // Each iteration takes a copy for a reader, then writes `writeCount`
+   // random values of the original while the copy is alive.
+   CopyMap map;
+   map.GetStorage().SetCopyOnWrite(isCopyOnWrite);
+   std::vector<uint32_t> keys;
+   keys.reserve(count);
+   for (size_t i = 0; i < count; ++i)
+   {
+      keys.push_back(map.Emplace());
+   }
+   std::mt19937 random(239480239);
+
+   for (auto _ : state)
+   {
+      CopyMap copy(map);
+      for (size_t i = 0; i < writeCount; ++i)
+      {
+         ++map.GetPtr(keys[std::uniform_int_distribution<size_t>(0, count - 1)(random)])->m_data[0];
+      }
+      benchmark::DoNotOptimize(copy.Size());
+   }
+
+   state.SetItemsProcessed(state.iterations() * count);
+}
+
+
+BENCHMARK(BM_Copy_Snapshot)
+   ->ArgNames({"cow", "count", "writes"})
+   ->ArgsProduct({{0, 1}, {1000000}, {0, 100, 10000}})
+   ->Unit(benchmark::kMicrosecond);
@@ -0,0 +1,106 @@
+// Copyright (c) 2024, Jan Milik (jan.milik@gmail.com) - All rights reserved.
+
+#include <benchmark/benchmark.h>
+
+#include <slotmap/mapped_slotmap.h>
+
+#if SLOTMAP_MAPPED_STORAGE
+
+#include <cstdio>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+
+struct MappedRecord
+{
+   uint64_t m_data[4] = {};
+};
+
+
+std::string GetMappedBenchmarkPath()
+{
+   return "/tmp/slotmap_mapped_benchmark_" + std::to_string(getpid());
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+void BM_Mapped_Rebuild(benchmark::State& state)
+{
+   const size_t count = static_cast<size_t>(state.range(0));
+
+   // Rebuild the map from an array of records, as if they were loaded from a
+   // database.
+   std::vector<MappedRecord> records(count);
+   for (size_t i = 0; i < count; ++i)
+   {
+      records[i].m_data[0] = i;
+   }
+
+   for (auto _ : state)
+   {
+      slotmap::SlotMap<MappedRecord> map;
+      for (const MappedRecord& record : records)
+      {
+         map.Emplace(record);
+      }
+      benchmark::DoNotOptimize(map.Size());
+   }
+
+   state.SetItemsProcessed(state.iterations() * count);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+void BM_Mapped_Reopen(benchmark::State& state)
+{
+   const size_t count = static_cast<size_t>(state.range(0));
+   const bool touch = state.range(1) != 0;
+   const std::string path = GetMappedBenchmarkPath();
+
+   std::remove(path.c_str());
+   {
+      slotmap::MappedSlotMap<MappedRecord> map;
+      map.GetStorage().Open(path.c_str());
+      for (size_t i = 0; i < count; ++i)
+      {
+         MappedRecord record;
+         record.m_data[0] = i;
+         map.Emplace(record);
+      }
+   }
+
+   for (auto _ : state)
+   {
+      slotmap::MappedSlotMap<MappedRecord> map;
+      map.GetStorage().Open(path.c_str());
+      if (touch)
+      {
+         // Page in the whole file.
+         uint64_t checksum = 0;
+         map.ForEach([&](uint32_t, const MappedRecord& record)
+         {
+            checksum += record.m_data[0];
+         });
+         benchmark::DoNotOptimize(checksum);
+      }
+      benchmark::DoNotOptimize(map.Size());
+   }
+
+   state.SetItemsProcessed(state.iterations() * count);
+   std::remove(path.c_str());
+}
+
+
+BENCHMARK(BM_Mapped_Rebuild)
+   ->ArgNames({"count"})
+   ->Arg(1000000)
+   ->Unit(benchmark::kMillisecond);
+BENCHMARK(BM_Mapped_Reopen)
+   ->ArgNames({"count", "touch"})
+   ->ArgsProduct({{1000000}, {0, 1}})
+   ->Unit(benchmark::kMillisecond);
+
+
+#endif // SLOTMAP_MAPPED_STORAGE
@@ -6,8 +6,15 @@
 #include <benchmark/benchmark.h>
 
 #include <slotmap/slotmap.h>
+#include <slotmap/slab_allocator.h>
 
+#include <algorithm>
+#include <climits>
 #include <cstdlib>
+#include <limits>
+#include <memory>
+#include <random>
+#include <type_traits>
 #include <unordered_map>
 
 #include "benchmark_common.h"
@@ -158,6 +165,32 @@ public:
       m_slotmap.ForEach(func);
    }
 
+   inline void GetBatch(const KeyType* keys, size_t count, ValueType** outPtrs)
+   {
+      m_slotmap.GetPtrBatch(keys, count, outPtrs);
+   }
+
+   inline size_t InsertN(size_t count, KeyType* outKeys)
+   {
+      return m_slotmap.EmplaceN(count, [](size_t index) { return static_cast<ValueType>(index); }, outKeys);
+   }
+
+   inline size_t EraseN(const KeyType* keys, size_t count)
+   {
+      return m_slotmap.EraseN(keys, count);
+   }
+
+   template<typename TFunc, typename TExecutor>
+   inline void ParallelForEach(TFunc func, TExecutor& executor)
+   {
+      m_slotmap.ParallelForEach(func, executor);
+   }
+
+   inline void Compact()
+   {
+      m_slotmap.Compact(std::numeric_limits<size_t>::max(), [](KeyType, KeyType) {});
+   }
+
    ContainerType m_slotmap;
 };
 
@@ -165,6 +198,16 @@ public:
 template<typename T, size_t TCapacity>
 using FixedSlotMapContainer = SlotMapContainer<T, slotmap::FixedBitSetTraits<>, slotmap::FixedSlotMapStorage<T, uint32_t, TCapacity>>;
 using FixedSlotMapContainer1000000 = FixedSlotMapContainer<uint64_t, 1000000>;
+using HierarchicalFixedSlotMapContainer1000000 = SlotMapContainer<uint64_t, slotmap::HierarchicalBitSetTraits<>,
+   slotmap::FixedSlotMapStorage<uint64_t, uint32_t, 1000000, slotmap::HierarchicalBitSetTraits<>>>;
+template<typename T>
+using HugePageSlotMapContainer = SlotMapContainer<T, slotmap::FixedBitSetTraits<>,
+   slotmap::ChunkedSlotMapStorage<T, uint32_t, slotmap::DefaultMaxChunkSize, slotmap::SlabAllocator<T>>>;
+template<typename T>
+using DenseSlotMapContainer = SlotMapContainer<T, slotmap::FixedBitSetTraits<>, slotmap::DenseSlotMapStorage<T, uint32_t>>;
+template<typename T>
+using InstrumentedSlotMapContainer = SlotMapContainer<T, slotmap::FixedBitSetTraits<>,
+   slotmap::ChunkedSlotMapStorage<T, uint32_t, slotmap::DefaultMaxChunkSize, std::allocator<T>, slotmap::FixedBitSetTraits<>, 8, slotmap::AtomicStats>>;
 
 
 template<typename T>
@@ -523,6 +566,8 @@ void BM_InsertErase(benchmark::State& state)
    AFTER_BENCHMARK()
 }
 MY_BENCHMARK(BM_InsertErase, SlotMapContainer<int>, SlotMap);
+MY_BENCHMARK(BM_InsertErase, InstrumentedSlotMapContainer<int>, InstrumentedSlotMap);
+MY_BENCHMARK(BM_InsertErase, DenseSlotMapContainer<int>, DenseSlotMap);
 MY_BENCHMARK(BM_InsertErase, StdUnorderedMapContainer<int>, UnorderedMap);
 MY_BENCHMARK(BM_InsertErase, VectorWithFreelist<int>, Vector);
 MY_BENCHMARK(BM_InsertErase, ColonyContainer<int>, Colony);
@@ -564,6 +609,265 @@ MY_BENCHMARK(BM_InsertAccess, VectorWithFreelist<uint64_t>, Vector);
 MY_BENCHMARK(BM_InsertAccess, ColonyContainer<uint64_t>, Colony);
 
 
+//////////////////////////////////////////////////////////////////////////
+template<typename TContainer>
+std::vector<typename TContainer::KeyType> SetupShuffledKeys(TContainer& container, size_t count)
+{
+   std::vector<typename TContainer::KeyType> keys;
+   keys.reserve(count);
+
+   container.Reserve(count);
+   for (size_t i = 0; i < count; ++i)
+   {
+      keys.push_back(container.Insert(i));
+   }
+
+   std::mt19937 random(239480239);
+   std::shuffle(keys.begin(), keys.end(), random);
+   return keys;
+}
+
+/**
+ * Looks up all elements in random order one by one, like `BM_InsertAccess`.
+ */
+template<typename TContainer>
+void BM_Lookup(benchmark::State& state)
+{
+   const size_t count = static_cast<size_t>(state.range(0));
+
+   auto container = std::make_unique<TContainer>();
+   const auto keys = SetupShuffledKeys(*container, count);
+
+   for (auto _ : state)
+   {
+      volatile uint64_t checksum = 0;
+      for (const auto key : keys)
+      {
+         checksum += container->Get(key);
+      }
+   }
+
+   state.SetItemsProcessed(state.iterations() * count);
+}
+
+/**
+ * Looks up all elements in random order with `GetPtrBatch()` in batches of
+ * 256 keys.
+ */
+template<typename TContainer>
+void BM_LookupBatch(benchmark::State& state)
+{
+   using ValueType = typename TContainer::ValueType;
+
+   constexpr size_t BatchSize = 256;
+
+   const size_t count = static_cast<size_t>(state.range(0));
+
+   auto container = std::make_unique<TContainer>();
+   const auto keys = SetupShuffledKeys(*container, count);
+
+   ValueType* ptrs[BatchSize];
+   for (auto _ : state)
+   {
+      volatile uint64_t checksum = 0;
+      for (size_t batchBegin = 0; batchBegin < count; batchBegin += BatchSize)
+      {
+         const size_t batchSize = std::min(BatchSize, count - batchBegin);
+         container->GetBatch(keys.data() + batchBegin, batchSize, ptrs);
+         for (size_t i = 0; i < batchSize; ++i)
+         {
+            checksum += *ptrs[i];
+         }
+      }
+   }
+
+   state.SetItemsProcessed(state.iterations() * count);
+}
+
+#undef ARGS
+#define ARGS ->Arg(1000)->Arg(100000)->Arg(1000000)->Arg(10000000)
+MY_BENCHMARK(BM_Lookup, SlotMapContainer<uint64_t>, SlotMap);
+MY_BENCHMARK(BM_Lookup, InstrumentedSlotMapContainer<uint64_t>, InstrumentedSlotMap);
+MY_BENCHMARK(BM_LookupBatch, SlotMapContainer<uint64_t>, SlotMap);
+MY_BENCHMARK(BM_Lookup, HugePageSlotMapContainer<uint64_t>, HugePageSlotMap);
+MY_BENCHMARK(BM_Lookup, DenseSlotMapContainer<uint64_t>, DenseSlotMap);
+#undef ARGS
+#define ARGS ->Arg(1000)->Arg(100000)->Arg(1000000)
+MY_BENCHMARK(BM_Lookup, FixedSlotMapContainer1000000, FixedSlotMap);
+MY_BENCHMARK(BM_LookupBatch, FixedSlotMapContainer1000000, FixedSlotMap);
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Loads a batch of elements into a map and drops them again, one element at
+ * a time. The map keeps its capacity between the iterations.
+ */
+template<typename TContainer>
+void BM_LoadDrop(benchmark::State& state)
+{
+   using ValueType = typename TContainer::ValueType;
+   using KeyType = typename TContainer::KeyType;
+
+   const size_t count = static_cast<size_t>(state.range(0));
+
+   auto container = std::make_unique<TContainer>();
+   container->Reserve(count);
+   std::vector<KeyType> keys(count);
+
+   for (auto _ : state)
+   {
+      for (size_t i = 0; i < count; ++i)
+      {
+         keys[i] = container->Insert(static_cast<ValueType>(i));
+      }
+      for (size_t i = 0; i < count; ++i)
+      {
+         container->Erase(keys[i]);
+      }
+   }
+
+   state.SetItemsProcessed(state.iterations() * count * 2);
+}
+
+/**
+ * Same as `BM_LoadDrop`, but with `EmplaceN()` and `EraseN()`.
+ */
+template<typename TContainer>
+void BM_LoadDropBatch(benchmark::State& state)
+{
+   using KeyType = typename TContainer::KeyType;
+
+   const size_t count = static_cast<size_t>(state.range(0));
+
+   auto container = std::make_unique<TContainer>();
+   container->Reserve(count);
+   std::vector<KeyType> keys(count);
+
+   for (auto _ : state)
+   {
+      container->InsertN(count, keys.data());
+      container->EraseN(keys.data(), count);
+   }
+
+   state.SetItemsProcessed(state.iterations() * count * 2);
+}
+
+MY_BENCHMARK(BM_LoadDrop, SlotMapContainer<uint64_t>, SlotMap);
+MY_BENCHMARK(BM_LoadDropBatch, SlotMapContainer<uint64_t>, SlotMap);
+MY_BENCHMARK(BM_LoadDrop, FixedSlotMapContainer1000000, FixedSlotMap);
+MY_BENCHMARK(BM_LoadDropBatch, FixedSlotMapContainer1000000, FixedSlotMap);
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Builds a new slotmap with the default allocator in every frame.
+ */
+struct DefaultFrameAllocator
+{
+   using MapType = slotmap::SlotMap<uint64_t>;
+
+   explicit DefaultFrameAllocator(size_t) {}
+
+   inline std::allocator<uint64_t> GetAllocator() { return {}; }
+   inline void EndFrame() {}
+};
+
+#if SLOTMAP_PMR
+/**
+ * Builds the slotmap in a preallocated buffer that is released at once at the
+ * end of every frame.
+ */
+struct MonotonicFrameAllocator
+{
+   using MapType = slotmap::pmr::SlotMap<uint64_t>;
+   using Storage = MapType::StorageType;
+
+   explicit MonotonicFrameAllocator(size_t count)
+      : m_buffer(GetBufferSize(count))
+      , m_resource(m_buffer.data(), m_buffer.size())
+   {
+   }
+
+   static size_t GetBufferSize(size_t count)
+   {
+      // The chunks plus the vector of chunk pointers, which grows
+      // geometrically.
+      const size_t chunkCount = (count + Storage::ChunkSlots - 1) / Storage::ChunkSlots;
+      return chunkCount * (sizeof(Storage::Chunk) + alignof(Storage::Chunk) + 4 * sizeof(void*)) + 4096;
+   }
+
+   inline std::pmr::polymorphic_allocator<uint64_t> GetAllocator() { return &m_resource; }
+   inline void EndFrame() { m_resource.release(); }
+
+   std::vector<std::byte> m_buffer;
+   std::pmr::monotonic_buffer_resource m_resource;
+};
+
+/**
+ * Builds the slotmap from a pool that keeps the released chunks between the
+ * frames.
+ */
+struct PoolFrameAllocator
+{
+   using MapType = slotmap::pmr::SlotMap<uint64_t>;
+
+   explicit PoolFrameAllocator(size_t) {}
+
+   inline std::pmr::polymorphic_allocator<uint64_t> GetAllocator() { return &m_resource; }
+   inline void EndFrame() {}
+
+   std::pmr::unsynchronized_pool_resource m_resource;
+};
+#endif
+
+
+/**
+ * Builds a slotmap of N elements, reads it and drops it, as a per-frame or
+ * per-request map would be used. The alloc counters show how many global
+ * allocations each frame needs with the given allocator.
+ */
+template<typename TFrameAllocator>
+void BM_FrameAlloc(benchmark::State& state)
+{
+   using MapType = typename TFrameAllocator::MapType;
+
+   const size_t count = static_cast<size_t>(state.range(0));
+   TFrameAllocator frameAllocator(count);
+
+   BEFORE_BENCHMARK()
+
+   for (auto _ : state)
+   {
+      ENABLE_MEM_COUNTERS();
+      {
+         MapType map(frameAllocator.GetAllocator());
+         for (size_t i = 0; i < count; ++i)
+         {
+            map.Emplace(i);
+         }
+
+         uint64_t sum = 0;
+         map.ForEach([&](typename MapType::KeyType, uint64_t value) { sum += value; });
+         benchmark::DoNotOptimize(sum);
+      }
+      frameAllocator.EndFrame();
+      DISABLE_MEM_COUNTERS();
+   }
+
+   state.SetItemsProcessed(state.iterations() * count);
+
+   AFTER_BENCHMARK()
+}
+
+#define FRAME_ARGS ->Arg(1000)->Arg(100000)->Arg(1000000)
+BENCHMARK_TEMPLATE(BM_FrameAlloc, DefaultFrameAllocator)->Name("BM_FrameAlloc/Default")FRAME_ARGS;
+#if SLOTMAP_PMR
+BENCHMARK_TEMPLATE(BM_FrameAlloc, MonotonicFrameAllocator)->Name("BM_FrameAlloc/PmrMonotonic")FRAME_ARGS;
+BENCHMARK_TEMPLATE(BM_FrameAlloc, PoolFrameAllocator)->Name("BM_FrameAlloc/PmrPool")FRAME_ARGS;
+#endif
+#undef FRAME_ARGS
+
+
 //////////////////////////////////////////////////////////////////////////
 template<typename TContainer>
 void BM_Clear(benchmark::State& state, const size_t count, float fillRatio)
@@ -607,7 +911,7 @@ void BM_Iteration_IteratorOnly(benchmark::State& state, TContainer& container)
    for (auto _ : state)
    {
       volatile uint64_t checksum = 0;
-      for (auto it = container.Begin(); it != container.End(); ++it)
+      for (auto it = container.m_slotmap.Begin(); it != container.m_slotmap.End(); ++it)
       {
          checksum += *it.GetPtr();
       }
@@ -621,7 +925,7 @@ void BM_Iteration_Iterator(benchmark::State& state, const size_t count, const fl
 
    SetupRandom(*container, count, fillRatio);
       
-   BM_Iteration_ForEachOnly(state, *container);
+   BM_Iteration_IteratorOnly(state, *container);
 }
 
 template<typename TContainer>
@@ -730,16 +1034,125 @@ void BM_Iteration_ForEach(benchmark::State& state)
 }
 
 
+/**
+ * Same as \ref BM_Iteration_ForEach, but the container is compacted after the
+ * random erasures.
+ */
+template<typename TContainer>
+void BM_Iteration_ForEachCompacted(benchmark::State& state)
+{
+   const float fillRatio = static_cast<float>(state.range(0)) / 100.0f;
+   const size_t count = static_cast<size_t>(state.range(1));
+
+   auto container = std::make_unique<TContainer>();
+
+   SetupRandom(*container, count, fillRatio);
+   container->Compact();
+
+   BM_Iteration_ForEachOnly(state, *container);
+}
+
+
+/**
+ * Same as \ref BM_Iteration_ForEach, but the values of each chunk are summed
+ * up by a loop over the span from `ForEachChunk()`. The words of the live
+ * bits with all slots live are summed up without looking at the bits, the
+ * others are masked without branches.
+ */
+template<typename TContainer>
+void BM_Iteration_ForEachChunk(benchmark::State& state)
+{
+   const float fillRatio = static_cast<float>(state.range(0)) / 100.0f;
+   const size_t count = static_cast<size_t>(state.range(1));
+
+   auto container = std::make_unique<TContainer>();
+
+   SetupRandom(*container, count, fillRatio);
+
+   const auto& map = container->m_slotmap;
+   for (auto _ : state)
+   {
+      volatile uint64_t checksum = 0;
+      map.ForEachChunk([&checksum](auto span)
+      {
+         using WordType = std::remove_cv_t<std::remove_pointer_t<decltype(span.GetLiveWords())>>;
+         constexpr size_t BitsPerWord = sizeof(WordType) * CHAR_BIT;
+
+         const auto* const values = span.GetValues();
+         const WordType* const words = span.GetLiveWords();
+         uint64_t sum = 0;
+         for (size_t wordIndex = 0; wordIndex < span.GetLiveWordCount(); ++wordIndex)
+         {
+            const WordType word = words[wordIndex];
+            const size_t first = wordIndex * BitsPerWord;
+            const size_t slotCount = std::min<size_t>(BitsPerWord, span.GetSlotCount() - first);
+            if (word == static_cast<WordType>(~static_cast<WordType>(0)))
+            {
+               for (size_t i = 0; i < slotCount; ++i)
+               {
+                  sum += values[first + i].m_value;
+               }
+            }
+            else
+            {
+               for (size_t i = 0; i < slotCount; ++i)
+               {
+                  sum += values[first + i].m_value & (0 - static_cast<uint64_t>((word >> i) & 1));
+               }
+            }
+         }
+         checksum += sum;
+      });
+   }
+}
+
+
+/**
+ * Same as \ref BM_Iteration_ForEach, but the values are visited with
+ * a range-based for loop over `Values()`.
+ */
+template<typename TContainer>
+void BM_Iteration_RangeFor(benchmark::State& state)
+{
+   const float fillRatio = static_cast<float>(state.range(0)) / 100.0f;
+   const size_t count = static_cast<size_t>(state.range(1));
+
+   auto container = std::make_unique<TContainer>();
+
+   SetupRandom(*container, count, fillRatio);
+
+   const auto& map = container->m_slotmap;
+   for (auto _ : state)
+   {
+      volatile uint64_t checksum = 0;
+      for (const auto& value : map.Values())
+      {
+         checksum += value;
+      }
+   }
+}
+
+
 #undef ARGS
 #define ARGS ->ArgsProduct({{0, 25, 50, 75, 100}, {1000000}})->Unit(benchmark::kMicrosecond)
 MY_BENCHMARK(BM_Iteration, SlotMapContainer<BenchmarkValue<>>, SlotMap);
 MY_BENCHMARK(BM_Iteration_ForEach, SlotMapContainer<BenchmarkValue<>>, SlotMap);
+MY_BENCHMARK(BM_Iteration_ForEachCompacted, SlotMapContainer<BenchmarkValue<>>, SlotMap);
+MY_BENCHMARK(BM_Iteration_ForEachChunk, SlotMapContainer<BenchmarkValue<>>, SlotMap);
 MY_BENCHMARK(BM_Iteration_Iterator, SlotMapContainer<BenchmarkValue<>>, SlotMap);
+MY_BENCHMARK(BM_Iteration_RangeFor, SlotMapContainer<BenchmarkValue<>>, SlotMap);
+MY_BENCHMARK(BM_Iteration, HugePageSlotMapContainer<BenchmarkValue<>>, HugePageSlotMap);
+MY_BENCHMARK(BM_Iteration_ForEach, HugePageSlotMapContainer<BenchmarkValue<>>, HugePageSlotMap);
+MY_BENCHMARK(BM_Iteration, DenseSlotMapContainer<BenchmarkValue<>>, DenseSlotMap);
+MY_BENCHMARK(BM_Iteration_ForEach, DenseSlotMapContainer<BenchmarkValue<>>, DenseSlotMap);
 using SlotMapContainerStdBitset = SlotMapContainer<BenchmarkValue<>, slotmap::StdBitSetTraits>;
 MY_BENCHMARK(BM_Iteration, SlotMapContainerStdBitset, SlotMapStdBitset);
 MY_BENCHMARK(BM_Iteration, FixedSlotMapContainer1000000, FixedSlotMap);
 MY_BENCHMARK(BM_Iteration_ForEach, FixedSlotMapContainer1000000, FixedSlotMap);
 MY_BENCHMARK(BM_Iteration_Iterator, FixedSlotMapContainer1000000, FixedSlotMap);
+MY_BENCHMARK(BM_Iteration_RangeFor, FixedSlotMapContainer1000000, FixedSlotMap);
+MY_BENCHMARK(BM_Iteration, HierarchicalFixedSlotMapContainer1000000, FixedSlotMapHierarchical);
+MY_BENCHMARK(BM_Iteration_ForEach, HierarchicalFixedSlotMapContainer1000000, FixedSlotMapHierarchical);
 MY_BENCHMARK(BM_Iteration, StdUnorderedMapContainer<BenchmarkValue<>>, UnorderedMap);
 MY_BENCHMARK(BM_Iteration, VectorWithFreelist<BenchmarkValue<>>, Vector);
 MY_BENCHMARK(BM_Iteration, ColonyContainer<BenchmarkValue<>>, Colony);
@@ -754,5 +1167,36 @@ MY_BENCHMARK(BM_Iteration_PartiallyFilled, VectorWithFreelist<BenchmarkValue<>>,
 MY_BENCHMARK(BM_Iteration_PartiallyFilled, ColonyContainer<BenchmarkValue<>>, Colony);
 
 
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TContainer>
+void BM_Iteration_ParallelForEach(benchmark::State& state)
+{
+   const float fillRatio = static_cast<float>(state.range(0)) / 100.0f;
+   const size_t count = static_cast<size_t>(state.range(1));
+   const size_t threadCount = static_cast<size_t>(state.range(2));
+
+   auto container = std::make_unique<TContainer>();
+
+   SetupRandom(*container, count, fillRatio);
+
+   slotmap::ThreadPool pool(threadCount - 1);
+
+   for (auto _ : state)
+   {
+      container->ParallelForEach([](typename TContainer::KeyType id, const typename TContainer::ValueType& value)
+      {
+         benchmark::DoNotOptimize(value);
+      }, pool);
+   }
+}
+
+
+#undef ARGS
+#define ARGS ->ArgsProduct({{25, 100}, {1000000}, {1, 2, 4, 8}})->Unit(benchmark::kMicrosecond)->UseRealTime()
+MY_BENCHMARK(BM_Iteration_ParallelForEach, SlotMapContainer<BenchmarkValue<>>, SlotMap);
+MY_BENCHMARK(BM_Iteration_ParallelForEach, FixedSlotMapContainer1000000, FixedSlotMap);
+
+
 BENCHMARK_MAIN();
 
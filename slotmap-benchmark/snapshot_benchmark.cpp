@@ -0,0 +1,161 @@
+// Copyright (c) 2024, Jan Milik (jan.milik@gmail.com) - All rights reserved.
+
+#include <benchmark/benchmark.h>
+
+#include <slotmap/slotmap.h>
+
+#include <random>
+#include <sstream>
+#include <vector>
+
+
+struct SnapshotValue
+{
+   uint64_t m_data[8] = {};
+};
+
+
+using SnapshotMap = slotmap::SlotMap<SnapshotValue>;
+
+
+/**
+ * Fills the map with `count` elements and erases a quarter of them at random.
+ */
+void SetupSnapshotMap(SnapshotMap& map, size_t count)
+{
+   std::vector<uint32_t> keys;
+   keys.reserve(count);
+   for (size_t i = 0; i < count; ++i)
+   {
+      SnapshotValue value;
+      value.m_data[0] = i;
+      keys.push_back(map.Emplace(value));
+   }
+
+   std::mt19937 random(239480239);
+   std::shuffle(keys.begin(), keys.end(), random);
+   keys.resize(count / 4);
+   for (const uint32_t key : keys)
+   {
+      map.Erase(key);
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+void BM_Snapshot_Save(benchmark::State& state)
+{
+   const size_t count = static_cast<size_t>(state.range(0));
+
+   SnapshotMap map;
+   SetupSnapshotMap(map, count);
+   std::stringstream stream;
+
+   for (auto _ : state)
+   {
+      stream.seekp(0);
+      map.SaveSnapshot(stream);
+      benchmark::ClobberMemory();
+   }
+
+   state.SetItemsProcessed(state.iterations() * map.Size());
+   state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(stream.tellp()));
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+void BM_Snapshot_Load(benchmark::State& state)
+{
+   const size_t count = static_cast<size_t>(state.range(0));
+
+   SnapshotMap map;
+   SetupSnapshotMap(map, count);
+   std::stringstream stream;
+   map.SaveSnapshot(stream);
+
+   SnapshotMap loaded;
+   for (auto _ : state)
+   {
+      stream.seekg(0);
+      loaded.LoadSnapshot(stream);
+      benchmark::DoNotOptimize(loaded.Size());
+   }
+
+   state.SetItemsProcessed(state.iterations() * loaded.Size());
+   state.SetBytesProcessed(state.iterations() * static_cast<int64_t>(stream.tellg()));
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+void BM_Snapshot_Reinsert(benchmark::State& state)
+{
+   const size_t count = static_cast<size_t>(state.range(0));
+
+   // The per-element path: copy the live elements into a new map, which
+   // also changes their keys.
+   SnapshotMap map;
+   SetupSnapshotMap(map, count);
+
+   for (auto _ : state)
+   {
+      SnapshotMap copy;
+      map.ForEach([&](uint32_t, const SnapshotValue& value)
+      {
+         copy.Emplace(value);
+      });
+      benchmark::DoNotOptimize(copy.Size());
+   }
+
+   state.SetItemsProcessed(state.iterations() * map.Size());
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+void BM_Snapshot_Delta(benchmark::State& state)
+{
+   const size_t count = static_cast<size_t>(state.range(0));
+   const size_t updateCount = static_cast<size_t>(state.range(1));
+
+   // Each epoch writes `updateCount` random elements, then saves the chunks
+   // they are in.
+   SnapshotMap map;
+   SetupSnapshotMap(map, count);
+   std::vector<uint32_t> keys;
+   map.ForEach([&](uint32_t key, const SnapshotValue&)
+   {
+      keys.push_back(key);
+   });
+   map.GetStorage().SetDirtyChunkTracking(true);
+   std::mt19937 random(239480239);
+   std::stringstream stream;
+   int64_t bytes = 0;
+
+   for (auto _ : state)
+   {
+      state.PauseTiming();
+      for (size_t i = 0; i < updateCount; ++i)
+      {
+         const uint32_t key = keys[std::uniform_int_distribution<size_t>(0, keys.size() - 1)(random)];
+         ++map.GetPtr(key)->m_data[1];
+         map.GetStorage().MarkDirty(key);
+      }
+      stream.str(std::string());
+      state.ResumeTiming();
+
+      map.GetStorage().SaveDelta(stream);
+      bytes += static_cast<int64_t>(stream.tellp());
+   }
+
+   state.SetBytesProcessed(bytes);
+   state.counters["bytes"] = static_cast<double>(bytes) / static_cast<double>(state.iterations());
+}
+
+
+#define ARGS ->Arg(1000000)->Unit(benchmark::kMillisecond)
+BENCHMARK(BM_Snapshot_Save)ARGS;
+BENCHMARK(BM_Snapshot_Load)ARGS;
+BENCHMARK(BM_Snapshot_Reinsert)ARGS;
+BENCHMARK(BM_Snapshot_Delta)
+   ->ArgNames({"count", "updates"})
+   ->ArgsProduct({{1000000}, {10, 1000, 100000}})
+   ->Unit(benchmark::kMicrosecond);
@@ -0,0 +1,137 @@
+// Copyright (c) 2024, Jan Milik (jan.milik@gmail.com) - All rights reserved.
+
+#include <benchmark/benchmark.h>
+
+#include <slotmap/slotmap.h>
+#include <slotmap/soa_slotmap.h>
+
+#include <algorithm>
+#include <random>
+#include <vector>
+
+
+/**
+ * Component-style value with 12 fields, of which the benchmarked pass reads
+ * two (the position and the velocity along one axis).
+ */
+struct PhysicsValue
+{
+   float m_fields[12] = {};
+};
+
+
+using SoaPhysicsMap = slotmap::SoaSlotMap<float, float, float, float, float, float, float, float, float, float, float, float>;
+
+
+/**
+ * Fills the map with `count` elements and erases `100 - fill` percent of them
+ * at random, like `BM_Iteration`.
+ */
+template<typename TEmplace, typename TErase>
+void SetupPhysicsMap(size_t count, int fill, TEmplace emplace, TErase erase)
+{
+   std::vector<uint32_t> keys;
+   keys.reserve(count);
+   for (size_t i = 0; i < count; ++i)
+   {
+      keys.push_back(emplace(static_cast<float>(i)));
+   }
+
+   std::mt19937 random(239480239);
+   std::shuffle(keys.begin(), keys.end(), random);
+   keys.resize(count * static_cast<size_t>(100 - fill) / 100);
+   for (const uint32_t key : keys)
+   {
+      erase(key);
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+void BM_Soa_TwoFields_AoS(benchmark::State& state)
+{
+   const int fill = static_cast<int>(state.range(0));
+   const size_t count = static_cast<size_t>(state.range(1));
+
+   slotmap::SlotMap<PhysicsValue> map;
+   SetupPhysicsMap(count, fill,
+      [&](float value) { PhysicsValue v; v.m_fields[0] = value; v.m_fields[1] = 1.0f; return map.Emplace(v); },
+      [&](uint32_t key) { map.Erase(key); });
+
+   for (auto _ : state)
+   {
+      float checksum = 0.0f;
+      map.ForEach([&](uint32_t, const PhysicsValue& value)
+      {
+         checksum += value.m_fields[0] + value.m_fields[1] * 0.01f;
+      });
+      benchmark::DoNotOptimize(checksum);
+   }
+
+   state.SetItemsProcessed(state.iterations() * map.Size());
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+void BM_Soa_TwoFields_SoA(benchmark::State& state)
+{
+   const int fill = static_cast<int>(state.range(0));
+   const size_t count = static_cast<size_t>(state.range(1));
+
+   SoaPhysicsMap map;
+   SetupPhysicsMap(count, fill,
+      [&](float value) { const uint32_t key = map.Emplace(); *map.GetPtr<0>(key) = value; *map.GetPtr<1>(key) = 1.0f; return key; },
+      [&](uint32_t key) { map.Erase(key); });
+
+   for (auto _ : state)
+   {
+      float checksum = 0.0f;
+      map.ForEach<0, 1>([&](uint32_t, float position, float velocity)
+      {
+         checksum += position + velocity * 0.01f;
+      });
+      benchmark::DoNotOptimize(checksum);
+   }
+
+   state.SetItemsProcessed(state.iterations() * map.Size());
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+void BM_Soa_TwoFields_SoASpans(benchmark::State& state)
+{
+   const int fill = static_cast<int>(state.range(0));
+   const size_t count = static_cast<size_t>(state.range(1));
+
+   SoaPhysicsMap map;
+   SetupPhysicsMap(count, fill,
+      [&](float value) { const uint32_t key = map.Emplace(); *map.GetPtr<0>(key) = value; *map.GetPtr<1>(key) = 1.0f; return key; },
+      [&](uint32_t key) { map.Erase(key); });
+
+   for (auto _ : state)
+   {
+      // The dead slots are summed up as well (their velocity is zero or
+      // stale), which lets the loop vectorize.
+      float checksum = 0.0f;
+      map.ForEachChunk([&](SoaPhysicsMap::ChunkSpan span)
+      {
+         const float* const positions = span.GetField<0>();
+         const float* const velocities = span.GetField<1>();
+         float chunkSum = 0.0f;
+         for (size_t i = 0; i < span.GetSlotCount(); ++i)
+         {
+            chunkSum += positions[i] + velocities[i] * 0.01f;
+         }
+         checksum += chunkSum;
+      });
+      benchmark::DoNotOptimize(checksum);
+   }
+
+   state.SetItemsProcessed(state.iterations() * map.Size());
+}
+
+
+#define ARGS ->ArgsProduct({{25, 50, 100}, {1000000}})->Unit(benchmark::kMicrosecond)
+BENCHMARK(BM_Soa_TwoFields_AoS)ARGS;
+BENCHMARK(BM_Soa_TwoFields_SoA)ARGS;
+BENCHMARK(BM_Soa_TwoFields_SoASpans)ARGS;
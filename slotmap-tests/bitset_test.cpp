@@ -80,6 +80,11 @@ public:
          return ::testing::AssertionFailure() << "Expected " << expected.size() << " bits set but got " << next;
       }
 
+      if (bitset.Count() != expected.size())
+      {
+         return ::testing::AssertionFailure() << "Expected " << expected.size() << " bits set but Count() returned " << bitset.Count();
+      }
+
       return ::testing::AssertionSuccess();
    }
 };
@@ -92,7 +97,7 @@ struct BitsetTestNameGenerator {
       using BitsetType = T;
 
       std::stringstream ss;
-      ss << BitsetType::StaticSize;
+      ss << i << "/" << BitsetType::StaticSize;
       return ss.str();
    }
 };
@@ -100,7 +105,11 @@ struct BitsetTestNameGenerator {
 
 using BitsetTestTypes = ::testing::Types<
    FixedBitset<64>,
-   FixedBitset<1024>>;
+   FixedBitset<1024>,
+   HierarchicalBitset<64>,
+   HierarchicalBitset<1024>,
+   HierarchicalBitset<5000>,
+   HierarchicalBitset<300000>>;
 TYPED_TEST_SUITE(BitsetTest, BitsetTestTypes, BitsetTestNameGenerator);
 
 
@@ -229,3 +238,197 @@ TYPED_TEST(BitsetTest, ForEachSetBit_FromTo)
    ASSERT_EQ(3, counter);
 }
 
+
+
+TYPED_TEST(BitsetTest, Sparse)
+{
+   using Bitset = typename TestFixture::BitsetType;
+   using IndexList = typename TestFixture::IndexList;
+
+   std::srand(1234);
+
+   Bitset bitset;
+   IndexList indexes;
+
+   for (size_t i = 0; i < bitset.size(); ++i)
+   {
+      if (randf() < 0.01f)
+      {
+         bitset.set(i);
+         indexes.push_back(i);
+      }
+   }
+   
+   EXPECT_TRUE(TestFixture::CheckBitset(bitset, indexes));
+
+   // Unset every other bit to make some words empty again.
+   IndexList remaining;
+   for (size_t i = 0; i < indexes.size(); ++i)
+   {
+      if ((i & 1) == 0)
+      {
+         bitset.reset(indexes[i]);
+      }
+      else
+      {
+         remaining.push_back(indexes[i]);
+      }
+   }
+
+   EXPECT_TRUE(TestFixture::CheckBitset(bitset, remaining));
+}
+
+
+TYPED_TEST(BitsetTest, ForEachSetBit_FromTo_WholeRange)
+{
+   using Bitset = typename TestFixture::BitsetType;
+
+   Bitset bitset;
+   bitset.set(0);
+   bitset.set(bitset.size() - 1);
+
+   size_t counter = 0;
+   bitset.ForEachSetBit(0, bitset.size(), [&](size_t index)
+   {
+      ++counter;
+   });
+   ASSERT_EQ(2, counter);
+
+   counter = 0;
+   bitset.ForEachSetBit(1, bitset.size() - 1, [&](size_t index)
+   {
+      ++counter;
+   });
+   ASSERT_EQ(0, counter);
+}
+
+
+TYPED_TEST(BitsetTest, SetRange)
+{
+   using Bitset = typename TestFixture::BitsetType;
+   using IndexList = typename TestFixture::IndexList;
+
+   const size_t size = Bitset::StaticSize;
+   const std::pair<size_t, size_t> ranges[] = {
+      { 0, 0 },
+      { 0, 1 },
+      { 3, 17 },
+      { 0, 64 },
+      { 60, 70 },
+      { 1, size - 1 },
+      { 0, size },
+      { size - 1, size },
+   };
+
+   for (auto range : ranges)
+   {
+      Bitset bitset;
+      IndexList indexes;
+
+      range.second = std::min(range.second, size);
+      range.first = std::min(range.first, range.second);
+
+      // A bit set next to the range must stay set.
+      if (range.first > 0)
+      {
+         bitset.set(range.first - 1);
+         indexes.push_back(range.first - 1);
+      }
+
+      bitset.SetRange(range.first, range.second);
+      for (size_t i = range.first; i < range.second; ++i)
+      {
+         indexes.push_back(i);
+      }
+
+      EXPECT_TRUE(TestFixture::CheckBitset(bitset, indexes)) << "Range " << range.first << ", " << range.second;
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(BitsetSimdTest, ForEachSetBit_AllLevels)
+{
+   // 19 words, so that every kernel has a scalar tail to process.
+   using Bitset = FixedBitset<19 * 64 - 5, uint64_t>;
+
+   const SimdLevel originalLevel = GetSimdLevel();
+
+   for (float fillRatio : { 0.0f, 0.01f, 0.5f, 1.0f })
+   {
+      std::srand(4321);
+
+      Bitset bitset;
+      std::vector<size_t> expected;
+      for (size_t i = 0; i < bitset.size(); ++i)
+      {
+         if (randf() < fillRatio)
+         {
+            bitset.set(i);
+            expected.push_back(i);
+         }
+      }
+
+      for (SimdLevel level : { SimdLevel::Scalar, SimdLevel::Sse42, SimdLevel::Avx2, SimdLevel::Avx512 })
+      {
+         if (SetMaxSimdLevel(level) != level)
+         {
+            continue;
+         }
+
+         std::vector<size_t> visited;
+         bitset.ForEachSetBit([&](size_t index)
+         {
+            visited.push_back(index);
+         });
+         EXPECT_EQ(expected, visited) << "SIMD level " << static_cast<int>(level) << ", fill ratio " << fillRatio;
+
+         std::vector<size_t> visitedRange;
+         bitset.ForEachSetBit(3, bitset.size() - 3, [&](size_t index)
+         {
+            visitedRange.push_back(index);
+         });
+         std::vector<size_t> expectedRange;
+         for (size_t index : expected)
+         {
+            if ((index >= 3) && (index < bitset.size() - 3))
+            {
+               expectedRange.push_back(index);
+            }
+         }
+         EXPECT_EQ(expectedRange, visitedRange) << "SIMD level " << static_cast<int>(level) << ", fill ratio " << fillRatio;
+      }
+   }
+
+   SetMaxSimdLevel(originalLevel);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(HierarchicalBitsetTest, Summary)
+{
+   using Bitset = HierarchicalBitset<300000, uint64_t>;
+   using Summary = typename Bitset::SummaryType;
+
+   static_assert(Bitset::NumWords == 4688);
+   static_assert(Summary::NumWords == 74);
+   static_assert(std::is_same_v<typename Summary::SummaryType, HierarchicalBitset<74, uint64_t>>);
+   static_assert(std::is_same_v<typename Summary::SummaryType::SummaryType, FixedBitset<2, uint64_t>>);
+
+   Bitset bitset;
+   bitset.set(64 * 64 * 64 + 5);
+   
+   EXPECT_TRUE(bitset.Summary().test(64 * 64 + 0));
+   EXPECT_TRUE(bitset.Summary().Summary().test(64));
+   EXPECT_TRUE(bitset.Summary().Summary().Summary().test(1));
+   EXPECT_EQ(64 * 64 * 64 + 5, bitset.FindNextBitSet(0));
+   EXPECT_EQ(64 * 64 * 64 + 5, bitset.FindNextBitSet(64 * 64 * 64 + 5));
+   EXPECT_EQ(bitset.size(), bitset.FindNextBitSet(64 * 64 * 64 + 6));
+
+   bitset.reset(64 * 64 * 64 + 5);
+
+   EXPECT_FALSE(bitset.Summary().test(64 * 64 + 0));
+   EXPECT_FALSE(bitset.Summary().Summary().test(64));
+   EXPECT_FALSE(bitset.Summary().Summary().Summary().test(1));
+   EXPECT_EQ(bitset.size(), bitset.FindNextBitSet(0));
+}
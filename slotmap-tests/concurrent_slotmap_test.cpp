@@ -0,0 +1,341 @@
+// Copyright (c) 2024, Jan Milik (jan.milik@gmail.com) - All rights reserved.
+
+#include "test_common.h"
+
+#include <slotmap/concurrent_slotmap.h>
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <atomic>
+#include <thread>
+#include <unordered_set>
+#include <vector>
+
+
+using namespace slotmap;
+
+
+namespace {
+constexpr size_t ThreadCount = 8;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ConcurrentSlotMapTest, ParallelEmplaceErase)
+{
+   using MapType = ConcurrentSlotMap<uint64_t>;
+   using KeyType = MapType::KeyType;
+
+   constexpr size_t ItemsPerThread = 20000;
+
+   MapType map;
+   std::vector<std::vector<KeyType>> keptKeys(ThreadCount);
+   std::vector<std::thread> threads;
+
+   for (size_t t = 0; t < ThreadCount; ++t)
+   {
+      threads.emplace_back([&map, &keptKeys, t]()
+      {
+         std::vector<KeyType> keys;
+         for (size_t i = 0; i < ItemsPerThread; ++i)
+         {
+            const uint64_t value = (static_cast<uint64_t>(t) << 32) | i;
+            keys.push_back(map.Emplace(value));
+
+            // Erase every other element soon after inserting it, so that
+            // slots are recycled while other threads are inserting.
+            if ((i % 2) == 1)
+            {
+               const KeyType key = keys[keys.size() - 2];
+               if (!map.Erase(key))
+               {
+                  ADD_FAILURE() << "Failed to erase key " << key;
+               }
+               keys.erase(keys.end() - 2);
+            }
+         }
+         keptKeys[t] = std::move(keys);
+      });
+   }
+
+   for (std::thread& thread : threads)
+   {
+      thread.join();
+   }
+
+   std::unordered_set<KeyType> allKeys;
+   for (size_t t = 0; t < ThreadCount; ++t)
+   {
+      for (size_t i = 0; i < keptKeys[t].size(); ++i)
+      {
+         const KeyType key = keptKeys[t][i];
+         ASSERT_NE(MapType::InvalidKey, key);
+         ASSERT_TRUE(allKeys.insert(key).second) << "Key " << key << " issued twice";
+
+         const uint64_t* ptr = map.GetPtr(key);
+         ASSERT_NE(nullptr, ptr);
+         ASSERT_EQ(t, *ptr >> 32);
+      }
+   }
+
+   ASSERT_EQ(ThreadCount * ItemsPerThread / 2, map.Size());
+
+   size_t count = 0;
+   map.ForEach([&](KeyType key, const uint64_t&)
+   {
+      EXPECT_EQ(1, allKeys.count(key));
+      ++count;
+   });
+   ASSERT_EQ(allKeys.size(), count);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ConcurrentSlotMapTest, RacingEraseSucceedsOnce)
+{
+   using MapType = ConcurrentSlotMap<uint64_t>;
+   using KeyType = MapType::KeyType;
+
+   constexpr size_t ItemCount = 10000;
+
+   MapType map;
+   std::vector<KeyType> keys;
+   for (size_t i = 0; i < ItemCount; ++i)
+   {
+      keys.push_back(map.Emplace(i));
+   }
+
+   std::atomic<size_t> erased{0};
+   std::vector<std::thread> threads;
+   for (size_t t = 0; t < ThreadCount; ++t)
+   {
+      threads.emplace_back([&]()
+      {
+         for (KeyType key : keys)
+         {
+            if (map.Erase(key))
+            {
+               erased.fetch_add(1, std::memory_order_relaxed);
+            }
+         }
+      });
+   }
+
+   for (std::thread& thread : threads)
+   {
+      thread.join();
+   }
+
+   ASSERT_EQ(ItemCount, erased.load());
+   ASSERT_EQ(0, map.Size());
+   for (KeyType key : keys)
+   {
+      ASSERT_EQ(nullptr, map.GetPtr(key));
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ConcurrentSlotMapTest, ReadersDuringWrites)
+{
+   using MapType = ConcurrentSlotMap<uint64_t>;
+   using KeyType = MapType::KeyType;
+
+   constexpr size_t StableCount = 5000;
+   constexpr size_t WriterIterations = 50000;
+
+   MapType map;
+   std::vector<KeyType> stableKeys;
+   for (size_t i = 0; i < StableCount; ++i)
+   {
+      stableKeys.push_back(map.Emplace(i));
+   }
+
+   std::atomic<bool> done{false};
+   std::vector<std::thread> threads;
+
+   // Writers keep growing and shrinking the map, which also allocates chunks.
+   for (size_t t = 0; t < ThreadCount / 2; ++t)
+   {
+      threads.emplace_back([&]()
+      {
+         std::vector<KeyType> keys;
+         for (size_t i = 0; i < WriterIterations; ++i)
+         {
+            keys.push_back(map.Emplace(StableCount + i));
+            if (keys.size() > 1000)
+            {
+               for (KeyType key : keys)
+               {
+                  EXPECT_TRUE(map.Erase(key));
+               }
+               keys.clear();
+            }
+         }
+         for (KeyType key : keys)
+         {
+            EXPECT_TRUE(map.Erase(key));
+         }
+         done.store(true);
+      });
+   }
+
+   for (size_t t = 0; t < ThreadCount / 2; ++t)
+   {
+      threads.emplace_back([&]()
+      {
+         while (!done.load())
+         {
+            for (size_t i = 0; i < StableCount; ++i)
+            {
+               const uint64_t* ptr = map.GetPtr(stableKeys[i]);
+               if (!ptr || (*ptr != i))
+               {
+                  ADD_FAILURE() << "Stable key " << stableKeys[i] << " not found";
+                  return;
+               }
+            }
+         }
+      });
+   }
+
+   for (std::thread& thread : threads)
+   {
+      thread.join();
+   }
+
+   ASSERT_EQ(StableCount, map.Size());
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ConcurrentSlotMapTest, ReserveDoesNotMoveChunks)
+{
+   using MapType = ConcurrentSlotMap<uint64_t>;
+   using KeyType = MapType::KeyType;
+
+   MapType map;
+   const KeyType key = map.Emplace(42u);
+   const uint64_t* ptr = map.GetPtr(key);
+
+   ASSERT_TRUE(map.Reserve(1000000));
+   ASSERT_GE(map.Capacity(), 1000000u);
+
+   ASSERT_EQ(ptr, map.GetPtr(key));
+   ASSERT_EQ(42u, *ptr);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ConcurrentSlotCacheTest, EmplaceErase)
+{
+   using MapType = ConcurrentSlotMap<uint64_t>;
+   using KeyType = MapType::KeyType;
+
+   MapType map;
+   std::vector<KeyType> keys;
+   {
+      ConcurrentSlotCache cache(map);
+      using CacheType = decltype(cache);
+
+      for (size_t i = 0; i < CacheType::MagazineSize * 4; ++i)
+      {
+         keys.push_back(cache.Emplace(i));
+         ASSERT_NE(MapType::InvalidKey, keys.back());
+      }
+      ASSERT_EQ(keys.size(), map.Size());
+
+      for (size_t i = 0; i < keys.size(); ++i)
+      {
+         const uint64_t* ptr = map.GetPtr(keys[i]);
+         ASSERT_NE(nullptr, ptr);
+         ASSERT_EQ(i, *ptr);
+      }
+
+      // Erasing more than the magazine holds returns slots to the map.
+      for (KeyType key : keys)
+      {
+         ASSERT_TRUE(cache.Erase(key));
+         ASSERT_FALSE(cache.Erase(key));
+         ASSERT_EQ(nullptr, map.GetPtr(key));
+         ASSERT_LE(cache.CachedSlotCount(), CacheType::MagazineSize);
+      }
+      ASSERT_EQ(0, map.Size());
+      ASSERT_GT(cache.CachedSlotCount(), 0);
+
+      // Keys issued from recycled slots must differ from the erased ones.
+      const KeyType key = cache.Emplace(123u);
+      ASSERT_EQ(keys.end(), std::find(keys.begin(), keys.end(), key));
+      ASSERT_TRUE(map.Erase(key));
+   }
+
+   // All slots are back in the shared free lists.
+   const size_t capacity = map.Capacity();
+   for (size_t i = 0; i < capacity; ++i)
+   {
+      ASSERT_NE(MapType::InvalidKey, map.EmplaceNoAlloc(i));
+   }
+   ASSERT_EQ(capacity, map.Size());
+   ASSERT_EQ(capacity, map.Capacity());
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ConcurrentSlotCacheTest, ParallelEmplaceErase)
+{
+   using MapType = ConcurrentSlotMap<uint64_t>;
+   using KeyType = MapType::KeyType;
+
+   constexpr size_t ItemsPerThread = 20000;
+
+   MapType map;
+   std::vector<std::vector<KeyType>> keptKeys(ThreadCount);
+   std::vector<std::thread> threads;
+
+   for (size_t t = 0; t < ThreadCount; ++t)
+   {
+      threads.emplace_back([&map, &keptKeys, t]()
+      {
+         ConcurrentSlotCache<MapType::StorageType, 64> cache(map.GetStorage());
+         std::vector<KeyType> keys;
+         for (size_t i = 0; i < ItemsPerThread; ++i)
+         {
+            const uint64_t value = (static_cast<uint64_t>(t) << 32) | i;
+            keys.push_back(cache.Emplace(value));
+
+            // Freed slots stay in the magazine and are reused right away.
+            if ((i % 2) == 1)
+            {
+               const KeyType key = keys[keys.size() - 2];
+               if (!cache.Erase(key))
+               {
+                  ADD_FAILURE() << "Failed to erase key " << key;
+               }
+               keys.erase(keys.end() - 2);
+            }
+         }
+         keptKeys[t] = std::move(keys);
+      });
+   }
+
+   for (std::thread& thread : threads)
+   {
+      thread.join();
+   }
+
+   std::unordered_set<KeyType> allKeys;
+   for (size_t t = 0; t < ThreadCount; ++t)
+   {
+      for (KeyType key : keptKeys[t])
+      {
+         ASSERT_TRUE(allKeys.insert(key).second) << "Key " << key << " issued twice";
+
+         const uint64_t* ptr = map.GetPtr(key);
+         ASSERT_NE(nullptr, ptr);
+         ASSERT_EQ(t, *ptr >> 32);
+      }
+   }
+
+   ASSERT_EQ(ThreadCount * ItemsPerThread / 2, map.Size());
+}
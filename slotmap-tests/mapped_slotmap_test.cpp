@@ -0,0 +1,288 @@
+// Copyright (c) 2024, Jan Milik (jan.milik@gmail.com) - All rights reserved.
+
+#include <slotmap/mapped_slotmap.h>
+
+#if SLOTMAP_MAPPED_STORAGE
+
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+
+using namespace slotmap;
+
+
+namespace {
+struct MappedValue
+{
+   int m_a;
+   double m_b;
+};
+
+using MapType = MappedSlotMap<MappedValue>;
+using KeyType = MapType::KeyType;
+
+
+/**
+ * Path of a temporary file that is removed when the test ends.
+ */
+class TempFile
+{
+public:
+   TempFile()
+      : m_path(testing::TempDir() + "slotmap_mapped_" + std::to_string(getpid()) + "_" +
+         testing::UnitTest::GetInstance()->current_test_info()->name())
+   {
+      std::remove(m_path.c_str());
+   }
+   ~TempFile() { std::remove(m_path.c_str()); }
+
+   const char* GetPath() const { return m_path.c_str(); }
+
+private:
+   std::string m_path;
+};
+
+
+/**
+ * Fills the map with `count` values and erases every third of them.
+ */
+std::vector<KeyType> FillMap(MapType& map, int count)
+{
+   std::vector<KeyType> keys;
+   for (int i = 0; i < count; ++i)
+   {
+      keys.push_back(map.Emplace(MappedValue{ i, i * 0.5 }));
+   }
+   for (size_t i = 0; i < keys.size(); i += 3)
+   {
+      map.Erase(keys[i]);
+   }
+   return keys;
+}
+
+
+void CheckMap(const MapType& map, const std::vector<KeyType>& keys)
+{
+   ASSERT_EQ(keys.size() - (keys.size() + 2) / 3, map.Size());
+   for (size_t i = 0; i < keys.size(); ++i)
+   {
+      const MappedValue* const value = map.GetPtr(keys[i]);
+      if ((i % 3) == 0)
+      {
+         ASSERT_EQ(nullptr, value);
+      }
+      else
+      {
+         ASSERT_NE(nullptr, value);
+         ASSERT_EQ(static_cast<int>(i), value->m_a);
+         ASSERT_EQ(static_cast<double>(i) * 0.5, value->m_b);
+      }
+   }
+
+   size_t count = 0;
+   map.ForEach([&](KeyType key, const MappedValue& value)
+   {
+      ASSERT_EQ(keys[static_cast<size_t>(value.m_a)], key);
+      ++count;
+   });
+   ASSERT_EQ(map.Size(), count);
+}
+} // namespace
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(MappedSlotMapTest, CloseAndReopen)
+{
+   TempFile file;
+   std::vector<KeyType> keys;
+   {
+      MapType map;
+      ASSERT_EQ(MapType::InvalidKey, map.Emplace());
+      ASSERT_EQ(MappedOpenResult::Created, map.GetStorage().Open(file.GetPath()));
+      keys = FillMap(map, 10000);
+      CheckMap(map, keys);
+   }
+
+   MapType map;
+   ASSERT_EQ(MappedOpenResult::Opened, map.GetStorage().Open(file.GetPath()));
+   CheckMap(map, keys);
+
+   // The freed slots are reused with a new generation, the old keys stay
+   // invalid.
+   for (size_t i = 0; i < keys.size(); i += 3)
+   {
+      const KeyType key = map.Emplace(MappedValue{ -1, 0.0 });
+      ASSERT_NE(MapType::InvalidKey, key);
+      ASSERT_EQ(nullptr, map.GetPtr(keys[i]));
+   }
+   ASSERT_EQ(keys.size(), map.Size());
+
+   map.Clear();
+   ASSERT_EQ(0, map.Size());
+   map.GetStorage().Close();
+   ASSERT_EQ(MappedOpenResult::Opened, map.GetStorage().Open(file.GetPath()));
+   ASSERT_EQ(0, map.Size());
+   for (const KeyType key : keys)
+   {
+      ASSERT_EQ(nullptr, map.GetPtr(key));
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(MappedSlotMapTest, RecoverUnflushed)
+{
+   TempFile file;
+   const std::string copyPath = std::string(file.GetPath()) + ".copy";
+   std::vector<KeyType> keys;
+   {
+      MapType map;
+      ASSERT_EQ(MappedOpenResult::Created, map.GetStorage().Open(file.GetPath()));
+      keys = FillMap(map, 5000);
+      ASSERT_TRUE(map.GetStorage().Flush());
+
+      // Copy the file while it is modified, as if the process crashed before
+      // the next flush.
+      for (size_t i = 0; i < keys.size(); ++i)
+      {
+         if ((i % 3) == 1)
+         {
+            map.GetPtr(keys[i])->m_b = -1.0;
+         }
+      }
+      map.Erase(keys[1]);
+      std::ifstream source(file.GetPath(), std::ios::binary);
+      std::ofstream destination(copyPath, std::ios::binary);
+      destination << source.rdbuf();
+   }
+
+   MapType map;
+   ASSERT_EQ(MappedOpenResult::Recovered, map.GetStorage().Open(copyPath.c_str()));
+   ASSERT_EQ(keys.size() - (keys.size() + 2) / 3 - 1, map.Size());
+   ASSERT_EQ(nullptr, map.GetPtr(keys[1]));
+   ASSERT_EQ(4, map.GetPtr(keys[4])->m_a);
+
+   // The rebuilt free lists hand out exactly the free slots.
+   const size_t size = map.Size();
+   for (size_t i = size; i < map.Capacity(); ++i)
+   {
+      ASSERT_NE(MapType::InvalidKey, map.Emplace(MappedValue{ -1, 0.0 }));
+   }
+   ASSERT_EQ(map.Capacity(), map.Size());
+   for (size_t i = 2; i < keys.size(); ++i)
+   {
+      if ((i % 3) != 0)
+      {
+         ASSERT_EQ(static_cast<int>(i), map.GetPtr(keys[i])->m_a);
+      }
+   }
+
+   // Flushed by the recovery.
+   map.GetStorage().Close();
+   ASSERT_EQ(MappedOpenResult::Opened, map.GetStorage().Open(copyPath.c_str()));
+   ASSERT_EQ(map.Capacity(), map.Size());
+   map.GetStorage().Close();
+   std::remove(copyPath.c_str());
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(MappedSlotMapTest, RecoverCleared)
+{
+   TempFile file;
+   std::vector<KeyType> keys;
+   {
+      MapType map;
+      ASSERT_EQ(MappedOpenResult::Created, map.GetStorage().Open(file.GetPath()));
+      keys = FillMap(map, 100);
+   }
+
+   // A child process clears the map and dies without closing it.
+   const pid_t child = fork();
+   ASSERT_NE(-1, child);
+   if (child == 0)
+   {
+      MapType map;
+      if (map.GetStorage().Open(file.GetPath()) != MappedOpenResult::Opened)
+      {
+         _exit(1);
+      }
+      map.Clear();
+      _exit(0);
+   }
+   int status = 0;
+   ASSERT_EQ(child, waitpid(child, &status, 0));
+   ASSERT_TRUE(WIFEXITED(status));
+   ASSERT_EQ(0, WEXITSTATUS(status));
+
+   MapType map;
+   ASSERT_EQ(MappedOpenResult::Recovered, map.GetStorage().Open(file.GetPath()));
+   ASSERT_EQ(0, map.Size());
+   for (const KeyType key : keys)
+   {
+      ASSERT_EQ(nullptr, map.GetPtr(key));
+   }
+   size_t count = 0;
+   map.ForEach([&](KeyType, const MappedValue&) { ++count; });
+   ASSERT_EQ(0, count);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(MappedSlotMapTest, IncompatibleFile)
+{
+   TempFile file;
+   {
+      MappedSlotMap<uint64_t> map;
+      ASSERT_EQ(MappedOpenResult::Created, map.GetStorage().Open(file.GetPath()));
+      map.Emplace(1u);
+   }
+
+   MappedSlotMap<uint32_t> map;
+   ASSERT_EQ(MappedOpenResult::Failed, map.GetStorage().Open(file.GetPath()));
+   ASSERT_FALSE(map.GetStorage().IsOpen());
+   ASSERT_EQ(MapType::InvalidKey, map.Emplace(1u));
+
+   {
+      std::ofstream garbage(file.GetPath(), std::ios::binary | std::ios::trunc);
+      garbage << "not a slotmap";
+   }
+   ASSERT_EQ(MappedOpenResult::Failed, map.GetStorage().Open(file.GetPath()));
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(MappedSlotMapTest, GrowthKeepsPointers)
+{
+   TempFile file;
+   using StorageType = MapType::StorageType;
+   constexpr size_t ChunkCount = 64;
+   const size_t maxFileSize = StorageType::DataOffset + ChunkCount * sizeof(StorageType::Chunk);
+
+   MapType map;
+   ASSERT_EQ(MappedOpenResult::Created, map.GetStorage().Open(file.GetPath(), maxFileSize));
+   const KeyType first = map.Emplace(MappedValue{ 7, 7.0 });
+   const MappedValue* const firstPtr = map.GetPtr(first);
+
+   ASSERT_TRUE(map.Reserve(ChunkCount * StorageType::ChunkSlots / 2));
+   ASSERT_EQ(firstPtr, map.GetPtr(first));
+   ASSERT_FALSE(map.Reserve(ChunkCount * StorageType::ChunkSlots + 1));
+
+   while (map.Size() < ChunkCount * StorageType::ChunkSlots)
+   {
+      ASSERT_NE(MapType::InvalidKey, map.Emplace(MappedValue{ 0, 0.0 }));
+   }
+   ASSERT_EQ(MapType::InvalidKey, map.Emplace(MappedValue{ 0, 0.0 }));
+   ASSERT_EQ(firstPtr, map.GetPtr(first));
+   ASSERT_EQ(7, firstPtr->m_a);
+}
+
+
+#endif // SLOTMAP_MAPPED_STORAGE
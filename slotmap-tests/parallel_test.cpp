@@ -0,0 +1,142 @@
+// Copyright (c) 2024, Jan Milik (jan.milik@gmail.com) - All rights reserved.
+
+#include "test_common.h"
+
+#include <slotmap/parallel.h>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <memory>
+#include <thread>
+#include <vector>
+
+
+using namespace slotmap;
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ThreadPoolTest, RunsEveryTaskOnce)
+{
+   ThreadPool pool(3);
+   ASSERT_EQ(4, pool.GetConcurrency());
+
+   for (size_t taskCount : { 0, 1, 2, 3, 4, 7, 100, 10000 })
+   {
+      std::unique_ptr<std::atomic<int>[]> calls(new std::atomic<int>[taskCount]);
+      for (size_t i = 0; i < taskCount; ++i)
+      {
+         calls[i].store(0);
+      }
+
+      pool.ParallelFor(taskCount, [&](size_t taskIndex)
+      {
+         calls[taskIndex].fetch_add(1);
+      });
+
+      for (size_t i = 0; i < taskCount; ++i)
+      {
+         ASSERT_EQ(1, calls[i].load()) << "Task " << i << " of " << taskCount;
+      }
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ThreadPoolTest, UnevenTasks)
+{
+   ThreadPool pool(3);
+
+   // All expensive tasks end up in the range of the first thread, the others
+   // have to steal them to finish.
+   std::atomic<size_t> sum{0};
+   pool.ParallelFor(64, [&](size_t taskIndex)
+   {
+      if (taskIndex < 16)
+      {
+         std::this_thread::sleep_for(std::chrono::milliseconds(1));
+      }
+      sum.fetch_add(taskIndex);
+   });
+   ASSERT_EQ(64 * 63 / 2, sum.load());
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ThreadPoolTest, NestedParallelFor)
+{
+   ThreadPool pool(2);
+
+   std::atomic<size_t> count{0};
+   pool.ParallelFor(8, [&](size_t)
+   {
+      pool.ParallelFor(8, [&](size_t)
+      {
+         count.fetch_add(1);
+      });
+   });
+   ASSERT_EQ(64, count.load());
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ThreadPoolTest, ConcurrentCallers)
+{
+   ThreadPool pool(2);
+
+   std::atomic<size_t> count{0};
+   std::vector<std::thread> threads;
+   for (size_t t = 0; t < 4; ++t)
+   {
+      threads.emplace_back([&]()
+      {
+         for (size_t i = 0; i < 100; ++i)
+         {
+            pool.ParallelFor(10, [&](size_t)
+            {
+               count.fetch_add(1);
+            });
+         }
+      });
+   }
+   for (std::thread& thread : threads)
+   {
+      thread.join();
+   }
+   ASSERT_EQ(4 * 100 * 10, count.load());
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ThreadPoolTest, NoWorkers)
+{
+   ThreadPool pool(0);
+   ASSERT_EQ(1, pool.GetConcurrency());
+
+   const std::thread::id callerId = std::this_thread::get_id();
+   size_t count = 0;
+   pool.ParallelFor(10, [&](size_t)
+   {
+      EXPECT_EQ(callerId, std::this_thread::get_id());
+      ++count;
+   });
+   ASSERT_EQ(10, count);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ParallelTest, SplitByWeight)
+{
+   const std::vector<size_t> weights = { 10, 0, 0, 10, 1, 1, 1, 1, 1, 1, 1, 1, 1, 1, 10 };
+
+   const std::vector<size_t> bounds = impl::SplitByWeight(weights.size(), 3, [&](size_t index)
+   {
+      return weights[index];
+   });
+   ASSERT_EQ((std::vector<size_t>{ 0, 3, 10, 15 }), bounds);
+
+   // Never more ranges than elements and no empty ranges.
+   ASSERT_EQ((std::vector<size_t>{ 0, 1, 2 }), impl::SplitByWeight(2, 8, [](size_t) { return 1; }));
+   ASSERT_EQ((std::vector<size_t>{ 0, 3 }), impl::SplitByWeight(3, 1, [](size_t) { return 1; }));
+   ASSERT_EQ((std::vector<size_t>{ 0 }), impl::SplitByWeight(0, 4, [](size_t) { return 1; }));
+}
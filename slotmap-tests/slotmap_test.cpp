@@ -3,12 +3,20 @@
 #include "test_common.h"
 
 #include <slotmap/slotmap.h>
+#include <slotmap/concurrent_slotmap.h>
+#include <slotmap/slab_allocator.h>
 
 #include <gtest/gtest.h>
 
+#include <atomic>
+#include <climits>
+#include <mutex>
 #include <queue>
+#include <random>
 #include <sstream>
+#include <thread>
 #include <type_traits>
+#include <unordered_map>
 #include <unordered_set>
 
 
@@ -49,14 +57,125 @@ struct SlotMapNameTraits<SlotMap<T, TKey, ChunkedSlotMapStorage<T, TKey>>>
 };
 
 
-template<typename T, size_t TCapacity, typename TKey>
-struct SlotMapNameTraits<SlotMap<T, TKey, FixedSlotMapStorage<T, TKey, TCapacity>>>
+template<typename T, int TGenerationBitSize, typename TKey = uint32_t>
+using WideGenerationSlotMap = SlotMap<T, TKey,
+   ChunkedSlotMapStorage<T, TKey, DefaultMaxChunkSize, std::allocator<T>, FixedBitSetTraits<>, TGenerationBitSize>>;
+
+
+template<typename T, typename TKey, int TGenerationBitSize>
+struct SlotMapNameTraits<WideGenerationSlotMap<T, TGenerationBitSize, TKey>>
+{
+   static void Get(std::ostream& out)
+   {
+      out << "SlotMap/";
+      TypeNameTraits<TKey>::Get(out);
+      out << "/gen" << TGenerationBitSize;
+   }
+
+   static void GetStorageInfo(std::ostream& out)
+   {
+      using Storage = typename WideGenerationSlotMap<T, TGenerationBitSize, TKey>::StorageType;
+
+      out << "Chunked:" << std::endl;
+      out << "  ChunkSlots: " << Storage::ChunkSlots << std::endl;
+      out << "  GenerationBitSize: " << Storage::GenerationBitSize << std::endl;
+      out << "  SlotIndexBitSize: " << Storage::SlotIndexBitSize << std::endl;
+      out << "  ChunkIndexBitSize: " << Storage::ChunkIndexBitSize;
+   }
+};
+
+
+template<typename T, typename TKey>
+class FullestFirstStorage : public ChunkedSlotMapStorage<T, TKey>
+{
+public:
+   FullestFirstStorage() { this->SetChunkAllocationPolicy(ChunkAllocationPolicy::FullestFirst); }
+};
+
+
+template<typename T, typename TKey = uint32_t>
+using FullestFirstSlotMap = SlotMap<T, TKey, FullestFirstStorage<T, TKey>>;
+
+
+template<typename T, typename TKey>
+struct SlotMapNameTraits<FullestFirstSlotMap<T, TKey>>
+{
+   static void Get(std::ostream& out)
+   {
+      out << "SlotMap/";
+      TypeNameTraits<TKey>::Get(out);
+      out << "/fullest";
+   }
+
+   static void GetStorageInfo(std::ostream& out)
+   {
+      out << "Chunked, fullest chunk first";
+   }
+};
+
+
+#if SLOTMAP_PMR
+template<typename T, typename TKey>
+struct SlotMapNameTraits<pmr::SlotMap<T, TKey>>
+{
+   static void Get(std::ostream& out)
+   {
+      out << "PmrSlotMap/";
+      TypeNameTraits<TKey>::Get(out);
+   }
+
+   static void GetStorageInfo(std::ostream& out)
+   {
+      out << "Chunked, polymorphic allocator";
+   }
+};
+#endif
+
+
+template<typename T, typename TKey>
+struct SlotMapNameTraits<DenseSlotMap<T, TKey>>
+{
+   static void Get(std::ostream& out)
+   {
+      out << "DenseSlotMap/";
+      TypeNameTraits<TKey>::Get(out);
+   }
+
+   static void GetStorageInfo(std::ostream& out)
+   {
+      out << "Dense, max. capacity " << DenseSlotMap<T, TKey>::MaxCapacity();
+   }
+};
+
+
+template<typename T, typename TKey>
+struct SlotMapNameTraits<HugePageSlotMap<T, TKey>>
+{
+   static void Get(std::ostream& out)
+   {
+      out << "HugePageSlotMap/";
+      TypeNameTraits<TKey>::Get(out);
+   }
+
+   static void GetStorageInfo(std::ostream& out)
+   {
+      out << "Chunked, slab allocator";
+   }
+};
+
+
+template<typename T, size_t TCapacity, typename TKey, typename TBitsetTraits>
+struct SlotMapNameTraits<SlotMap<T, TKey, FixedSlotMapStorage<T, TKey, TCapacity, TBitsetTraits>>>
 {
    static void Get(std::ostream& out)
    {
       out << "FixedSlotMap/";
       TypeNameTraits<TKey>::Get(out);
       out << "/" << TCapacity;
+      if constexpr (std::is_same_v<TBitsetTraits, HierarchicalBitSetTraits<>>)
+      {
+         out << "/Hierarchical";
+      }
    }
 
    static void GetStorageInfo(std::ostream& out)
@@ -66,6 +185,29 @@ struct SlotMapNameTraits<SlotMap<T, TKey, FixedSlotMapStorage<T, TKey, TCapacity
 };
 
 
+template<typename T, typename TKey>
+struct SlotMapNameTraits<SlotMap<T, TKey, ConcurrentChunkedSlotMapStorage<T, TKey>>>
+{
+   static void Get(std::ostream& out)
+   {
+      out << "ConcurrentSlotMap/";
+      TypeNameTraits<TKey>::Get(out);
+   }
+
+   static void GetStorageInfo(std::ostream& out)
+   {
+      using Storage = ConcurrentChunkedSlotMapStorage<T, TKey>;
+
+      out << "Concurrent:" << std::endl;
+      out << "  Value size: " << sizeof(T) << std::endl;
+      out << "  ChunkSlots: " << Storage::ChunkSlots << std::endl;
+      out << "  SlotIndexBitSize: " << Storage::SlotIndexBitSize << std::endl;
+      out << "  ChunkIndexBitSize: " << Storage::ChunkIndexBitSize << std::endl;
+      out << "  SegmentCount: " << Storage::SegmentCount;
+   }
+};
+
+
 //////////////////////////////////////////////////////////////////////////
 template<typename TSlotMap, size_t TMaxSize>
 struct SlotMapTestTraits
@@ -169,6 +311,43 @@ public:
       return ::testing::AssertionSuccess();
    }
 
+   template<typename TExecutor>
+   ::testing::AssertionResult CheckParallelIteration(const MapType& map, const Pairs& values, TExecutor&& executor)
+   {
+      std::mutex mutex;
+      std::vector<std::pair<KeyType, const ValueType*>> visited;
+
+      map.ParallelForEach([&](KeyType key, const ValueType& value)
+      {
+         std::lock_guard<std::mutex> lock(mutex);
+         visited.emplace_back(key, &value);
+      }, std::forward<TExecutor>(executor));
+
+      Keys visitedKeys;
+      for (const auto& [key, ptr] : visited)
+      {
+         if (!visitedKeys.insert(key).second)
+         {
+            return ::testing::AssertionFailure() << "Key " << key << " already visited";
+         }
+         if (values.count(key) == 0)
+         {
+            return ::testing::AssertionFailure() << "Key " << key << " not found in expected values";
+         }
+         if (map.GetPtr(key) != ptr)
+         {
+            return ::testing::AssertionFailure() << "Key " << key << " visited with a wrong value";
+         }
+      }
+
+      if (visitedKeys.size() != values.size())
+      {
+         return ::testing::AssertionFailure() << "Visited " << visitedKeys.size() << " keys, expected " << values.size();
+      }
+
+      return ::testing::AssertionSuccess();
+   }
+
    ::testing::AssertionResult SetUpTestDataA(MapType& map, Pairs& values)
    {
       const size_t count = MaxSize >> 1;
@@ -432,11 +611,26 @@ using SlotMapTestTypes = ::testing::Types<
    SlotMapTestTraits<FixedSlotMap<TestValueType, 255, uint16_t>, 255>,
    SlotMapTestTraits<FixedSlotMap<TestValueType, 1024>, 1024>,
    SlotMapTestTraits<FixedSlotMap<TestValueType, 1024, uint64_t>, 1024>,
+   SlotMapTestTraits<SlotMap<TestValueType, uint32_t, FixedSlotMapStorage<TestValueType, uint32_t, 5000, HierarchicalBitSetTraits<>>>, 5000>,
    SlotMapTestTraits<SlotMap<TestValueType, uint16_t>, SlotMap<TestValueType, uint16_t>::MaxCapacity()>,
    SlotMapTestTraits<SlotMap<TestValueType>, 10000>,
    SlotMapTestTraits<SlotMap<TestValueType>, 1000000>,
    SlotMapTestTraits<SlotMap<TestValueType>, SlotMap<TestValueType>::MaxCapacity()>,
-   SlotMapTestTraits<SlotMap<TestValueType, uint64_t>, 1000000>
+   SlotMapTestTraits<SlotMap<TestValueType, uint64_t>, 1000000>,
+   SlotMapTestTraits<WideGenerationSlotMap<TestValueType, 16>, WideGenerationSlotMap<TestValueType, 16>::MaxCapacity()>,
+   SlotMapTestTraits<WideGenerationSlotMap<TestValueType, 12>, 10000>,
+   SlotMapTestTraits<FullestFirstSlotMap<TestValueType, uint16_t>, FullestFirstSlotMap<TestValueType, uint16_t>::MaxCapacity()>,
+   SlotMapTestTraits<FullestFirstSlotMap<TestValueType>, 10000>,
+#if SLOTMAP_PMR
+   SlotMapTestTraits<pmr::SlotMap<TestValueType>, 10000>,
+#endif
+   SlotMapTestTraits<HugePageSlotMap<TestValueType>, 10000>,
+   SlotMapTestTraits<DenseSlotMap<TestValueType, uint16_t>, DenseSlotMap<TestValueType, uint16_t>::MaxCapacity()>,
+   SlotMapTestTraits<DenseSlotMap<TestValueType>, 10000>,
+   SlotMapTestTraits<DenseSlotMap<TestValueType>, 1000000>,
+   SlotMapTestTraits<ConcurrentSlotMap<TestValueType, uint16_t>, ConcurrentSlotMap<TestValueType, uint16_t>::MaxCapacity()>,
+   SlotMapTestTraits<ConcurrentSlotMap<TestValueType>, 10000>,
+   SlotMapTestTraits<ConcurrentSlotMap<TestValueType>, 1000000>
 >;
 TYPED_TEST_SUITE(SlotMapTest, SlotMapTestTypes, TemplateTestNameGenerator);
 
@@ -783,6 +977,173 @@ TYPED_TEST(SlotMapTest, GetKeyByIndex)
 }
 
 
+//////////////////////////////////////////////////////////////////////////
+TYPED_TEST(SlotMapTest, GetPtrBatch)
+{
+   using MapType = typename TestFixture::MapType;
+   using KeyType = typename MapType::KeyType;
+   using ValueType = typename MapType::ValueType;
+
+   ASSERT_TRUE(TestFixture::SetUpTestDataA(this->m_map1, this->m_items));
+
+   // Valid keys mixed with invalid ones and keys of erased elements.
+   std::vector<KeyType> keys;
+   keys.push_back(MapType::InvalidKey);
+   keys.push_back(std::numeric_limits<KeyType>::max());
+   for (auto& pair : this->m_items)
+   {
+      keys.push_back(pair.first);
+      keys.push_back(static_cast<KeyType>(pair.first + 1));
+   }
+
+   std::vector<ValueType*> ptrs(keys.size(), nullptr);
+   this->m_map1.GetPtrBatch(keys.data(), keys.size(), ptrs.data());
+
+   const MapType& constMap = this->m_map1;
+   std::vector<const ValueType*> constPtrs(keys.size(), nullptr);
+   constMap.GetPtrBatch(keys.data(), keys.size(), constPtrs.data());
+
+   for (size_t i = 0; i < keys.size(); ++i)
+   {
+      ASSERT_EQ(this->m_map1.GetPtr(keys[i]), ptrs[i]) << "Key " << keys[i];
+      ASSERT_EQ(ptrs[i], constPtrs[i]) << "Key " << keys[i];
+   }
+
+   ASSERT_EQ(nullptr, ptrs[0]);
+   for (size_t i = 2; i < keys.size(); i += 2)
+   {
+      ASSERT_NE(nullptr, ptrs[i]);
+      ASSERT_EQ(this->m_items[keys[i]], *ptrs[i]);
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TYPED_TEST(SlotMapTest, EmplaceN)
+{
+   using MapType = typename TestFixture::MapType;
+   using KeyType = typename MapType::KeyType;
+   using ValueType = typename MapType::ValueType;
+   using Traits = typename TestFixture::Traits;
+
+   MapType map;
+
+   // Leave some recycled slots in the map, so that both the free lists and
+   // the fresh slots are used.
+   std::vector<KeyType> keys(16);
+   for (size_t i = 0; i < keys.size(); ++i)
+   {
+      keys[i] = map.Emplace(static_cast<int>(i));
+   }
+   for (size_t i = 0; i < keys.size(); i += 2)
+   {
+      ASSERT_TRUE(map.Erase(keys[i]));
+   }
+
+   const size_t count = Traits::MaxSize - map.Size();
+   std::vector<KeyType> newKeys(count, MapType::InvalidKey);
+   const size_t emplaced = map.EmplaceN(count, [](size_t index)
+   {
+      return ValueType(static_cast<int>(index));
+   }, newKeys.data());
+
+   ASSERT_EQ(count, emplaced);
+   ASSERT_EQ(Traits::MaxSize, map.Size());
+
+   std::unordered_set<KeyType> uniqueKeys;
+   for (size_t i = 1; i < keys.size(); i += 2)
+   {
+      uniqueKeys.insert(keys[i]);
+   }
+   for (size_t i = 0; i < count; ++i)
+   {
+      const KeyType key = newKeys[i];
+      ASSERT_NE(MapType::InvalidKey, key);
+      ASSERT_TRUE(uniqueKeys.insert(key).second) << "Key " << key << " issued twice";
+
+      const ValueType* ptr = map.GetPtr(key);
+      ASSERT_NE(nullptr, ptr);
+      if (static_cast<int>(i) != *ptr)
+      {
+         ASSERT_EQ(static_cast<int>(i), *ptr);
+      }
+   }
+
+   if (map.Size() == MapType::MaxCapacity())
+   {
+      KeyType key = MapType::InvalidKey;
+      ASSERT_EQ(0, map.EmplaceN(1, [](size_t) { return ValueType(0); }, &key));
+      ASSERT_EQ(MapType::InvalidKey, key);
+   }
+
+   ASSERT_TRUE(TestFixture::CheckIteration(map));
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TYPED_TEST(SlotMapTest, EraseN)
+{
+   using MapType = typename TestFixture::MapType;
+   using KeyType = typename MapType::KeyType;
+   using ValueType = typename MapType::ValueType;
+   using Traits = typename TestFixture::Traits;
+
+   MapType map;
+
+   const size_t count = std::min<size_t>(Traits::MaxSize, 5000);
+   std::vector<KeyType> keys(count);
+   ASSERT_EQ(count, map.EmplaceN(count, [](size_t index) { return ValueType(static_cast<int>(index)); }, keys.data()));
+
+   // Erase two thirds of the elements in random order, mixed with invalid
+   // and duplicate keys.
+   std::vector<KeyType> eraseKeys;
+   for (size_t i = 0; i < count; ++i)
+   {
+      if ((i % 3) != 0)
+      {
+         eraseKeys.push_back(keys[i]);
+      }
+   }
+   const size_t erasedCount = eraseKeys.size();
+   eraseKeys.push_back(MapType::InvalidKey);
+   eraseKeys.push_back(keys[1]);
+   std::shuffle(eraseKeys.begin(), eraseKeys.end(), std::mt19937(42));
+
+   const size_t dtorCount = TestValueType::s_dtorCount;
+   ASSERT_EQ(erasedCount, map.EraseN(eraseKeys.data(), eraseKeys.size()));
+   ASSERT_EQ(erasedCount, TestValueType::s_dtorCount - dtorCount);
+   ASSERT_EQ(count - erasedCount, map.Size());
+   ASSERT_EQ(0, map.EraseN(eraseKeys.data(), eraseKeys.size()));
+
+   for (size_t i = 0; i < count; ++i)
+   {
+      const ValueType* ptr = map.GetPtr(keys[i]);
+      if ((i % 3) != 0)
+      {
+         ASSERT_EQ(nullptr, ptr);
+      }
+      else
+      {
+         ASSERT_NE(nullptr, ptr);
+         ASSERT_EQ(static_cast<int>(i), *ptr);
+      }
+   }
+   ASSERT_TRUE(TestFixture::CheckIteration(map));
+
+   // The freed slots can be reused.
+   std::vector<KeyType> newKeys(erasedCount);
+   ASSERT_EQ(erasedCount, map.EmplaceN(erasedCount, [](size_t index) { return ValueType(static_cast<int>(index)); }, newKeys.data()));
+   ASSERT_EQ(count, map.Size());
+   ASSERT_TRUE(TestFixture::CheckIteration(map));
+
+   // Erase everything in the order of insertion.
+   ASSERT_EQ(erasedCount, map.EraseN(newKeys.data(), newKeys.size()));
+   ASSERT_EQ(count - erasedCount, map.EraseN(keys.data(), keys.size()));
+   ASSERT_EQ(0, map.Size());
+   ASSERT_TRUE(TestFixture::CheckIteration(map));
+}
+
+
 //////////////////////////////////////////////////////////////////////////
 TYPED_TEST(SlotMapTest, Swap)
 {
@@ -851,49 +1212,1718 @@ TYPED_TEST(SlotMapTest, Clear)
 
 
 //////////////////////////////////////////////////////////////////////////
-TYPED_TEST(SlotMapTest, Iteration_Empty)
-{
-   ASSERT_EQ(0, TestFixture::m_map1.Size());
-   ASSERT_TRUE(TestFixture::CheckIteration());
-}
- 
-
-//////////////////////////////////////////////////////////////////////////
-TYPED_TEST(SlotMapTest, Iteration_Filled)
+TYPED_TEST(SlotMapTest, ShrinkToFit)
 {
    using MapType = typename TestFixture::MapType;
    using KeyType = typename MapType::KeyType;
    using ValueType = typename MapType::ValueType;
    using Traits = typename TestFixture::Traits;
 
-   ASSERT_TRUE(TestFixture::SetUpTestData(TestFixture::MaxSize));
-   ASSERT_TRUE(TestFixture::CheckIteration());
-}
+   MapType map;
+   const size_t count = std::min<size_t>(Traits::MaxSize, 100000);
+   std::vector<KeyType> keys(count);
+   ASSERT_EQ(count, map.EmplaceN(count, [](size_t index) { return ValueType(static_cast<int>(index)); }, keys.data()));
 
+   // Erase the second half from the back.
+   for (size_t i = count; i-- > count / 2;)
+   {
+      ASSERT_TRUE(map.Erase(keys[i]));
+   }
 
-//////////////////////////////////////////////////////////////////////////
-TYPED_TEST(SlotMapTest, Iteration_TestData)
-{
-   using MapType = typename TestFixture::MapType;
-   using KeyType = typename MapType::KeyType;
-   using ValueType = typename MapType::ValueType;
-   using Traits = typename TestFixture::Traits;
+   const size_t capacity = map.Capacity();
+   map.ShrinkToFit();
+   ASSERT_LE(map.Capacity(), capacity);
+   ASSERT_GE(map.Capacity(), map.Size());
+   ASSERT_EQ(count / 2, map.Size());
 
-   ASSERT_TRUE(TestFixture::SetUpTestDataA(this->m_map1, TestFixture::m_items));
-   ASSERT_TRUE(TestFixture::CheckIteration());
+   for (size_t i = 0; i < count; ++i)
+   {
+      const ValueType* ptr = map.GetPtr(keys[i]);
+      if (i < count / 2)
+      {
+         ASSERT_NE(nullptr, ptr);
+         ASSERT_EQ(static_cast<int>(i), *ptr);
+      }
+      else
+      {
+         ASSERT_EQ(nullptr, ptr);
+      }
+   }
+   ASSERT_TRUE(TestFixture::CheckIteration(map));
+
+   // The slots of the erased elements are reused, but their old keys stay
+   // invalid.
+   for (size_t i = count / 2; i < count; ++i)
+   {
+      ASSERT_NE(MapType::InvalidKey, map.Emplace(static_cast<int>(i)));
+   }
+   for (size_t i = count / 2; i < count; ++i)
+   {
+      ASSERT_EQ(nullptr, map.GetPtr(keys[i]));
+   }
+   ASSERT_EQ(count, map.Size());
+   ASSERT_TRUE(TestFixture::CheckIteration(map));
 }
 
 
 //////////////////////////////////////////////////////////////////////////
-TYPED_TEST(SlotMapTest, Iteration_Iterator)
+TYPED_TEST(SlotMapTest, Compact)
 {
    using MapType = typename TestFixture::MapType;
    using KeyType = typename MapType::KeyType;
    using ValueType = typename MapType::ValueType;
    using Traits = typename TestFixture::Traits;
 
-   ASSERT_TRUE(TestFixture::SetUpTestData(TestFixture::MaxSize));
-   ASSERT_TRUE(TestFixture::CheckIteration_Iterator());
-}
+   MapType map;
+   const size_t count = std::min<size_t>(Traits::MaxSize, 100000);
+   std::vector<KeyType> keys(count);
+   ASSERT_EQ(count, map.EmplaceN(count, [](size_t index) { return ValueType(static_cast<int>(index)); }, keys.data()));
 
+   // Keep every tenth element, scattered over the whole storage.
+   for (size_t i = 0; i < count; ++i)
+   {
+      if ((i % 10) != 0)
+      {
+         ASSERT_TRUE(map.Erase(keys[i]));
+         keys[i] = MapType::InvalidKey;
+      }
+   }
+   const size_t size = map.Size();
+   const size_t capacity = map.Capacity();
+
+   std::unordered_map<KeyType, size_t> indexByKey;
+   for (size_t i = 0; i < count; i += 10)
+   {
+      indexByKey[keys[i]] = i;
+   }
+
+   // Compact in small slices.
+   const size_t budget = 100;
+   size_t moved = 0;
+   size_t totalMoved = 0;
+   do
+   {
+      moved = map.Compact(budget, [&](KeyType oldKey, KeyType newKey)
+      {
+         const auto it = indexByKey.find(oldKey);
+         ASSERT_NE(indexByKey.end(), it);
+         ASSERT_EQ(nullptr, map.GetPtr(oldKey));
+         ASSERT_NE(nullptr, map.GetPtr(newKey));
+         const size_t index = it->second;
+         keys[index] = newKey;
+         indexByKey.erase(it);
+         indexByKey[newKey] = index;
+      });
+      ASSERT_LE(moved, budget);
+      totalMoved += moved;
+   } while (moved == budget);
+
+   ASSERT_EQ(size, map.Size());
+   ASSERT_LE(map.Capacity(), capacity);
+   if (totalMoved > 0)
+   {
+      ASSERT_LT(map.Capacity(), capacity);
+   }
+   for (size_t i = 0; i < count; i += 10)
+   {
+      const ValueType* ptr = map.GetPtr(keys[i]);
+      ASSERT_NE(nullptr, ptr);
+      ASSERT_EQ(static_cast<int>(i), *ptr);
+   }
+   ASSERT_TRUE(TestFixture::CheckIteration(map));
+   ASSERT_EQ(0, map.Compact(budget, [](KeyType, KeyType) {}));
+
+   // The compacted storage keeps working.
+   for (size_t i = 0; i < count; ++i)
+   {
+      if ((i % 10) != 0)
+      {
+         keys[i] = map.Emplace(static_cast<int>(i));
+         ASSERT_NE(MapType::InvalidKey, keys[i]);
+      }
+   }
+   ASSERT_EQ(count, map.Size());
+   for (size_t i = 0; i < count; ++i)
+   {
+      ASSERT_EQ(static_cast<int>(i), *map.GetPtr(keys[i]));
+   }
+   ASSERT_TRUE(TestFixture::CheckIteration(map));
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TYPED_TEST(SlotMapTest, Iteration_Empty)
+{
+   ASSERT_EQ(0, TestFixture::m_map1.Size());
+   ASSERT_TRUE(TestFixture::CheckIteration());
+}
+ 
+
+//////////////////////////////////////////////////////////////////////////
+TYPED_TEST(SlotMapTest, Iteration_Filled)
+{
+   using MapType = typename TestFixture::MapType;
+   using KeyType = typename MapType::KeyType;
+   using ValueType = typename MapType::ValueType;
+   using Traits = typename TestFixture::Traits;
+
+   ASSERT_TRUE(TestFixture::SetUpTestData(TestFixture::MaxSize));
+   ASSERT_TRUE(TestFixture::CheckIteration());
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TYPED_TEST(SlotMapTest, Iteration_TestData)
+{
+   using MapType = typename TestFixture::MapType;
+   using KeyType = typename MapType::KeyType;
+   using ValueType = typename MapType::ValueType;
+   using Traits = typename TestFixture::Traits;
+
+   ASSERT_TRUE(TestFixture::SetUpTestDataA(this->m_map1, TestFixture::m_items));
+   ASSERT_TRUE(TestFixture::CheckIteration());
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TYPED_TEST(SlotMapTest, Iteration_Iterator)
+{
+   using MapType = typename TestFixture::MapType;
+   using KeyType = typename MapType::KeyType;
+   using ValueType = typename MapType::ValueType;
+   using Traits = typename TestFixture::Traits;
+
+   ASSERT_TRUE(TestFixture::SetUpTestData(TestFixture::MaxSize));
+   ASSERT_TRUE(TestFixture::CheckIteration_Iterator());
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TYPED_TEST(SlotMapTest, Iteration_RangeFor)
+{
+   using MapType = typename TestFixture::MapType;
+   using KeyType = typename MapType::KeyType;
+   using ValueType = typename MapType::ValueType;
+
+   static_assert(std::is_same_v<typename std::iterator_traits<typename MapType::Iterator>::iterator_category, std::forward_iterator_tag>);
+   static_assert(std::is_same_v<typename std::iterator_traits<typename MapType::Iterator>::value_type, std::pair<KeyType, ValueType&>>);
+   static_assert(std::is_same_v<typename std::iterator_traits<typename MapType::ConstIterator>::value_type, std::pair<KeyType, const ValueType&>>);
+
+   ASSERT_TRUE(TestFixture::SetUpTestDataA(this->m_map1, TestFixture::m_items));
+   MapType& map = this->m_map1;
+   const MapType& constMap = this->m_map1;
+
+   size_t count = 0;
+   for (auto [key, value] : constMap)
+   {
+      ASSERT_EQ(map.GetPtr(key), &value);
+      ASSERT_EQ(TestFixture::m_items.at(key), value);
+      ++count;
+   }
+   ASSERT_EQ(TestFixture::m_items.size(), count);
+
+   for (auto [key, value] : map)
+   {
+      value = ValueType(value.m_value + 1);
+   }
+   for (auto it = constMap.begin(); it != constMap.end(); ++it)
+   {
+      ASSERT_EQ(TestFixture::m_items.at(it->first).m_value + 1, it->second.m_value);
+   }
+
+   std::vector<KeyType> keys(constMap.Keys().begin(), constMap.Keys().end());
+   ASSERT_EQ(TestFixture::m_items.size(), keys.size());
+   ASSERT_TRUE(std::all_of(keys.begin(), keys.end(), [&](KeyType key) { return TestFixture::m_items.count(key) != 0; }));
+
+   for (ValueType& value : map.Values())
+   {
+      value = ValueType(value.m_value - 1);
+   }
+   const auto values = constMap.Values();
+   ASSERT_EQ(static_cast<ptrdiff_t>(count), std::distance(values.begin(), values.end()));
+   ASSERT_EQ(values.empty(), count == 0);
+   if (count > 0)
+   {
+      const auto it = std::find(values.begin(), values.end(), TestFixture::m_items.at(keys.back()));
+      ASSERT_NE(values.end(), it);
+      ASSERT_EQ(TestFixture::m_items.at(keys.back()), *it);
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TYPED_TEST(SlotMapTest, Iteration_Parallel)
+{
+   ThreadPool pool(3);
+   ASSERT_TRUE(TestFixture::CheckParallelIteration(this->m_map1, TestFixture::m_items, pool));
+
+   ASSERT_TRUE(TestFixture::SetUpTestDataA(this->m_map1, TestFixture::m_items));
+   ASSERT_TRUE(TestFixture::CheckParallelIteration(this->m_map1, TestFixture::m_items, pool));
+   ASSERT_TRUE(TestFixture::CheckParallelIteration(this->m_map1, TestFixture::m_items, SequentialExecutor()));
+#if SLOTMAP_EXECUTION_POLICIES
+   ASSERT_TRUE(TestFixture::CheckParallelIteration(this->m_map1, TestFixture::m_items, std::execution::seq));
+#endif
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ChunkedSlotMapStorageTest, ShrinkToFit_StaleKeys)
+{
+   using MapType = SlotMap<TestValueType>;
+   using KeyType = MapType::KeyType;
+   constexpr size_t ChunkSlots = MapType::StorageType::ChunkSlots;
+
+   MapType map;
+   const size_t count = ChunkSlots * 3;
+   std::vector<KeyType> keys(count);
+   ASSERT_EQ(count, map.EmplaceN(count, [](size_t index) { return TestValueType(index); }, keys.data()));
+   ASSERT_EQ(count, map.EraseN(keys.data(), keys.size()));
+
+   map.ShrinkToFit();
+   ASSERT_EQ(0, map.Capacity());
+
+   // The new chunks take the place of the released ones.
+   std::vector<KeyType> newKeys(count);
+   ASSERT_EQ(count, map.EmplaceN(count, [](size_t index) { return TestValueType(index); }, newKeys.data()));
+   for (size_t i = 0; i < count; ++i)
+   {
+      ASSERT_EQ(nullptr, map.GetPtr(keys[i]));
+      ASSERT_NE(nullptr, map.GetPtr(newKeys[i]));
+   }
+   ASSERT_EQ(0, map.EraseN(keys.data(), keys.size()));
+   ASSERT_EQ(count, map.Size());
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ChunkedSlotMapStorageTest, GenerationBitSize)
+{
+   using MapType = WideGenerationSlotMap<TestValueType, 12>;
+   using StorageType = MapType::StorageType;
+   using KeyType = MapType::KeyType;
+
+   static_assert(StorageType::GenerationBitSize == 12);
+   static_assert(std::is_same_v<StorageType::GenerationType, uint16_t>);
+   static_assert(StorageType::GenerationBitSize + StorageType::SlotIndexBitSize + StorageType::ChunkIndexBitSize == 32);
+
+   // A single slot churned over and over hands out every nonzero generation
+   // once before the first key comes back.
+   MapType map;
+   const KeyType first = map.Emplace(0);
+   std::unordered_set<KeyType> keys{first};
+   KeyType key = first;
+   for (size_t i = 1; i < StorageType::GenerationMask; ++i)
+   {
+      ASSERT_TRUE(map.Erase(key));
+      key = map.Emplace(static_cast<int>(i));
+      ASSERT_TRUE(keys.insert(key).second);
+      ASSERT_EQ(nullptr, map.GetPtr(first));
+   }
+   ASSERT_EQ(StorageType::GenerationMask, keys.size());
+
+   ASSERT_TRUE(map.Erase(key));
+   ASSERT_EQ(first, map.Emplace(0));
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ChunkedSlotMapStorageTest, RetireSlot)
+{
+   using MapType = WideGenerationSlotMap<TestValueType, 4>;
+   using StorageType = MapType::StorageType;
+   using KeyType = MapType::KeyType;
+
+   TestValueType::ResetCounters();
+   {
+      MapType map;
+      map.GetStorage().SetGenerationOverflowPolicy(GenerationOverflowPolicy::RetireSlot);
+
+      // Churn a single slot through all of its generations.
+      std::vector<KeyType> keys{map.Emplace(0)};
+      for (size_t i = 1; i < StorageType::GenerationMask; ++i)
+      {
+         ASSERT_TRUE(map.Erase(keys.back()));
+         keys.push_back(map.Emplace(static_cast<int>(i)));
+         ASSERT_EQ(keys[0] & ~(StorageType::GenerationMask << StorageType::GenerationShift),
+            keys.back() & ~(StorageType::GenerationMask << StorageType::GenerationShift));
+      }
+      ASSERT_EQ(0, map.GetStorage().RetiredSlotCount());
+      ASSERT_TRUE(map.Erase(keys.back()));
+      ASSERT_EQ(1, map.GetStorage().RetiredSlotCount());
+      ASSERT_TRUE(TestValueType::CheckLiveInstances(0));
+
+      // The retired slot is not reused, not even after Clear().
+      for (int pass = 0; pass < 2; ++pass)
+      {
+         for (size_t i = 0; i < StorageType::ChunkSlots; ++i)
+         {
+            const KeyType key = map.Emplace(static_cast<int>(i));
+            for (const KeyType oldKey : keys)
+            {
+               ASSERT_NE(oldKey, key);
+            }
+         }
+         for (const KeyType oldKey : keys)
+         {
+            ASSERT_EQ(nullptr, map.GetPtr(oldKey));
+            ASSERT_FALSE(map.Erase(oldKey));
+         }
+         ASSERT_EQ(2, map.GetStorage().Capacity() / StorageType::ChunkSlots);
+         map.Clear();
+      }
+      ASSERT_EQ(1, map.GetStorage().RetiredSlotCount());
+
+      // Chunks with retired slots are never released.
+      map.ShrinkToFit();
+      ASSERT_EQ(StorageType::ChunkSlots, map.Capacity());
+
+      MapType copy(map);
+      ASSERT_EQ(1, copy.GetStorage().RetiredSlotCount());
+      ASSERT_EQ(GenerationOverflowPolicy::RetireSlot, copy.GetStorage().GetGenerationOverflowPolicy());
+
+      // A slot that is still live when its generation runs out is retired by
+      // Clear() too.
+      MapType churned;
+      churned.GetStorage().SetGenerationOverflowPolicy(GenerationOverflowPolicy::RetireSlot);
+      const KeyType first = churned.Emplace(0);
+      KeyType last = first;
+      for (size_t i = 1; i < StorageType::GenerationMask; ++i)
+      {
+         ASSERT_TRUE(churned.Erase(last));
+         last = churned.Emplace(static_cast<int>(i));
+      }
+      churned.Clear();
+      ASSERT_EQ(1, churned.GetStorage().RetiredSlotCount());
+      for (size_t i = 0; i < StorageType::ChunkSlots; ++i)
+      {
+         ASSERT_NE(first, churned.Emplace(static_cast<int>(i)));
+         ASSERT_EQ(nullptr, churned.GetPtr(first));
+         ASSERT_EQ(nullptr, churned.GetPtr(last));
+      }
+   }
+   ASSERT_TRUE(TestValueType::CheckLiveInstances(0));
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ChunkedSlotMapStorageTest, RetireChunk)
+{
+   using MapType = WideGenerationSlotMap<TestValueType, 4>;
+   using StorageType = MapType::StorageType;
+   using KeyType = MapType::KeyType;
+   constexpr size_t ChunkSlots = StorageType::ChunkSlots;
+
+   TestValueType::ResetCounters();
+   {
+      MapType map;
+      map.GetStorage().SetGenerationOverflowPolicy(GenerationOverflowPolicy::RetireChunk);
+
+      // Churn all slots of the first chunk through all of their generations,
+      // half of the rounds with single and half with bulk operations.
+      std::vector<KeyType> keys(ChunkSlots);
+      std::vector<KeyType> allKeys;
+      for (size_t round = 0; round < StorageType::GenerationMask; ++round)
+      {
+         ASSERT_EQ(ChunkSlots, map.EmplaceN(ChunkSlots, [](size_t index) { return TestValueType(index); }, keys.data()));
+         allKeys.insert(allKeys.end(), keys.begin(), keys.end());
+         if ((round % 2) == 0)
+         {
+            for (const KeyType key : keys)
+            {
+               ASSERT_TRUE(map.Erase(key));
+            }
+         }
+         else
+         {
+            ASSERT_EQ(ChunkSlots, map.EraseN(keys.data(), keys.size()));
+         }
+      }
+      ASSERT_EQ(ChunkSlots, map.GetStorage().RetiredSlotCount());
+      ASSERT_EQ(1, map.GetStorage().RetiredChunkCount());
+      ASSERT_TRUE(TestValueType::CheckLiveInstances(0));
+
+      // The new elements go to a new chunk.
+      const KeyType key = map.Emplace(42);
+      ASSERT_EQ(1, key & StorageType::ChunkIndexMask);
+      ASSERT_EQ(1, map.Size());
+      for (const KeyType oldKey : allKeys)
+      {
+         ASSERT_EQ(nullptr, map.GetPtr(oldKey));
+         ASSERT_FALSE(map.Erase(oldKey));
+      }
+
+      size_t count = 0;
+      map.ForEach([&](KeyType, const TestValueType& value)
+      {
+         ASSERT_EQ(42, value);
+         ++count;
+      });
+      ASSERT_EQ(1, count);
+
+      MapType copy(map);
+      ASSERT_EQ(1, copy.GetStorage().RetiredChunkCount());
+      ASSERT_EQ(42, *copy.GetPtr(key));
+      ASSERT_EQ(nullptr, copy.GetPtr(allKeys.back()));
+
+      MapType moved(std::move(copy));
+      ASSERT_EQ(1, moved.GetStorage().RetiredChunkCount());
+      moved.Swap(map);
+      ASSERT_EQ(42, *moved.GetPtr(key));
+
+      map.Clear();
+      ASSERT_EQ(0, map.Size());
+      ASSERT_NE(0, map.Emplace(1) & StorageType::ChunkIndexMask);
+   }
+   ASSERT_TRUE(TestValueType::CheckLiveInstances(0));
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ChunkedSlotMapStorageTest, FullestFirstAllocation)
+{
+   using MapType = SlotMap<TestValueType>;
+   using StorageType = MapType::StorageType;
+   using KeyType = MapType::KeyType;
+   constexpr size_t ChunkSlots = StorageType::ChunkSlots;
+
+   TestValueType::ResetCounters();
+   {
+      MapType map;
+      map.GetStorage().SetChunkAllocationPolicy(ChunkAllocationPolicy::FullestFirst);
+
+      std::vector<KeyType> keys(ChunkSlots * 4);
+      ASSERT_EQ(keys.size(), map.EmplaceN(keys.size(), [](size_t index) { return TestValueType(index); }, keys.data()));
+
+      // Leave the chunks 1/4, 3/4, 1/2 and all but one slot full, the most
+      // recently freed chunk being the emptiest.
+      const auto eraseFromChunk = [&](size_t chunkIndex, size_t begin, size_t end)
+      {
+         for (size_t i = begin; i < end; ++i)
+         {
+            ASSERT_TRUE(map.Erase(keys[chunkIndex * ChunkSlots + i]));
+         }
+      };
+      eraseFromChunk(3, 0, 1);
+      eraseFromChunk(1, 0, ChunkSlots / 4);
+      eraseFromChunk(2, 0, ChunkSlots / 2);
+      eraseFromChunk(0, 0, ChunkSlots * 3 / 4);
+
+      // The new elements fill the chunk 3 first, then the chunk 1, then the
+      // chunk 2.
+      ASSERT_EQ(3, map.Emplace(-1) & StorageType::ChunkIndexMask);
+      for (size_t i = 0; i < ChunkSlots / 4; ++i)
+      {
+         ASSERT_EQ(1, map.Emplace(-1) & StorageType::ChunkIndexMask);
+      }
+      ASSERT_EQ(2, map.Emplace(-1) & StorageType::ChunkIndexMask);
+
+      // A full chunk with a hole is preferred again.
+      ASSERT_TRUE(map.Erase(keys[ChunkSlots * 3 + ChunkSlots - 1]));
+      ASSERT_EQ(3, map.Emplace(-1) & StorageType::ChunkIndexMask);
+
+      // The chunk 0 drains and stays empty while there are other free slots.
+      eraseFromChunk(0, ChunkSlots * 3 / 4, ChunkSlots);
+      for (size_t i = 0; i < ChunkSlots / 2 - 1; ++i)
+      {
+         ASSERT_EQ(2, map.Emplace(-1) & StorageType::ChunkIndexMask);
+      }
+      ASSERT_EQ(0, map.Emplace(-1) & StorageType::ChunkIndexMask);
+
+      // Switching the policy keeps all free slots available.
+      map.GetStorage().SetChunkAllocationPolicy(ChunkAllocationPolicy::MostRecentlyFreed);
+      const size_t freeSlots = map.Capacity() - map.Size();
+      for (size_t i = 0; i < freeSlots; ++i)
+      {
+         ASSERT_GT(4, map.Emplace(-1) & StorageType::ChunkIndexMask);
+      }
+      ASSERT_EQ(map.Capacity(), map.Size());
+   }
+   ASSERT_TRUE(TestValueType::CheckLiveInstances(0));
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ChunkedSlotMapStorageTest, Snapshot)
+{
+   using MapType = WideGenerationSlotMap<uint64_t, 4>;
+   using StorageType = MapType::StorageType;
+   using KeyType = MapType::KeyType;
+   constexpr size_t ChunkSlots = StorageType::ChunkSlots;
+
+   MapType map;
+   map.GetStorage().SetGenerationOverflowPolicy(GenerationOverflowPolicy::RetireSlot);
+   std::vector<KeyType> keys(ChunkSlots * 5);
+   ASSERT_EQ(keys.size(), map.EmplaceN(keys.size(), [](size_t index) { return static_cast<uint64_t>(index); }, keys.data()));
+
+   // Leave the last chunk released, a retired slot and holes in the other
+   // chunks.
+   ASSERT_EQ(ChunkSlots, map.EraseN(keys.data() + ChunkSlots * 4, ChunkSlots));
+   map.ShrinkToFit();
+   KeyType churned = keys[0];
+   for (size_t i = 1; i < StorageType::GenerationMask; ++i)
+   {
+      ASSERT_TRUE(map.Erase(churned));
+      churned = map.Emplace(uint64_t(0));
+   }
+   ASSERT_TRUE(map.Erase(churned));
+   ASSERT_EQ(1, map.GetStorage().RetiredSlotCount());
+   for (size_t i = 1; i < ChunkSlots * 4; i += 3)
+   {
+      ASSERT_TRUE(map.Erase(keys[i]));
+   }
+
+   std::stringstream stream;
+   ASSERT_TRUE(map.SaveSnapshot(stream));
+   const std::string snapshot = stream.str();
+
+   MapType loaded;
+   loaded.Emplace(uint64_t(42));
+   ASSERT_TRUE(loaded.LoadSnapshot(stream));
+   ASSERT_EQ(map.Size(), loaded.Size());
+   ASSERT_EQ(map.Capacity(), loaded.Capacity());
+   ASSERT_EQ(1, loaded.GetStorage().RetiredSlotCount());
+   ASSERT_EQ(GenerationOverflowPolicy::RetireSlot, loaded.GetStorage().GetGenerationOverflowPolicy());
+   for (size_t i = 0; i < keys.size(); ++i)
+   {
+      const uint64_t* const value = map.GetPtr(keys[i]);
+      if (value)
+      {
+         ASSERT_EQ(i, *value);
+         ASSERT_EQ(i, *loaded.GetPtr(keys[i]));
+      }
+      else
+      {
+         ASSERT_EQ(nullptr, loaded.GetPtr(keys[i]));
+      }
+   }
+
+   // Both maps hand out the same keys from here on, the retired slot and
+   // the keys into the released chunk stay invalid.
+   for (size_t i = 0; i < ChunkSlots * 2; ++i)
+   {
+      const KeyType key = map.Emplace(uint64_t(i));
+      ASSERT_EQ(key, loaded.Emplace(uint64_t(i)));
+      ASSERT_NE(churned, key);
+   }
+   for (size_t i = ChunkSlots * 4; i < keys.size(); ++i)
+   {
+      ASSERT_EQ(nullptr, loaded.GetPtr(keys[i]));
+   }
+
+   // A truncated snapshot or one of a different map type is not loaded.
+   for (const size_t length : { size_t(0), sizeof(impl::SnapshotHeader), snapshot.size() / 2, snapshot.size() - 1 })
+   {
+      std::stringstream truncated(snapshot.substr(0, length));
+      ASSERT_FALSE(loaded.LoadSnapshot(truncated));
+      ASSERT_EQ(map.Size(), loaded.Size());
+   }
+   std::stringstream other(snapshot);
+   SlotMap<uint64_t> otherMap;
+   ASSERT_FALSE(otherMap.LoadSnapshot(other));
+   ASSERT_EQ(0, otherMap.Size());
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ChunkedSlotMapStorageTest, DeltaSnapshot)
+{
+   using MapType = SlotMap<uint64_t>;
+   using StorageType = MapType::StorageType;
+   using KeyType = MapType::KeyType;
+   constexpr size_t ChunkSlots = StorageType::ChunkSlots;
+
+   MapType map;
+   std::vector<KeyType> keys(ChunkSlots * 8);
+   ASSERT_EQ(keys.size(), map.EmplaceN(keys.size(), [](size_t index) { return static_cast<uint64_t>(index); }, keys.data()));
+   for (size_t i = 0; i < keys.size(); i += 5)
+   {
+      ASSERT_TRUE(map.Erase(keys[i]));
+   }
+
+   std::stringstream base;
+   ASSERT_TRUE(map.SaveSnapshot(base));
+   MapType replica;
+   ASSERT_TRUE(replica.LoadSnapshot(base));
+   map.GetStorage().SetDirtyChunkTracking(true);
+   ASSERT_EQ(0, map.GetStorage().DirtyChunkCount());
+
+   const auto checkReplica = [&]()
+   {
+      ASSERT_EQ(map.Size(), replica.Size());
+      ASSERT_EQ(map.Capacity(), replica.Capacity());
+      for (const KeyType key : keys)
+      {
+         const uint64_t* const value = map.GetPtr(key);
+         if (value)
+         {
+            ASSERT_NE(nullptr, replica.GetPtr(key));
+            ASSERT_EQ(*value, *replica.GetPtr(key));
+         }
+         else
+         {
+            ASSERT_EQ(nullptr, replica.GetPtr(key));
+         }
+      }
+   };
+
+   // Release the last chunk, refill some holes and write a value in place.
+   map.EraseN(keys.data() + ChunkSlots * 7, ChunkSlots);
+   map.ShrinkToFit();
+   ASSERT_TRUE(map.Erase(keys[ChunkSlots + 1]));
+   for (size_t i = 0; i < 3; ++i)
+   {
+      keys.push_back(map.Emplace(uint64_t(1000000 + i)));
+   }
+   size_t written = ChunkSlots * 3;
+   while (!map.GetPtr(keys[written]))
+   {
+      ++written;
+   }
+   *map.GetPtr(keys[written]) = 42;
+   map.GetStorage().MarkDirty(keys[written]);
+   ASSERT_LT(map.GetStorage().DirtyChunkCount(), 6);
+
+   std::stringstream delta;
+   ASSERT_TRUE(map.GetStorage().SaveDelta(delta));
+   ASSERT_EQ(0, map.GetStorage().DirtyChunkCount());
+   ASSERT_TRUE(replica.GetStorage().ApplyDelta(delta));
+   checkReplica();
+
+   // The next delta goes on top of the previous one, with the chunks picked
+   // by their occupancy.
+   map.GetStorage().SetChunkAllocationPolicy(ChunkAllocationPolicy::FullestFirst);
+   for (size_t i = 2; i < ChunkSlots * 5; i += 7)
+   {
+      map.Erase(keys[i]);
+   }
+   for (size_t i = 0; i < ChunkSlots * 2; ++i)
+   {
+      keys.push_back(map.Emplace(uint64_t(2000000 + i)));
+   }
+   delta.str(std::string());
+   delta.clear();
+   ASSERT_TRUE(map.GetStorage().SaveDelta(delta));
+   const std::string deltaData = delta.str();
+   ASSERT_TRUE(replica.GetStorage().ApplyDelta(delta));
+   checkReplica();
+
+   // Both maps hand out the same keys from here on.
+   for (size_t i = 0; i < ChunkSlots; ++i)
+   {
+      keys.push_back(map.Emplace(uint64_t(i)));
+      ASSERT_EQ(keys.back(), replica.Emplace(uint64_t(i)));
+   }
+
+   // A truncated delta or a full snapshot is not applied.
+   for (const size_t length : { size_t(0), sizeof(impl::SnapshotHeader), deltaData.size() / 2, deltaData.size() - 1 })
+   {
+      std::stringstream truncated(deltaData.substr(0, length));
+      ASSERT_FALSE(replica.GetStorage().ApplyDelta(truncated));
+      checkReplica();
+   }
+   std::stringstream snapshot;
+   ASSERT_TRUE(map.SaveSnapshot(snapshot));
+   ASSERT_FALSE(replica.GetStorage().ApplyDelta(snapshot));
+   checkReplica();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ChunkedSlotMapStorageTest, DeltaSnapshot_TrackingDisabled)
+{
+   using MapType = SlotMap<uint64_t>;
+
+   MapType map;
+   std::stringstream base;
+   ASSERT_TRUE(map.SaveSnapshot(base));
+   MapType replica;
+   ASSERT_TRUE(replica.LoadSnapshot(base));
+
+   // Without tracking no delta is written.
+   for (uint64_t i = 0; i < 10; ++i)
+   {
+      map.Emplace(i);
+   }
+   std::stringstream delta;
+   ASSERT_FALSE(map.GetStorage().SaveDelta(delta));
+   ASSERT_TRUE(delta.str().empty());
+
+   // A delta that misses the chunks changed before tracking was enabled does
+   // not match the replica and is not applied.
+   map.GetStorage().SetDirtyChunkTracking(true);
+   ASSERT_TRUE(map.GetStorage().SaveDelta(delta));
+   ASSERT_FALSE(replica.GetStorage().ApplyDelta(delta));
+   ASSERT_EQ(0, replica.Size());
+   ASSERT_EQ(0, replica.Capacity());
+   for (uint64_t i = 0; i < 10; ++i)
+   {
+      replica.Emplace(i);
+   }
+   size_t count = 0;
+   replica.ForEach([&](uint32_t, uint64_t) { ++count; });
+   ASSERT_EQ(10, count);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ChunkedSlotMapStorageTest, CopyOnWrite)
+{
+   using MapType = SlotMap<TestValueType>;
+   using StorageType = MapType::StorageType;
+   using KeyType = MapType::KeyType;
+   constexpr size_t ChunkSlots = StorageType::ChunkSlots;
+   constexpr size_t Count = ChunkSlots * 4;
+
+   TestValueType::ResetCounters();
+   {
+      MapType map;
+      map.GetStorage().SetCopyOnWrite(true);
+      std::vector<KeyType> keys;
+      for (size_t i = 0; i < Count; ++i)
+      {
+         keys.push_back(map.Emplace(i));
+      }
+
+      // The copy shares all the chunks, no value is copied.
+      std::unique_ptr<MapType> copy = std::make_unique<MapType>(map);
+      ASSERT_TRUE(TestValueType::CheckLiveInstances(Count));
+      ASSERT_EQ(4, map.GetStorage().SharedChunkCount());
+      ASSERT_EQ(4, copy->GetStorage().SharedChunkCount());
+      ASSERT_EQ(static_cast<const MapType&>(map).GetPtr(keys[0]), static_cast<const MapType&>(*copy).GetPtr(keys[0]));
+
+      // Writing a value, erasing and inserting copy only the chunks they
+      // change.
+      map.GetPtr(keys[0])->m_value = -1;
+      ASSERT_TRUE(map.Erase(keys[ChunkSlots]));
+      const KeyType reusedKey = map.Emplace(-2);
+      ASSERT_EQ(keys[ChunkSlots] & StorageType::ChunkIndexMask, reusedKey & StorageType::ChunkIndexMask);
+      ASSERT_EQ(2, map.GetStorage().SharedChunkCount());
+      ASSERT_EQ(4, copy->GetStorage().SharedChunkCount());
+      ASSERT_TRUE(TestValueType::CheckLiveInstances(Count + ChunkSlots * 2));
+      for (size_t i = 0; i < Count; ++i)
+      {
+         ASSERT_EQ(static_cast<int32_t>(i), static_cast<const MapType&>(*copy).GetPtr(keys[i])->m_value);
+      }
+      ASSERT_EQ(-1, map.GetPtr(keys[0])->m_value);
+      ASSERT_EQ(nullptr, map.GetPtr(keys[ChunkSlots]));
+
+      // The copy can be copied again and changed on its own. Neither erasing
+      // keys that are not live nor clearing copies a chunk.
+      MapType copyOfCopy(*copy);
+      const size_t ctorCount = TestValueType::s_ctorCount;
+      ASSERT_EQ(0, copyOfCopy.EraseN(&reusedKey, 1));
+      ASSERT_EQ(4, copyOfCopy.GetStorage().SharedChunkCount());
+      copyOfCopy.Clear();
+      ASSERT_EQ(ctorCount, TestValueType::s_ctorCount);
+      ASSERT_EQ(0, copyOfCopy.GetStorage().SharedChunkCount());
+      ASSERT_TRUE(TestValueType::CheckLiveInstances(Count + ChunkSlots * 2));
+      for (size_t i = 0; i < ChunkSlots * 2; ++i)
+      {
+         ASSERT_NE(keys[i], copyOfCopy.Emplace(-3));
+      }
+      for (size_t i = 0; i < Count; ++i)
+      {
+         ASSERT_EQ(nullptr, static_cast<const MapType&>(copyOfCopy).GetPtr(keys[i]));
+         ASSERT_EQ(static_cast<int32_t>(i), static_cast<const MapType&>(*copy).GetPtr(keys[i])->m_value);
+      }
+      copyOfCopy.Clear();
+      ASSERT_TRUE(TestValueType::CheckLiveInstances(Count + ChunkSlots * 2));
+      ASSERT_EQ(Count, copy->Size());
+
+      // Same when clearing keeps the retired slots.
+      {
+         MapType retiring(*copy);
+         retiring.GetStorage().SetGenerationOverflowPolicy(GenerationOverflowPolicy::RetireSlot);
+         retiring.Clear();
+         ASSERT_EQ(ctorCount, TestValueType::s_ctorCount - ChunkSlots * 2);
+         ASSERT_EQ(0, retiring.GetStorage().SharedChunkCount());
+         ASSERT_EQ(0, retiring.Size());
+      }
+      ASSERT_TRUE(TestValueType::CheckLiveInstances(Count + ChunkSlots * 2));
+      ASSERT_EQ(Count, copy->Size());
+
+      // Once the copies are gone, the chunks are taken over without copying.
+      copy.reset();
+      ASSERT_TRUE(TestValueType::CheckLiveInstances(Count));
+      map.GetStorage().UnshareChunks();
+      ASSERT_EQ(0, map.GetStorage().SharedChunkCount());
+      ASSERT_TRUE(TestValueType::CheckLiveInstances(Count));
+
+      // Releasing a shared chunk leaves it to the copy.
+      MapType snapshot(map);
+      map.EraseN(keys.data() + ChunkSlots * 3, ChunkSlots);
+      ASSERT_EQ(1, map.GetStorage().ShrinkToFit());
+      ASSERT_EQ(Count, snapshot.Size());
+      ASSERT_EQ(static_cast<int32_t>(Count - 1), static_cast<const MapType&>(snapshot).GetPtr(keys.back())->m_value);
+   }
+   ASSERT_TRUE(TestValueType::CheckLiveInstances(0));
+
+   // Loading a snapshot keeps the copies sharing the chunks.
+   {
+      SlotMap<uint64_t> map;
+      map.GetStorage().SetCopyOnWrite(true);
+      for (size_t i = 0; i < Count; ++i)
+      {
+         map.Emplace(uint64_t(i));
+      }
+      std::stringstream stream;
+      ASSERT_TRUE(map.SaveSnapshot(stream));
+      ASSERT_TRUE(map.LoadSnapshot(stream));
+      ASSERT_TRUE(map.GetStorage().IsCopyOnWrite());
+      SlotMap<uint64_t> copy(map);
+      ASSERT_EQ(4, copy.GetStorage().SharedChunkCount());
+   }
+
+   // A copy read on another thread while the original keeps changing.
+   SlotMap<uint64_t> map;
+   map.GetStorage().SetCopyOnWrite(true);
+   std::vector<uint32_t> keys;
+   for (size_t i = 0; i < Count; ++i)
+   {
+      keys.push_back(map.Emplace(uint64_t(i)));
+   }
+   uint64_t expectedSum = Count * (Count - 1) / 2;
+   for (size_t round = 0; round < 10; ++round)
+   {
+      auto copy = std::make_unique<SlotMap<uint64_t>>(map);
+      uint64_t sum = 0;
+      std::thread reader([&sum, copy = std::move(copy)]()
+      {
+         copy->ForEach([&](uint32_t, uint64_t value) { sum += value; });
+      });
+      uint64_t added = 0;
+      for (size_t i = round; i < keys.size(); i += 10)
+      {
+         *map.GetPtr(keys[i]) += Count;
+         added += Count;
+      }
+      reader.join();
+      ASSERT_EQ(expectedSum, sum);
+      expectedSum += added;
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ChunkedSlotMapStorageTest, ChunkRanges)
+{
+   using MapType = SlotMap<uint64_t>;
+   using StorageType = MapType::StorageType;
+   using ChunkRangeIterator = decltype(std::declval<MapType&>().ChunkRanges().begin());
+   static_assert(std::is_same_v<typename std::iterator_traits<ChunkRangeIterator>::iterator_category, std::random_access_iterator_tag>);
+
+   MapType map;
+   ASSERT_TRUE(map.ChunkRanges().empty());
+
+   // Some chunks are left empty, including the last one.
+   const size_t count = StorageType::ChunkSlots * 10;
+   std::vector<uint32_t> keys;
+   for (size_t i = 0; i < count; ++i)
+   {
+      keys.push_back(map.Emplace(i));
+   }
+   for (size_t i = 0; i < count; ++i)
+   {
+      const size_t chunkIndex = i / StorageType::ChunkSlots;
+      if ((chunkIndex == 3) || (chunkIndex == 4) || (chunkIndex == 9) || ((chunkIndex == 6) && (i % 3 != 0)))
+      {
+         ASSERT_TRUE(map.Erase(keys[i]));
+      }
+   }
+
+   const auto chunks = map.ChunkRanges();
+   ASSERT_EQ(10, chunks.end() - chunks.begin());
+   for (size_t chunkIndex = 0; chunkIndex < 10; ++chunkIndex)
+   {
+      size_t chunkCount = 0;
+      for (auto [key, value] : chunks.begin()[chunkIndex])
+      {
+         ASSERT_EQ(chunkIndex, key & StorageType::ChunkIndexMask);
+         ASSERT_EQ(map.GetPtr(key), &value);
+         ++chunkCount;
+      }
+      const size_t expectedCount = ((chunkIndex == 3) || (chunkIndex == 4) || (chunkIndex == 9)) ? 0 :
+         (chunkIndex == 6) ? (StorageType::ChunkSlots + 2) / 3 : StorageType::ChunkSlots;
+      ASSERT_EQ(expectedCount, chunkCount);
+   }
+
+   // Every element is visited exactly once when the chunks are split between threads.
+   std::vector<std::atomic<uint32_t>> visitCounts(count);
+   ThreadPool pool(3);
+   pool.ParallelFor(chunks.end() - chunks.begin(), [&](size_t chunkIndex)
+   {
+      for (auto [key, value] : chunks.begin()[chunkIndex])
+      {
+         ++visitCounts[value];
+         value *= 2;
+      }
+   });
+#if SLOTMAP_EXECUTION_POLICIES
+   std::for_each(std::execution::seq, chunks.begin(), chunks.end(), [&](auto chunk)
+   {
+      for (auto [key, value] : chunk)
+      {
+         ++visitCounts[value / 2];
+      }
+   });
+#endif
+   for (size_t i = 0; i < count; ++i)
+   {
+      const uint64_t* value = map.GetPtr(keys[i]);
+      const uint32_t expectedCount = (SLOTMAP_EXECUTION_POLICIES ? 2 : 1) * (value ? 1 : 0);
+      ASSERT_EQ(expectedCount, visitCounts[i].load());
+      ASSERT_TRUE(!value || (*value == i * 2));
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ChunkedSlotMapStorageTest, OccupancyHistogram)
+{
+   using MapType = SlotMap<uint64_t>;
+   using StorageType = MapType::StorageType;
+   constexpr size_t ChunkSlots = StorageType::ChunkSlots;
+
+   MapType map;
+   ChunkOccupancyHistogram histogram = map.GetStorage().OccupancyHistogram();
+   ASSERT_EQ(0, histogram.m_chunkCount);
+   ASSERT_EQ(0.0, histogram.GetFragmentation());
+
+   std::vector<uint32_t> keys(ChunkSlots * 5);
+   ASSERT_EQ(keys.size(), map.EmplaceN(keys.size(), [](size_t index) { return index; }, keys.data()));
+   histogram = map.GetStorage().OccupancyHistogram();
+   ASSERT_EQ(5, histogram.m_chunkCount);
+   ASSERT_EQ(5, histogram.m_chunkCounts[ChunkOccupancyHistogram::BucketCount - 1]);
+   ASSERT_EQ(0.0, histogram.GetFragmentation());
+
+   // Chunk 0 stays full, chunk 1 is emptied, chunk 2 keeps one element,
+   // chunk 3 keeps a half and chunk 4 all but one element.
+   const size_t keptCounts[] = { ChunkSlots, 0, 1, ChunkSlots / 2, ChunkSlots - 1 };
+   for (size_t chunkIndex = 0; chunkIndex < 5; ++chunkIndex)
+   {
+      const size_t eraseCount = ChunkSlots - keptCounts[chunkIndex];
+      ASSERT_EQ(eraseCount, map.EraseN(keys.data() + chunkIndex * ChunkSlots, eraseCount));
+      ASSERT_EQ(keptCounts[chunkIndex], map.GetStorage().ChunkOccupancy(chunkIndex));
+   }
+
+   histogram = map.GetStorage().OccupancyHistogram();
+   ASSERT_EQ(5, histogram.m_chunkCount);
+   ASSERT_EQ(ChunkSlots, histogram.m_chunkSlots);
+   ASSERT_EQ(map.Size(), histogram.m_liveSlotCount);
+   size_t expectedCounts[ChunkOccupancyHistogram::BucketCount] = {};
+   for (const size_t keptCount : keptCounts)
+   {
+      ++expectedCounts[ChunkOccupancyHistogram::GetBucket(keptCount, ChunkSlots)];
+   }
+   for (size_t bucket = 0; bucket < ChunkOccupancyHistogram::BucketCount; ++bucket)
+   {
+      ASSERT_EQ(expectedCounts[bucket], histogram.m_chunkCounts[bucket]) << "Bucket " << bucket;
+   }
+   ASSERT_EQ(1, histogram.m_chunkCounts[0]);
+   ASSERT_EQ(1, histogram.m_chunkCounts[1]);
+   ASSERT_EQ(1, histogram.m_chunkCounts[4]);
+   ASSERT_EQ(1, histogram.m_chunkCounts[5]);
+   ASSERT_DOUBLE_EQ(1.0 - static_cast<double>(map.Size()) / (4 * ChunkSlots), histogram.GetFragmentation());
+
+   // Compacting packs the elements into full chunks.
+   map.Compact(std::numeric_limits<size_t>::max(), [](uint32_t, uint32_t) {});
+   histogram = map.GetStorage().OccupancyHistogram();
+   ASSERT_EQ(map.Size(), histogram.m_liveSlotCount);
+   ASSERT_LT(histogram.GetFragmentation(), 1.0 / 3);
+   size_t liveCount = 0;
+   for (size_t chunkIndex = 0; chunkIndex < map.Capacity() / ChunkSlots; ++chunkIndex)
+   {
+      liveCount += map.GetStorage().ChunkOccupancy(chunkIndex);
+   }
+   ASSERT_EQ(map.Size(), liveCount);
+
+   // Clearing keeps the chunks, which are all empty.
+   const size_t chunkCount = map.Capacity() / ChunkSlots;
+   map.Clear();
+   histogram = map.GetStorage().OccupancyHistogram();
+   ASSERT_EQ(chunkCount, histogram.m_chunkCount);
+   ASSERT_EQ(chunkCount, histogram.m_chunkCounts[0]);
+   ASSERT_EQ(0, histogram.m_liveSlotCount);
+   ASSERT_EQ(0.0, histogram.GetFragmentation());
+   for (size_t chunkIndex = 0; chunkIndex < chunkCount; ++chunkIndex)
+   {
+      ASSERT_EQ(0, map.GetStorage().ChunkOccupancy(chunkIndex));
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ChunkedSlotMapStorageTest, FullChunkIteration)
+{
+   using MapType = SlotMap<uint64_t>;
+   using StorageType = MapType::StorageType;
+
+   // Collects the keys with each way of iteration, which skip the bit scans
+   // in the full chunks.
+   const auto checkIteration = [](const MapType& map) -> ::testing::AssertionResult
+   {
+      std::vector<uint32_t> forEachKeys;
+      map.ForEach([&](uint32_t key, const uint64_t&)
+      {
+         forEachKeys.push_back(key);
+      });
+      std::vector<uint32_t> iteratorKeys(map.Keys().begin(), map.Keys().end());
+      std::vector<uint32_t> findNextKeys;
+      for (uint32_t key = 0; map.FindNextKey(key); key = map.IncrementKey(key))
+      {
+         findNextKeys.push_back(key);
+      }
+
+      if (forEachKeys.size() != map.Size())
+      {
+         return ::testing::AssertionFailure() << "ForEach() visited " << forEachKeys.size() << " of " << map.Size() << " elements";
+      }
+      if ((iteratorKeys != forEachKeys) || (findNextKeys != forEachKeys))
+      {
+         return ::testing::AssertionFailure() << "The iterators and FindNextKey() visit other keys than ForEach()";
+      }
+      for (const uint32_t key : forEachKeys)
+      {
+         if (map.GetPtr(key) == nullptr)
+         {
+            return ::testing::AssertionFailure() << "Visited key " << key << " is not valid";
+         }
+      }
+      return ::testing::AssertionSuccess();
+   };
+
+   MapType map;
+   std::vector<uint32_t> keys(StorageType::ChunkSlots * 5);
+   ASSERT_EQ(keys.size(), map.EmplaceN(keys.size(), [](size_t index) { return index; }, keys.data()));
+   ASSERT_TRUE(checkIteration(map));
+
+   // The last slot of chunk 1 and the first slot of chunk 3 are freed, then
+   // chunk 3 is filled up again.
+   ASSERT_TRUE(map.Erase(keys[StorageType::ChunkSlots * 2 - 1]));
+   ASSERT_TRUE(map.Erase(keys[StorageType::ChunkSlots * 3]));
+   ASSERT_TRUE(checkIteration(map));
+   map.Emplace(0u);
+   ASSERT_TRUE(checkIteration(map));
+
+   ASSERT_EQ(StorageType::ChunkSlots, map.EraseN(keys.data() + StorageType::ChunkSlots * 4, StorageType::ChunkSlots));
+   ASSERT_TRUE(checkIteration(map));
+   map.Compact(std::numeric_limits<size_t>::max(), [](uint32_t, uint32_t) {});
+   ASSERT_TRUE(checkIteration(map));
+
+   std::stringstream stream;
+   ASSERT_TRUE(map.GetStorage().SaveSnapshot(stream));
+   MapType loaded;
+   ASSERT_TRUE(loaded.GetStorage().LoadSnapshot(stream));
+   ASSERT_TRUE(checkIteration(loaded));
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ChunkedSlotMapStorageTest, ForEachChunk)
+{
+   using MapType = SlotMap<uint64_t>;
+   using StorageType = MapType::StorageType;
+   using WordType = std::remove_cv_t<std::remove_pointer_t<decltype(std::declval<StorageType::ConstChunkSpan>().GetLiveWords())>>;
+   constexpr size_t BitsPerWord = sizeof(WordType) * CHAR_BIT;
+
+   MapType map;
+   map.ForEachChunk([](auto) { FAIL() << "Empty map has no chunks with live elements"; });
+
+   // Chunk 1 is left empty, chunk 2 is half empty.
+   const size_t count = StorageType::ChunkSlots * 4;
+   std::vector<uint32_t> keys;
+   for (size_t i = 0; i < count; ++i)
+   {
+      keys.push_back(map.Emplace(i));
+   }
+   uint64_t expectedSum = 0;
+   for (size_t i = 0; i < count; ++i)
+   {
+      const size_t chunkIndex = i / StorageType::ChunkSlots;
+      if ((chunkIndex == 1) || ((chunkIndex == 2) && (i % 2 == 0)))
+      {
+         ASSERT_TRUE(map.Erase(keys[i]));
+      }
+      else
+      {
+         expectedSum += i;
+      }
+   }
+
+   std::vector<size_t> chunkIndices;
+   uint64_t sum = 0;
+   size_t liveCount = 0;
+   const MapType& constMap = map;
+   constMap.ForEachChunk([&](StorageType::ConstChunkSpan span)
+   {
+      chunkIndices.push_back(span.GetChunkIndex());
+      liveCount += span.GetLiveCount();
+      ASSERT_EQ(span.GetChunkIndex() != 2, span.IsFull());
+
+      // Branch-free masked sum over the live words, like a vectorized loop would do it.
+      const uint64_t* const values = span.GetValues();
+      const WordType* const words = span.GetLiveWords();
+      for (size_t wordIndex = 0; wordIndex < span.GetLiveWordCount(); ++wordIndex)
+      {
+         const size_t first = wordIndex * BitsPerWord;
+         for (size_t i = 0; (i < BitsPerWord) && (first + i < span.GetSlotCount()); ++i)
+         {
+            sum += values[first + i] & (0 - static_cast<uint64_t>((words[wordIndex] >> i) & 1));
+         }
+      }
+
+      for (size_t slotIndex = 0; slotIndex < span.GetSlotCount(); ++slotIndex)
+      {
+         if (span.IsLive(slotIndex))
+         {
+            const uint32_t key = span.GetKey(slotIndex);
+            ASSERT_EQ(span.GetChunkIndex(), key & StorageType::ChunkIndexMask);
+            ASSERT_EQ(span.GetBaseKey(), key & StorageType::ChunkIndexMask);
+            ASSERT_EQ(constMap.GetPtr(key), span.GetPtr(slotIndex));
+            ASSERT_EQ(span.GetGenerations()[slotIndex], key >> StorageType::GenerationShift);
+         }
+      }
+   });
+   ASSERT_EQ((std::vector<size_t>{ 0, 2, 3 }), chunkIndices);
+   ASSERT_EQ(map.Size(), liveCount);
+   ASSERT_EQ(expectedSum, sum);
+
+   // Writes through the spans of a copy-on-write copy don't change the original.
+   map.GetStorage().SetCopyOnWrite(true);
+   MapType copy(map);
+   copy.ForEachChunk([](StorageType::ChunkSpan span)
+   {
+      for (size_t slotIndex = 0; slotIndex < span.GetSlotCount(); ++slotIndex)
+      {
+         if (span.IsLive(slotIndex))
+         {
+            span.GetValues()[slotIndex] *= 2;
+         }
+      }
+   });
+   for (size_t i = 0; i < count; ++i)
+   {
+      if (const uint64_t* value = map.GetPtr(keys[i]))
+      {
+         ASSERT_EQ(i, *value);
+         ASSERT_EQ(i * 2, *copy.GetPtr(keys[i]));
+      }
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ChunkedSlotMapStorageTest, Stats)
+{
+   using MapType = InstrumentedSlotMap<uint64_t>;
+   using StorageType = MapType::StorageType;
+   using KeyType = MapType::KeyType;
+   constexpr size_t ChunkSlots = StorageType::ChunkSlots;
+
+   MapType map;
+   StatsSnapshot stats = map.GetStorage().GetStats().GetSnapshot();
+   ASSERT_EQ(0, stats.m_insertCount);
+   ASSERT_EQ(0, stats.m_chunkAllocationCount);
+   ASSERT_EQ(0, stats.GetFailedLookupCount());
+
+   std::vector<KeyType> keys(ChunkSlots * 2);
+   ASSERT_EQ(keys.size(), map.EmplaceN(keys.size(), [](size_t index) { return index; }, keys.data()));
+   const KeyType erased = keys.back();
+   keys.pop_back();
+   ASSERT_TRUE(map.Erase(erased));
+   ASSERT_FALSE(map.Erase(erased));
+
+   stats = map.GetStorage().GetStats().GetSnapshot();
+   ASSERT_EQ(ChunkSlots * 2, stats.m_insertCount);
+   ASSERT_EQ(1, stats.m_eraseCount);
+   ASSERT_EQ(2, stats.m_chunkAllocationCount);
+   ASSERT_EQ(map.Size(), stats.m_size);
+   ASSERT_EQ(ChunkSlots * 2, stats.m_peakSize);
+   ASSERT_EQ(1, stats.m_freeSlotCount);
+   ASSERT_EQ(map.GetStorage().FreeSlotCount(), stats.m_freeSlotCount);
+
+   // The successful lookups are not counted, the failed ones by the reason.
+   for (const KeyType key : keys)
+   {
+      ASSERT_NE(nullptr, map.GetPtr(key));
+   }
+   ASSERT_EQ(nullptr, map.GetPtr(erased));
+   const KeyType reused = map.Emplace(0);
+   ASSERT_EQ(reused & StorageType::ChunkIndexMask, erased & StorageType::ChunkIndexMask);
+   ASSERT_EQ(nullptr, map.GetPtr(erased));
+   ASSERT_EQ(nullptr, map.GetPtr(StorageType::ChunkIndexMask));
+
+   const KeyType batchKeys[] = { reused, erased, StorageType::ChunkIndexMask };
+   const uint64_t* batchPtrs[3] = {};
+   map.GetStorage().GetPtrBatch(batchKeys, 3, batchPtrs);
+   ASSERT_NE(nullptr, batchPtrs[0]);
+
+   stats = map.GetStorage().GetStats().GetSnapshot();
+   ASSERT_EQ(2, stats.GetFailedLookupCount(LookupFailure::OutOfRange));
+   ASSERT_EQ(1, stats.GetFailedLookupCount(LookupFailure::DeadSlot));
+   ASSERT_EQ(2, stats.GetFailedLookupCount(LookupFailure::StaleGeneration));
+   ASSERT_EQ(5, stats.GetFailedLookupCount());
+   ASSERT_EQ(0, stats.m_freeSlotCount);
+
+   // Churning a single slot wraps its generation once.
+   KeyType key = reused;
+   for (size_t i = 0; i < StorageType::GenerationMask; ++i)
+   {
+      ASSERT_TRUE(map.Erase(key));
+      key = map.Emplace(i);
+   }
+   stats = map.GetStorage().GetStats().GetSnapshot();
+   ASSERT_EQ(1, stats.m_generationWrapCount);
+   ASSERT_EQ(stats.m_insertCount - stats.m_eraseCount, map.Size());
+
+   // The counters stay with the storage object, a copy only takes its size.
+   MapType copy(map);
+   StatsSnapshot copyStats = copy.GetStorage().GetStats().GetSnapshot();
+   ASSERT_EQ(0, copyStats.m_insertCount);
+   ASSERT_EQ(0, copyStats.GetFailedLookupCount());
+   ASSERT_EQ(copy.Size(), copyStats.m_size);
+   ASSERT_EQ(copy.Size(), copyStats.m_peakSize);
+
+   // Erasing is not a lookup, whether or not the chunks are shared.
+   map.GetStorage().SetCopyOnWrite(true);
+   MapType sharingCopy(map);
+   ASSERT_EQ(0, map.EraseN(&erased, 1));
+   ASSERT_EQ(5, map.GetStorage().GetStats().GetSnapshot().GetFailedLookupCount());
+
+   map.Clear();
+   stats = map.GetStorage().GetStats().GetSnapshot();
+   ASSERT_EQ(0, stats.m_size);
+   ASSERT_EQ(ChunkSlots * 2, stats.m_peakSize);
+   ASSERT_EQ(stats.m_insertCount, stats.m_eraseCount);
+   ASSERT_EQ(map.Capacity(), stats.m_freeSlotCount);
+
+   map.ShrinkToFit();
+   ASSERT_EQ(0, map.GetStorage().GetStats().GetSnapshot().m_freeSlotCount);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ChunkedSlotMapStorageTest, Stats_ConcurrentSnapshot)
+{
+   using MapType = InstrumentedSlotMap<uint64_t>;
+   using KeyType = MapType::KeyType;
+   constexpr size_t Count = 100000;
+
+   // Another thread scrapes the counters while the owner keeps inserting and
+   // erasing, every counter only grows.
+   MapType map;
+   std::atomic<bool> isDone{false};
+   std::thread reader([&]()
+   {
+      StatsSnapshot previous;
+      while (!isDone.load(std::memory_order_acquire))
+      {
+         const StatsSnapshot stats = map.GetStorage().GetStats().GetSnapshot();
+         EXPECT_GE(stats.m_insertCount, previous.m_insertCount);
+         EXPECT_GE(stats.m_eraseCount, previous.m_eraseCount);
+         EXPECT_GE(stats.m_peakSize, previous.m_peakSize);
+         EXPECT_GE(stats.m_chunkAllocationCount, previous.m_chunkAllocationCount);
+         previous = stats;
+      }
+   });
+
+   std::vector<KeyType> keys;
+   for (size_t i = 0; i < Count; ++i)
+   {
+      keys.push_back(map.Emplace(i));
+      if ((i % 3) == 2)
+      {
+         ASSERT_TRUE(map.Erase(keys[i / 2]));
+      }
+   }
+   isDone.store(true, std::memory_order_release);
+   reader.join();
+
+   const StatsSnapshot stats = map.GetStorage().GetStats().GetSnapshot();
+   ASSERT_EQ(Count, stats.m_insertCount);
+   ASSERT_EQ(Count / 3, stats.m_eraseCount);
+   ASSERT_EQ(map.Size(), stats.m_size);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(FixedSlotMapStorageTest, RetireSlot)
+{
+   using MapType = FixedSlotMap<TestValueType, 255, uint16_t>;
+   using StorageType = MapType::StorageType;
+   using KeyType = MapType::KeyType;
+
+   MapType map;
+   map.GetStorage().SetGenerationOverflowPolicy(GenerationOverflowPolicy::RetireSlot);
+
+   std::vector<KeyType> keys{map.Emplace(0)};
+   for (size_t i = 1; i < StorageType::GenerationMask; ++i)
+   {
+      ASSERT_TRUE(map.Erase(keys.back()));
+      keys.push_back(map.Emplace(static_cast<int>(i)));
+   }
+   ASSERT_TRUE(map.Erase(keys.back()));
+   ASSERT_EQ(1, map.GetStorage().RetiredSlotCount());
+
+   // All other slots are still available, but not the retired one.
+   for (int pass = 0; pass < 2; ++pass)
+   {
+      for (size_t i = 1; i < StorageType::StaticCapacity; ++i)
+      {
+         ASSERT_NE(MapType::InvalidKey, map.Emplace(static_cast<int>(i)));
+      }
+      ASSERT_EQ(MapType::InvalidKey, map.Emplace(0));
+      for (const KeyType key : keys)
+      {
+         ASSERT_EQ(nullptr, map.GetPtr(key));
+      }
+      map.Clear();
+   }
+
+   // A slot that is still live when its generation runs out is retired by
+   // Clear() too.
+   MapType churned;
+   churned.GetStorage().SetGenerationOverflowPolicy(GenerationOverflowPolicy::RetireSlot);
+   const KeyType first = churned.Emplace(0);
+   KeyType last = first;
+   for (size_t i = 1; i < StorageType::GenerationMask; ++i)
+   {
+      ASSERT_TRUE(churned.Erase(last));
+      last = churned.Emplace(static_cast<int>(i));
+   }
+   churned.Clear();
+   ASSERT_EQ(1, churned.GetStorage().RetiredSlotCount());
+   for (size_t i = 1; i < StorageType::StaticCapacity; ++i)
+   {
+      ASSERT_NE(first, churned.Emplace(static_cast<int>(i)));
+      ASSERT_EQ(nullptr, churned.GetPtr(first));
+      ASSERT_EQ(nullptr, churned.GetPtr(last));
+   }
+   ASSERT_EQ(MapType::InvalidKey, churned.Emplace(0));
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(FixedSlotMapStorageTest, Stats)
+{
+   using StorageType = FixedSlotMapStorage<TestValueType, uint16_t, 255, FixedBitSetTraits<>, AtomicStats>;
+   using MapType = SlotMap<TestValueType, uint16_t, StorageType>;
+   using KeyType = MapType::KeyType;
+
+   MapType map;
+   std::vector<KeyType> keys;
+   for (size_t i = 0; i < StorageType::StaticCapacity / 2; ++i)
+   {
+      keys.push_back(map.Emplace(static_cast<int>(i)));
+   }
+
+   const KeyType erased = keys.back();
+   keys.pop_back();
+   ASSERT_TRUE(map.Erase(erased));
+   ASSERT_EQ(nullptr, map.GetPtr(erased));
+   const KeyType reused = map.Emplace(0);
+   ASSERT_EQ(nullptr, map.GetPtr(erased));
+   ASSERT_EQ(nullptr, map.GetPtr(static_cast<KeyType>(StorageType::StaticCapacity - 1)));
+
+   StatsSnapshot stats = map.GetStorage().GetStats().GetSnapshot();
+   ASSERT_EQ(StorageType::StaticCapacity / 2 + 1, stats.m_insertCount);
+   ASSERT_EQ(1, stats.m_eraseCount);
+   ASSERT_EQ(1, stats.GetFailedLookupCount(LookupFailure::OutOfRange));
+   ASSERT_EQ(1, stats.GetFailedLookupCount(LookupFailure::DeadSlot));
+   ASSERT_EQ(1, stats.GetFailedLookupCount(LookupFailure::StaleGeneration));
+   ASSERT_EQ(0, stats.m_chunkAllocationCount);
+   ASSERT_EQ(map.Size(), stats.m_size);
+   ASSERT_EQ(StorageType::StaticCapacity - map.Size(), stats.m_freeSlotCount);
+
+   KeyType key = reused;
+   for (size_t i = 0; i < StorageType::GenerationMask; ++i)
+   {
+      ASSERT_TRUE(map.Erase(key));
+      key = map.Emplace(static_cast<int>(i));
+   }
+   stats = map.GetStorage().GetStats().GetSnapshot();
+   ASSERT_EQ(1, stats.m_generationWrapCount);
+
+   // A full storage rejects the insert without counting it.
+   while (map.Size() < StorageType::StaticCapacity)
+   {
+      map.Emplace(0);
+   }
+   ASSERT_EQ(MapType::InvalidKey, map.Emplace(0));
+   stats = map.GetStorage().GetStats().GetSnapshot();
+   ASSERT_EQ(stats.m_insertCount - stats.m_eraseCount, map.Size());
+   ASSERT_EQ(StorageType::StaticCapacity, stats.m_peakSize);
+   ASSERT_EQ(0, stats.m_freeSlotCount);
+
+   map.Clear();
+   stats = map.GetStorage().GetStats().GetSnapshot();
+   ASSERT_EQ(0, stats.m_size);
+   ASSERT_EQ(StorageType::StaticCapacity, stats.m_freeSlotCount);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ChunkedSlotMapStorageTest, EmptyChunkLimit)
+{
+   using MapType = SlotMap<TestValueType>;
+   using KeyType = MapType::KeyType;
+   constexpr size_t ChunkSlots = MapType::StorageType::ChunkSlots;
+
+   MapType map;
+   map.GetStorage().SetEmptyChunkLimit(4);
+
+   const size_t count = ChunkSlots * 10;
+   std::vector<KeyType> keys(count);
+   for (size_t i = 0; i < count; ++i)
+   {
+      keys[i] = map.Emplace(static_cast<int>(i));
+   }
+   ASSERT_EQ(count, map.Capacity());
+
+   // Four empty chunks at the end are kept.
+   for (size_t i = count; i-- > ChunkSlots * 6;)
+   {
+      ASSERT_TRUE(map.Erase(keys[i]));
+   }
+   ASSERT_EQ(ChunkSlots * 10, map.Capacity());
+
+   // The fifth one triggers the release of all but two of them.
+   for (size_t i = ChunkSlots * 6; i-- > ChunkSlots * 5;)
+   {
+      ASSERT_TRUE(map.Erase(keys[i]));
+   }
+   ASSERT_EQ(ChunkSlots * 7, map.Capacity());
+
+   for (size_t i = 0; i < count; ++i)
+   {
+      const TestValueType* ptr = map.GetPtr(keys[i]);
+      if (i < ChunkSlots * 5)
+      {
+         ASSERT_NE(nullptr, ptr);
+         ASSERT_EQ(static_cast<int>(i), *ptr);
+      }
+      else
+      {
+         ASSERT_EQ(nullptr, ptr);
+      }
+   }
+
+   // EraseN() checks the limit once, after all seven chunks are empty.
+   ASSERT_EQ(ChunkSlots * 5, map.EraseN(keys.data(), ChunkSlots * 5));
+   ASSERT_EQ(0, map.Size());
+   ASSERT_EQ(ChunkSlots * 2, map.Capacity());
+
+   map.ShrinkToFit();
+   ASSERT_EQ(0, map.Capacity());
+}
+
+
+#if SLOTMAP_PMR
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Memory resource that counts the outstanding allocations.
+ */
+class CountingMemoryResource : public std::pmr::memory_resource
+{
+public:
+   size_t m_allocCount = 0;
+   size_t m_liveBytes = 0;
+
+protected:
+   void* do_allocate(size_t bytes, size_t alignment) override
+   {
+      ++m_allocCount;
+      m_liveBytes += bytes;
+      return std::pmr::new_delete_resource()->allocate(bytes, alignment);
+   }
+
+   void do_deallocate(void* ptr, size_t bytes, size_t alignment) override
+   {
+      m_liveBytes -= bytes;
+      std::pmr::new_delete_resource()->deallocate(ptr, bytes, alignment);
+   }
+
+   bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override
+   {
+      return this == &other;
+   }
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ChunkedSlotMapStorageTest, PmrAllocator)
+{
+   using MapType = pmr::SlotMap<TestValueType>;
+   using KeyType = MapType::KeyType;
+   constexpr size_t ChunkSlots = MapType::StorageType::ChunkSlots;
+
+   TestValueType::ResetCounters();
+
+   CountingMemoryResource resource;
+   {
+      MapType map(&resource);
+      std::vector<KeyType> keys(ChunkSlots * 3);
+      for (size_t i = 0; i < keys.size(); ++i)
+      {
+         keys[i] = map.Emplace(static_cast<int>(i));
+      }
 
+      // Three chunks and the chunk pointers.
+      ASSERT_LE(4, resource.m_allocCount);
+      ASSERT_LE(sizeof(MapType::StorageType::Chunk) * 3, resource.m_liveBytes);
+
+      map.GetStorage().SetEmptyChunkLimit(1);
+      for (size_t i = ChunkSlots; i < keys.size(); ++i)
+      {
+         ASSERT_TRUE(map.Erase(keys[i]));
+      }
+      map.ShrinkToFit();
+      ASSERT_GT(sizeof(MapType::StorageType::Chunk) * 2, resource.m_liveBytes);
+
+      // Moving to a map with another resource moves the values, the keys stay
+      // valid.
+      MapType other(std::pmr::new_delete_resource());
+      other = std::move(map);
+      ASSERT_EQ(0, map.Size());
+      ASSERT_EQ(ChunkSlots, other.Size());
+      for (size_t i = 0; i < ChunkSlots; ++i)
+      {
+         const TestValueType* ptr = other.GetPtr(keys[i]);
+         ASSERT_NE(nullptr, ptr);
+         ASSERT_EQ(static_cast<int>(i), *ptr);
+      }
+   }
+   ASSERT_EQ(0, resource.m_liveBytes);
+   ASSERT_TRUE(TestValueType::CheckLiveInstances(0));
+}
+#endif
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(ChunkedSlotMapStorageTest, SlabAllocator)
+{
+   using MapType = HugePageSlotMap<TestValueType>;
+   using KeyType = MapType::KeyType;
+   constexpr size_t ChunkSlots = MapType::StorageType::ChunkSlots;
+
+   TestValueType::ResetCounters();
+
+   auto pool = std::make_shared<SlabPool>();
+   {
+      MapType map{SlabAllocator<TestValueType>(pool)};
+      std::vector<KeyType> keys(ChunkSlots * 3);
+      for (size_t i = 0; i < keys.size(); ++i)
+      {
+         keys[i] = map.Emplace(static_cast<int>(i));
+      }
+      ASSERT_EQ(1, pool->SlabCount());
+
+      // All chunks are carved out of the same slab.
+      const uintptr_t slab = reinterpret_cast<uintptr_t>(map.GetPtr(keys[0])) & ~static_cast<uintptr_t>(SlabSize - 1);
+      for (size_t i = 0; i < keys.size(); i += ChunkSlots)
+      {
+         const uintptr_t ptr = reinterpret_cast<uintptr_t>(map.GetPtr(keys[i]));
+         ASSERT_EQ(slab, ptr & ~static_cast<uintptr_t>(SlabSize - 1));
+      }
+
+      // Released chunks are reused by the next allocations.
+      map.GetStorage().SetEmptyChunkLimit(1);
+      for (size_t i = ChunkSlots; i < keys.size(); ++i)
+      {
+         ASSERT_TRUE(map.Erase(keys[i]));
+      }
+      map.ShrinkToFit();
+      for (size_t i = ChunkSlots; i < keys.size(); ++i)
+      {
+         keys[i] = map.Emplace(static_cast<int>(i));
+      }
+      ASSERT_EQ(1, pool->SlabCount());
+
+      for (size_t i = 0; i < keys.size(); ++i)
+      {
+         const TestValueType* ptr = map.GetPtr(keys[i]);
+         ASSERT_NE(nullptr, ptr);
+         ASSERT_EQ(static_cast<int>(i), *ptr);
+      }
+   }
+   ASSERT_TRUE(TestValueType::CheckLiveInstances(0));
+
+   // The blocks keep their alignment whatever was carved before them.
+   void* const small = pool->Allocate(8, 8);
+   void* const aligned = pool->Allocate(200, 256);
+   void* const page = pool->Allocate(4096 * 2, 8);
+   void* const overaligned = pool->Allocate(64, 8192);
+   ASSERT_EQ(0, reinterpret_cast<uintptr_t>(small) % 64);
+   ASSERT_EQ(0, reinterpret_cast<uintptr_t>(aligned) % 256);
+   ASSERT_EQ(0, reinterpret_cast<uintptr_t>(page) % 4096);
+   ASSERT_EQ(0, reinterpret_cast<uintptr_t>(overaligned) % 8192);
+   pool->Deallocate(small, 8, 8);
+   pool->Deallocate(aligned, 200, 256);
+   pool->Deallocate(page, 4096 * 2, 8);
+   pool->Deallocate(overaligned, 64, 8192);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(DenseSlotMapStorageTest, StaysPacked)
+{
+   using MapType = DenseSlotMap<TestValueType>;
+   using KeyType = MapType::KeyType;
+
+   TestValueType::ResetCounters();
+   {
+      MapType map;
+      std::vector<KeyType> keys;
+      for (int i = 0; i < 1000; ++i)
+      {
+         keys.push_back(map.Emplace(i));
+      }
+
+      // Erasing moves the last element into the hole.
+      const TestValueType* first = map.GetPtr(keys[0]);
+      ASSERT_TRUE(map.Erase(keys[0]));
+      ASSERT_EQ(first, map.GetPtr(keys[999]));
+      ASSERT_EQ(0, map.GetIndexByKey(keys[999]));
+      ASSERT_EQ(keys[999], map.GetKeyByIndex(0));
+
+      for (size_t i = 1; i < keys.size(); i += 2)
+      {
+         ASSERT_TRUE(map.Erase(keys[i]));
+      }
+      ASSERT_TRUE(TestValueType::CheckLiveInstances(map.Size()));
+
+      // The elements are contiguous and in the order of their indices.
+      size_t index = 0;
+      map.ForEach([&](KeyType key, const TestValueType& value)
+      {
+         ASSERT_EQ(index, map.GetIndexByKey(key));
+         ASSERT_EQ(first + index, &value);
+         ++index;
+      });
+      ASSERT_EQ(map.Size(), index);
+
+      for (size_t i = 1; i < keys.size(); ++i)
+      {
+         const TestValueType* ptr = map.GetPtr(keys[i]);
+         if ((i % 2) == 1)
+         {
+            ASSERT_EQ(nullptr, ptr);
+         }
+         else
+         {
+            ASSERT_NE(nullptr, ptr);
+            ASSERT_EQ(static_cast<int>(i), *ptr);
+         }
+      }
+
+      // The last freed slot is reused with a new generation.
+      const KeyType key = map.Emplace(-1);
+      ASSERT_EQ(keys[999] & MapType::StorageType::SlotIndexMask, key & MapType::StorageType::SlotIndexMask);
+      ASSERT_NE(keys[999], key);
+      ASSERT_EQ(nullptr, map.GetPtr(keys[999]));
+
+      map.ShrinkToFit();
+      ASSERT_EQ(map.Size(), map.Capacity());
+   }
+   ASSERT_TRUE(TestValueType::CheckLiveInstances(0));
+}
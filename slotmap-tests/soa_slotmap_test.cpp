@@ -0,0 +1,220 @@
+// Copyright (c) 2024, Jan Milik (jan.milik@gmail.com) - All rights reserved.
+
+#include "test_common.h"
+
+#include <slotmap/soa_slotmap.h>
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+
+using namespace slotmap;
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(SoaSlotMapTest, EmplaceGetErase)
+{
+   using MapType = SoaSlotMap<int, float, std::string>;
+   using KeyType = MapType::KeyType;
+   constexpr size_t Count = MapType::ChunkSlots * 3 + 5;
+
+   MapType map;
+   std::vector<KeyType> keys;
+   for (size_t i = 0; i < Count; ++i)
+   {
+      keys.push_back(map.Emplace(static_cast<int>(i), static_cast<float>(i) * 0.5f, std::to_string(i)));
+      ASSERT_NE(MapType::InvalidKey, keys.back());
+   }
+   ASSERT_EQ(Count, map.Size());
+
+   for (size_t i = 0; i < Count; ++i)
+   {
+      ASSERT_EQ(static_cast<int>(i), *map.GetPtr<0>(keys[i]));
+      ASSERT_EQ(static_cast<float>(i) * 0.5f, *map.GetPtr<1>(keys[i]));
+      ASSERT_EQ(std::to_string(i), *map.GetPtr<2>(keys[i]));
+   }
+
+   for (size_t i = 0; i < Count; i += 2)
+   {
+      ASSERT_TRUE(map.Erase(keys[i]));
+      ASSERT_FALSE(map.Erase(keys[i]));
+      ASSERT_EQ(nullptr, map.GetPtr<0>(keys[i]));
+      ASSERT_EQ(nullptr, map.GetPtr<2>(keys[i]));
+   }
+   ASSERT_EQ(Count / 2, map.Size());
+
+   // The freed slots are reused with a new generation, the old keys stay
+   // invalid.
+   for (size_t i = 0; i < Count; i += 2)
+   {
+      const KeyType key = map.Emplace();
+      ASSERT_NE(MapType::InvalidKey, key);
+      ASSERT_EQ(0, *map.GetPtr<0>(key));
+      ASSERT_TRUE(map.GetPtr<2>(key)->empty());
+   }
+   for (size_t i = 0; i < Count; ++i)
+   {
+      if ((i % 2) == 0)
+      {
+         ASSERT_EQ(nullptr, map.GetPtr<1>(keys[i]));
+      }
+      else
+      {
+         ASSERT_EQ(std::to_string(i), *map.GetPtr<2>(keys[i]));
+      }
+   }
+   ASSERT_EQ(Count, map.Size());
+
+   map.Clear();
+   ASSERT_EQ(0, map.Size());
+   for (const KeyType key : keys)
+   {
+      ASSERT_EQ(nullptr, map.GetPtr<0>(key));
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(SoaSlotMapTest, ForEachFields)
+{
+   using MapType = SoaSlotMap<int, double, char>;
+   using KeyType = MapType::KeyType;
+
+   MapType map;
+   std::vector<KeyType> keys;
+   for (int i = 0; i < 1000; ++i)
+   {
+      keys.push_back(map.Emplace(i, i * 2.0, static_cast<char>(i)));
+   }
+   for (size_t i = 0; i < keys.size(); i += 3)
+   {
+      map.Erase(keys[i]);
+   }
+
+   size_t count = 0;
+   map.ForEach([&](KeyType key, int& a, double& b, char& c)
+   {
+      ASSERT_EQ(&a, map.GetPtr<0>(key));
+      ASSERT_EQ(a * 2.0, b);
+      ASSERT_EQ(static_cast<char>(a), c);
+      ++count;
+   });
+   ASSERT_EQ(map.Size(), count);
+
+   // Only the selected fields, in the given order.
+   count = 0;
+   const MapType& constMap = map;
+   constMap.ForEach<1, 0>([&](KeyType key, const double& b, const int& a)
+   {
+      ASSERT_EQ(&b, constMap.GetPtr<1>(key));
+      ASSERT_EQ(a * 2.0, b);
+      ++count;
+   });
+   ASSERT_EQ(map.Size(), count);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(SoaSlotMapTest, ChunkSpans)
+{
+   using MapType = SoaSlotMap<float, float, uint32_t>;
+   using KeyType = MapType::KeyType;
+
+   MapType map;
+   std::vector<KeyType> keys;
+   for (int i = 0; i < 5000; ++i)
+   {
+      keys.push_back(map.Emplace(static_cast<float>(i), 1.0f, 0u));
+   }
+   for (size_t i = 0; i < keys.size(); i += 7)
+   {
+      map.Erase(keys[i]);
+   }
+
+   // Process whole arrays, including the slots that aren't live.
+   map.ForEachChunk([](MapType::ChunkSpan span)
+   {
+      float* const positions = span.GetField<0>();
+      const float* const velocities = span.GetField<1>();
+      for (size_t i = 0; i < span.GetSlotCount(); ++i)
+      {
+         positions[i] += velocities[i] * 2.0f;
+      }
+   });
+
+   size_t liveCount = 0;
+   const MapType& constMap = map;
+   constMap.ForEachChunk([&](MapType::ConstChunkSpan span)
+   {
+      ASSERT_LT(span.GetChunkIndex(), constMap.ChunkCount());
+      for (size_t i = 0; i < span.GetSlotCount(); ++i)
+      {
+         if (span.IsLive(i))
+         {
+            ASSERT_EQ(span.GetField<0>() + i, constMap.GetPtr<0>(span.GetKey(i)));
+            ++liveCount;
+         }
+      }
+   });
+   ASSERT_EQ(map.Size(), liveCount);
+
+   for (size_t i = 0; i < keys.size(); ++i)
+   {
+      if ((i % 7) != 0)
+      {
+         ASSERT_EQ(static_cast<float>(i) + 2.0f, *map.GetPtr<0>(keys[i]));
+      }
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+TEST(SoaSlotMapTest, CopyAndMove)
+{
+   using MapType = SoaSlotMap<TestValueType, int>;
+   using KeyType = MapType::KeyType;
+
+   TestValueType::ResetCounters();
+   {
+      MapType map;
+      std::vector<KeyType> keys;
+      for (int i = 0; i < 1000; ++i)
+      {
+         keys.push_back(map.Emplace(TestValueType(i), -i));
+      }
+      for (size_t i = 0; i < keys.size(); i += 2)
+      {
+         map.Erase(keys[i]);
+      }
+      ASSERT_TRUE(TestValueType::CheckLiveInstances(500));
+
+      MapType copy(map);
+      ASSERT_TRUE(TestValueType::CheckLiveInstances(1000));
+      ASSERT_EQ(map.Size(), copy.Size());
+
+      MapType moved(std::move(map));
+      ASSERT_EQ(0, map.Size());
+      ASSERT_TRUE(TestValueType::CheckLiveInstances(1000));
+
+      for (size_t i = 0; i < keys.size(); ++i)
+      {
+         ASSERT_EQ(nullptr, map.GetPtr<0>(keys[i]));
+         if ((i % 2) == 0)
+         {
+            ASSERT_EQ(nullptr, copy.GetPtr<0>(keys[i]));
+            ASSERT_EQ(nullptr, moved.GetPtr<1>(keys[i]));
+         }
+         else
+         {
+            ASSERT_EQ(static_cast<int>(i), *copy.GetPtr<0>(keys[i]));
+            ASSERT_EQ(-static_cast<int>(i), *moved.GetPtr<1>(keys[i]));
+         }
+      }
+
+      copy = std::move(moved);
+      ASSERT_TRUE(TestValueType::CheckLiveInstances(500));
+   }
+   ASSERT_TRUE(TestValueType::CheckLiveInstances(0));
+}
@@ -1,17 +1,32 @@
 // Copyright (c) 2024, Jan Milik (jan.milik@gmail.com) - All rights reserved.
 
 #pragma once
+#include <algorithm>
 #include <bitset>
 #include <cassert>
 #include <climits>
 #include <cstdint>
 #include <cstring>
+#include <atomic>
+#include <limits>
 #include <type_traits>
 
 #ifdef _MSC_VER
 #include <intrin.h>
 #endif
 
+/**
+ * Runtime-dispatched SIMD kernels for iteration over set bits are available
+ * when compiling with GCC or Clang for x86. Define `SLOTMAP_DISABLE_SIMD` to
+ * always use the scalar implementation.
+ */
+#if !defined(SLOTMAP_DISABLE_SIMD) && (defined(__GNUC__) || defined(__clang__)) && (defined(__x86_64__) || defined(__i386__))
+#define SLOTMAP_SIMD_DISPATCH 1
+#include <immintrin.h>
+#else
+#define SLOTMAP_SIMD_DISPATCH 0
+#endif
+
 
 namespace slotmap {
 
@@ -45,6 +60,339 @@ inline int CountTrailingZeros(T x)
 }
 
 
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Counts the number of leading zeros in a non-zero unsigned integer.
+ *
+ * The result for zero is undefined.
+ */
+template<typename T, std::enable_if_t<std::is_unsigned_v<T>, int> = 0>
+inline int CountLeadingZeros(T x)
+{
+   constexpr int Digits = std::numeric_limits<T>::digits;
+#ifdef _MSC_VER
+   static_assert(sizeof(T) <= sizeof(uint64_t), "Unsupported integer type.");
+   unsigned long r;
+   if constexpr(sizeof(T) <= sizeof(unsigned long))
+   {
+      _BitScanReverse(&r, x);
+      return static_cast<int>(Digits - 1 - r);
+   }
+   else
+   {
+      _BitScanReverse64(&r, x);
+      return static_cast<int>(Digits - 1 - r);
+   }
+#else
+   static_assert(sizeof(T) <= sizeof(unsigned long long), "Unsupported integer type.");
+   if constexpr(sizeof(T) <= sizeof(unsigned int))
+      return __builtin_clz(x) - (std::numeric_limits<unsigned int>::digits - Digits);
+   else if constexpr(sizeof(T) <= sizeof(unsigned long))
+      return __builtin_clzl(x) - (std::numeric_limits<unsigned long>::digits - Digits);
+   else
+      return __builtin_clzll(x) - (std::numeric_limits<unsigned long long>::digits - Digits);
+#endif
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Counts the number of bits set in an unsigned integer.
+ */
+template<typename T, std::enable_if_t<std::is_unsigned_v<T>, int> = 0>
+inline int PopCount(T x)
+{
+#ifdef _MSC_VER
+   // `__popcnt` requires a CPU with POPCNT support, `std::bitset::count` is
+   // always available and compiles to the same instruction when possible.
+   return static_cast<int>(std::bitset<std::numeric_limits<T>::digits>(x).count());
+#else
+   static_assert(sizeof(T) <= sizeof(unsigned long long), "Unsupported integer type.");
+   if constexpr(sizeof(T) <= sizeof(unsigned int))
+      return __builtin_popcount(x);
+   else if constexpr(sizeof(T) <= sizeof(unsigned long))
+      return __builtin_popcountl(x);
+   else
+      return __builtin_popcountll(x);
+#endif
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Instruction set used by the bitset iteration kernels.
+ */
+enum class SimdLevel
+{
+   Scalar = 0,
+   Sse42,
+   Avx2,
+   Avx512,
+};
+
+
+namespace impl {
+
+
+inline SimdLevel DetectSimdLevel()
+{
+#if SLOTMAP_SIMD_DISPATCH
+   __builtin_cpu_init();
+   if (__builtin_cpu_supports("avx512f"))
+   {
+      return SimdLevel::Avx512;
+   }
+   if (__builtin_cpu_supports("avx2"))
+   {
+      return SimdLevel::Avx2;
+   }
+   if (__builtin_cpu_supports("sse4.2"))
+   {
+      return SimdLevel::Sse42;
+   }
+#endif
+   return SimdLevel::Scalar;
+}
+
+
+inline std::atomic<SimdLevel>& ActiveSimdLevel()
+{
+   static std::atomic<SimdLevel> level{ DetectSimdLevel() };
+   return level;
+}
+
+
+} // namespace impl
+
+
+/**
+ * Returns the instruction set currently used by `ForEachSetBit()`.
+ */
+inline SimdLevel GetSimdLevel()
+{
+   return impl::ActiveSimdLevel().load(std::memory_order_relaxed);
+}
+
+
+/**
+ * Limits the instruction set used by `ForEachSetBit()` to at most `maxLevel`
+ * (and to what the CPU supports). Returns the level that is actually used.
+ *
+ * Mostly useful for testing and benchmarking the individual kernels.
+ */
+inline SimdLevel SetMaxSimdLevel(SimdLevel maxLevel)
+{
+   const SimdLevel detected = impl::DetectSimdLevel();
+   const SimdLevel level = (maxLevel < detected) ? maxLevel : detected;
+   impl::ActiveSimdLevel().store(level, std::memory_order_relaxed);
+   return level;
+}
+
+
+namespace impl {
+
+
+/**
+ * Calls `func` for every set bit in words `[firstWord, lastWord)` one word at
+ * a time.
+ */
+template<typename TWord, typename TFunc>
+inline void ForEachSetBitScalar(const TWord* words, size_t firstWord, size_t lastWord, TFunc& func)
+{
+   constexpr size_t BitsPerWord = sizeof(TWord) * CHAR_BIT;
+
+   for (size_t wordIndex = firstWord; wordIndex < lastWord; ++wordIndex)
+   {
+      TWord word = words[wordIndex];
+      while (word != static_cast<TWord>(0))
+      {
+         const size_t bitIndex = CountTrailingZeros(word);
+         func(wordIndex * BitsPerWord + bitIndex);
+         word &= ~(static_cast<TWord>(1u) << bitIndex);
+      }
+   }
+}
+
+
+#if SLOTMAP_SIMD_DISPATCH
+
+template<typename TFunc>
+inline void ForEachSetBitInWord(uint64_t word, size_t base, TFunc& func)
+{
+   while (word != 0)
+   {
+      func(base + static_cast<size_t>(CountTrailingZeros(word)));
+      word &= word - 1;
+   }
+}
+
+
+/**
+ * The SIMD kernels test a whole block of words (128, 256 or 512 bits) for
+ * zero with a single instruction and then only decode the non-zero words of
+ * the block. Decoding the set bits into an index buffer first and invoking the
+ * functor afterwards was measured to be slower for dense bitsets, so the
+ * functor is invoked directly while decoding each word.
+ */
+template<typename TFunc>
+__attribute__((target("sse4.2")))
+void ForEachSetBitSse42(const uint64_t* words, size_t firstWord, size_t lastWord, TFunc& func)
+{
+   size_t wordIndex = firstWord;
+   // Counting the words left keeps the tail provably shorter than a block.
+   size_t wordCount = lastWord - firstWord;
+
+   for (; wordCount >= 2; wordIndex += 2, wordCount -= 2)
+   {
+      const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(words + wordIndex));
+      if (_mm_testz_si128(block, block))
+      {
+         continue;
+      }
+
+      ForEachSetBitInWord(words[wordIndex], wordIndex * 64, func);
+      ForEachSetBitInWord(words[wordIndex + 1], (wordIndex + 1) * 64, func);
+   }
+
+   ForEachSetBitScalar(words, wordIndex, wordIndex + wordCount, func);
+}
+
+
+template<typename TFunc>
+__attribute__((target("avx2")))
+void ForEachSetBitAvx2(const uint64_t* words, size_t firstWord, size_t lastWord, TFunc& func)
+{
+   size_t wordIndex = firstWord;
+   size_t wordCount = lastWord - firstWord;
+   const __m256i zero = _mm256_setzero_si256();
+
+   for (; wordCount >= 4; wordIndex += 4, wordCount -= 4)
+   {
+      const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(words + wordIndex));
+      const int zeroLanes = _mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpeq_epi64(block, zero)));
+      unsigned nonZeroLanes = ~static_cast<unsigned>(zeroLanes) & 0xFu;
+      if (nonZeroLanes == 0)
+      {
+         continue;
+      }
+
+      while (nonZeroLanes != 0)
+      {
+         const size_t lane = static_cast<size_t>(CountTrailingZeros(nonZeroLanes));
+         ForEachSetBitInWord(words[wordIndex + lane], (wordIndex + lane) * 64, func);
+         nonZeroLanes &= nonZeroLanes - 1;
+      }
+   }
+
+   ForEachSetBitScalar(words, wordIndex, wordIndex + wordCount, func);
+}
+
+
+template<typename TFunc>
+__attribute__((target("avx512f")))
+void ForEachSetBitAvx512(const uint64_t* words, size_t firstWord, size_t lastWord, TFunc& func)
+{
+   size_t wordIndex = firstWord;
+   size_t wordCount = lastWord - firstWord;
+
+   for (; wordCount >= 8; wordIndex += 8, wordCount -= 8)
+   {
+      const __m512i block = _mm512_loadu_si512(words + wordIndex);
+      unsigned nonZeroLanes = static_cast<unsigned>(_mm512_test_epi64_mask(block, block));
+      if (nonZeroLanes == 0)
+      {
+         continue;
+      }
+
+      while (nonZeroLanes != 0)
+      {
+         const size_t lane = static_cast<size_t>(CountTrailingZeros(nonZeroLanes));
+         ForEachSetBitInWord(words[wordIndex + lane], (wordIndex + lane) * 64, func);
+         nonZeroLanes &= nonZeroLanes - 1;
+      }
+   }
+
+   ForEachSetBitScalar(words, wordIndex, wordIndex + wordCount, func);
+}
+
+#endif // SLOTMAP_SIMD_DISPATCH
+
+
+/**
+ * Calls `func` for every set bit in words `[firstWord, lastWord)` using the
+ * best kernel available.
+ */
+template<typename TWord, typename TFunc>
+inline void ForEachSetBitInWords(const TWord* words, size_t firstWord, size_t lastWord, TFunc& func)
+{
+#if SLOTMAP_SIMD_DISPATCH
+   if constexpr (std::is_same_v<TWord, uint64_t>)
+   {
+      if (lastWord - firstWord >= 2)
+      {
+         switch (GetSimdLevel())
+         {
+         case SimdLevel::Avx512:
+            ForEachSetBitAvx512(words, firstWord, lastWord, func);
+            return;
+         case SimdLevel::Avx2:
+            ForEachSetBitAvx2(words, firstWord, lastWord, func);
+            return;
+         case SimdLevel::Sse42:
+            ForEachSetBitSse42(words, firstWord, lastWord, func);
+            return;
+         default:
+            break;
+         }
+      }
+   }
+#endif
+
+   ForEachSetBitScalar(words, firstWord, lastWord, func);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Sets bits `[from, to)` of a word array, filling whole words at once.
+ * Taking the array by reference lets the compiler see that the words stay
+ * in bounds.
+ */
+template<typename TWord, size_t TNumWords>
+inline void SetWordRange(TWord (&words)[TNumWords], size_t from, size_t to)
+{
+   constexpr size_t BitsPerWord = sizeof(TWord) * CHAR_BIT;
+   constexpr TWord AllOnes = ~static_cast<TWord>(0);
+
+   if (from >= to)
+   {
+      return;
+   }
+
+   const size_t firstWord = from / BitsPerWord;
+   assert(to <= TNumWords * BitsPerWord);
+   const size_t lastWord = std::min((to - 1) / BitsPerWord, TNumWords - 1);
+   const TWord firstMask = AllOnes << (from % BitsPerWord);
+   const TWord lastMask = AllOnes >> (BitsPerWord - 1 - ((to - 1) % BitsPerWord));
+
+   if (firstWord == lastWord)
+   {
+      words[firstWord] |= firstMask & lastMask;
+      return;
+   }
+
+   words[firstWord] |= firstMask;
+   for (size_t wordIndex = firstWord + 1; wordIndex < lastWord; ++wordIndex)
+   {
+      words[wordIndex] = AllOnes;
+   }
+   words[lastWord] |= lastMask;
+}
+
+
+} // namespace impl
+
+
 //////////////////////////////////////////////////////////////////////////
 /**
  * This is a fixed bitset implementation very similar to `std::bitset`, but
@@ -86,6 +434,10 @@ public:
    void Set(size_t index);
    void Unset(size_t index);
    void Set(size_t index, bool value);
+   /**
+    * Sets all the bits in `[from, to)` a word at a time.
+    */
+   void SetRange(size_t from, size_t to);
    void Flip(size_t index);
    void Flip();
 
@@ -96,6 +448,8 @@ public:
 
    template<typename TFunc>
    void ForEachSetBit(size_t from, size_t to, TFunc func) const;
+
+   size_t Count() const;
    
    void Clear();
 
@@ -107,6 +461,93 @@ public:
    inline bool test(size_t index) const { return Get(index); }
    // STL Capacity
    inline size_t size() const { return StaticSize; }
+   inline size_t count() const { return Count(); }
+   // STL Modifiers
+   inline void set(size_t index) { Set(index); }
+   inline void reset(size_t index) { Unset(index); }
+   inline void reset() { Clear(); }
+   inline void flip(size_t index) { Flip(index); }
+   inline void flip() { Flip(); }
+
+private:
+   TWord m_words[NumWords];
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Fixed bitset with a summary bitset on top of it that keeps track of which
+ * words of the bitset contain at least one set bit.
+ *
+ * The summary is itself a `HierarchicalBitset` as long as it has more than one
+ * word worth of bits, so the number of levels grows logarithmically with the
+ * size of the bitset. Iteration over set bits skips empty words using the
+ * summary, so its time complexity is proportional to the number of set bits
+ * rather than to the size of the bitset. This makes it a good fit for large,
+ * sparsely populated storages (e.g. \ref FixedSlotMapStorage with high
+ * capacity). The price is an extra write to the summary whenever a word
+ * changes from empty to non-empty or back.
+ *
+ * The interface is the same as the interface of \ref FixedBitset.
+ */
+template<size_t TSize, typename TWord = uintptr_t>
+class HierarchicalBitset
+{
+public:
+   static_assert(std::is_unsigned_v<TWord>, "The word type must be an unsigned integer type.");
+
+   using WordType = TWord;
+
+   static constexpr size_t StaticSize = TSize;
+   static constexpr size_t BitsPerWord = sizeof(TWord) * CHAR_BIT;
+   static constexpr size_t NumWords = (StaticSize + BitsPerWord - 1) / BitsPerWord;
+   static constexpr size_t BitIndexMask = BitsPerWord - 1;
+
+   using SummaryType = std::conditional_t<
+      (NumWords <= BitsPerWord),
+      FixedBitset<NumWords, TWord>,
+      HierarchicalBitset<NumWords, TWord>>;
+
+   HierarchicalBitset();
+
+   inline bool operator[](size_t index) const { return Get(index); }
+
+   inline WordType* Data() { return m_words; }
+   inline const WordType* Data() const { return m_words; }
+   inline const SummaryType& Summary() const { return m_summary; }
+
+   constexpr bool Get(size_t index) const;
+   void Set(size_t index);
+   void Unset(size_t index);
+   void Set(size_t index, bool value);
+   /**
+    * Sets all the bits in `[from, to)` a word at a time.
+    */
+   void SetRange(size_t from, size_t to);
+   void Flip(size_t index);
+   void Flip();
+
+   inline size_t FindNextBitSet(size_t start) const;
+
+   template<typename TFunc>
+   void ForEachSetBit(TFunc func) const;
+
+   template<typename TFunc>
+   void ForEachSetBit(size_t from, size_t to, TFunc func) const;
+
+   size_t Count() const;
+
+   void Clear();
+
+   static constexpr size_t GetWordIndex(size_t index) { return index / BitsPerWord; }
+   static constexpr size_t GetBitIndex(size_t index) { return index & BitIndexMask; }
+
+   // STL-compatibility functions
+   // STL Element access
+   inline bool test(size_t index) const { return Get(index); }
+   // STL Capacity
+   inline size_t size() const { return StaticSize; }
+   inline size_t count() const { return Count(); }
    // STL Modifiers
    inline void set(size_t index) { Set(index); }
    inline void reset(size_t index) { Unset(index); }
@@ -115,6 +556,7 @@ public:
    inline void flip() { Flip(); }
 
 private:
+   SummaryType m_summary;
    TWord m_words[NumWords];
 };
 
@@ -143,9 +585,61 @@ struct FixedBitSetTraits
    {
       bitset.ForEachSetBit(from, to, func);
    }
+
+   template<size_t TSize>
+   static inline size_t Count(const BitsetType<TSize>& bitset)
+   {
+      return bitset.Count();
+   }
+
+   template<size_t TSize>
+   static inline void SetRange(BitsetType<TSize>& bitset, size_t from, size_t to)
+   {
+      bitset.SetRange(from, to);
+   }
 };
 
 
+//////////////////////////////////////////////////////////////////////////
+template<typename TWord = uintptr_t>
+struct HierarchicalBitSetTraits
+{
+   template<size_t TSize>
+   using BitsetType = HierarchicalBitset<TSize, TWord>;
+   
+   template<size_t TSize>
+   static inline size_t FindNextBitSet(const BitsetType<TSize>& bitset, size_t start)
+   {
+      return bitset.FindNextBitSet(start);
+   }
+
+   template<size_t TSize, typename TFunc>
+   static inline void ForEachSetBit(const BitsetType<TSize>& bitset, TFunc func)
+   {
+      bitset.ForEachSetBit(func);
+   }
+
+   template<size_t TSize, typename TFunc>
+   static inline void ForEachSetBit(size_t from, size_t to, const BitsetType<TSize>& bitset, TFunc func)
+   {
+      bitset.ForEachSetBit(from, to, func);
+   }
+
+   template<size_t TSize>
+   static inline size_t Count(const BitsetType<TSize>& bitset)
+   {
+      return bitset.Count();
+   }
+
+   template<size_t TSize>
+   static inline void SetRange(BitsetType<TSize>& bitset, size_t from, size_t to)
+   {
+      bitset.SetRange(from, to);
+   }
+};
+
+
+//////////////////////////////////////////////////////////////////////////
 struct StdBitSetTraits
 {
    template<size_t TSize>
@@ -187,6 +681,21 @@ struct StdBitSetTraits
          }
       }
    }
+
+   template<size_t TSize>
+   static inline size_t Count(const BitsetType<TSize>& bitset)
+   {
+      return bitset.count();
+   }
+
+   template<size_t TSize>
+   static inline void SetRange(BitsetType<TSize>& bitset, size_t from, size_t to)
+   {
+      for (size_t i = from; i < to; ++i)
+      {
+         bitset.set(i);
+      }
+   }
 };
 
 
@@ -212,6 +721,14 @@ FixedBitset<TSize, TWord>::FixedBitset(FixedBitset&& other)
 }
 
 
+template<size_t TSize, typename TWord>
+FixedBitset<TSize, TWord>& FixedBitset<TSize, TWord>::operator=(const FixedBitset& other)
+{
+   memcpy(m_words, other.m_words, sizeof(m_words));
+   return *this;
+}
+
+
 template<size_t TSize, typename TWord>
 FixedBitset<TSize, TWord>& FixedBitset<TSize, TWord>::operator=(FixedBitset&& other)
 {
@@ -238,6 +755,14 @@ void FixedBitset<TSize, TWord>::Set(size_t index)
 }
 
 
+template<size_t TSize, typename TWord>
+void FixedBitset<TSize, TWord>::SetRange(size_t from, size_t to)
+{
+   assert(from <= to && to <= StaticSize);
+   impl::SetWordRange(m_words, from, to);
+}
+
+
 template<size_t TSize, typename TWord>
 void FixedBitset<TSize, TWord>::Unset(size_t index)
 {
@@ -315,16 +840,7 @@ template<size_t TSize, typename TWord>
 template<typename TFunc>
 void FixedBitset<TSize, TWord>::ForEachSetBit(TFunc func) const
 {
-   for (size_t wordIndex = 0; wordIndex < NumWords; ++wordIndex)
-   {
-      TWord word = m_words[wordIndex];
-      while (word != static_cast<TWord>(0))
-      {
-         const size_t bitIndex = CountTrailingZeros(word);
-         func(wordIndex * BitsPerWord + bitIndex);
-         word &= ~(static_cast<TWord>(1u) << bitIndex);
-      }
-   }
+   impl::ForEachSetBitInWords(m_words, 0, NumWords, func);
 }
 
 
@@ -366,17 +882,21 @@ void FixedBitset<TSize, TWord>::ForEachSetBit(size_t from, size_t to, TFunc func
          word &= ~(static_cast<TWord>(1u) << bitIndex);
       }
       
-      for (size_t wordIndex = fromWordIndex + 1; wordIndex < toWordIndex; ++wordIndex)
+      // Limiting the words to `NumWords` lets the compiler see that the
+      // visited indices stay below the size, with a single word there are no
+      // words in between at all.
+      if constexpr (NumWords > 1)
       {
-         word = m_words[wordIndex];
-         while (word != static_cast<TWord>(0))
-         {
-            const size_t bitIndex = CountTrailingZeros(word);
-            func(wordIndex * BitsPerWord + bitIndex);
-            word &= ~(static_cast<TWord>(1u) << bitIndex);
-         }
+         impl::ForEachSetBitInWords(m_words, fromWordIndex + 1, std::min(toWordIndex, NumWords), func);
       }
       
+      if ((toBitIndex == 0) || (toWordIndex >= NumWords))
+      {
+         // The range ends at a word boundary, there is nothing left to visit
+         // (and `toWordIndex` may be past the last word).
+         return;
+      }
+
       word = m_words[toWordIndex];
       while (word != static_cast<TWord>(0))
       {
@@ -392,6 +912,18 @@ void FixedBitset<TSize, TWord>::ForEachSetBit(size_t from, size_t to, TFunc func
 }
 
 
+template<size_t TSize, typename TWord>
+size_t FixedBitset<TSize, TWord>::Count() const
+{
+   size_t count = 0;
+   for (size_t wordIndex = 0; wordIndex < NumWords; ++wordIndex)
+   {
+      count += PopCount(m_words[wordIndex]);
+   }
+   return count;
+}
+
+
 template<size_t TSize, typename TWord>
 void FixedBitset<TSize, TWord>::Clear()
 {
@@ -399,5 +931,206 @@ void FixedBitset<TSize, TWord>::Clear()
 }
 
 
+//////////////////////////////////////////////////////////////////////////
+template<size_t TSize, typename TWord>
+HierarchicalBitset<TSize, TWord>::HierarchicalBitset()
+{
+   memset(m_words, 0, sizeof(m_words));
+}
+
+
+template<size_t TSize, typename TWord>
+constexpr bool HierarchicalBitset<TSize, TWord>::Get(size_t index) const
+{
+   const size_t wordIndex = index / BitsPerWord;
+   assert(wordIndex < NumWords);
+   return (m_words[wordIndex] & (static_cast<TWord>(1u) << (index & BitIndexMask))) != 0;
+}
+
+
+template<size_t TSize, typename TWord>
+void HierarchicalBitset<TSize, TWord>::Set(size_t index)
+{
+   const size_t wordIndex = index / BitsPerWord;
+   assert(wordIndex < NumWords);
+   if (m_words[wordIndex] == static_cast<TWord>(0))
+   {
+      m_summary.Set(wordIndex);
+   }
+   m_words[wordIndex] |= (static_cast<TWord>(1u) << (index & BitIndexMask));
+}
+
+
+template<size_t TSize, typename TWord>
+void HierarchicalBitset<TSize, TWord>::SetRange(size_t from, size_t to)
+{
+   assert(from <= to && to <= StaticSize);
+   if (from < to)
+   {
+      impl::SetWordRange(m_words, from, to);
+      m_summary.SetRange(from / BitsPerWord, (to - 1) / BitsPerWord + 1);
+   }
+}
+
+
+template<size_t TSize, typename TWord>
+void HierarchicalBitset<TSize, TWord>::Unset(size_t index)
+{
+   const size_t wordIndex = index / BitsPerWord;
+   assert(wordIndex < NumWords);
+   m_words[wordIndex] &= ~(static_cast<TWord>(1u) << (index & BitIndexMask));
+   if (m_words[wordIndex] == static_cast<TWord>(0))
+   {
+      m_summary.Unset(wordIndex);
+   }
+}
+
+
+template<size_t TSize, typename TWord>
+void HierarchicalBitset<TSize, TWord>::Set(size_t index, bool value)
+{
+   if (value)
+   {
+      Set(index);
+   }
+   else
+   {
+      Unset(index);
+   }
+}
+
+
+template<size_t TSize, typename TWord>
+void HierarchicalBitset<TSize, TWord>::Flip(size_t index)
+{
+   const size_t wordIndex = index / BitsPerWord;
+   assert(wordIndex < NumWords);
+   m_words[wordIndex] ^= (static_cast<TWord>(1u) << (index & BitIndexMask));
+   m_summary.Set(wordIndex, m_words[wordIndex] != static_cast<TWord>(0));
+}
+
+
+template<size_t TSize, typename TWord>
+void HierarchicalBitset<TSize, TWord>::Flip()
+{
+   for (size_t i = 0; i < NumWords; ++i)
+   {
+      m_words[i] = ~m_words[i];
+      m_summary.Set(i, m_words[i] != static_cast<TWord>(0));
+   }
+}
+
+
+template<size_t TSize, typename TWord>
+size_t HierarchicalBitset<TSize, TWord>::FindNextBitSet(size_t start) const
+{
+   if (start >= StaticSize)
+   {
+      return StaticSize;
+   }
+
+   const size_t wordIndex = GetWordIndex(start);
+
+   const TWord word = m_words[wordIndex] >> GetBitIndex(start);
+
+   if (word != static_cast<TWord>(0))
+   {
+      const size_t bitIndex = CountTrailingZeros(word);
+      return start + bitIndex;
+   }
+
+   if (wordIndex + 1 >= NumWords)
+   {
+      return StaticSize;
+   }
+
+   const size_t nextWordIndex = m_summary.FindNextBitSet(wordIndex + 1);
+   if (nextWordIndex >= NumWords)
+   {
+      return StaticSize;
+   }
+
+   assert(m_words[nextWordIndex] != static_cast<TWord>(0));
+   return nextWordIndex * BitsPerWord + CountTrailingZeros(m_words[nextWordIndex]);
+}
+
+
+template<size_t TSize, typename TWord>
+template<typename TFunc>
+void HierarchicalBitset<TSize, TWord>::ForEachSetBit(TFunc func) const
+{
+   m_summary.ForEachSetBit([&](size_t wordIndex)
+   {
+      TWord word = m_words[wordIndex];
+      while (word != static_cast<TWord>(0))
+      {
+         const size_t bitIndex = CountTrailingZeros(word);
+         func(wordIndex * BitsPerWord + bitIndex);
+         word &= ~(static_cast<TWord>(1u) << bitIndex);
+      }
+   });
+}
+
+
+template<size_t TSize, typename TWord>
+template<typename TFunc>
+void HierarchicalBitset<TSize, TWord>::ForEachSetBit(size_t from, size_t to, TFunc func) const
+{
+   if (to > StaticSize)
+   {
+      to = StaticSize;
+   }
+   
+   if (from >= to)
+   {
+      return;
+   }
+
+   const size_t fromWordIndex = from / BitsPerWord;
+   const size_t lastWordIndex = (to - 1) / BitsPerWord;
+   const TWord fromMask = ~static_cast<TWord>(0) << (from & BitIndexMask);
+   const TWord lastMask = ~static_cast<TWord>(0) >> (BitsPerWord - 1 - ((to - 1) & BitIndexMask));
+
+   m_summary.ForEachSetBit(fromWordIndex, lastWordIndex + 1, [&](size_t wordIndex)
+   {
+      TWord word = m_words[wordIndex];
+      if (wordIndex == fromWordIndex)
+      {
+         word &= fromMask;
+      }
+      if (wordIndex == lastWordIndex)
+      {
+         word &= lastMask;
+      }
+      while (word != static_cast<TWord>(0))
+      {
+         const size_t bitIndex = CountTrailingZeros(word);
+         func(wordIndex * BitsPerWord + bitIndex);
+         word &= ~(static_cast<TWord>(1u) << bitIndex);
+      }
+   });
+}
+
+
+template<size_t TSize, typename TWord>
+size_t HierarchicalBitset<TSize, TWord>::Count() const
+{
+   size_t count = 0;
+   m_summary.ForEachSetBit([&](size_t wordIndex)
+   {
+      count += PopCount(m_words[wordIndex]);
+   });
+   return count;
+}
+
+
+template<size_t TSize, typename TWord>
+void HierarchicalBitset<TSize, TWord>::Clear()
+{
+   memset(m_words, 0, sizeof(m_words));
+   m_summary.Clear();
+}
+
+
 } // namespace slotmap
 
@@ -0,0 +1,490 @@
+// vim: et:ts=3:sw=3:sts=3
+// Copyright (c) 2024, Jan Milik (jan.milik@gmail.com).
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+
+#include "slotmap.h"
+
+
+namespace slotmap {
+
+
+namespace impl {
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Lock-free stack of indices linked through `next`.
+ *
+ * The head holds `index + 1` in the low 32 bits (0 meaning empty) and a
+ * modification counter in the high 32 bits, which protects the pop from the
+ * ABA problem. `next` is only read by a pop that is then validated by the
+ * head CAS, so it may hold a stale value without any harm.
+ */
+template<typename TNextFunc>
+inline uint32_t PopTaggedIndex(std::atomic<uint64_t>& head, TNextFunc next)
+{
+   uint64_t oldHead = head.load(std::memory_order_acquire);
+   for (;;)
+   {
+      const uint32_t top = static_cast<uint32_t>(oldHead);
+      if (top == 0)
+      {
+         return 0;
+      }
+
+      const uint64_t tag = (oldHead >> 32) + 1;
+      const uint64_t newHead = (tag << 32) | next(top - 1);
+      if (head.compare_exchange_weak(oldHead, newHead, std::memory_order_acquire, std::memory_order_acquire))
+      {
+         return top;
+      }
+   }
+}
+
+
+/**
+ * Pushes a chain of indices starting with `first` on a stack managed by
+ * \ref PopTaggedIndex(). `lastNext` is the link of the last index in the chain
+ * (the link of `first` when pushing a single index).
+ *
+ * The CAS is sequentially consistent because the chunk free list relies on
+ * it being ordered with the free-chunk flag (see
+ * \ref ConcurrentChunkedSlotMapStorage::EnqueueChunk()).
+ */
+inline void PushTaggedIndex(std::atomic<uint64_t>& head, std::atomic<uint32_t>& lastNext, uint32_t first)
+{
+   uint64_t oldHead = head.load(std::memory_order_relaxed);
+   for (;;)
+   {
+      lastNext.store(static_cast<uint32_t>(oldHead), std::memory_order_relaxed);
+
+      const uint64_t tag = (oldHead >> 32) + 1;
+      const uint64_t newHead = (tag << 32) | (static_cast<uint64_t>(first) + 1);
+      if (head.compare_exchange_weak(oldHead, newHead, std::memory_order_seq_cst, std::memory_order_relaxed))
+      {
+         return;
+      }
+   }
+}
+
+
+} // namespace impl
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Chunk of a \ref ConcurrentChunkedSlotMapStorage.
+ *
+ * All the bookkeeping is atomic, the slot storage itself is owned by whoever
+ * reserved the slot.
+ */
+template<size_t TSlotCount, typename TValue, typename TSlotState>
+struct ConcurrentChunkTpl
+{
+   struct Slot
+   {
+      alignas(TValue) uint8_t m_storage[sizeof(TValue)];
+
+      inline TValue* GetPtr() { return reinterpret_cast<TValue*>(m_storage); }
+      inline const TValue* GetPtr() const { return reinterpret_cast<const TValue*>(m_storage); }
+   };
+
+   static constexpr size_t LiveWordCount = (TSlotCount + 63) / 64;
+
+   std::atomic<uint64_t> m_freeSlotHead;
+   std::atomic<uint32_t> m_nextFreeChunk;
+   std::atomic<bool> m_isInFreeList;
+
+   std::atomic<uint64_t> m_liveBits[LiveWordCount];
+   std::atomic<TSlotState> m_slotStates[TSlotCount];
+   std::atomic<uint32_t> m_nextFreeSlot[TSlotCount];
+   Slot m_slots[TSlotCount];
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Dynamically allocated SlotMap storage that supports concurrent insertion,
+ * removal and lookup.
+ *
+ * The layout of keys is the same as in \ref ChunkedSlotMapStorage. The
+ * differences are:
+ *
+ * - Chunks are referenced from a segmented directory which only grows, so
+ *   a `Chunk*` never moves and readers never need to synchronize with a
+ *   writer that allocates a new chunk.
+ * - Each chunk has its own lock-free free list and the chunks with free slots
+ *   are kept in a lock-free stack.
+ * - The generation and liveness of a slot are a single atomic word, so
+ *   \ref GetPtr() is wait-free.
+ *
+ * `ReserveSlot()`, `CommitSlot()`, `FreeSlot()`, `GetPtr()`, `ForEachSlot()`
+ * and the key iteration functions can be called from any number of threads at
+ * the same time. The remaining functions (`Clear()`, `Swap()`, copying and
+ * moving) require exclusive access.
+ *
+ * The storage does not manage the lifetime of values beyond that: erasing an
+ * element while another thread still uses a pointer to it is a race in the
+ * calling code.
+ */
+template<
+   typename TValue,
+   typename TKey = uint32_t,
+   size_t MaxChunkSize = DefaultMaxChunkSize,
+   typename TAllocator = std::allocator<TValue>>
+class ConcurrentChunkedSlotMapStorage
+{
+public:
+   using ValueType = TValue;
+   using KeyType = TKey;
+   using GenerationType = uint8_t;
+   using SlotStateType = uint16_t;
+
+   using SizeType = size_t;
+   using IndexType = ptrdiff_t;
+
+   static_assert(std::is_unsigned_v<KeyType>, "Slotmap key type must be an unsigned integer type.");
+   static_assert(sizeof(KeyType) > sizeof(GenerationType), "The size of slotmap key type must be greater than the size of generation type.");
+
+   static constexpr KeyType InvalidKey = static_cast<KeyType>(0);
+
+   template<size_t TSlotCount>
+   using ChunkTplFor = ConcurrentChunkTpl<TSlotCount, ValueType, SlotStateType>;
+
+   static constexpr size_t MaxChunkSlots = impl::GetChunkMaxSlotsFor<MinChunkSlots, MaxChunkSize, MaxChunkSize, ChunkTplFor>();
+   static constexpr int GenerationBitSize = sizeof(GenerationType) * CHAR_BIT;
+   static constexpr int SlotIndexBitSize = std::min(
+      impl::GetIndexBitSize(MaxChunkSlots),
+      static_cast<int>(sizeof(KeyType) * CHAR_BIT - GenerationBitSize - 1));
+   static constexpr int ChunkIndexBitSize = (sizeof(TKey) * CHAR_BIT) - GenerationBitSize - SlotIndexBitSize;
+
+   static constexpr KeyType ChunkSlots = std::min<KeyType>(static_cast<KeyType>(MaxChunkSlots), static_cast<KeyType>(1) << SlotIndexBitSize);
+   static_assert(ChunkSlots > 0, "Chunk must contain more than 0 slots.");
+
+   static constexpr KeyType ChunkIndexMask = (static_cast<KeyType>(1) << ChunkIndexBitSize) - 1;
+   // Chunk indices are stored as `index + 1` in 32 bits of the free-chunk stack head.
+   static constexpr KeyType MaxChunkCount = static_cast<KeyType>(std::min<uintmax_t>(ChunkIndexMask, 0xFFFFFFFEu));
+
+   static constexpr KeyType SlotIndexShift = ChunkIndexBitSize;
+   static constexpr KeyType SlotIndexMask = (static_cast<KeyType>(1) << SlotIndexBitSize) - 1;
+
+   static constexpr KeyType GenerationShift = ChunkIndexBitSize + SlotIndexBitSize;
+   static constexpr KeyType GenerationMask = (static_cast<KeyType>(1) << GenerationBitSize) - 1;
+
+   static_assert(SlotIndexBitSize > 0);
+   static_assert(ChunkIndexBitSize > 0);
+
+   using Chunk = ChunkTplFor<ChunkSlots>;
+   using Slot = typename Chunk::Slot;
+   static_assert(sizeof(Chunk) <= MaxChunkSize, "Chunk size is too large.");
+
+   /**
+    * The chunk directory is split into segments, segment `k` holds
+    * `FirstSegmentSize << k` chunk pointers.
+    */
+   static constexpr size_t FirstSegmentSize = 64;
+   static constexpr int SegmentCount =
+      (impl::GetIndexBitSize(static_cast<uintmax_t>(MaxChunkCount) + 1) > 6) ?
+      (impl::GetIndexBitSize(static_cast<uintmax_t>(MaxChunkCount) + 1) - 5) : 1;
+
+   template<bool IsConst>
+   class IteratorTpl
+   {
+      friend class ConcurrentChunkedSlotMapStorage;
+
+   public:
+      using StoragePtr = std::conditional_t<IsConst, const ConcurrentChunkedSlotMapStorage*, ConcurrentChunkedSlotMapStorage*>;
+      using ReferenceType = std::conditional_t<IsConst, const ValueType&, ValueType&>;
+      using PointerType = std::conditional_t<IsConst, const ValueType*, ValueType*>;
+
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = std::pair<KeyType, ReferenceType>;
+      using difference_type = std::ptrdiff_t;
+      using reference = value_type;
+      using pointer = impl::ArrowProxy<value_type>;
+
+      IteratorTpl() = default;
+
+   private:
+      constexpr IteratorTpl(StoragePtr storage, KeyType key) : m_storage(storage), m_key(key) {}
+      constexpr IteratorTpl(StoragePtr storage) : m_storage(storage) {}
+
+   public:
+      inline bool operator==(const IteratorTpl& other) const { return m_key == other.m_key; }
+      inline bool operator!=(const IteratorTpl& other) const { return m_key != other.m_key; }
+
+      inline IteratorTpl& operator++() { Advance(); return *this; }
+      inline IteratorTpl operator++(int) { IteratorTpl it(*this); Advance(); return it; }
+
+      inline KeyType GetKey() const { return m_key; }
+      inline PointerType GetPtr() const { return m_ptr; }
+
+      inline reference operator*() const { return reference(m_key, *m_ptr); }
+      inline pointer operator->() const { return pointer(**this); }
+
+      /**
+       * Moves the iterator to the next valid element if there is one or to the end otherwise.
+       *
+       * \return `true` if after the call the iterator points to a valid element, `false` otherwise.
+       */
+      bool Advance();
+
+   private:
+      bool FindNext();
+
+      StoragePtr m_storage = nullptr;
+      KeyType m_key = std::numeric_limits<KeyType>::max();
+      PointerType m_ptr = nullptr;
+   };
+
+   using Iterator = IteratorTpl<false>;
+   using ConstIterator = IteratorTpl<true>;
+
+   ConcurrentChunkedSlotMapStorage();
+   ConcurrentChunkedSlotMapStorage(const ConcurrentChunkedSlotMapStorage& other);
+   ConcurrentChunkedSlotMapStorage(ConcurrentChunkedSlotMapStorage&& other);
+
+   ~ConcurrentChunkedSlotMapStorage();
+
+   ConcurrentChunkedSlotMapStorage& operator=(const ConcurrentChunkedSlotMapStorage&) = delete;
+   ConcurrentChunkedSlotMapStorage& operator=(ConcurrentChunkedSlotMapStorage&& other);
+
+   inline SizeType Size() const { return m_size.load(std::memory_order_relaxed); }
+   inline SizeType Capacity() const { return static_cast<SizeType>(m_chunkCount.load(std::memory_order_relaxed)) * ChunkSlots; }
+   inline static constexpr SizeType MaxCapacity() { return static_cast<SizeType>(MaxChunkCount) * ChunkSlots; }
+
+   bool Reserve(size_t capacity);
+
+   TValue* GetPtr(TKey key) const;
+   void GetPtrBatch(const TKey* keys, size_t count, TValue** outPtrs) const;
+   inline void GetPtrBatch(const TKey* keys, size_t count, const TValue** outPtrs) const { GetPtrBatch(keys, count, const_cast<TValue**>(outPtrs)); }
+
+   SizeType GetIndexByKey(KeyType key) const;
+   KeyType GetKeyByIndex(SizeType index) const;
+
+   bool FindNextKey(TKey& key) const;
+   KeyType IncrementKey(TKey key) const;
+
+   template<typename TFunc>
+   void ForEachSlot(TFunc func) const;
+   /**
+    * Same as `ForEachSlot()`, but visits ranges of chunks balanced by their
+    * number of live slots on the given executor.
+    */
+   template<typename TFunc, typename TExecutor>
+   void ParallelForEachSlot(TFunc func, TExecutor&& executor) const;
+
+   KeyType ReserveSlot(ValueType*& outPtr);
+   KeyType ReserveSlotNoAlloc(ValueType*& outPtr);
+   /**
+    * Publishes a slot returned by `ReserveSlot()` once its value has been
+    * constructed. Until then the key is not visible to readers.
+    */
+   void CommitSlot(KeyType key);
+   bool FreeSlot(KeyType key);
+
+   /**
+    * \name Slot leasing
+    *
+    * Used by \ref ConcurrentSlotCache to move free slots between the shared
+    * free lists and a thread-local magazine in batches. A leased slot is
+    * identified by the key it had when it was last freed.
+    */
+   ///@{
+   /**
+    * Takes up to `maxCount` free slots out of the shared free lists, detaching
+    * the whole free list of a chunk with a single atomic operation when
+    * possible. Returns the number of leased slots.
+    */
+   SizeType LeaseSlots(KeyType* outSlots, SizeType maxCount, bool allowAlloc);
+   /**
+    * Reserves a leased slot the same way `ReserveSlot()` would.
+    */
+   KeyType ReserveLeasedSlot(KeyType slot, ValueType*& outPtr);
+   /**
+    * Erases the element with the given key, but keeps the slot leased
+    * instead of returning it to the free list.
+    */
+   bool ReleaseSlot(KeyType key);
+   /**
+    * Returns leased slots to the shared free lists. Runs of slots from the
+    * same chunk are pushed with a single atomic operation.
+    */
+   void ReturnSlots(const KeyType* slots, SizeType count);
+   ///@}
+
+   void Swap(ConcurrentChunkedSlotMapStorage& other);
+   void Clear();
+
+   Iterator Begin() { Iterator it(this, 0); it.FindNext(); return it; }
+   constexpr Iterator End() { return Iterator(this); }
+
+   ConstIterator Begin() const { ConstIterator it(this, 0); it.FindNext(); return it; }
+   constexpr ConstIterator End() const { return ConstIterator(this); }
+
+private:
+   using ChunkSlot = std::atomic<Chunk*>;
+   using ChunkAllocator = typename std::allocator_traits<TAllocator>::template rebind_alloc<Chunk>;
+   using ChunkSlotAllocator = typename std::allocator_traits<TAllocator>::template rebind_alloc<ChunkSlot>;
+
+   static inline constexpr SlotStateType MakeSlotState(GenerationType generation, bool isLive)
+   {
+      return static_cast<SlotStateType>((static_cast<SlotStateType>(generation) << 1) | (isLive ? 1 : 0));
+   }
+
+   static inline constexpr KeyType MakeKey(GenerationType generation, SizeType slotIndex, SizeType chunkIndex)
+   {
+      return (static_cast<KeyType>(generation) << GenerationShift) |
+         (static_cast<KeyType>(slotIndex) << SlotIndexShift) |
+         static_cast<KeyType>(chunkIndex);
+   }
+
+   static inline constexpr SizeType GetSegmentSize(int segment) { return FirstSegmentSize << segment; }
+   static int GetSegmentIndex(SizeType chunkIndex, SizeType& outOffset);
+
+   Chunk* GetChunk(SizeType chunkIndex) const;
+
+   template<typename TFunc>
+   void ForEachSlotInChunks(SizeType beginChunk, SizeType endChunk, TFunc& func) const;
+   ChunkSlot* GetOrCreateSegment(int segment);
+
+   bool AllocateChunk();
+   static void InitializeChunk(Chunk* chunk);
+   void EnqueueChunk(Chunk* chunk, uint32_t chunkIndex);
+   Chunk* PeekFreeChunk(uint64_t& outHead, uint32_t& outChunkIndex, bool allowAlloc);
+   void RetireFreeChunk(uint64_t head, Chunk* chunk, uint32_t chunkIndex);
+   KeyType ActivateSlot(Chunk* chunk, SizeType chunkIndex, SizeType slotIndex, ValueType*& outPtr);
+   KeyType ReserveSlotTpl(ValueType*& outPtr, bool allowAlloc);
+
+   void RebuildFreeLists();
+   void Release();
+
+   alignas(impl::CacheLineSize) std::atomic<uint64_t> m_freeChunkHead{0};
+   alignas(impl::CacheLineSize) std::atomic<SizeType> m_size{0};
+   alignas(impl::CacheLineSize) std::atomic<SizeType> m_chunkCount{0};
+   std::atomic<ChunkSlot*> m_segments[SegmentCount];
+   TAllocator m_allocator;
+
+   template<typename TStorage, size_t TMagazineSize>
+   friend class ConcurrentSlotCache;
+
+   // Number of live ConcurrentSlotCache objects, which must be zero whenever
+   // the free lists are rebuilt.
+   std::atomic<SizeType> m_cacheCount{0};
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Thread-local cache of free slots of a \ref ConcurrentChunkedSlotMapStorage.
+ *
+ * Each thread that inserts into a shared \ref ConcurrentSlotMap can own a
+ * cache. Insertions are served from a local magazine of leased slots, which
+ * is refilled from the shared free lists `TMagazineSize / 2` slots at a time.
+ * Slots erased through the cache go back to the magazine, and the older half
+ * of a full magazine is returned to the shared free lists in one batch. This
+ * removes the contention on the shared free lists from the common path.
+ *
+ * The cache itself is not thread-safe and all leased slots are returned when
+ * it's destroyed or flushed. Caches must not outlive their storage and must be
+ * flushed before the storage is cleared, copied, moved or swapped.
+ *
+ * \code
+ * ConcurrentSlotMap<Entity> entities;
+ * // In each thread:
+ * ConcurrentSlotCache cache(entities);
+ * const auto key = cache.Emplace(...);
+ * cache.Erase(key);
+ * \endcode
+ */
+template<typename TStorage, size_t TMagazineSize = 256>
+class ConcurrentSlotCache
+{
+public:
+   using StorageType = TStorage;
+   using ValueType = typename TStorage::ValueType;
+   using KeyType = typename TStorage::KeyType;
+   using SizeType = typename TStorage::SizeType;
+
+   static constexpr KeyType InvalidKey = TStorage::InvalidKey;
+   static constexpr SizeType MagazineSize = TMagazineSize;
+   static constexpr SizeType BatchSize = TMagazineSize / 2;
+   static_assert(BatchSize > 0, "The magazine must hold at least two slots.");
+
+   explicit ConcurrentSlotCache(TStorage& storage);
+   template<typename TValue, typename TKey>
+   explicit ConcurrentSlotCache(SlotMap<TValue, TKey, TStorage>& slotmap) : ConcurrentSlotCache(slotmap.GetStorage()) {}
+
+   ConcurrentSlotCache(const ConcurrentSlotCache&) = delete;
+   ConcurrentSlotCache& operator=(const ConcurrentSlotCache&) = delete;
+
+   ~ConcurrentSlotCache();
+
+   /**
+    * Same as \ref SlotMap::Emplace(), but reserves the slot from the local
+    * magazine.
+    */
+   template<typename... TArgs>
+   KeyType Emplace(TArgs&&... args);
+   /**
+    * Same as \ref SlotMap::Erase(), but keeps the freed slot in the local
+    * magazine.
+    */
+   bool Erase(KeyType key);
+   /**
+    * Returns all the slots in the magazine to the storage.
+    */
+   void Flush();
+
+   inline SizeType CachedSlotCount() const { return m_count; }
+
+private:
+   TStorage& m_storage;
+   SizeType m_count = 0;
+   KeyType m_slots[TMagazineSize];
+};
+
+
+template<typename TValue, typename TKey, typename TStorage>
+ConcurrentSlotCache(SlotMap<TValue, TKey, TStorage>&) -> ConcurrentSlotCache<TStorage>;
+
+
+/**
+ * \ref SlotMap implementation that can be modified from multiple threads at
+ * the same time (see \ref ConcurrentChunkedSlotMapStorage).
+ */
+template<typename TValue, typename TKey = uint32_t>
+using ConcurrentSlotMap = SlotMap<TValue, TKey, ConcurrentChunkedSlotMapStorage<TValue, TKey>>;
+
+
+} // namespace slotmap
+
+
+#include "concurrent_slotmap.inl"
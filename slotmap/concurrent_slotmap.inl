@@ -0,0 +1,1188 @@
+// vim: et:ts=3:sw=3:sts=3
+// Copyright (c) 2024, Jan Milik (jan.milik@gmail.com).
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+
+namespace slotmap {
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::ConcurrentChunkedSlotMapStorage()
+{
+   for (int i = 0; i < SegmentCount; ++i)
+   {
+      m_segments[i].store(nullptr, std::memory_order_relaxed);
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::ConcurrentChunkedSlotMapStorage(const ConcurrentChunkedSlotMapStorage& other)
+   : ConcurrentChunkedSlotMapStorage()
+{
+   m_allocator = std::allocator_traits<TAllocator>::select_on_container_copy_construction(other.m_allocator);
+
+   const SizeType chunkCount = other.m_chunkCount.load(std::memory_order_acquire);
+   for (SizeType chunkIndex = 0; chunkIndex < chunkCount; ++chunkIndex)
+   {
+      const Chunk* const otherChunk = other.GetChunk(chunkIndex);
+      if (!otherChunk || !AllocateChunk())
+      {
+         break;
+      }
+
+      Chunk* const chunk = GetChunk(chunkIndex);
+      for (size_t slotIndex = 0; slotIndex < ChunkSlots; ++slotIndex)
+      {
+         const SlotStateType state = otherChunk->m_slotStates[slotIndex].load(std::memory_order_acquire);
+         chunk->m_slotStates[slotIndex].store(state, std::memory_order_relaxed);
+         if (state & 1)
+         {
+            new (chunk->m_slots[slotIndex].GetPtr()) TValue(*otherChunk->m_slots[slotIndex].GetPtr());
+            chunk->m_liveBits[slotIndex / 64].fetch_or(static_cast<uint64_t>(1) << (slotIndex % 64), std::memory_order_relaxed);
+            m_size.fetch_add(1, std::memory_order_relaxed);
+         }
+      }
+   }
+
+   RebuildFreeLists();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::ConcurrentChunkedSlotMapStorage(ConcurrentChunkedSlotMapStorage&& other)
+   : ConcurrentChunkedSlotMapStorage()
+{
+   Swap(other);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::~ConcurrentChunkedSlotMapStorage()
+{
+   Release();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>&
+ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::operator=(ConcurrentChunkedSlotMapStorage&& other)
+{
+   if (this != &other)
+   {
+      Release();
+      Swap(other);
+   }
+
+   return *this;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+bool ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::Reserve(size_t capacity)
+{
+   if (capacity > MaxCapacity())
+   {
+      return false;
+   }
+
+   while (Capacity() < capacity)
+   {
+      if (!AllocateChunk())
+      {
+         return Capacity() >= capacity;
+      }
+   }
+
+   return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+int ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::GetSegmentIndex(SizeType chunkIndex, SizeType& outOffset)
+{
+   // Segment k starts at chunk FirstSegmentSize * (2^k - 1).
+   const SizeType blocks = chunkIndex / FirstSegmentSize + 1;
+   const int segment = std::numeric_limits<SizeType>::digits - 1 - CountLeadingZeros(blocks);
+   outOffset = chunkIndex - FirstSegmentSize * ((static_cast<SizeType>(1) << segment) - 1);
+   return segment;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+typename ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::Chunk*
+ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::GetChunk(SizeType chunkIndex) const
+{
+   SizeType offset = 0;
+   const int segmentIndex = GetSegmentIndex(chunkIndex, offset);
+   if (segmentIndex >= SegmentCount)
+   {
+      return nullptr;
+   }
+
+   const ChunkSlot* const segment = m_segments[segmentIndex].load(std::memory_order_acquire);
+   if (!segment)
+   {
+      return nullptr;
+   }
+
+   return segment[offset].load(std::memory_order_acquire);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+typename ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::ChunkSlot*
+ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::GetOrCreateSegment(int segmentIndex)
+{
+   ChunkSlot* segment = m_segments[segmentIndex].load(std::memory_order_acquire);
+   if (segment)
+   {
+      return segment;
+   }
+
+   ChunkSlotAllocator allocator(m_allocator);
+   const SizeType segmentSize = GetSegmentSize(segmentIndex);
+   ChunkSlot* const newSegment = std::allocator_traits<ChunkSlotAllocator>::allocate(allocator, segmentSize);
+   for (SizeType i = 0; i < segmentSize; ++i)
+   {
+      std::allocator_traits<ChunkSlotAllocator>::construct(allocator, newSegment + i, nullptr);
+   }
+
+   if (m_segments[segmentIndex].compare_exchange_strong(segment, newSegment, std::memory_order_acq_rel, std::memory_order_acquire))
+   {
+      return newSegment;
+   }
+
+   // Another thread installed the segment first.
+   std::allocator_traits<ChunkSlotAllocator>::deallocate(allocator, newSegment, segmentSize);
+   return segment;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+TValue* ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::GetPtr(TKey key) const
+{
+   const KeyType chunkIndex = key & ChunkIndexMask;
+   if (chunkIndex >= m_chunkCount.load(std::memory_order_acquire))
+   {
+      return nullptr;
+   }
+
+   Chunk* const chunk = GetChunk(chunkIndex);
+   const KeyType slotIndex = (key >> SlotIndexShift) & SlotIndexMask;
+   if (!chunk || (slotIndex >= ChunkSlots))
+   {
+      return nullptr;
+   }
+
+   const GenerationType generation = (key >> GenerationShift) & GenerationMask;
+   if (chunk->m_slotStates[slotIndex].load(std::memory_order_acquire) != MakeSlotState(generation, true))
+   {
+      return nullptr;
+   }
+
+   return chunk->m_slots[slotIndex].GetPtr();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+void ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::GetPtrBatch(const TKey* keys, size_t count, TValue** outPtrs) const
+{
+   Chunk* chunks[impl::LookupGroupSize];
+
+   const SizeType chunkCount = m_chunkCount.load(std::memory_order_acquire);
+   for (size_t groupBegin = 0; groupBegin < count; groupBegin += impl::LookupGroupSize)
+   {
+      const size_t groupSize = std::min(count - groupBegin, impl::LookupGroupSize);
+      const TKey* groupKeys = keys + groupBegin;
+      TValue** groupPtrs = outPtrs + groupBegin;
+
+      // Stage 1: chunks and slot states. The segment directory is small and
+      // stays in the cache.
+      for (size_t i = 0; i < groupSize; ++i)
+      {
+         const KeyType chunkIndex = groupKeys[i] & ChunkIndexMask;
+         const KeyType slotIndex = (groupKeys[i] >> SlotIndexShift) & SlotIndexMask;
+         chunks[i] = ((chunkIndex < chunkCount) && (slotIndex < ChunkSlots)) ? GetChunk(chunkIndex) : nullptr;
+         if (chunks[i])
+         {
+            impl::Prefetch(&chunks[i]->m_slotStates[slotIndex]);
+         }
+      }
+
+      // Stage 2: validation, values are prefetched for the caller.
+      for (size_t i = 0; i < groupSize; ++i)
+      {
+         groupPtrs[i] = nullptr;
+
+         Chunk* const chunk = chunks[i];
+         if (!chunk)
+         {
+            continue;
+         }
+
+         const KeyType slotIndex = (groupKeys[i] >> SlotIndexShift) & SlotIndexMask;
+         const GenerationType generation = (groupKeys[i] >> GenerationShift) & GenerationMask;
+         if (chunk->m_slotStates[slotIndex].load(std::memory_order_acquire) == MakeSlotState(generation, true))
+         {
+            groupPtrs[i] = chunk->m_slots[slotIndex].GetPtr();
+            impl::Prefetch(groupPtrs[i]);
+         }
+      }
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+typename ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::SizeType
+ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::GetIndexByKey(TKey key) const
+{
+   const KeyType chunkIndex = key & ChunkIndexMask;
+   const KeyType slotIndex = (key >> SlotIndexShift) & SlotIndexMask;
+
+   return static_cast<SizeType>(chunkIndex * ChunkSlots + slotIndex);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+TKey ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::GetKeyByIndex(SizeType index) const
+{
+   const SizeType chunkIndex = index / ChunkSlots;
+   if (chunkIndex >= m_chunkCount.load(std::memory_order_acquire))
+   {
+      return InvalidKey;
+   }
+
+   const Chunk* const chunk = GetChunk(chunkIndex);
+   if (!chunk)
+   {
+      return InvalidKey;
+   }
+
+   const SizeType slotIndex = index % ChunkSlots;
+   const SlotStateType state = chunk->m_slotStates[slotIndex].load(std::memory_order_acquire);
+   if (!(state & 1))
+   {
+      return InvalidKey;
+   }
+
+   return MakeKey(static_cast<GenerationType>(state >> 1), slotIndex, chunkIndex);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+bool ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::FindNextKey(TKey& key) const
+{
+   SizeType chunkIndex = key & ChunkIndexMask;
+   SizeType slotIndex = (key >> SlotIndexShift) & SlotIndexMask;
+
+   const SizeType chunkCount = m_chunkCount.load(std::memory_order_acquire);
+   for (; chunkIndex < chunkCount; ++chunkIndex, slotIndex = 0)
+   {
+      const Chunk* const chunk = GetChunk(chunkIndex);
+      if (!chunk)
+      {
+         continue;
+      }
+
+      for (SizeType wordIndex = slotIndex / 64; wordIndex < Chunk::LiveWordCount; ++wordIndex)
+      {
+         uint64_t word = chunk->m_liveBits[wordIndex].load(std::memory_order_acquire);
+         if (wordIndex == slotIndex / 64)
+         {
+            word &= ~static_cast<uint64_t>(0) << (slotIndex % 64);
+         }
+
+         while (word)
+         {
+            const SizeType index = wordIndex * 64 + CountTrailingZeros(word);
+            word &= word - 1;
+
+            const SlotStateType state = chunk->m_slotStates[index].load(std::memory_order_acquire);
+            if (state & 1)
+            {
+               key = MakeKey(static_cast<GenerationType>(state >> 1), index, chunkIndex);
+               return true;
+            }
+         }
+      }
+   }
+
+   return false;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+TKey ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::IncrementKey(TKey key) const
+{
+   const KeyType chunkIndex = key & ChunkIndexMask;
+   KeyType slotIndex = (key >> SlotIndexShift) & SlotIndexMask;
+
+   ++slotIndex;
+
+   if (slotIndex < ChunkSlots)
+   {
+      return (slotIndex << SlotIndexShift) | chunkIndex;
+   }
+
+   return chunkIndex + 1;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+template<typename TFunc>
+void ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::ForEachSlot(TFunc func) const
+{
+   ForEachSlotInChunks(0, m_chunkCount.load(std::memory_order_acquire), func);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+template<typename TFunc, typename TExecutor>
+void ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::ParallelForEachSlot(TFunc func, TExecutor&& executor) const
+{
+   const SizeType chunkCount = m_chunkCount.load(std::memory_order_acquire);
+   const size_t rangeCount = std::min(chunkCount, impl::GetExecutorConcurrency(executor) * impl::TasksPerThread);
+   if (rangeCount <= 1)
+   {
+      ForEachSlotInChunks(0, chunkCount, func);
+      return;
+   }
+
+   // The live bits are a snapshot, chunks may fill up or empty while the
+   // ranges are being processed, which only affects the balance.
+   const std::vector<size_t> bounds = impl::SplitByWeight(chunkCount, rangeCount, [this](size_t chunkIndex)
+   {
+      size_t weight = Chunk::LiveWordCount;
+      if (const Chunk* chunk = GetChunk(chunkIndex))
+      {
+         for (SizeType wordIndex = 0; wordIndex < Chunk::LiveWordCount; ++wordIndex)
+         {
+            weight += PopCount(chunk->m_liveBits[wordIndex].load(std::memory_order_relaxed));
+         }
+      }
+      return weight;
+   });
+
+   impl::ExecuteParallelFor(std::forward<TExecutor>(executor), bounds.size() - 1, [&](size_t rangeIndex)
+   {
+      ForEachSlotInChunks(bounds[rangeIndex], bounds[rangeIndex + 1], func);
+   });
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+template<typename TFunc>
+void ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::ForEachSlotInChunks(SizeType beginChunk, SizeType endChunk, TFunc& func) const
+{
+   for (SizeType chunkIndex = beginChunk; chunkIndex < endChunk; ++chunkIndex)
+   {
+      Chunk* const chunk = GetChunk(chunkIndex);
+      if (!chunk)
+      {
+         continue;
+      }
+
+      for (SizeType wordIndex = 0; wordIndex < Chunk::LiveWordCount; ++wordIndex)
+      {
+         uint64_t word = chunk->m_liveBits[wordIndex].load(std::memory_order_acquire);
+         while (word)
+         {
+            const SizeType slotIndex = wordIndex * 64 + CountTrailingZeros(word);
+            word &= word - 1;
+
+            // The live bit is only a hint, the slot state is authoritative.
+            const SlotStateType state = chunk->m_slotStates[slotIndex].load(std::memory_order_acquire);
+            if (state & 1)
+            {
+               const TKey key = MakeKey(static_cast<GenerationType>(state >> 1), slotIndex, chunkIndex);
+               func(key, *chunk->m_slots[slotIndex].GetPtr());
+            }
+         }
+      }
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+bool ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::AllocateChunk()
+{
+   SizeType chunkIndex = m_chunkCount.load(std::memory_order_relaxed);
+   do
+   {
+      if (chunkIndex >= MaxChunkCount)
+      {
+         return false;
+      }
+   } while (!m_chunkCount.compare_exchange_weak(chunkIndex, chunkIndex + 1, std::memory_order_acq_rel, std::memory_order_relaxed));
+
+   SizeType offset = 0;
+   const int segmentIndex = GetSegmentIndex(chunkIndex, offset);
+   assert(segmentIndex < SegmentCount);
+   ChunkSlot* const segment = GetOrCreateSegment(segmentIndex);
+
+   ChunkAllocator allocator(m_allocator);
+   Chunk* const chunk = std::allocator_traits<ChunkAllocator>::allocate(allocator, 1);
+   new (chunk) Chunk();
+   InitializeChunk(chunk);
+
+   segment[offset].store(chunk, std::memory_order_release);
+
+   EnqueueChunk(chunk, static_cast<uint32_t>(chunkIndex));
+
+   return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+void ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::InitializeChunk(Chunk* chunk)
+{
+   for (size_t i = 0; i < Chunk::LiveWordCount; ++i)
+   {
+      chunk->m_liveBits[i].store(0, std::memory_order_relaxed);
+   }
+
+   for (size_t i = 0; i < ChunkSlots; ++i)
+   {
+      chunk->m_slotStates[i].store(0, std::memory_order_relaxed);
+      chunk->m_nextFreeSlot[i].store(static_cast<uint32_t>(i + 2 <= ChunkSlots ? i + 2 : 0), std::memory_order_relaxed);
+   }
+
+   chunk->m_freeSlotHead.store(1, std::memory_order_relaxed);
+   chunk->m_nextFreeChunk.store(0, std::memory_order_relaxed);
+   chunk->m_isInFreeList.store(false, std::memory_order_relaxed);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Pushes the chunk on the free-chunk stack unless it's already there.
+ *
+ * A chunk that is popped from the stack clears `m_isInFreeList` and then
+ * re-checks its own free list, while `FreeSlot()` pushes the slot and then
+ * sets the flag. Both sides use sequentially consistent operations, so at
+ * least one of them observes the other and a chunk with free slots is never
+ * lost.
+ */
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+void ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::EnqueueChunk(Chunk* chunk, uint32_t chunkIndex)
+{
+   // The plain load avoids a read-modify-write in the common case of a chunk
+   // that is already in the stack.
+   if (chunk->m_isInFreeList.load(std::memory_order_seq_cst) ||
+      chunk->m_isInFreeList.exchange(true, std::memory_order_seq_cst))
+   {
+      return;
+   }
+
+   impl::PushTaggedIndex(m_freeChunkHead, chunk->m_nextFreeChunk, chunkIndex);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+typename ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::Chunk*
+ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::PeekFreeChunk(uint64_t& outHead, uint32_t& outChunkIndex, bool allowAlloc)
+{
+   for (;;)
+   {
+      outHead = m_freeChunkHead.load(std::memory_order_acquire);
+      const uint32_t top = static_cast<uint32_t>(outHead);
+      if (top != 0)
+      {
+         outChunkIndex = top - 1;
+         Chunk* const chunk = GetChunk(outChunkIndex);
+         assert(chunk);
+         return chunk;
+      }
+
+      if (!allowAlloc || !AllocateChunk())
+      {
+         // Another thread may have freed a slot in the meantime.
+         if (static_cast<uint32_t>(m_freeChunkHead.load(std::memory_order_acquire)) != 0)
+         {
+            continue;
+         }
+         return nullptr;
+      }
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+void ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::RetireFreeChunk(uint64_t head, Chunk* chunk, uint32_t chunkIndex)
+{
+   // The chunk is full, take it off the stack unless someone else already did.
+   const uint64_t newHead = (((head >> 32) + 1) << 32) | chunk->m_nextFreeChunk.load(std::memory_order_relaxed);
+   if (m_freeChunkHead.compare_exchange_strong(head, newHead, std::memory_order_acq_rel, std::memory_order_relaxed))
+   {
+      chunk->m_isInFreeList.store(false, std::memory_order_seq_cst);
+      if (static_cast<uint32_t>(chunk->m_freeSlotHead.load(std::memory_order_seq_cst)) != 0)
+      {
+         EnqueueChunk(chunk, chunkIndex);
+      }
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+TKey ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::ActivateSlot(Chunk* chunk, SizeType chunkIndex, SizeType slotIndex, ValueType*& outPtr)
+{
+   // The slot is exclusively owned by this thread until it's committed.
+   const SlotStateType state = chunk->m_slotStates[slotIndex].load(std::memory_order_relaxed);
+   assert(!(state & 1));
+
+   GenerationType generation = static_cast<GenerationType>((state >> 1) + 1);
+   if (generation == 0)
+   {
+      generation = 1;
+   }
+   chunk->m_slotStates[slotIndex].store(MakeSlotState(generation, false), std::memory_order_relaxed);
+
+   m_size.fetch_add(1, std::memory_order_relaxed);
+
+   outPtr = chunk->m_slots[slotIndex].GetPtr();
+   return MakeKey(generation, slotIndex, chunkIndex);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+TKey ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::ReserveSlotTpl(ValueType*& outPtr, bool allowAlloc)
+{
+   uint64_t head = 0;
+   uint32_t chunkIndex = 0;
+   while (Chunk* const chunk = PeekFreeChunk(head, chunkIndex, allowAlloc))
+   {
+      const uint32_t top = impl::PopTaggedIndex(chunk->m_freeSlotHead, [chunk](uint32_t slotIndex)
+      {
+         return chunk->m_nextFreeSlot[slotIndex].load(std::memory_order_relaxed);
+      });
+
+      if (top != 0)
+      {
+         return ActivateSlot(chunk, chunkIndex, top - 1, outPtr);
+      }
+
+      RetireFreeChunk(head, chunk, chunkIndex);
+   }
+
+   outPtr = nullptr;
+   return InvalidKey;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+TKey ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::ReserveSlot(ValueType*& outPtr)
+{
+   return ReserveSlotTpl(outPtr, true);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+TKey ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::ReserveSlotNoAlloc(ValueType*& outPtr)
+{
+   return ReserveSlotTpl(outPtr, false);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+void ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::CommitSlot(KeyType key)
+{
+   const KeyType chunkIndex = key & ChunkIndexMask;
+   const KeyType slotIndex = (key >> SlotIndexShift) & SlotIndexMask;
+   const GenerationType generation = (key >> GenerationShift) & GenerationMask;
+
+   Chunk* const chunk = GetChunk(chunkIndex);
+   assert(chunk);
+   assert(chunk->m_slotStates[slotIndex].load(std::memory_order_relaxed) == MakeSlotState(generation, false));
+
+   chunk->m_slotStates[slotIndex].store(MakeSlotState(generation, true), std::memory_order_release);
+   chunk->m_liveBits[slotIndex / 64].fetch_or(static_cast<uint64_t>(1) << (slotIndex % 64), std::memory_order_release);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+bool ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::FreeSlot(KeyType key)
+{
+   if (!ReleaseSlot(key))
+   {
+      return false;
+   }
+
+   ReturnSlots(&key, 1);
+   return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+typename ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::SizeType
+ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::LeaseSlots(KeyType* outSlots, SizeType maxCount, bool allowAlloc)
+{
+   SizeType count = 0;
+   uint64_t head = 0;
+   uint32_t chunkIndex = 0;
+   while (count < maxCount)
+   {
+      Chunk* const chunk = PeekFreeChunk(head, chunkIndex, allowAlloc && (count == 0));
+      if (!chunk)
+      {
+         break;
+      }
+
+      // Detach the whole free list, the slots in it are then owned by this thread.
+      uint64_t slotHead = chunk->m_freeSlotHead.load(std::memory_order_acquire);
+      while ((static_cast<uint32_t>(slotHead) != 0) &&
+         !chunk->m_freeSlotHead.compare_exchange_weak(slotHead, ((slotHead >> 32) + 1) << 32, std::memory_order_acquire, std::memory_order_acquire))
+      {
+      }
+
+      uint32_t top = static_cast<uint32_t>(slotHead);
+      while ((top != 0) && (count < maxCount))
+      {
+         const SizeType slotIndex = top - 1;
+         const SlotStateType state = chunk->m_slotStates[slotIndex].load(std::memory_order_relaxed);
+         outSlots[count++] = MakeKey(static_cast<GenerationType>(state >> 1), slotIndex, chunkIndex);
+         top = chunk->m_nextFreeSlot[slotIndex].load(std::memory_order_relaxed);
+      }
+
+      if (top != 0)
+      {
+         // Give back what did not fit, the chain still ends with the original tail.
+         SizeType lastIndex = top - 1;
+         for (uint32_t next = chunk->m_nextFreeSlot[lastIndex].load(std::memory_order_relaxed); next != 0;
+            next = chunk->m_nextFreeSlot[lastIndex].load(std::memory_order_relaxed))
+         {
+            lastIndex = next - 1;
+         }
+         impl::PushTaggedIndex(chunk->m_freeSlotHead, chunk->m_nextFreeSlot[lastIndex], top - 1);
+         EnqueueChunk(chunk, chunkIndex);
+      }
+      else
+      {
+         RetireFreeChunk(head, chunk, chunkIndex);
+      }
+   }
+
+   return count;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+TKey ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::ReserveLeasedSlot(KeyType slot, ValueType*& outPtr)
+{
+   const KeyType chunkIndex = slot & ChunkIndexMask;
+   const KeyType slotIndex = (slot >> SlotIndexShift) & SlotIndexMask;
+
+   Chunk* const chunk = GetChunk(chunkIndex);
+   assert(chunk);
+
+   return ActivateSlot(chunk, chunkIndex, slotIndex, outPtr);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+bool ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::ReleaseSlot(KeyType key)
+{
+   const KeyType chunkIndex = key & ChunkIndexMask;
+   if (chunkIndex >= m_chunkCount.load(std::memory_order_acquire))
+   {
+      return false;
+   }
+
+   Chunk* const chunk = GetChunk(chunkIndex);
+   const KeyType slotIndex = (key >> SlotIndexShift) & SlotIndexMask;
+   if (!chunk || (slotIndex >= ChunkSlots))
+   {
+      return false;
+   }
+
+   // Only one thread can win the transition from live to dead.
+   const GenerationType generation = (key >> GenerationShift) & GenerationMask;
+   SlotStateType expected = MakeSlotState(generation, true);
+   if (!chunk->m_slotStates[slotIndex].compare_exchange_strong(expected, MakeSlotState(generation, false), std::memory_order_acq_rel, std::memory_order_relaxed))
+   {
+      return false;
+   }
+
+   chunk->m_liveBits[slotIndex / 64].fetch_and(~(static_cast<uint64_t>(1) << (slotIndex % 64)), std::memory_order_relaxed);
+
+   if constexpr (!std::is_trivially_destructible_v<TValue>)
+   {
+      chunk->m_slots[slotIndex].GetPtr()->~TValue();
+   }
+
+   assert(m_size.load(std::memory_order_relaxed) > 0);
+   m_size.fetch_sub(1, std::memory_order_relaxed);
+
+   return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+void ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::ReturnSlots(const KeyType* slots, SizeType count)
+{
+   SizeType begin = 0;
+   while (begin < count)
+   {
+      const KeyType chunkIndex = slots[begin] & ChunkIndexMask;
+      Chunk* const chunk = GetChunk(chunkIndex);
+      assert(chunk);
+
+      // Link the run of slots from the same chunk into a chain.
+      SizeType firstIndex = (slots[begin] >> SlotIndexShift) & SlotIndexMask;
+      SizeType lastIndex = firstIndex;
+      SizeType end = begin + 1;
+      for (; (end < count) && ((slots[end] & ChunkIndexMask) == chunkIndex); ++end)
+      {
+         const SizeType slotIndex = (slots[end] >> SlotIndexShift) & SlotIndexMask;
+         chunk->m_nextFreeSlot[lastIndex].store(static_cast<uint32_t>(slotIndex + 1), std::memory_order_relaxed);
+         lastIndex = slotIndex;
+      }
+
+      impl::PushTaggedIndex(chunk->m_freeSlotHead, chunk->m_nextFreeSlot[lastIndex], static_cast<uint32_t>(firstIndex));
+      EnqueueChunk(chunk, static_cast<uint32_t>(chunkIndex));
+
+      begin = end;
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+void ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::Swap(ConcurrentChunkedSlotMapStorage& other)
+{
+   auto swapAtomic = [](auto& a, auto& b)
+   {
+      b.store(a.exchange(b.load(std::memory_order_relaxed), std::memory_order_relaxed), std::memory_order_relaxed);
+   };
+
+   swapAtomic(m_freeChunkHead, other.m_freeChunkHead);
+   swapAtomic(m_size, other.m_size);
+   swapAtomic(m_chunkCount, other.m_chunkCount);
+   for (int i = 0; i < SegmentCount; ++i)
+   {
+      swapAtomic(m_segments[i], other.m_segments[i]);
+   }
+   std::swap(m_allocator, other.m_allocator);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+void ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::Clear()
+{
+   assert(m_cacheCount.load(std::memory_order_relaxed) == 0);
+
+   const SizeType chunkCount = m_chunkCount.load(std::memory_order_acquire);
+   for (SizeType chunkIndex = 0; chunkIndex < chunkCount; ++chunkIndex)
+   {
+      Chunk* const chunk = GetChunk(chunkIndex);
+      assert(chunk);
+
+      // Generations are kept so that the keys issued so far stay invalid.
+      for (size_t wordIndex = 0; wordIndex < Chunk::LiveWordCount; ++wordIndex)
+      {
+         uint64_t word = chunk->m_liveBits[wordIndex].exchange(0, std::memory_order_relaxed);
+         while (word)
+         {
+            const size_t slotIndex = wordIndex * 64 + CountTrailingZeros(word);
+            word &= word - 1;
+
+            if constexpr (!std::is_trivially_destructible_v<TValue>)
+            {
+               chunk->m_slots[slotIndex].GetPtr()->~TValue();
+            }
+            chunk->m_slotStates[slotIndex].fetch_and(static_cast<SlotStateType>(~1), std::memory_order_relaxed);
+         }
+      }
+   }
+
+   m_size.store(0, std::memory_order_relaxed);
+   RebuildFreeLists();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Links all dead slots into the free lists and all chunks with a free slot
+ * into the free-chunk stack, lowest indices on top. Not thread-safe.
+ */
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+void ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::RebuildFreeLists()
+{
+   uint32_t firstFreeChunk = 0;
+
+   const SizeType chunkCount = m_chunkCount.load(std::memory_order_relaxed);
+   for (SizeType chunkIndex = chunkCount; chunkIndex > 0; --chunkIndex)
+   {
+      Chunk* const chunk = GetChunk(chunkIndex - 1);
+
+      uint32_t firstFreeSlot = 0;
+      for (size_t slotIndex = ChunkSlots; slotIndex > 0; --slotIndex)
+      {
+         if (!(chunk->m_slotStates[slotIndex - 1].load(std::memory_order_relaxed) & 1))
+         {
+            chunk->m_nextFreeSlot[slotIndex - 1].store(firstFreeSlot, std::memory_order_relaxed);
+            firstFreeSlot = static_cast<uint32_t>(slotIndex);
+         }
+      }
+      chunk->m_freeSlotHead.store(firstFreeSlot, std::memory_order_relaxed);
+
+      const bool hasFreeSlot = (firstFreeSlot != 0);
+      chunk->m_isInFreeList.store(hasFreeSlot, std::memory_order_relaxed);
+      if (hasFreeSlot)
+      {
+         chunk->m_nextFreeChunk.store(firstFreeChunk, std::memory_order_relaxed);
+         firstFreeChunk = static_cast<uint32_t>(chunkIndex);
+      }
+   }
+
+   m_freeChunkHead.store(firstFreeChunk, std::memory_order_release);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+void ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::Release()
+{
+   Clear();
+
+   ChunkAllocator chunkAllocator(m_allocator);
+   ChunkSlotAllocator segmentAllocator(m_allocator);
+
+   const SizeType chunkCount = m_chunkCount.load(std::memory_order_relaxed);
+   for (SizeType chunkIndex = 0; chunkIndex < chunkCount; ++chunkIndex)
+   {
+      Chunk* const chunk = GetChunk(chunkIndex);
+      chunk->~Chunk();
+      std::allocator_traits<ChunkAllocator>::deallocate(chunkAllocator, chunk, 1);
+   }
+
+   for (int segmentIndex = 0; segmentIndex < SegmentCount; ++segmentIndex)
+   {
+      ChunkSlot* const segment = m_segments[segmentIndex].load(std::memory_order_relaxed);
+      if (segment)
+      {
+         std::allocator_traits<ChunkSlotAllocator>::deallocate(segmentAllocator, segment, GetSegmentSize(segmentIndex));
+         m_segments[segmentIndex].store(nullptr, std::memory_order_relaxed);
+      }
+   }
+
+   m_chunkCount.store(0, std::memory_order_relaxed);
+   m_freeChunkHead.store(0, std::memory_order_relaxed);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+template<bool IsConst>
+bool ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::IteratorTpl<IsConst>::Advance()
+{
+   m_key = m_storage->IncrementKey(m_key);
+   return FindNext();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator>
+template<bool IsConst>
+bool ConcurrentChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator>::IteratorTpl<IsConst>::FindNext()
+{
+   if (!m_storage->FindNextKey(m_key))
+   {
+      m_key = std::numeric_limits<KeyType>::max();
+      m_ptr = nullptr;
+      return false;
+   }
+   m_ptr = m_storage->GetPtr(m_key);
+   return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TStorage, size_t TMagazineSize>
+ConcurrentSlotCache<TStorage, TMagazineSize>::ConcurrentSlotCache(TStorage& storage)
+   : m_storage(storage)
+{
+   m_storage.m_cacheCount.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TStorage, size_t TMagazineSize>
+ConcurrentSlotCache<TStorage, TMagazineSize>::~ConcurrentSlotCache()
+{
+   Flush();
+   m_storage.m_cacheCount.fetch_sub(1, std::memory_order_relaxed);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TStorage, size_t TMagazineSize>
+template<typename... TArgs>
+typename ConcurrentSlotCache<TStorage, TMagazineSize>::KeyType
+ConcurrentSlotCache<TStorage, TMagazineSize>::Emplace(TArgs&&... args)
+{
+   if (m_count == 0)
+   {
+      m_count = m_storage.LeaseSlots(m_slots, BatchSize, true);
+      if (m_count == 0)
+      {
+         return InvalidKey;
+      }
+   }
+
+   ValueType* ptr = nullptr;
+   const KeyType key = m_storage.ReserveLeasedSlot(m_slots[--m_count], ptr);
+   assert(ptr);
+
+   new (ptr) ValueType(std::forward<TArgs>(args)...);
+
+   m_storage.CommitSlot(key);
+
+   return key;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TStorage, size_t TMagazineSize>
+bool ConcurrentSlotCache<TStorage, TMagazineSize>::Erase(KeyType key)
+{
+   if (!m_storage.ReleaseSlot(key))
+   {
+      return false;
+   }
+
+   if (m_count == MagazineSize)
+   {
+      // Return the older half, the most recently freed slots are more likely
+      // to be in the CPU cache.
+      m_storage.ReturnSlots(m_slots, BatchSize);
+      std::copy(m_slots + BatchSize, m_slots + MagazineSize, m_slots);
+      m_count -= BatchSize;
+   }
+
+   m_slots[m_count++] = key;
+   return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TStorage, size_t TMagazineSize>
+void ConcurrentSlotCache<TStorage, TMagazineSize>::Flush()
+{
+   m_storage.ReturnSlots(m_slots, m_count);
+   m_count = 0;
+}
+
+
+}
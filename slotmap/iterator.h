@@ -0,0 +1,206 @@
+// vim: et:ts=3:sw=3:sts=3
+// Copyright (c) 2024, Jan Milik (jan.milik@gmail.com).
+// 
+// All rights reserved.
+//
+// MIT License
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+
+#include <cstddef>
+#include <iterator>
+#include <type_traits>
+#include <utility>
+
+
+namespace slotmap {
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Pair of iterators usable in a range-based for loop and with the standard
+ * algorithms.
+ */
+template<typename TIterator>
+class IteratorRange
+{
+public:
+   using iterator = TIterator;
+
+   IteratorRange() = default;
+   constexpr IteratorRange(TIterator begin, TIterator end) : m_begin(begin), m_end(end) {}
+
+   constexpr TIterator begin() const { return m_begin; }
+   constexpr TIterator end() const { return m_end; }
+
+   inline bool empty() const { return m_begin == m_end; }
+
+private:
+   TIterator m_begin;
+   TIterator m_end;
+};
+
+
+namespace impl {
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Result of `operator->` of the iterators that dereference to a temporary,
+ * e.g. a (key, value reference) pair.
+ */
+template<typename TReference>
+class ArrowProxy
+{
+public:
+   explicit constexpr ArrowProxy(TReference reference) : m_reference(reference) {}
+
+   constexpr TReference* operator->() { return &m_reference; }
+
+private:
+   TReference m_reference;
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Adapts an iterator of a storage to dereference to the keys only.
+ */
+template<typename TIterator>
+class KeyIterator
+{
+public:
+   using iterator_category = std::forward_iterator_tag;
+   using value_type = typename TIterator::value_type::first_type;
+   using difference_type = std::ptrdiff_t;
+   using reference = value_type;
+   using pointer = ArrowProxy<value_type>;
+
+   KeyIterator() = default;
+   explicit constexpr KeyIterator(TIterator it) : m_it(it) {}
+
+   inline bool operator==(const KeyIterator& other) const { return m_it == other.m_it; }
+   inline bool operator!=(const KeyIterator& other) const { return m_it != other.m_it; }
+
+   inline KeyIterator& operator++() { ++m_it; return *this; }
+   inline KeyIterator operator++(int) { const KeyIterator it(*this); ++m_it; return it; }
+
+   inline reference operator*() const { return m_it.GetKey(); }
+   inline pointer operator->() const { return pointer(m_it.GetKey()); }
+
+private:
+   TIterator m_it;
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Adapts an iterator of a storage to dereference to the values only.
+ */
+template<typename TIterator>
+class ValueIterator
+{
+public:
+   using iterator_category = std::forward_iterator_tag;
+   using value_type = std::remove_cv_t<std::remove_reference_t<typename TIterator::ReferenceType>>;
+   using difference_type = std::ptrdiff_t;
+   using reference = typename TIterator::ReferenceType;
+   using pointer = typename TIterator::PointerType;
+
+   ValueIterator() = default;
+   explicit constexpr ValueIterator(TIterator it) : m_it(it) {}
+
+   inline bool operator==(const ValueIterator& other) const { return m_it == other.m_it; }
+   inline bool operator!=(const ValueIterator& other) const { return m_it != other.m_it; }
+
+   inline ValueIterator& operator++() { ++m_it; return *this; }
+   inline ValueIterator operator++(int) { const ValueIterator it(*this); ++m_it; return it; }
+
+   inline reference operator*() const { return *m_it.GetPtr(); }
+   inline pointer operator->() const { return m_it.GetPtr(); }
+
+private:
+   TIterator m_it;
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Random access iterator over the chunks of a chunked storage. Dereferences
+ * to an \ref IteratorRange of the elements of one chunk, so that a parallel
+ * algorithm (e.g. `std::for_each(std::execution::par, ...)`) can split the
+ * elements of the storage between threads.
+ *
+ * The storage must provide `ChunkBegin(chunkIndex)`, which returns an
+ * iterator over the elements of the chunk that compares equal to `End()`
+ * once it leaves the chunk.
+ */
+template<typename TStoragePtr, typename TIterator>
+class ChunkRangeIterator
+{
+public:
+   using iterator_category = std::random_access_iterator_tag;
+   using value_type = IteratorRange<TIterator>;
+   using difference_type = std::ptrdiff_t;
+   using reference = value_type;
+   using pointer = ArrowProxy<value_type>;
+
+   ChunkRangeIterator() = default;
+   constexpr ChunkRangeIterator(TStoragePtr storage, size_t chunkIndex) : m_storage(storage), m_chunkIndex(chunkIndex) {}
+
+   inline bool operator==(const ChunkRangeIterator& other) const { return m_chunkIndex == other.m_chunkIndex; }
+   inline bool operator!=(const ChunkRangeIterator& other) const { return m_chunkIndex != other.m_chunkIndex; }
+   inline bool operator<(const ChunkRangeIterator& other) const { return m_chunkIndex < other.m_chunkIndex; }
+   inline bool operator>(const ChunkRangeIterator& other) const { return m_chunkIndex > other.m_chunkIndex; }
+   inline bool operator<=(const ChunkRangeIterator& other) const { return m_chunkIndex <= other.m_chunkIndex; }
+   inline bool operator>=(const ChunkRangeIterator& other) const { return m_chunkIndex >= other.m_chunkIndex; }
+
+   inline ChunkRangeIterator& operator++() { ++m_chunkIndex; return *this; }
+   inline ChunkRangeIterator operator++(int) { const ChunkRangeIterator it(*this); ++m_chunkIndex; return it; }
+   inline ChunkRangeIterator& operator--() { --m_chunkIndex; return *this; }
+   inline ChunkRangeIterator operator--(int) { const ChunkRangeIterator it(*this); --m_chunkIndex; return it; }
+
+   inline ChunkRangeIterator& operator+=(difference_type offset) { m_chunkIndex += offset; return *this; }
+   inline ChunkRangeIterator& operator-=(difference_type offset) { m_chunkIndex -= offset; return *this; }
+   inline ChunkRangeIterator operator+(difference_type offset) const { return ChunkRangeIterator(m_storage, m_chunkIndex + offset); }
+   inline ChunkRangeIterator operator-(difference_type offset) const { return ChunkRangeIterator(m_storage, m_chunkIndex - offset); }
+   friend inline ChunkRangeIterator operator+(difference_type offset, const ChunkRangeIterator& it) { return it + offset; }
+
+   inline difference_type operator-(const ChunkRangeIterator& other) const
+   {
+      return static_cast<difference_type>(m_chunkIndex) - static_cast<difference_type>(other.m_chunkIndex);
+   }
+
+   inline reference operator*() const { return reference(m_storage->ChunkBegin(m_chunkIndex), m_storage->End()); }
+   inline pointer operator->() const { return pointer(**this); }
+   inline reference operator[](difference_type offset) const { return *(*this + offset); }
+
+private:
+   TStoragePtr m_storage = nullptr;
+   size_t m_chunkIndex = 0;
+};
+
+
+} // namespace impl
+
+
+} // namespace slotmap
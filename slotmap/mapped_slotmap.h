@@ -0,0 +1,412 @@
+// vim: et:ts=3:sw=3:sts=3
+// Copyright (c) 2024, Jan Milik (jan.milik@gmail.com).
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <type_traits>
+#include <utility>
+
+#include "slotmap.h"
+
+/**
+ * The \ref MappedSlotMapStorage needs POSIX `mmap()` and `msync()`. Define
+ * `SLOTMAP_DISABLE_MAPPED_STORAGE` to leave it out.
+ */
+#if !defined(SLOTMAP_DISABLE_MAPPED_STORAGE) && defined(__has_include)
+#if __has_include(<sys/mman.h>) && __has_include(<unistd.h>)
+#define SLOTMAP_MAPPED_STORAGE 1
+#endif
+#endif
+#ifndef SLOTMAP_MAPPED_STORAGE
+#define SLOTMAP_MAPPED_STORAGE 0
+#endif
+
+#if SLOTMAP_MAPPED_STORAGE
+
+
+namespace slotmap {
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Default size of the address range reserved for the file of a
+ * \ref MappedSlotMapStorage, which limits how large the file can grow.
+ */
+constexpr size_t DefaultMaxMappedSize = (sizeof(void*) >= 8) ? (static_cast<size_t>(64) << 30) : (static_cast<size_t>(1) << 30);
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Result of \ref MappedSlotMapStorage::Open().
+ */
+enum class MappedOpenResult
+{
+   /**
+    * The file did not exist or was empty, the storage is empty.
+    */
+   Created,
+   /**
+    * The file was closed or flushed cleanly, all the keys are valid.
+    */
+   Opened,
+   /**
+    * The file was not flushed after its last modification (e.g. the process
+    * crashed). The free lists and the size have been rebuilt from the live
+    * bits of the chunks, the values written since the last flush may be
+    * lost or torn.
+    */
+   Recovered,
+   /**
+    * The file could not be opened or mapped, or it has not been written by
+    * a storage of the same type. The storage stays closed.
+    */
+   Failed,
+};
+
+
+namespace impl {
+/**
+ * Header of the file of a \ref MappedSlotMapStorage, stored in its first
+ * page. The chunks follow at \ref MappedSlotMapStorage::DataOffset.
+ */
+struct MappedFileHeader
+{
+   static constexpr uint64_t Magic = 0x50414d544f4c53ull; // "SLOTMAP"
+   static constexpr uint32_t Version = 1;
+
+   uint64_t m_magic;
+   uint32_t m_version;
+   uint32_t m_keySize;
+   uint64_t m_valueSize;
+   uint64_t m_valueAlignment;
+   uint64_t m_chunkSlots;
+   uint64_t m_chunkSize;
+   uint64_t m_chunkCount;
+   uint64_t m_maxUsedChunk;
+   uint64_t m_size;
+   int64_t m_firstFreeChunk;
+   // Set before the first modification after a flush and cleared by the
+   // next flush.
+   uint64_t m_dirty;
+   uint64_t m_checksum;
+};
+
+/**
+ * FNV-1a hash of the header without the checksum.
+ */
+inline uint64_t GetHeaderChecksum(const MappedFileHeader& header)
+{
+   const uint8_t* const bytes = reinterpret_cast<const uint8_t*>(&header);
+   uint64_t hash = 0xcbf29ce484222325ull;
+   for (size_t i = 0; i < offsetof(MappedFileHeader, m_checksum); ++i)
+   {
+      hash = (hash ^ bytes[i]) * 0x100000001b3ull;
+   }
+   return hash;
+}
+} // namespace impl
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * SlotMap storage whose chunks live in a memory-mapped file, so that a map
+ * can be closed and reopened later with all of its keys still valid.
+ *
+ * The chunks have the same layout as the chunks of the
+ * \ref ChunkedSlotMapStorage (live bits, generations and slots) and follow
+ * the header page of the file back to back, so the chunk directory is just
+ * the offset of the chunk, `DataOffset + chunkIndex * sizeof(Chunk)`. The
+ * address range for the largest allowed file is reserved by \ref Open(), so
+ * the file grows without moving the mapping and pointers to the values stay
+ * stable. Since the values are stored in the file as they are, `TValue`
+ * must be trivially copyable and must not point into the process (e.g. hold
+ * pointers).
+ *
+ * Opening a file that has been written by a storage with the same value
+ * size, key type and chunk layout takes a few system calls, the chunks are
+ * paged in on demand.
+ *
+ * Crash consistency: \ref Flush() writes all the chunks to the file with
+ * `msync()` first and only then the header with the size and the head of the
+ * chunk free list, a dirty flag cleared and a checksum. The first
+ * modification after a flush sets the dirty flag in the file before it
+ * changes any chunk. When \ref Open() finds the dirty flag set or the
+ * checksum wrong, it rebuilds the free lists and the size from the live
+ * bits of the chunks (see \ref MappedOpenResult::Recovered). The values
+ * themselves are not journaled, a value written after the last flush may be
+ * lost or torn, but the structure of the map is always valid.
+ *
+ * The storage is not copyable. Until \ref Open() succeeds, it has no
+ * capacity and all insertions fail.
+ */
+template<
+   typename TValue,
+   typename TKey = uint32_t,
+   size_t MaxChunkSize = DefaultMaxChunkSize>
+class MappedSlotMapStorage
+{
+public:
+   using ValueType = TValue;
+   using KeyType = TKey;
+   using GenerationType = uint8_t;
+   using BitsetTraits = FixedBitSetTraits<>;
+
+   using SizeType = size_t;
+   // Fixed width, so that the layout of the file does not depend on the
+   // platform.
+   using IndexType = int64_t;
+
+   static_assert(std::is_trivially_copyable_v<TValue>, "The values of a mapped slotmap must be trivially copyable.");
+   static_assert(std::is_unsigned_v<KeyType>, "Slotmap key type must be an unsigned integer type.");
+   static_assert(sizeof(KeyType) > sizeof(GenerationType), "The size of slotmap key type must be greater than the size of generation type.");
+
+   static constexpr KeyType InvalidKey = static_cast<KeyType>(0);
+
+   static constexpr size_t MaxChunkSlots = impl::GetChunkMaxSlots<MinChunkSlots, MaxChunkSize, MaxChunkSize, ValueType, IndexType, GenerationType, BitsetTraits>();
+   static constexpr int GenerationBitSize = sizeof(GenerationType) * CHAR_BIT;
+   static constexpr int SlotIndexBitSize = std::min(
+      impl::GetIndexBitSize(MaxChunkSlots),
+      static_cast<int>(sizeof(KeyType) * CHAR_BIT - GenerationBitSize - 1));
+   static constexpr int ChunkIndexBitSize = (sizeof(TKey) * CHAR_BIT) - GenerationBitSize - SlotIndexBitSize;
+
+   static constexpr KeyType ChunkSlots = std::min<KeyType>(static_cast<KeyType>(MaxChunkSlots), static_cast<KeyType>(1) << SlotIndexBitSize);
+   static_assert(ChunkSlots > 0, "Chunk must contain more than 0 slots.");
+
+   static constexpr KeyType ChunkIndexMask = (static_cast<KeyType>(1) << ChunkIndexBitSize) - 1;
+   static constexpr KeyType MaxChunkCount = ChunkIndexMask;
+
+   static constexpr KeyType SlotIndexShift = ChunkIndexBitSize;
+   static constexpr KeyType SlotIndexMask = (static_cast<KeyType>(1) << SlotIndexBitSize) - 1;
+
+   static constexpr KeyType GenerationShift = ChunkIndexBitSize + SlotIndexBitSize;
+   static constexpr KeyType GenerationMask = (static_cast<KeyType>(1) << GenerationBitSize) - 1;
+
+   static_assert(SlotIndexBitSize > 0);
+   static_assert(ChunkIndexBitSize > 0);
+
+   using Chunk = ChunkTpl<ChunkSlots, ValueType, IndexType, GenerationType, BitsetTraits>;
+   using Slot = typename Chunk::Slot;
+   static_assert(sizeof(Chunk) <= MaxChunkSize, "Chunk size is too large.");
+
+   /**
+    * Offset of the first chunk in the file, the header takes one page.
+    */
+   static constexpr SizeType DataOffset = 4096;
+   static_assert(sizeof(impl::MappedFileHeader) <= DataOffset);
+   static_assert(alignof(Chunk) <= DataOffset);
+
+   template<bool IsConst>
+   class IteratorTpl
+   {
+      friend class MappedSlotMapStorage;
+
+   public:
+      using StoragePtr = std::conditional_t<IsConst, const MappedSlotMapStorage*, MappedSlotMapStorage*>;
+      using ReferenceType = std::conditional_t<IsConst, const ValueType&, ValueType&>;
+      using PointerType = std::conditional_t<IsConst, const ValueType*, ValueType*>;
+
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = std::pair<KeyType, ReferenceType>;
+      using difference_type = std::ptrdiff_t;
+      using reference = value_type;
+      using pointer = impl::ArrowProxy<value_type>;
+
+      IteratorTpl() = default;
+
+   private:
+      constexpr IteratorTpl(StoragePtr storage, size_t chunkIndex, size_t slotIndex)
+         : m_storage(storage), m_chunkIndex(chunkIndex), m_slotIndex(slotIndex)
+      {}
+      constexpr IteratorTpl(StoragePtr storage)
+         : m_storage(storage)
+      {}
+
+   public:
+      inline bool operator==(const IteratorTpl& other) const { return m_key == other.m_key; }
+      inline bool operator!=(const IteratorTpl& other) const { return m_key != other.m_key; }
+
+      inline IteratorTpl& operator++() { Advance(); return *this; }
+      inline IteratorTpl operator++(int) { const IteratorTpl it(*this); Advance(); return it; }
+
+      inline KeyType GetKey() const { return m_key; }
+      inline PointerType GetPtr() const { return m_ptr; }
+
+      inline reference operator*() const { return reference(m_key, *m_ptr); }
+      inline pointer operator->() const { return pointer(**this); }
+
+      inline bool Advance() { ++m_slotIndex; return FindNext(); }
+
+   private:
+      bool FindNext();
+
+      StoragePtr m_storage = nullptr;
+      SizeType m_chunkIndex = 0;
+      SizeType m_slotIndex = 0;
+
+      KeyType m_key = std::numeric_limits<KeyType>::max();
+      PointerType m_ptr = nullptr;
+   };
+
+   using Iterator = IteratorTpl<false>;
+   using ConstIterator = IteratorTpl<true>;
+
+   MappedSlotMapStorage() = default;
+   MappedSlotMapStorage(const MappedSlotMapStorage&) = delete;
+   MappedSlotMapStorage(MappedSlotMapStorage&& other);
+
+   /**
+    * Flushes and closes the file.
+    */
+   ~MappedSlotMapStorage();
+
+   MappedSlotMapStorage& operator=(const MappedSlotMapStorage&) = delete;
+   MappedSlotMapStorage& operator=(MappedSlotMapStorage&& other);
+
+   /**
+    * Opens the file at `path`, creating it if it does not exist, and maps
+    * it. A file of a storage that is already open is closed first.
+    *
+    * `maxFileSize` is the size of the address range reserved for the file
+    * and limits the capacity of the storage. It is raised to the size of the
+    * file if the file is larger.
+    */
+   MappedOpenResult Open(const char* path, SizeType maxFileSize = DefaultMaxMappedSize);
+   /**
+    * Writes all the chunks and then the header to the file (see the crash
+    * consistency notes of the class). Returns `false` if the storage is not
+    * open or `msync()` fails.
+    */
+   bool Flush();
+   /**
+    * Flushes and closes the file. The storage is empty afterwards.
+    */
+   void Close();
+   inline bool IsOpen() const { return m_base != nullptr; }
+
+   inline SizeType Size() const { return m_size; }
+   inline SizeType Capacity() const { return m_chunkCount * ChunkSlots; }
+   inline static constexpr SizeType MaxCapacity() { return MaxChunkCount * ChunkSlots; }
+
+   bool Reserve(SizeType capacity);
+
+   TValue* GetPtr(TKey key) const;
+   void GetPtrBatch(const TKey* keys, size_t count, TValue** outPtrs) const;
+   inline void GetPtrBatch(const TKey* keys, size_t count, const TValue** outPtrs) const { GetPtrBatch(keys, count, const_cast<TValue**>(outPtrs)); }
+
+   SizeType GetIndexByKey(KeyType key) const;
+   KeyType GetKeyByIndex(SizeType index) const;
+
+   bool FindNextKey(TKey& key) const;
+   KeyType IncrementKey(TKey key) const;
+
+   template<typename TFunc>
+   void ForEachSlot(TFunc func) const;
+
+   template<typename TFunc, typename TExecutor>
+   void ParallelForEachSlot(TFunc func, TExecutor&& executor) const;
+
+   KeyType ReserveSlot(ValueType*& outPtr);
+   KeyType ReserveSlotNoAlloc(ValueType*& outPtr);
+   bool FreeSlot(KeyType key);
+
+   void Swap(MappedSlotMapStorage& other);
+   void Clear();
+
+   Iterator Begin() { Iterator it(this, 0, 0); it.FindNext(); return it; }
+   constexpr Iterator End() { return Iterator(this); }
+
+   ConstIterator Begin() const { ConstIterator it(this, 0, 0); it.FindNext(); return it; }
+   constexpr ConstIterator End() const { return ConstIterator(this); }
+
+private:
+   static inline constexpr KeyType MakeKey(GenerationType generation, SizeType slotIndex, SizeType chunkIndex)
+   {
+      return (static_cast<KeyType>(generation) << GenerationShift) |
+         (static_cast<KeyType>(slotIndex) << SlotIndexShift) |
+         static_cast<KeyType>(chunkIndex);
+   }
+
+   inline Chunk* GetChunk(SizeType chunkIndex) const
+   {
+      return reinterpret_cast<Chunk*>(m_base + DataOffset + chunkIndex * sizeof(Chunk));
+   }
+
+   inline impl::MappedFileHeader* GetHeader() const
+   {
+      return reinterpret_cast<impl::MappedFileHeader*>(m_base);
+   }
+
+   // Sets the dirty flag in the file before the first modification after a
+   // flush.
+   inline void MarkDirty()
+   {
+      if (!m_isDirty)
+      {
+         WriteHeader(true);
+      }
+   }
+
+   template<typename TFunc>
+   void ForEachSlotInChunks(SizeType beginChunk, SizeType endChunk, TFunc& func) const;
+
+   bool GrowFile(SizeType chunkCount);
+   bool AllocateChunk();
+   static void InitializeChunk(Chunk* chunk);
+   bool IsCompatible(const impl::MappedFileHeader& header) const;
+   void Recover(SizeType chunkCount);
+   bool WriteHeader(bool isDirty);
+
+   int m_file = -1;
+   uint8_t* m_base = nullptr;
+   SizeType m_mappedSize = 0;
+   SizeType m_maxChunkCount = 0;
+   bool m_isDirty = false;
+
+   SizeType m_size = 0;
+   IndexType m_firstFreeChunk = -1;
+   SizeType m_maxUsedChunk = 0;
+   SizeType m_chunkCount = 0;
+};
+
+
+/**
+ * \ref SlotMap that lives in a memory-mapped file (see
+ * \ref MappedSlotMapStorage). Open the file with
+ * `map.GetStorage().Open(path)`.
+ */
+template<typename TValue, typename TKey = uint32_t>
+using MappedSlotMap = SlotMap<TValue, TKey, MappedSlotMapStorage<TValue, TKey>>;
+
+
+} // namespace slotmap
+
+
+#include "mapped_slotmap.inl"
+
+
+#endif // SLOTMAP_MAPPED_STORAGE
@@ -0,0 +1,719 @@
+// vim: et:ts=3:sw=3:sts=3
+// Copyright (c) 2024, Jan Milik (jan.milik@gmail.com).
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <algorithm>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace slotmap {
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+template<bool IsConst>
+bool MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::IteratorTpl<IsConst>::FindNext()
+{
+   for (; m_chunkIndex < m_storage->m_maxUsedChunk; ++m_chunkIndex)
+   {
+      auto* chunk = m_storage->GetChunk(m_chunkIndex);
+      if ((m_slotIndex < ChunkSlots) && !chunk->IsFull())
+      {
+         m_slotIndex = BitsetTraits::FindNextBitSet(chunk->m_liveBits, m_slotIndex);
+      }
+      if (m_slotIndex < ChunkSlots)
+      {
+         m_key = MakeKey(chunk->m_generations[m_slotIndex], m_slotIndex, m_chunkIndex);
+         m_ptr = chunk->m_slots[m_slotIndex].GetPtr();
+         return true;
+      }
+      m_slotIndex = 0;
+   }
+
+   m_key = std::numeric_limits<KeyType>::max();
+   m_ptr = nullptr;
+   return false;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::MappedSlotMapStorage(MappedSlotMapStorage&& other)
+{
+   Swap(other);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::~MappedSlotMapStorage()
+{
+   Close();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+MappedSlotMapStorage<TValue, TKey, MaxChunkSize>& MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::operator=(MappedSlotMapStorage&& other)
+{
+   if (this != &other)
+   {
+      Close();
+      Swap(other);
+   }
+   return *this;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+MappedOpenResult MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::Open(const char* path, SizeType maxFileSize)
+{
+   Close();
+
+   m_file = open(path, O_RDWR | O_CREAT, 0644);
+   if (m_file < 0)
+   {
+      return MappedOpenResult::Failed;
+   }
+
+   struct stat fileStat;
+   if (fstat(m_file, &fileStat) != 0)
+   {
+      Close();
+      return MappedOpenResult::Failed;
+   }
+   const SizeType fileSize = static_cast<SizeType>(fileStat.st_size);
+
+   // The whole range is reserved up front, so that the chunks never move.
+   // Only the part backed by the file may be touched.
+   const SizeType maxSize = std::max({ maxFileSize, fileSize, DataOffset });
+   m_maxChunkCount = std::min<SizeType>((maxSize - DataOffset) / sizeof(Chunk), MaxChunkCount);
+   m_mappedSize = DataOffset + m_maxChunkCount * sizeof(Chunk);
+   void* const mapped = mmap(nullptr, m_mappedSize, PROT_READ | PROT_WRITE, MAP_SHARED, m_file, 0);
+   if (mapped == MAP_FAILED)
+   {
+      Close();
+      return MappedOpenResult::Failed;
+   }
+   m_base = static_cast<uint8_t*>(mapped);
+
+   if (fileSize == 0)
+   {
+      if (ftruncate(m_file, DataOffset) != 0)
+      {
+         Close();
+         return MappedOpenResult::Failed;
+      }
+      impl::MappedFileHeader* const header = GetHeader();
+      header->m_magic = impl::MappedFileHeader::Magic;
+      header->m_version = impl::MappedFileHeader::Version;
+      header->m_keySize = sizeof(KeyType);
+      header->m_valueSize = sizeof(ValueType);
+      header->m_valueAlignment = alignof(ValueType);
+      header->m_chunkSlots = ChunkSlots;
+      header->m_chunkSize = sizeof(Chunk);
+      m_isDirty = true;
+      Flush();
+      return MappedOpenResult::Created;
+   }
+
+   const impl::MappedFileHeader& header = *GetHeader();
+   if ((fileSize < DataOffset) || !IsCompatible(header))
+   {
+      Close();
+      return MappedOpenResult::Failed;
+   }
+
+   const SizeType fileChunkCount = std::min<SizeType>((fileSize - DataOffset) / sizeof(Chunk), m_maxChunkCount);
+   const bool isClean = (header.m_dirty == 0) &&
+      (header.m_checksum == impl::GetHeaderChecksum(header)) &&
+      (header.m_chunkCount <= fileChunkCount) &&
+      (header.m_maxUsedChunk <= header.m_chunkCount) &&
+      (header.m_firstFreeChunk < static_cast<int64_t>(header.m_maxUsedChunk));
+   if (!isClean)
+   {
+      Recover(fileChunkCount);
+      m_isDirty = true;
+      Flush();
+      return MappedOpenResult::Recovered;
+   }
+
+   m_size = header.m_size;
+   m_firstFreeChunk = header.m_firstFreeChunk;
+   m_maxUsedChunk = header.m_maxUsedChunk;
+   m_chunkCount = header.m_chunkCount;
+   m_isDirty = false;
+   return MappedOpenResult::Opened;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+bool MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::Flush()
+{
+   if (!m_base)
+   {
+      return false;
+   }
+
+   if (!m_isDirty)
+   {
+      // Only the values might have changed.
+      return msync(m_base + DataOffset, m_chunkCount * sizeof(Chunk), MS_SYNC) == 0;
+   }
+
+   // The chunks must be on the disk before the header says they are valid.
+   if ((m_chunkCount > 0) && (msync(m_base + DataOffset, m_chunkCount * sizeof(Chunk), MS_SYNC) != 0))
+   {
+      return false;
+   }
+   return WriteHeader(false);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+void MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::Close()
+{
+   if (m_base)
+   {
+      Flush();
+      munmap(m_base, m_mappedSize);
+   }
+   if (m_file >= 0)
+   {
+      close(m_file);
+   }
+
+   m_file = -1;
+   m_base = nullptr;
+   m_mappedSize = 0;
+   m_maxChunkCount = 0;
+   m_isDirty = false;
+   m_size = 0;
+   m_firstFreeChunk = -1;
+   m_maxUsedChunk = 0;
+   m_chunkCount = 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+bool MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::Reserve(SizeType capacity)
+{
+   if (capacity <= Capacity())
+   {
+      return true;
+   }
+
+   const SizeType chunkCount = (capacity + ChunkSlots - 1) / ChunkSlots;
+   if (!m_base || (chunkCount > m_maxChunkCount))
+   {
+      return false;
+   }
+
+   MarkDirty();
+   return GrowFile(chunkCount);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+TValue* MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::GetPtr(TKey key) const
+{
+   const KeyType chunkIndex = key & ChunkIndexMask;
+   if (chunkIndex >= m_maxUsedChunk)
+   {
+      return nullptr;
+   }
+
+   Chunk* const chunk = GetChunk(chunkIndex);
+   const KeyType slotIndex = (key >> SlotIndexShift) & SlotIndexMask;
+   if ((slotIndex >= ChunkSlots) || !chunk->m_liveBits.test(slotIndex))
+   {
+      return nullptr;
+   }
+
+   const GenerationType generation = (key >> GenerationShift) & GenerationMask;
+   if (chunk->m_generations[slotIndex] != generation)
+   {
+      return nullptr;
+   }
+
+   return chunk->m_slots[slotIndex].GetPtr();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+void MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::GetPtrBatch(const TKey* keys, size_t count, TValue** outPtrs) const
+{
+   // The chunks are found without a pointer load, so the generations can be
+   // prefetched right away.
+   for (size_t groupBegin = 0; groupBegin < count; groupBegin += impl::LookupGroupSize)
+   {
+      const size_t groupSize = std::min(count - groupBegin, impl::LookupGroupSize);
+      for (size_t i = 0; i < groupSize; ++i)
+      {
+         const TKey key = keys[groupBegin + i];
+         const KeyType chunkIndex = key & ChunkIndexMask;
+         const KeyType slotIndex = (key >> SlotIndexShift) & SlotIndexMask;
+         if ((chunkIndex < m_maxUsedChunk) && (slotIndex < ChunkSlots))
+         {
+            impl::Prefetch(&GetChunk(chunkIndex)->m_generations[slotIndex]);
+         }
+      }
+      for (size_t i = 0; i < groupSize; ++i)
+      {
+         outPtrs[groupBegin + i] = GetPtr(keys[groupBegin + i]);
+      }
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+typename MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::SizeType
+MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::GetIndexByKey(TKey key) const
+{
+   const KeyType chunkIndex = key & ChunkIndexMask;
+   const KeyType slotIndex = (key >> SlotIndexShift) & SlotIndexMask;
+
+   return static_cast<SizeType>(chunkIndex * ChunkSlots + slotIndex);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+TKey MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::GetKeyByIndex(SizeType index) const
+{
+   const SizeType chunkIndex = index / ChunkSlots;
+   if (chunkIndex >= m_maxUsedChunk)
+   {
+      return InvalidKey;
+   }
+
+   const SizeType slotIndex = index % ChunkSlots;
+   const Chunk* const chunk = GetChunk(chunkIndex);
+   if (!chunk->m_liveBits.test(slotIndex))
+   {
+      return InvalidKey;
+   }
+
+   return MakeKey(chunk->m_generations[slotIndex], slotIndex, chunkIndex);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+bool MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::FindNextKey(TKey& key) const
+{
+   KeyType chunkIndex = key & ChunkIndexMask;
+   KeyType slotIndex = (key >> SlotIndexShift) & SlotIndexMask;
+
+   for (; chunkIndex < m_maxUsedChunk; ++chunkIndex)
+   {
+      const Chunk* const chunk = GetChunk(chunkIndex);
+      if (!chunk->IsFull())
+      {
+         slotIndex = static_cast<KeyType>(BitsetTraits::FindNextBitSet(chunk->m_liveBits, slotIndex));
+      }
+      if (slotIndex < ChunkSlots)
+      {
+         key = MakeKey(chunk->m_generations[slotIndex], slotIndex, chunkIndex);
+         return true;
+      }
+
+      slotIndex = 0;
+   }
+
+   return false;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+TKey MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::IncrementKey(TKey key) const
+{
+   const KeyType chunkIndex = key & ChunkIndexMask;
+   const KeyType slotIndex = ((key >> SlotIndexShift) & SlotIndexMask) + 1;
+
+   if (slotIndex < ChunkSlots)
+   {
+      return (slotIndex << SlotIndexShift) | chunkIndex;
+   }
+
+   return chunkIndex + 1;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+template<typename TFunc>
+void MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::ForEachSlot(TFunc func) const
+{
+   ForEachSlotInChunks(0, m_maxUsedChunk, func);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+template<typename TFunc, typename TExecutor>
+void MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::ParallelForEachSlot(TFunc func, TExecutor&& executor) const
+{
+   const size_t rangeCount = std::min(m_maxUsedChunk, impl::GetExecutorConcurrency(executor) * impl::TasksPerThread);
+   if (rangeCount <= 1)
+   {
+      ForEachSlot(func);
+      return;
+   }
+
+   constexpr size_t ChunkScanCost = ChunkSlots / (sizeof(uint64_t) * CHAR_BIT) + 1;
+
+   const std::vector<size_t> bounds = impl::SplitByWeight(m_maxUsedChunk, rangeCount, [this](size_t chunkIndex)
+   {
+      return static_cast<size_t>(GetChunk(chunkIndex)->m_liveCount) + ChunkScanCost;
+   });
+
+   impl::ExecuteParallelFor(std::forward<TExecutor>(executor), bounds.size() - 1, [&](size_t rangeIndex)
+   {
+      ForEachSlotInChunks(bounds[rangeIndex], bounds[rangeIndex + 1], func);
+   });
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+template<typename TFunc>
+void MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::ForEachSlotInChunks(SizeType beginChunk, SizeType endChunk, TFunc& func) const
+{
+   for (SizeType chunkIndex = beginChunk; chunkIndex < endChunk; ++chunkIndex)
+   {
+      const Chunk* const chunk = GetChunk(chunkIndex);
+      const auto visitSlot = [&](size_t slotIndex)
+      {
+         func(MakeKey(chunk->m_generations[slotIndex], slotIndex, chunkIndex), *chunk->m_slots[slotIndex].GetPtr());
+      };
+
+      if (chunk->IsFull())
+      {
+         for (size_t slotIndex = 0; slotIndex < ChunkSlots; ++slotIndex)
+         {
+            visitSlot(slotIndex);
+         }
+      }
+      else
+      {
+         BitsetTraits::ForEachSetBit(chunk->m_liveBits, visitSlot);
+      }
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+TKey MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::ReserveSlot(ValueType*& outPtr)
+{
+   if ((m_firstFreeChunk < 0) && !AllocateChunk())
+   {
+      outPtr = nullptr;
+      return InvalidKey;
+   }
+
+   return ReserveSlotNoAlloc(outPtr);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+TKey MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::ReserveSlotNoAlloc(ValueType*& outPtr)
+{
+   if (m_firstFreeChunk < 0)
+   {
+      outPtr = nullptr;
+      return InvalidKey;
+   }
+
+   MarkDirty();
+
+   const SizeType chunkIndex = static_cast<SizeType>(m_firstFreeChunk);
+   Chunk* const chunk = GetChunk(chunkIndex);
+   assert(chunk->m_firstFreeSlot >= 0);
+
+   const SizeType slotIndex = static_cast<SizeType>(chunk->m_firstFreeSlot);
+   Slot* const slot = chunk->m_slots + slotIndex;
+   outPtr = slot->GetPtr();
+
+   chunk->m_firstFreeSlot = slot->m_nextFreeSlot;
+   if (chunk->m_firstFreeSlot < 0)
+   {
+      chunk->m_lastFreeSlot = -1;
+      m_firstFreeChunk = chunk->m_nextFreeChunk;
+   }
+
+   // Zero is skipped, so that a key is never equal to InvalidKey.
+   GenerationType& generation = chunk->m_generations[slotIndex];
+   ++generation;
+   if (generation == 0)
+   {
+      generation = 1;
+   }
+
+   assert(!chunk->m_liveBits[slotIndex]);
+   chunk->m_liveBits.set(slotIndex);
+   ++chunk->m_liveCount;
+   ++m_size;
+
+   return MakeKey(generation, slotIndex, chunkIndex);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+bool MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::FreeSlot(KeyType key)
+{
+   if (!GetPtr(key))
+   {
+      return false;
+   }
+
+   MarkDirty();
+
+   const SizeType chunkIndex = key & ChunkIndexMask;
+   const SizeType slotIndex = (key >> SlotIndexShift) & SlotIndexMask;
+   Chunk* const chunk = GetChunk(chunkIndex);
+
+   chunk->m_liveBits.reset(slotIndex);
+   --chunk->m_liveCount;
+   assert(m_size > 0);
+   --m_size;
+
+   chunk->m_slots[slotIndex].m_nextFreeSlot = chunk->m_firstFreeSlot;
+   const bool isChunkInFreeList = (chunk->m_firstFreeSlot >= 0);
+   chunk->m_firstFreeSlot = static_cast<IndexType>(slotIndex);
+   if (!isChunkInFreeList)
+   {
+      chunk->m_lastFreeSlot = static_cast<IndexType>(slotIndex);
+      chunk->m_nextFreeChunk = m_firstFreeChunk;
+      m_firstFreeChunk = static_cast<IndexType>(chunkIndex);
+   }
+
+   return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+void MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::Swap(MappedSlotMapStorage& other)
+{
+   std::swap(m_file, other.m_file);
+   std::swap(m_base, other.m_base);
+   std::swap(m_mappedSize, other.m_mappedSize);
+   std::swap(m_maxChunkCount, other.m_maxChunkCount);
+   std::swap(m_isDirty, other.m_isDirty);
+   std::swap(m_size, other.m_size);
+   std::swap(m_firstFreeChunk, other.m_firstFreeChunk);
+   std::swap(m_maxUsedChunk, other.m_maxUsedChunk);
+   std::swap(m_chunkCount, other.m_chunkCount);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+void MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::Clear()
+{
+   if (m_maxUsedChunk == 0)
+   {
+      return;
+   }
+
+   // The values are trivially destructible. The generations stay in the
+   // chunks, so that the old keys do not become valid again. The live bits
+   // are cleared in the file, which is what a recovery trusts.
+   MarkDirty();
+   for (SizeType chunkIndex = 0; chunkIndex < m_maxUsedChunk; ++chunkIndex)
+   {
+      Chunk* const chunk = GetChunk(chunkIndex);
+      chunk->m_liveBits.reset();
+      chunk->m_liveCount = 0;
+   }
+   m_size = 0;
+   m_firstFreeChunk = -1;
+   m_maxUsedChunk = 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+bool MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::GrowFile(SizeType chunkCount)
+{
+   assert(chunkCount > m_chunkCount);
+   assert(chunkCount <= m_maxChunkCount);
+
+   // The new part of the file reads as zeros.
+   if (ftruncate(m_file, static_cast<off_t>(DataOffset + chunkCount * sizeof(Chunk))) != 0)
+   {
+      return false;
+   }
+
+   for (SizeType chunkIndex = m_chunkCount; chunkIndex < chunkCount; ++chunkIndex)
+   {
+      new (GetChunk(chunkIndex)) Chunk();
+   }
+   m_chunkCount = chunkCount;
+
+   return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+bool MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::AllocateChunk()
+{
+   if (m_maxUsedChunk >= m_chunkCount)
+   {
+      if (!m_base || (m_chunkCount >= m_maxChunkCount))
+      {
+         return false;
+      }
+
+      // The file grows by a quarter at a time, so that the number of
+      // `ftruncate()` calls stays logarithmic.
+      MarkDirty();
+      const SizeType chunkCount = std::min(m_maxChunkCount, m_chunkCount + std::max<SizeType>(m_chunkCount / 4, 1));
+      if (!GrowFile(chunkCount))
+      {
+         return false;
+      }
+   }
+
+   MarkDirty();
+
+   const SizeType chunkIndex = m_maxUsedChunk++;
+   Chunk* const chunk = GetChunk(chunkIndex);
+   InitializeChunk(chunk);
+   chunk->m_nextFreeChunk = m_firstFreeChunk;
+   m_firstFreeChunk = static_cast<IndexType>(chunkIndex);
+
+   return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+void MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::InitializeChunk(Chunk* chunk)
+{
+   chunk->m_liveBits.reset();
+   for (SizeType slotIndex = 0; slotIndex < ChunkSlots - 1; ++slotIndex)
+   {
+      chunk->m_slots[slotIndex].m_nextFreeSlot = static_cast<IndexType>(slotIndex + 1);
+   }
+   chunk->m_slots[ChunkSlots - 1].m_nextFreeSlot = -1;
+   chunk->m_firstFreeSlot = 0;
+   chunk->m_lastFreeSlot = ChunkSlots - 1;
+   chunk->m_liveCount = 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+bool MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::IsCompatible(const impl::MappedFileHeader& header) const
+{
+   return (header.m_magic == impl::MappedFileHeader::Magic) &&
+      (header.m_version == impl::MappedFileHeader::Version) &&
+      (header.m_keySize == sizeof(KeyType)) &&
+      (header.m_valueSize == sizeof(ValueType)) &&
+      (header.m_valueAlignment == alignof(ValueType)) &&
+      (header.m_chunkSlots == ChunkSlots) &&
+      (header.m_chunkSize == sizeof(Chunk));
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+void MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::Recover(SizeType chunkCount)
+{
+   // Only the live bits and the generations are trusted. Every chunk in the
+   // file counts as used and its free list is rebuilt in slot order.
+   m_chunkCount = chunkCount;
+   m_maxUsedChunk = chunkCount;
+   m_size = 0;
+   m_firstFreeChunk = -1;
+
+   for (SizeType chunkIndex = chunkCount; chunkIndex-- > 0;)
+   {
+      Chunk* const chunk = GetChunk(chunkIndex);
+      chunk->m_firstFreeSlot = -1;
+      chunk->m_lastFreeSlot = -1;
+      chunk->m_prevFreeChunk = -1;
+      chunk->m_retiredSlotCount = 0;
+      chunk->m_liveCount = static_cast<IndexType>(BitsetTraits::Count(chunk->m_liveBits));
+      m_size += static_cast<SizeType>(chunk->m_liveCount);
+
+      for (IndexType slotIndex = static_cast<IndexType>(ChunkSlots) - 1; slotIndex >= 0; --slotIndex)
+      {
+         if (!chunk->m_liveBits.test(static_cast<SizeType>(slotIndex)))
+         {
+            chunk->m_slots[slotIndex].m_nextFreeSlot = chunk->m_firstFreeSlot;
+            chunk->m_firstFreeSlot = slotIndex;
+            if (chunk->m_lastFreeSlot < 0)
+            {
+               chunk->m_lastFreeSlot = slotIndex;
+            }
+         }
+      }
+
+      if (chunk->m_firstFreeSlot >= 0)
+      {
+         chunk->m_nextFreeChunk = m_firstFreeChunk;
+         m_firstFreeChunk = static_cast<IndexType>(chunkIndex);
+      }
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, size_t MaxChunkSize>
+bool MappedSlotMapStorage<TValue, TKey, MaxChunkSize>::WriteHeader(bool isDirty)
+{
+   impl::MappedFileHeader* const header = GetHeader();
+   header->m_chunkCount = m_chunkCount;
+   header->m_maxUsedChunk = m_maxUsedChunk;
+   header->m_size = m_size;
+   header->m_firstFreeChunk = m_firstFreeChunk;
+   header->m_dirty = isDirty ? 1 : 0;
+   header->m_checksum = impl::GetHeaderChecksum(*header);
+
+   m_isDirty = isDirty;
+   return msync(m_base, DataOffset, MS_SYNC) == 0;
+}
+
+
+} // namespace slotmap
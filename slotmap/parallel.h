@@ -0,0 +1,536 @@
+// vim: et:ts=3:sw=3:sts=3
+// Copyright (c) 2024, Jan Milik (jan.milik@gmail.com).
+// 
+// All rights reserved.
+//
+// MIT License
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <limits>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+/**
+ * C++17 execution policies (e.g. `std::execution::par`) are accepted as
+ * executors when the standard library provides them. Note that some standard
+ * library implementations require an additional library for the parallel
+ * policies (e.g. TBB for libstdc++). Define
+ * `SLOTMAP_DISABLE_EXECUTION_POLICIES` to avoid including `<execution>`.
+ */
+#if !defined(SLOTMAP_DISABLE_EXECUTION_POLICIES) && defined(__has_include)
+#if __has_include(<execution>)
+#include <execution>
+#endif
+#endif
+
+#if !defined(SLOTMAP_DISABLE_EXECUTION_POLICIES) && defined(__cpp_lib_execution)
+#define SLOTMAP_EXECUTION_POLICIES 1
+#else
+#define SLOTMAP_EXECUTION_POLICIES 0
+#endif
+
+
+namespace slotmap {
+
+
+namespace impl {
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Size used to keep frequently modified shared atomics on separate cache lines.
+ */
+constexpr size_t CacheLineSize = 64;
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Number of tasks per thread of an executor that a parallel loop is split
+ * into. More tasks than threads give work stealing room to even out the
+ * differences in the cost of the tasks.
+ */
+constexpr size_t TasksPerThread = 4;
+
+
+} // namespace impl
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Executor that runs all tasks on the calling thread.
+ *
+ * An executor is any object that provides `size_t GetConcurrency() const`
+ * returning the number of threads it runs tasks on and
+ * `void ParallelFor(size_t taskCount, TFunc&& func)` that calls `func(index)`
+ * for every index in `[0, taskCount)` and returns once all calls are done.
+ */
+struct SequentialExecutor
+{
+   inline size_t GetConcurrency() const { return 1; }
+
+   template<typename TFunc>
+   void ParallelFor(size_t taskCount, TFunc&& func) const
+   {
+      for (size_t taskIndex = 0; taskIndex < taskCount; ++taskIndex)
+      {
+         func(taskIndex);
+      }
+   }
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Pool of `std::thread` workers that run parallel loops with work stealing.
+ *
+ * `ParallelFor()` gives every participating thread a contiguous range of task
+ * indices. A thread takes tasks from the front of its own range and when it
+ * runs out of work, it steals the back half of the largest range left to
+ * another thread. The calling thread participates as well, so a pool with no
+ * workers runs all tasks on the calling thread.
+ *
+ * Only one `ParallelFor()` runs on the pool at a time. Nested calls from
+ * inside a task and calls made while another thread uses the pool run on the
+ * calling thread instead of waiting. Tasks must not throw.
+ */
+class ThreadPool
+{
+public:
+   explicit ThreadPool(size_t workerCount = GetDefaultWorkerCount());
+   ~ThreadPool();
+
+   ThreadPool(const ThreadPool&) = delete;
+   ThreadPool& operator=(const ThreadPool&) = delete;
+
+   /**
+    * Returns the number of threads running tasks, including the calling thread.
+    */
+   inline size_t GetConcurrency() const { return m_workers.size() + 1; }
+
+   template<typename TFunc>
+   void ParallelFor(size_t taskCount, TFunc&& func);
+
+   /**
+    * Returns the pool shared by all parallel algorithms that don't get an
+    * explicit executor. It's created on first use.
+    */
+   static ThreadPool& GetDefault();
+
+   /**
+    * Returns one worker less than the number of hardware threads, because
+    * the calling thread takes part in the work as well.
+    */
+   static size_t GetDefaultWorkerCount();
+
+private:
+   using JobFunc = void (*)(void* context, size_t taskIndex);
+
+   // Range of task indices with `begin` in the low and `end` in the high 32 bits.
+   struct alignas(impl::CacheLineSize) TaskRange
+   {
+      std::atomic<uint64_t> m_range{0};
+   };
+
+   static constexpr uint64_t MakeRange(uint64_t begin, uint64_t end) { return (end << 32) | begin; }
+   static constexpr uint32_t GetRangeBegin(uint64_t range) { return static_cast<uint32_t>(range); }
+   static constexpr uint32_t GetRangeEnd(uint64_t range) { return static_cast<uint32_t>(range >> 32); }
+
+   static ThreadPool*& CurrentPool();
+
+   void WorkerMain(size_t participantIndex);
+   void RunTasks(size_t participantIndex, JobFunc job, void* context);
+   bool PopTask(size_t participantIndex, size_t& outTaskIndex);
+   bool StealTasks(size_t participantIndex);
+
+   std::vector<std::thread> m_workers;
+   std::unique_ptr<TaskRange[]> m_ranges;
+
+   alignas(impl::CacheLineSize) std::atomic<size_t> m_remainingTasks{0};
+
+   std::mutex m_callerMutex;
+   std::mutex m_mutex;
+   std::condition_variable m_wakeCondition;
+   std::condition_variable m_doneCondition;
+   JobFunc m_job = nullptr;
+   void* m_jobContext = nullptr;
+   uint64_t m_jobId = 0;
+   size_t m_activeWorkers = 0;
+   bool m_stop = false;
+};
+
+
+namespace impl {
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Tells whether the given type is a standard execution policy.
+ */
+template<typename T>
+struct IsExecutionPolicy
+#if SLOTMAP_EXECUTION_POLICIES
+   : std::is_execution_policy<std::decay_t<T>>
+#else
+   : std::false_type
+#endif
+{
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Returns the number of threads the executor runs tasks on.
+ */
+template<typename TExecutor>
+inline size_t GetExecutorConcurrency(const TExecutor& executor)
+{
+   if constexpr (IsExecutionPolicy<TExecutor>::value)
+   {
+      return std::max<size_t>(std::thread::hardware_concurrency(), 1);
+   }
+   else
+   {
+      return std::max<size_t>(executor.GetConcurrency(), 1);
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Calls `func(index)` for every index in `[0, taskCount)` on the executor,
+ * which is either an executor object (see \ref SequentialExecutor) or
+ * a standard execution policy.
+ */
+template<typename TExecutor, typename TFunc>
+inline void ExecuteParallelFor(TExecutor&& executor, size_t taskCount, TFunc&& func)
+{
+#if SLOTMAP_EXECUTION_POLICIES
+   if constexpr (IsExecutionPolicy<TExecutor>::value)
+   {
+      std::vector<size_t> taskIndices(taskCount);
+      std::iota(taskIndices.begin(), taskIndices.end(), static_cast<size_t>(0));
+      std::for_each(std::forward<TExecutor>(executor), taskIndices.begin(), taskIndices.end(), [&func](size_t taskIndex)
+      {
+         func(taskIndex);
+      });
+   }
+   else
+#endif
+   {
+      executor.ParallelFor(taskCount, std::forward<TFunc>(func));
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Splits `[0, count)` into at most `rangeCount` consecutive non-empty ranges
+ * with roughly the same sum of `weight(index)`.
+ *
+ * Returns the boundaries of the ranges, i.e. range `i` is
+ * `[result[i], result[i + 1])`.
+ */
+template<typename TWeightFunc>
+std::vector<size_t> SplitByWeight(size_t count, size_t rangeCount, TWeightFunc weight)
+{
+   std::vector<size_t> prefixSums(count + 1);
+   prefixSums[0] = 0;
+   for (size_t index = 0; index < count; ++index)
+   {
+      prefixSums[index + 1] = prefixSums[index] + weight(index);
+   }
+
+   std::vector<size_t> bounds;
+   bounds.reserve(rangeCount + 1);
+   bounds.push_back(0);
+
+   const size_t totalWeight = prefixSums[count];
+   for (size_t rangeIndex = 1; rangeIndex < rangeCount; ++rangeIndex)
+   {
+      const size_t targetWeight = totalWeight * rangeIndex / rangeCount;
+      size_t bound = std::lower_bound(prefixSums.begin(), prefixSums.end(), targetWeight) - prefixSums.begin();
+      if ((bound > 0) && ((targetWeight - prefixSums[bound - 1]) < (prefixSums[bound] - targetWeight)))
+      {
+         --bound;
+      }
+      if ((bound > bounds.back()) && (bound < count))
+      {
+         bounds.push_back(bound);
+      }
+   }
+
+   if (count > 0)
+   {
+      bounds.push_back(count);
+   }
+   return bounds;
+}
+
+
+} // namespace impl
+
+
+//////////////////////////////////////////////////////////////////////////
+inline ThreadPool::ThreadPool(size_t workerCount)
+   : m_ranges(new TaskRange[workerCount + 1])
+{
+   m_workers.reserve(workerCount);
+   for (size_t workerIndex = 0; workerIndex < workerCount; ++workerIndex)
+   {
+      m_workers.emplace_back(&ThreadPool::WorkerMain, this, workerIndex + 1);
+   }
+}
+
+
+inline ThreadPool::~ThreadPool()
+{
+   {
+      std::lock_guard<std::mutex> lock(m_mutex);
+      m_stop = true;
+   }
+   m_wakeCondition.notify_all();
+
+   for (std::thread& worker : m_workers)
+   {
+      worker.join();
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+inline ThreadPool& ThreadPool::GetDefault()
+{
+   static ThreadPool pool;
+   return pool;
+}
+
+
+inline size_t ThreadPool::GetDefaultWorkerCount()
+{
+   const size_t hardwareThreads = std::thread::hardware_concurrency();
+   return (hardwareThreads > 1) ? (hardwareThreads - 1) : 0;
+}
+
+
+inline ThreadPool*& ThreadPool::CurrentPool()
+{
+   thread_local ThreadPool* pool = nullptr;
+   return pool;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TFunc>
+void ThreadPool::ParallelFor(size_t taskCount, TFunc&& func)
+{
+   assert(taskCount <= std::numeric_limits<uint32_t>::max());
+
+   if (taskCount == 0)
+   {
+      return;
+   }
+
+   std::unique_lock<std::mutex> callerLock(m_callerMutex, std::defer_lock);
+   if (m_workers.empty() || (taskCount == 1) || (CurrentPool() == this) || !callerLock.try_lock())
+   {
+      for (size_t taskIndex = 0; taskIndex < taskCount; ++taskIndex)
+      {
+         func(taskIndex);
+      }
+      return;
+   }
+
+   using FuncType = std::remove_reference_t<TFunc>;
+   const JobFunc job = [](void* context, size_t taskIndex)
+   {
+      (*static_cast<FuncType*>(context))(taskIndex);
+   };
+
+   void* const context = const_cast<void*>(static_cast<const void*>(std::addressof(func)));
+   const size_t participantCount = m_workers.size() + 1;
+   {
+      std::unique_lock<std::mutex> lock(m_mutex);
+
+      // Workers that woke up too late for the previous job may still be
+      // looking for work in the ranges.
+      m_doneCondition.wait(lock, [this]() { return m_activeWorkers == 0; });
+
+      for (size_t participantIndex = 0; participantIndex < participantCount; ++participantIndex)
+      {
+         const uint64_t begin = taskCount * participantIndex / participantCount;
+         const uint64_t end = taskCount * (participantIndex + 1) / participantCount;
+         m_ranges[participantIndex].m_range.store(MakeRange(begin, end), std::memory_order_relaxed);
+      }
+      m_remainingTasks.store(taskCount, std::memory_order_relaxed);
+      m_job = job;
+      m_jobContext = context;
+      ++m_jobId;
+   }
+   m_wakeCondition.notify_all();
+
+   ThreadPool* const previousPool = std::exchange(CurrentPool(), this);
+   RunTasks(0, job, context);
+   CurrentPool() = previousPool;
+
+   std::unique_lock<std::mutex> lock(m_mutex);
+   m_doneCondition.wait(lock, [this]()
+   {
+      return m_remainingTasks.load(std::memory_order_acquire) == 0;
+   });
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+inline void ThreadPool::WorkerMain(size_t participantIndex)
+{
+   CurrentPool() = this;
+
+   uint64_t lastJobId = 0;
+   for (;;)
+   {
+      JobFunc job = nullptr;
+      void* context = nullptr;
+      {
+         std::unique_lock<std::mutex> lock(m_mutex);
+         m_wakeCondition.wait(lock, [&]() { return m_stop || (m_jobId != lastJobId); });
+         if (m_stop)
+         {
+            return;
+         }
+         lastJobId = m_jobId;
+         job = m_job;
+         context = m_jobContext;
+         ++m_activeWorkers;
+      }
+
+      RunTasks(participantIndex, job, context);
+
+      {
+         std::lock_guard<std::mutex> lock(m_mutex);
+         --m_activeWorkers;
+      }
+      m_doneCondition.notify_all();
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+inline void ThreadPool::RunTasks(size_t participantIndex, JobFunc job, void* context)
+{
+   do
+   {
+      size_t taskIndex;
+      while (PopTask(participantIndex, taskIndex))
+      {
+         job(context, taskIndex);
+
+         if (m_remainingTasks.fetch_sub(1, std::memory_order_acq_rel) == 1)
+         {
+            // Locking makes sure the caller either sees the counter or waits
+            // for the notification.
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_doneCondition.notify_all();
+         }
+      }
+   }
+   while (StealTasks(participantIndex));
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+inline bool ThreadPool::PopTask(size_t participantIndex, size_t& outTaskIndex)
+{
+   std::atomic<uint64_t>& range = m_ranges[participantIndex].m_range;
+
+   uint64_t oldRange = range.load(std::memory_order_acquire);
+   for (;;)
+   {
+      const uint32_t begin = GetRangeBegin(oldRange);
+      const uint32_t end = GetRangeEnd(oldRange);
+      if (begin >= end)
+      {
+         return false;
+      }
+
+      if (range.compare_exchange_weak(oldRange, MakeRange(begin + 1, end), std::memory_order_acq_rel, std::memory_order_acquire))
+      {
+         outTaskIndex = begin;
+         return true;
+      }
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+inline bool ThreadPool::StealTasks(size_t participantIndex)
+{
+   const size_t participantCount = m_workers.size() + 1;
+
+   for (;;)
+   {
+      size_t victimIndex = participantIndex;
+      uint64_t victimRange = 0;
+      uint32_t victimSize = 0;
+
+      for (size_t offset = 1; offset < participantCount; ++offset)
+      {
+         const size_t index = (participantIndex + offset) % participantCount;
+         const uint64_t range = m_ranges[index].m_range.load(std::memory_order_acquire);
+         const uint32_t begin = GetRangeBegin(range);
+         const uint32_t end = GetRangeEnd(range);
+         if ((begin < end) && ((end - begin) > victimSize))
+         {
+            victimIndex = index;
+            victimRange = range;
+            victimSize = end - begin;
+         }
+      }
+
+      if (victimSize == 0)
+      {
+         return false;
+      }
+
+      const uint32_t begin = GetRangeBegin(victimRange);
+      const uint32_t end = GetRangeEnd(victimRange);
+      const uint32_t middle = begin + victimSize / 2;
+      if (m_ranges[victimIndex].m_range.compare_exchange_strong(victimRange, MakeRange(begin, middle), std::memory_order_acq_rel, std::memory_order_relaxed))
+      {
+         // Nobody else touches an empty range, so a plain store is enough.
+         m_ranges[participantIndex].m_range.store(MakeRange(middle, end), std::memory_order_release);
+         return true;
+      }
+   }
+}
+
+
+} // namespace slotmap
@@ -0,0 +1,310 @@
+// vim: et:ts=3:sw=3:sts=3
+// Copyright (c) 2024, Jan Milik (jan.milik@gmail.com).
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
+
+#include "slotmap.h"
+
+/**
+ * On Linux the slabs are mapped with `mmap()` and marked with
+ * `MADV_HUGEPAGE`, so that transparent huge pages can back them. Elsewhere
+ * they are allocated with the aligned `operator new`. Define
+ * `SLOTMAP_DISABLE_MMAP` to always use `operator new`.
+ */
+#if !defined(SLOTMAP_DISABLE_MMAP) && defined(__linux__)
+#include <sys/mman.h>
+#define SLOTMAP_MMAP 1
+#else
+#define SLOTMAP_MMAP 0
+#endif
+
+
+namespace slotmap {
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Size and alignment of the slabs of a \ref SlabPool, which is the size of a
+ * huge page on x86-64.
+ */
+constexpr size_t SlabSize = 2 * 1024 * 1024;
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Allocator of memory blocks carved out of large aligned slabs.
+ *
+ * The pool maps 2 MB slabs aligned to 2 MB and marks them for transparent
+ * huge pages, so that a storage with thousands of chunks is backed by a few
+ * huge pages instead of thousands of small ones, which takes pressure off
+ * the TLB during iteration and random lookups. Blocks are cache-line aligned
+ * and a block whose size is a multiple of the page size is also page
+ * aligned. Freed blocks are kept in a free list per block size and reused,
+ * the slabs are returned to the system only when the pool is destroyed.
+ * Blocks larger than a quarter of a slab or aligned to more than a page get
+ * slabs of their own, which are unmapped on deallocation.
+ *
+ * The pool is thread-safe.
+ */
+class SlabPool
+{
+public:
+   SlabPool() = default;
+   ~SlabPool();
+
+   SlabPool(const SlabPool&) = delete;
+   SlabPool& operator=(const SlabPool&) = delete;
+
+   void* Allocate(size_t size, size_t alignment);
+   void Deallocate(void* ptr, size_t size, size_t alignment);
+
+   /**
+    * Returns the number of slabs mapped by the pool, not counting the
+    * dedicated slabs of large blocks.
+    */
+   size_t SlabCount() const;
+
+private:
+   static constexpr size_t PageSize = 4096;
+
+   static size_t GetBlockSize(size_t size, size_t alignment);
+   static size_t GetBlockAlignment(size_t blockSize);
+   static bool IsDedicatedSlab(size_t blockSize, size_t alignment);
+   static void* AllocateSlab(size_t size);
+   static void FreeSlab(void* ptr, size_t size);
+
+   mutable std::mutex m_mutex;
+   std::vector<void*> m_slabs;
+   // Heads of the free lists, linked through the first word of each block.
+   std::unordered_map<size_t, void*> m_freeBlocks;
+   uint8_t* m_cursor = nullptr;
+   uint8_t* m_end = nullptr;
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Standard allocator that allocates from a shared \ref SlabPool.
+ *
+ * A default constructed allocator creates a new pool, copies and rebound
+ * copies share it. Used with the \ref ChunkedSlotMapStorage, every chunk is a
+ * separate block, so the chunks never move and pointers to elements stay
+ * stable (see \ref HugePageSlotMap).
+ */
+template<typename T>
+class SlabAllocator
+{
+public:
+   using value_type = T;
+   using propagate_on_container_copy_assignment = std::true_type;
+   using propagate_on_container_move_assignment = std::true_type;
+   using propagate_on_container_swap = std::true_type;
+
+   SlabAllocator() : m_pool(std::make_shared<SlabPool>()) {}
+   explicit SlabAllocator(std::shared_ptr<SlabPool> pool) : m_pool(std::move(pool)) {}
+
+   template<typename U>
+   SlabAllocator(const SlabAllocator<U>& other) : m_pool(other.GetPool()) {}
+
+   inline T* allocate(size_t count) { return static_cast<T*>(m_pool->Allocate(count * sizeof(T), alignof(T))); }
+   inline void deallocate(T* ptr, size_t count) { m_pool->Deallocate(ptr, count * sizeof(T), alignof(T)); }
+
+   inline const std::shared_ptr<SlabPool>& GetPool() const { return m_pool; }
+
+   template<typename U>
+   inline bool operator==(const SlabAllocator<U>& other) const { return m_pool == other.GetPool(); }
+   template<typename U>
+   inline bool operator!=(const SlabAllocator<U>& other) const { return m_pool != other.GetPool(); }
+
+private:
+   std::shared_ptr<SlabPool> m_pool;
+};
+
+
+/**
+ * \ref SlotMap whose chunks are carved out of huge page slabs (see
+ * \ref SlabPool).
+ */
+template<typename TValue, typename TKey = uint32_t>
+using HugePageSlotMap = SlotMap<TValue, TKey, ChunkedSlotMapStorage<TValue, TKey, DefaultMaxChunkSize, SlabAllocator<TValue>>>;
+
+
+//////////////////////////////////////////////////////////////////////////
+inline SlabPool::~SlabPool()
+{
+   for (void* slab : m_slabs)
+   {
+      FreeSlab(slab, SlabSize);
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+inline void* SlabPool::Allocate(size_t size, size_t alignment)
+{
+   const size_t blockSize = GetBlockSize(size, alignment);
+   if (IsDedicatedSlab(blockSize, alignment))
+   {
+      return AllocateSlab((blockSize + SlabSize - 1) & ~(SlabSize - 1));
+   }
+
+   std::lock_guard<std::mutex> lock(m_mutex);
+
+   void*& freeBlock = m_freeBlocks[blockSize];
+   if (freeBlock)
+   {
+      void* const block = freeBlock;
+      freeBlock = *static_cast<void**>(block);
+      return block;
+   }
+
+   // The blocks of one size are all aligned the same, so that the freed
+   // blocks can be reused for any allocation of that size.
+   const uintptr_t blockAlignment = GetBlockAlignment(blockSize);
+   const uintptr_t alignedCursor = (reinterpret_cast<uintptr_t>(m_cursor) + blockAlignment - 1) & ~(blockAlignment - 1);
+   uint8_t* block = reinterpret_cast<uint8_t*>(alignedCursor);
+   if (!m_cursor || (alignedCursor + blockSize > reinterpret_cast<uintptr_t>(m_end)))
+   {
+      // The rest of the current slab is left unused.
+      uint8_t* const slab = static_cast<uint8_t*>(AllocateSlab(SlabSize));
+      m_slabs.push_back(slab);
+      m_end = slab + SlabSize;
+      block = slab;
+   }
+
+   m_cursor = block + blockSize;
+   return block;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+inline void SlabPool::Deallocate(void* ptr, size_t size, size_t alignment)
+{
+   const size_t blockSize = GetBlockSize(size, alignment);
+   if (IsDedicatedSlab(blockSize, alignment))
+   {
+      FreeSlab(ptr, (blockSize + SlabSize - 1) & ~(SlabSize - 1));
+      return;
+   }
+
+   std::lock_guard<std::mutex> lock(m_mutex);
+
+   void*& freeBlock = m_freeBlocks[blockSize];
+   *static_cast<void**>(ptr) = freeBlock;
+   freeBlock = ptr;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+inline size_t SlabPool::SlabCount() const
+{
+   std::lock_guard<std::mutex> lock(m_mutex);
+   return m_slabs.size();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+inline size_t SlabPool::GetBlockSize(size_t size, size_t alignment)
+{
+   const size_t blockAlignment = std::max(alignment, impl::CacheLineSize);
+   assert((blockAlignment & (blockAlignment - 1)) == 0);
+   assert(blockAlignment <= SlabSize);
+
+   return (std::max(size, sizeof(void*)) + blockAlignment - 1) & ~(blockAlignment - 1);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+inline size_t SlabPool::GetBlockAlignment(size_t blockSize)
+{
+   // The largest power of two that divides the block size, which is at least
+   // the cache line size, up to the page size.
+   return std::min(blockSize & (~blockSize + 1), PageSize);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+inline bool SlabPool::IsDedicatedSlab(size_t blockSize, size_t alignment)
+{
+   return (blockSize > SlabSize / 4) || (alignment > PageSize);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+inline void* SlabPool::AllocateSlab(size_t size)
+{
+#if SLOTMAP_MMAP
+   // Map one slab more than needed, so that the mapping can be trimmed to
+   // a slab-aligned range.
+   const size_t mappedSize = size + SlabSize;
+   void* const mapped = mmap(nullptr, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+   if (mapped == MAP_FAILED)
+   {
+      throw std::bad_alloc();
+   }
+
+   const uintptr_t begin = reinterpret_cast<uintptr_t>(mapped);
+   const uintptr_t alignedBegin = (begin + SlabSize - 1) & ~static_cast<uintptr_t>(SlabSize - 1);
+   if (alignedBegin > begin)
+   {
+      munmap(mapped, alignedBegin - begin);
+   }
+   const uintptr_t end = begin + mappedSize;
+   if (end > alignedBegin + size)
+   {
+      munmap(reinterpret_cast<void*>(alignedBegin + size), end - (alignedBegin + size));
+   }
+
+   void* const slab = reinterpret_cast<void*>(alignedBegin);
+#ifdef MADV_HUGEPAGE
+   madvise(slab, size, MADV_HUGEPAGE);
+#endif
+   return slab;
+#else
+   return ::operator new(size, std::align_val_t(SlabSize));
+#endif
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+inline void SlabPool::FreeSlab(void* ptr, size_t size)
+{
+#if SLOTMAP_MMAP
+   munmap(ptr, size);
+#else
+   ::operator delete(ptr, size, std::align_val_t(SlabSize));
+#endif
+}
+
+
+} // namespace slotmap
@@ -25,6 +25,9 @@
 
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <atomic>
 #include <type_traits>
 #include <climits>
 #include <limits>
@@ -32,8 +35,29 @@
 #include <bitset>
 #include <memory>
 #include <cassert>
+#include <istream>
+#include <ostream>
+
+/**
+ * `std::pmr` aliases of the slotmap (e.g. \ref pmr::SlotMap) are provided
+ * when the standard library supports polymorphic allocators.
+ */
+#if defined(__has_include)
+#if __has_include(<memory_resource>)
+#include <memory_resource>
+#endif
+#endif
+
+#if defined(__cpp_lib_memory_resource)
+#define SLOTMAP_PMR 1
+#else
+#define SLOTMAP_PMR 0
+#endif
 
 #include "bitset.h"
+#include "iterator.h"
+#include "parallel.h"
+#include "stats.h"
 
 
 /**
@@ -70,18 +94,117 @@ constexpr int GetIndexBitSize(uintmax_t arraySize)
 }
 
 
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Number of keys looked up together by the batched lookups. The prefetches of
+ * one stage for all keys in a group are issued before the next stage reads
+ * the prefetched memory, so that the cache misses overlap.
+ */
+constexpr size_t LookupGroupSize = 16;
+
+/**
+ * Number of slots reserved together by \ref SlotMap::EmplaceN(). The values
+ * of a block are constructed right after the block is reserved, while the
+ * slots are still in the cache.
+ */
+constexpr size_t EmplaceBlockSize = 256;
+
+/**
+ * Average number of keys from the same chunk in a row, above which
+ * \ref ChunkedSlotMapStorage::FreeSlots() does not sort the keys by chunk.
+ */
+constexpr size_t MinFreeSlotRunLength = 16;
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Hints the CPU to load the cache line containing the given address.
+ */
+inline void Prefetch(const void* address)
+{
+#if defined(__GNUC__) || defined(__clang__)
+   __builtin_prefetch(address);
+#elif defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+   _mm_prefetch(static_cast<const char*>(address), _MM_HINT_T0);
+#else
+   (void)address;
+#endif
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Detects bitsets that expose their words through `Data()`.
+ */
+template<typename TBitset, typename = void>
+struct HasBitsetData : std::false_type {};
+
+template<typename TBitset>
+struct HasBitsetData<TBitset, std::void_t<decltype(std::declval<const TBitset&>().Data())>>
+   : std::true_type {};
+
+
+/**
+ * Returns the address of the word holding the given bit, or the address of
+ * the bitset itself if its words aren't accessible.
+ */
+template<typename TBitset>
+inline const void* GetBitAddress(const TBitset& bitset, size_t index)
+{
+   if constexpr (HasBitsetData<TBitset>::value)
+   {
+      return bitset.Data() + TBitset::GetWordIndex(index);
+   }
+   else
+   {
+      return &bitset;
+   }
+}
+
+
 } // namespace impl
 
 
+//////////////////////////////////////////////////////////////////////////
+/**
+ * What a storage does with a slot whose generation has reached the maximum
+ * when the slot is freed.
+ */
+enum class GenerationOverflowPolicy
+{
+   /**
+    * The generation wraps around (skipping zero) and the slot is reused. A
+    * stale key that has survived all the generations of its slot becomes
+    * valid again.
+    */
+   Wrap,
+   /**
+    * The slot is never reused. Stale keys stay invalid forever, at the cost
+    * of one slot of memory per retired slot.
+    */
+   RetireSlot,
+   /**
+    * Same as \ref RetireSlot, but once all slots of a chunk are retired, the
+    * chunk is returned to the allocator and its index stays retired. Storages
+    * without chunks treat it as \ref RetireSlot.
+    */
+   RetireChunk,
+};
+
+
 //////////////////////////////////////////////////////////////////////////
 /**
  * Fixed-capacity statically allocated SlotMap storage.
+ *
+ * `TStats` is the stats policy that counts the operations, see
+ * \ref AtomicStats. The default \ref NoStats has no cost.
  */
 template<
    typename TValue,
    typename TKey,
    size_t TCapacity = 1024,
-   typename TBitsetTraits = FixedBitSetTraits<>>
+   typename TBitsetTraits = FixedBitSetTraits<>,
+   typename TStats = NoStats>
 class FixedSlotMapStorage
 {
 public:
@@ -146,6 +269,12 @@ public:
       using ReferenceType = std::conditional_t<IsConst, const ValueType&, ValueType&>;
       using PointerType = std::conditional_t<IsConst, const ValueType*, ValueType*>;
 
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = std::pair<KeyType, ReferenceType>;
+      using difference_type = std::ptrdiff_t;
+      using reference = value_type;
+      using pointer = impl::ArrowProxy<value_type>;
+
       IteratorTpl() = default;
 
    private:
@@ -161,6 +290,9 @@ public:
 
       inline KeyType GetKey() const { return m_key; }
       inline PointerType GetPtr() const { return m_ptr; }
+
+      inline reference operator*() const { return reference(m_key, *m_ptr); }
+      inline pointer operator->() const { return pointer(**this); }
       
       bool Advance();
    
@@ -195,6 +327,12 @@ public:
 
    inline TValue* GetPtr(TKey key) { return GetPtrTpl(this, key); }
    inline const TValue* GetPtr(TKey key) const { return GetPtrTpl(this, key); }
+
+   template<typename TSelf, typename TPtr>
+   static void GetPtrBatchTpl(TSelf self, const TKey* keys, size_t count, TPtr* outPtrs);
+
+   inline void GetPtrBatch(const TKey* keys, size_t count, TValue** outPtrs) { GetPtrBatchTpl(this, keys, count, outPtrs); }
+   inline void GetPtrBatch(const TKey* keys, size_t count, const TValue** outPtrs) const { GetPtrBatchTpl(this, keys, count, outPtrs); }
    
    TKey GetKeyByIndex(SizeType index) const;
    SizeType GetIndexByKey(TKey key) const;
@@ -204,11 +342,40 @@ public:
 
    template<typename TFunc>
    void ForEachSlot(TFunc func) const;
+
+   template<typename TFunc, typename TExecutor>
+   void ParallelForEachSlot(TFunc func, TExecutor&& executor) const;
    
    KeyType ReserveSlot(ValueType*& outPtr);
    inline KeyType ReserveSlotNoAlloc(ValueType*& outPtr) { return ReserveSlot(outPtr); }
+   /**
+    * Reserves up to `count` slots, taking the recycled slots first and then a
+    * single run of never used slots. Returns the number of reserved slots.
+    */
+   SizeType ReserveSlots(SizeType count, KeyType* outKeys, ValueType** outPtrs);
    bool FreeSlot(KeyType key);
 
+   /**
+    * Sets what happens to the slots whose generation overflows, see
+    * \ref GenerationOverflowPolicy. Applies to the slots freed after the call.
+    */
+   inline void SetGenerationOverflowPolicy(GenerationOverflowPolicy policy) { m_overflowPolicy = policy; }
+   inline GenerationOverflowPolicy GetGenerationOverflowPolicy() const { return m_overflowPolicy; }
+   /**
+    * Returns the number of slots that have been retired and are never going
+    * to be reused.
+    */
+   inline SizeType RetiredSlotCount() const { return m_retiredSlotCount; }
+   /**
+    * Returns the number of slots that can be reused, i.e. the capacity
+    * without the live and the retired slots.
+    */
+   inline SizeType FreeSlotCount() const { return StaticCapacity - m_size - m_retiredSlotCount; }
+   /**
+    * Returns the stats policy, e.g. to take a snapshot of \ref AtomicStats.
+    */
+   inline const TStats& GetStats() const { return m_stats; }
+
    void Swap(FixedSlotMapStorage& other);
    void Clear();
    
@@ -219,12 +386,20 @@ public:
    constexpr ConstIterator End() const { return ConstIterator(this); }
 
 private:
+   // Marks the retired slots in place of the next free slot index.
+   static constexpr IndexType RetiredSlot = -2;
+
+   inline void UpdateStats() { m_stats.OnSizeChanged(m_size, FreeSlotCount()); }
+
    SizeType m_size = 0;
    IndexType m_firstFreeSlot = -1;
    IndexType m_maxUsedSlot = 0;
+   SizeType m_retiredSlotCount = 0;
+   GenerationOverflowPolicy m_overflowPolicy = GenerationOverflowPolicy::Wrap;
    BitsetType m_liveBits;
    GenerationType m_generations[TCapacity];
    Slot m_slots[TCapacity];
+   TStats m_stats;
 };
 
 
@@ -233,6 +408,120 @@ constexpr size_t DefaultMaxChunkSize = 4096;
 constexpr size_t MinChunkSlots = 4;
 
 
+//////////////////////////////////////////////////////////////////////////
+/**
+ * How \ref ChunkedSlotMapStorage picks the chunk that the next value goes to.
+ */
+enum class ChunkAllocationPolicy
+{
+   /**
+    * The chunk that most recently got a free slot. The cheapest to maintain,
+    * but under churn the values scatter over many half-empty chunks.
+    */
+   MostRecentlyFreed,
+   /**
+    * The fullest chunk with a free slot. The values concentrate in few
+    * chunks, the other chunks drain and can be released, and iteration
+    * touches fewer chunks. The chunks with free slots are kept in buckets by
+    * their occupancy, so picking the chunk stays O(1), but the chunks within
+    * a bucket are not ordered.
+    */
+   FullestFirst,
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Numbers of chunks of a \ref ChunkedSlotMapStorage by the fraction of their
+ * slots that are live, see \ref ChunkedSlotMapStorage::OccupancyHistogram().
+ */
+struct ChunkOccupancyHistogram
+{
+   /**
+    * The buckets are the empty chunks, the chunks with less than 25%, 50%,
+    * 75% and 100% of their slots live, and the full chunks.
+    */
+   static constexpr size_t BucketCount = 6;
+
+   size_t m_chunkCounts[BucketCount] = {};
+   size_t m_chunkCount = 0;
+   size_t m_chunkSlots = 0;
+   size_t m_liveSlotCount = 0;
+
+   /**
+    * Returns the bucket of a chunk with `liveCount` of its `chunkSlots` slots
+    * live.
+    */
+   static constexpr size_t GetBucket(size_t liveCount, size_t chunkSlots)
+   {
+      return (liveCount == 0) ? 0 : (liveCount == chunkSlots) ? BucketCount - 1 : liveCount * 4 / chunkSlots + 1;
+   }
+
+   /**
+    * Returns the fraction of the slots of the non-empty chunks that are not
+    * live: 0 if all of them are full, close to 1 if the elements are spread
+    * over many chunks with few elements each.
+    */
+   inline double GetFragmentation() const
+   {
+      const size_t usedSlotCount = (m_chunkCount - m_chunkCounts[0]) * m_chunkSlots;
+      return (usedSlotCount > 0) ? 1.0 - static_cast<double>(m_liveSlotCount) / static_cast<double>(usedSlotCount) : 0.0;
+   }
+};
+
+
+namespace impl {
+/**
+ * Header of a snapshot written by \ref ChunkedSlotMapStorage::SaveSnapshot(),
+ * followed by the heads of the occupancy buckets and the chunks. The layout
+ * fields must match the loading storage exactly, a snapshot is not portable
+ * between builds with different value types, chunk sizes or ABIs.
+ */
+struct SnapshotHeader
+{
+   static constexpr uint64_t Magic = 0x50414e53544f4c53ull; // "SLOTSNAP"
+   // The header of a delta, followed by the number of the chunk records
+   // and the records prefixed with their chunk index.
+   static constexpr uint64_t DeltaMagic = 0x41544c44544f4c53ull; // "SLOTDLTA"
+   static constexpr uint32_t Version = 1;
+
+   uint64_t m_magic;
+   uint32_t m_version;
+   uint32_t m_keySize;
+   uint64_t m_valueSize;
+   uint64_t m_generationBitSize;
+   uint64_t m_chunkSlots;
+   uint64_t m_chunkSize;
+   uint64_t m_chunkCount;
+   uint64_t m_maxUsedChunk;
+   uint64_t m_size;
+   int64_t m_firstFreeChunk;
+   uint64_t m_retiredSlotCount;
+   uint64_t m_retiredChunkCount;
+   uint64_t m_releasedGenerationCount;
+   uint64_t m_emptyChunkLimit;
+   uint32_t m_overflowPolicy;
+   uint32_t m_allocationPolicy;
+};
+
+/**
+ * Per-chunk record of a snapshot or a delta, followed by the generations of the chunk
+ * and, for the used chunks, by its live bits and slots.
+ */
+struct SnapshotChunkHeader
+{
+   int64_t m_nextFreeChunk;
+   int64_t m_prevFreeChunk;
+   int64_t m_firstFreeSlot;
+   int64_t m_lastFreeSlot;
+   int64_t m_liveCount;
+   int64_t m_retiredSlotCount;
+   // The chunk is retired as a whole and nothing else follows.
+   uint64_t m_isRetired;
+};
+} // namespace impl
+
+
 //////////////////////////////////////////////////////////////////////////
 template<size_t TSlotCount, typename TValue, typename TIndexType, typename TGenerationType, typename TBitsetTraits>
 struct ChunkTpl
@@ -253,10 +542,25 @@ struct ChunkTpl
 
    ChunkTpl() = default;
    ChunkTpl(const ChunkTpl& other);
+   /**
+    * Moves the live values of `other` into the new chunk. The moved-from
+    * values are left in `other` and still need to be destroyed.
+    */
+   ChunkTpl(ChunkTpl&& other);
+
+   /**
+    * Tells whether all slots of the chunk are live, in which case the
+    * iteration visits them without scanning the live bits.
+    */
+   inline bool IsFull() const { return m_liveCount == static_cast<TIndexType>(TSlotCount); }
 
    TIndexType m_nextFreeChunk = -1;
+   // Only linked with ChunkAllocationPolicy::FullestFirst.
+   TIndexType m_prevFreeChunk = -1;
    TIndexType m_firstFreeSlot = -1;
    TIndexType m_lastFreeSlot = -1;
+   TIndexType m_liveCount = 0;
+   TIndexType m_retiredSlotCount = 0;
 
    BitsetType m_liveBits;
    TGenerationType m_generations[TSlotCount];
@@ -312,36 +616,174 @@ constexpr size_t GetChunkMaxSlots()
 
    return MinSlots;
 }
+
+
+/**
+ * Same as \ref GetChunkMaxSlots(), but for any chunk template that is
+ * parametrized only by the number of slots.
+ */
+template<size_t MinSlots, size_t MaxSlots, size_t MaxChunkSize, template<size_t> typename TChunk>
+constexpr size_t GetChunkMaxSlotsFor()
+{
+   if constexpr (MaxSlots <= MinSlots)
+   {
+      return MinSlots;
+   }
+   else if constexpr (sizeof(TChunk<MinSlots>) >= MaxChunkSize)
+   {
+      return MinSlots;
+   }
+   else if constexpr (sizeof(TChunk<MaxSlots>) <= MaxChunkSize)
+   {
+      return MaxSlots;
+   }
+   else
+   {
+      constexpr size_t pivot = (MinSlots + MaxSlots) >> 1;
+
+      if constexpr (pivot == MinSlots)
+      {
+         return MinSlots;
+      }
+      else if constexpr (sizeof(TChunk<pivot>) > MaxChunkSize)
+      {
+         return GetChunkMaxSlotsFor<MinSlots, pivot - 1, MaxChunkSize, TChunk>();
+      }
+      else
+      {
+         return GetChunkMaxSlotsFor<pivot, MaxSlots, MaxChunkSize, TChunk>();
+      }
+   }
+
+   return MinSlots;
+}
+
+
+/**
+ * Detects storages that need to be notified once the value in a slot returned
+ * by `ReserveSlot()` has been constructed (see
+ * \ref ConcurrentChunkedSlotMapStorage::CommitSlot()).
+ */
+template<typename TStorage, typename = void>
+struct HasCommitSlot : std::false_type {};
+
+template<typename TStorage>
+struct HasCommitSlot<TStorage, std::void_t<decltype(std::declval<TStorage&>().CommitSlot(std::declval<typename TStorage::KeyType>()))>>
+   : std::true_type {};
+
+
+/**
+ * Detect storages that can reserve and free many slots in a single call (see
+ * \ref ChunkedSlotMapStorage::ReserveSlots() and
+ * \ref ChunkedSlotMapStorage::FreeSlots()).
+ */
+template<typename TStorage, typename = void>
+struct HasReserveSlots : std::false_type {};
+
+template<typename TStorage>
+struct HasReserveSlots<TStorage, std::void_t<decltype(std::declval<TStorage&>().ReserveSlots(
+   std::declval<typename TStorage::SizeType>(),
+   std::declval<typename TStorage::KeyType*>(),
+   std::declval<typename TStorage::ValueType**>()))>>
+   : std::true_type {};
+
+template<typename TStorage, typename = void>
+struct HasFreeSlots : std::false_type {};
+
+template<typename TStorage>
+struct HasFreeSlots<TStorage, std::void_t<decltype(std::declval<TStorage&>().FreeSlots(
+   std::declval<const typename TStorage::KeyType*>(),
+   std::declval<typename TStorage::SizeType>()))>>
+   : std::true_type {};
+
+
+/**
+ * Detects storages that can release unused memory (see
+ * \ref ChunkedSlotMapStorage::ShrinkToFit()).
+ */
+template<typename TStorage, typename = void>
+struct HasShrinkToFit : std::false_type {};
+
+template<typename TStorage>
+struct HasShrinkToFit<TStorage, std::void_t<decltype(std::declval<TStorage&>().ShrinkToFit())>>
+   : std::true_type {};
+
+
+/**
+ * Detects storages that can move their values to fewer chunks (see
+ * \ref ChunkedSlotMapStorage::Compact()).
+ */
+template<typename TStorage, typename = void>
+struct HasCompact : std::false_type {};
+
+template<typename TStorage>
+struct HasCompact<TStorage, std::void_t<decltype(std::declval<TStorage&>().Compact(
+   std::declval<typename TStorage::SizeType>(),
+   std::declval<void (*)(typename TStorage::KeyType, typename TStorage::KeyType)>()))>>
+   : std::true_type {};
+
+
+/**
+ * Detects storages that share memory with their copies and need to know
+ * which values are going to be written (see
+ * \ref ChunkedSlotMapStorage::GetMutablePtr()).
+ */
+template<typename TStorage, typename = void>
+struct HasGetMutablePtr : std::false_type {};
+
+template<typename TStorage>
+struct HasGetMutablePtr<TStorage, std::void_t<decltype(std::declval<TStorage&>().GetMutablePtr(std::declval<typename TStorage::KeyType>()))>>
+   : std::true_type {};
 } // namespace impl
 
 
 //////////////////////////////////////////////////////////////////////////
 /**
  * Dynamically allocated SlotMap storage implemented as a chunked vector.
+ *
+ * A key packs the generation of the slot, the index of the slot in its chunk
+ * and the index of the chunk. `TGenerationBitSize` sets the width of the
+ * generation. A slot reuses a key it has already handed out only after it
+ * has been reused `2^TGenerationBitSize - 1` times, so tables with a high
+ * churn can trade some of the chunk index bits for a wider generation (e.g.
+ * a 16-bit generation in a 32-bit key) instead of switching to 64-bit keys.
+ *
+ * `TStats` is the stats policy that counts the operations, see
+ * \ref AtomicStats. The default \ref NoStats has no cost.
  */
 template<
    typename TValue,
    typename TKey = uint32_t,
    size_t MaxChunkSize = DefaultMaxChunkSize,
    typename TAllocator = std::allocator<TValue>,
-   typename TBitsetTraits = FixedBitSetTraits<>>
+   typename TBitsetTraits = FixedBitSetTraits<>,
+   int TGenerationBitSize = 8,
+   typename TStats = NoStats>
 class ChunkedSlotMapStorage
 {
 public:
+   static constexpr int GenerationBitSize = TGenerationBitSize;
+   static_assert(GenerationBitSize > 0, "GenerationBitSize must be greater than 0.");
+   static_assert(GenerationBitSize <= 64, "GenerationBitSize must be less or equal to 64.");
+
    using ValueType = TValue;
    using KeyType = TKey;
-   using GenerationType = uint8_t;
+   using GenerationType = std::conditional_t<GenerationBitSize <= 8, uint8_t,
+      std::conditional_t<GenerationBitSize <= 16, uint16_t,
+      std::conditional_t<GenerationBitSize <= 32, uint32_t,
+      uint64_t>>>;
+   using AllocatorType = TAllocator;
 
    using SizeType = size_t;
    using IndexType = ptrdiff_t;
 
    static_assert(std::is_unsigned_v<KeyType>, "Slotmap key type must be an unsigned integer type.");
-   static_assert(sizeof(KeyType) > sizeof(GenerationType), "The size of slotmap key type must be greater than the size of generation type.");
+   static_assert(static_cast<int>(sizeof(KeyType) * CHAR_BIT) > GenerationBitSize + 1,
+      "The slotmap key type must have room for the generation, the slot index and the chunk index.");
 
    static constexpr KeyType InvalidKey = static_cast<KeyType>(0);
    
    static constexpr size_t MaxChunkSlots = impl::GetChunkMaxSlots<MinChunkSlots, MaxChunkSize, MaxChunkSize, ValueType, IndexType, GenerationType, TBitsetTraits>();
-   static constexpr int GenerationBitSize = sizeof(GenerationType) * CHAR_BIT;
    static constexpr int SlotIndexBitSize = std::min(
       impl::GetIndexBitSize(MaxChunkSlots), 
       static_cast<int>(sizeof(KeyType) * CHAR_BIT - GenerationBitSize - 1));
@@ -378,12 +820,21 @@ public:
       using ReferenceType = std::conditional_t<IsConst, const ValueType&, ValueType&>;
       using PointerType = std::conditional_t<IsConst, const ValueType*, ValueType*>;
 
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = std::pair<KeyType, ReferenceType>;
+      using difference_type = std::ptrdiff_t;
+      using reference = value_type;
+      using pointer = impl::ArrowProxy<value_type>;
+
       IteratorTpl() = default;
 
    private:
       constexpr IteratorTpl(StoragePtr storage, size_t chunkIndex, size_t slotIndex) 
          : m_storage(storage), m_chunkIndex(chunkIndex), m_slotIndex(slotIndex) 
       {}
+      constexpr IteratorTpl(StoragePtr storage, size_t chunkIndex, size_t slotIndex, size_t endChunkIndex)
+         : m_storage(storage), m_chunkIndex(chunkIndex), m_slotIndex(slotIndex), m_endChunkIndex(endChunkIndex)
+      {}
       constexpr IteratorTpl(StoragePtr storage) 
          : m_storage(storage) 
       {}
@@ -397,6 +848,9 @@ public:
       
       inline KeyType GetKey() const { return m_key; }
       inline PointerType GetPtr() const { return m_ptr; }
+
+      inline reference operator*() const { return reference(m_key, *m_ptr); }
+      inline pointer operator->() const { return pointer(**this); }
       
       /**
        * Moves the iterator to the next valid element if there is one or to the end otherwise.
@@ -410,9 +864,11 @@ public:
 
       bool FindNext();
 
-      StoragePtr const m_storage = nullptr;
+      StoragePtr m_storage = nullptr;
       SizeType m_chunkIndex = 0;
       SizeType m_slotIndex = 0;
+      // The iterator ends before this chunk, see \ref ChunkBegin().
+      SizeType m_endChunkIndex = std::numeric_limits<SizeType>::max();
 
       KeyType m_key = std::numeric_limits<KeyType>::max();
       PointerType m_ptr = nullptr;
@@ -420,58 +876,783 @@ public:
 
    using Iterator = IteratorTpl<false>;
    using ConstIterator = IteratorTpl<true>;
+
+   /**
+    * View of the arrays of one chunk, see \ref ForEachChunk().
+    *
+    * The arrays have \ref GetSlotCount() elements, including the slots that
+    * are not live. Those must not be accessed as values, except that a loop
+    * over trivially copyable values can process whole arrays and mask out the
+    * results of the slots that are not live with \ref GetLiveWords(). The
+    * key of a live slot is \ref GetBaseKey() combined with the slot index and
+    * its generation, see \ref GetKey().
+    */
+   template<bool IsConst>
+   class ChunkSpanTpl
+   {
+      friend class ChunkedSlotMapStorage;
+
+   public:
+      using ChunkPtr = std::conditional_t<IsConst, const Chunk*, Chunk*>;
+      using PointerType = std::conditional_t<IsConst, const ValueType*, ValueType*>;
+
+      inline SizeType GetChunkIndex() const { return m_chunkIndex; }
+      inline static constexpr SizeType GetSlotCount() { return ChunkSlots; }
+      inline SizeType GetLiveCount() const { return static_cast<SizeType>(m_chunk->m_liveCount); }
+      inline bool IsFull() const { return m_chunk->IsFull(); }
+
+      inline const BitsetType& GetLiveBits() const { return m_chunk->m_liveBits; }
+      inline bool IsLive(SizeType slotIndex) const { return m_chunk->m_liveBits.test(slotIndex); }
+      /**
+       * Returns the words of the live bits, bit `i % BitsPerWord` of word
+       * `i / BitsPerWord` is set for the live slot `i`. Only available with
+       * bitsets that expose their words (e.g. \ref FixedBitSet).
+       */
+      inline auto GetLiveWords() const { return m_chunk->m_liveBits.Data(); }
+      inline static constexpr SizeType GetLiveWordCount() { return BitsetType::NumWords; }
+
+      inline const GenerationType* GetGenerations() const { return m_chunk->m_generations; }
+      inline KeyType GetBaseKey() const { return static_cast<KeyType>(m_chunkIndex); }
+      inline KeyType GetKey(SizeType slotIndex) const
+      {
+         return (static_cast<KeyType>(m_chunk->m_generations[slotIndex]) << GenerationShift) |
+            (static_cast<KeyType>(slotIndex) << SlotIndexShift) |
+            GetBaseKey();
+      }
+
+      /**
+       * Returns the array of the values, indexed by slot index. Only available
+       * if a slot is not larger than a value, i.e. the value is at least as
+       * large as \ref IndexType.
+       */
+      inline PointerType GetValues() const
+      {
+         static_assert(sizeof(Slot) == sizeof(ValueType), "The slots are larger than the values, use GetPtr().");
+         return m_chunk->m_slots[0].GetPtr();
+      }
+      inline PointerType GetPtr(SizeType slotIndex) const { return m_chunk->m_slots[slotIndex].GetPtr(); }
+
+   private:
+      constexpr ChunkSpanTpl(ChunkPtr chunk, SizeType chunkIndex) : m_chunk(chunk), m_chunkIndex(chunkIndex) {}
+
+      ChunkPtr m_chunk;
+      SizeType m_chunkIndex;
+   };
+
+   using ChunkSpan = ChunkSpanTpl<false>;
+   using ConstChunkSpan = ChunkSpanTpl<true>;
    
    ChunkedSlotMapStorage() = default;
+   /**
+    * Constructs an empty storage that allocates its chunks and its other
+    * memory with `allocator`.
+    */
+   explicit ChunkedSlotMapStorage(const TAllocator& allocator);
    ChunkedSlotMapStorage(const ChunkedSlotMapStorage&);
    ChunkedSlotMapStorage(ChunkedSlotMapStorage&& other);
 
-   inline ~ChunkedSlotMapStorage() { Clear(); }
+   ~ChunkedSlotMapStorage();
 
    ChunkedSlotMapStorage& operator=(const ChunkedSlotMapStorage&) = delete;
    ChunkedSlotMapStorage& operator=(ChunkedSlotMapStorage&& other);
 
+   inline TAllocator GetAllocator() const { return m_allocator; }
+
    inline SizeType Size() const { return m_size; }
    inline SizeType Capacity() const { return m_chunks.size() * ChunkSlots; }
    inline static constexpr SizeType MaxCapacity() { return MaxChunkCount * ChunkSlots; }
    
    bool Reserve(size_t capacity);
-   
-   TValue* GetPtr(TKey key) const;
-
-   SizeType GetIndexByKey(KeyType key) const;
-   KeyType GetKeyByIndex(SizeType index) const;
-
-   bool FindNextKey(TKey& key) const;
-   KeyType IncrementKey(TKey key) const;
-
+   /**
+    * Releases all empty chunks at the end of the storage, including the
+    * chunks kept by \ref Clear() or allocated by \ref Reserve(), and returns
+    * the number of released chunks.
+    *
+    * Only the trailing chunks can be released, since the chunk index is a
+    * part of the key. The keys into the remaining chunks stay valid. The
+    * highest generation of each released chunk is remembered, so that the
+    * stale keys into it still fail once a new chunk takes its place.
+    */
+   SizeType ShrinkToFit();
+   /**
+    * Moves up to `budget` values from the chunks at the end of the storage
+    * into the free slots of the chunks at the beginning, then releases the
+    * trailing chunks that end up empty like \ref ShrinkToFit(). Returns the
+    * number of moved values.
+    *
+    * Every moved value gets a new key and `remap(oldKey, newKey)` is called
+    * right after the move, the old key becomes invalid. Pointers to the moved
+    * values are invalidated.
+    *
+    * The work done by a call is bounded by the budget plus one pass over the
+    * chunk headers, so a large storage can be compacted over several frames.
+    * Once it returns less than `budget`, the storage is fully compacted.
+    */
    template<typename TFunc>
-   void ForEachSlot(TFunc func) const;
-
-   void AllocateChunk();
-   static void InitializeChunk(Chunk* chunk);
-   void AppendChunkToFreeList(Chunk* chunk, IndexType chunkIndex);
-   KeyType ReserveSlot(ValueType*& outPtr);
-   KeyType ReserveSlotNoAlloc(ValueType*& outPtr);
-   bool FreeSlot(KeyType key);
-   void FreeSlotByIndex(IndexType chunkIndex, IndexType slotIndex);
-   
-   void Swap(ChunkedSlotMapStorage& other);
-   void Clear();
-   
-   Iterator Begin() { Iterator it(this, 0, 0); it.FindFirst(); return it; }
-   constexpr Iterator End() { return Iterator(this); }
-   
-   ConstIterator Begin() const { ConstIterator it(this, 0, 0); it.FindFirst(); return it; }
+   SizeType Compact(SizeType budget, TFunc&& remap);
+   /**
+    * Enables the automatic release of empty chunks.
+    *
+    * Once more than `maxEmptyChunks` empty chunks accumulate at the end of
+    * the storage, all of them but `maxEmptyChunks / 2` are released, so that
+    * alternating insertions and removals around the limit do not allocate
+    * and release the same chunk over and over. Zero (the default) disables
+    * the automatic release.
+    */
+   inline void SetEmptyChunkLimit(SizeType maxEmptyChunks) { m_emptyChunkLimit = maxEmptyChunks; }
+   inline SizeType GetEmptyChunkLimit() const { return m_emptyChunkLimit; }
+   /**
+    * Sets what happens to the slots whose generation overflows, see
+    * \ref GenerationOverflowPolicy. Applies to the slots freed after the call.
+    *
+    * Retired slots stay retired through \ref Clear(), and the chunks with
+    * retired slots are not released by \ref ShrinkToFit(). The indices of the
+    * chunks retired as a whole all share a single empty chunk.
+    */
+   inline void SetGenerationOverflowPolicy(GenerationOverflowPolicy policy) { m_overflowPolicy = policy; }
+   inline GenerationOverflowPolicy GetGenerationOverflowPolicy() const { return m_overflowPolicy; }
+   /**
+    * Returns the number of slots that have been retired and are never going
+    * to be reused, including the slots of the retired chunks.
+    */
+   inline SizeType RetiredSlotCount() const { return m_retiredSlotCount; }
+   /**
+    * Returns the number of chunks that have been retired as a whole and
+    * returned to the allocator.
+    */
+   inline SizeType RetiredChunkCount() const { return m_retiredChunkCount; }
+   /**
+    * Returns the number of slots that can be reused without allocating, i.e.
+    * the capacity without the live and the retired slots.
+    */
+   inline SizeType FreeSlotCount() const { return Capacity() - m_size - m_retiredSlotCount; }
+   /**
+    * Returns the stats policy, e.g. to take a snapshot of \ref AtomicStats.
+    */
+   inline const TStats& GetStats() const { return m_stats; }
+   /**
+    * Returns the number of live elements in the chunk `chunkIndex`, where
+    * `chunkIndex < Capacity() / ChunkSlots`. Has *O(1)* time complexity.
+    */
+   inline SizeType ChunkOccupancy(SizeType chunkIndex) const
+   {
+      assert(chunkIndex < m_chunks.size());
+      // The spare chunks kept by Clear() are not reset until they are used
+      // again.
+      return (chunkIndex < m_maxUsedChunk) ? static_cast<SizeType>(m_chunks[chunkIndex]->m_liveCount) : 0;
+   }
+   /**
+    * Returns the numbers of chunks by the fraction of their slots that are
+    * live, without the retired chunks. Only reads the live count of each
+    * chunk, so it has *O(chunks)* time complexity and doesn't touch the
+    * slots.
+    */
+   ChunkOccupancyHistogram OccupancyHistogram() const;
+   /**
+    * Sets how the chunk that new values go to is picked, see
+    * \ref ChunkAllocationPolicy. The chunks with free slots are reordered
+    * right away.
+    */
+   void SetChunkAllocationPolicy(ChunkAllocationPolicy policy);
+   inline ChunkAllocationPolicy GetChunkAllocationPolicy() const { return m_allocationPolicy; }
+   /**
+    * Enables copy-on-write copies. A copy of a storage with copy-on-write
+    * enabled shares the chunks instead of copying them, so copying costs a
+    * pass over the chunk pointers. A shared chunk is copied once either
+    * storage changes it, and the copies never see the changes of each other.
+    * The chunks are shared with reference counts, so the copies can be used
+    * and destroyed on different threads. Disabled by default. The chunks are
+    * copied as usual if the allocator of the copy is not equal.
+    *
+    * Copying the storage registers the shared chunks in the source storage
+    * too, so a copy counts as a write to the source: two copies of the same
+    * storage must not be made at the same time, nor a copy while the source
+    * is used on another thread.
+    *
+    * The insertions and removals, \ref GetMutablePtr() and the mutable
+    * iterators copy the shared chunks they write to. The pointers returned by
+    * \ref GetPtr() and \ref GetPtrBatch() may point into a shared chunk and
+    * must not be written through while \ref SharedChunkCount() is nonzero.
+    */
+   inline void SetCopyOnWrite(bool enable) { m_isCopyOnWrite = enable; }
+   inline bool IsCopyOnWrite() const { return m_isCopyOnWrite; }
+   /**
+    * Returns the number of chunks that are shared with copy-on-write copies
+    * of the storage, or have been until the copies released them.
+    */
+   inline SizeType SharedChunkCount() const { return m_sharedChunkCount; }
+   /**
+    * Copies all the chunks shared with copy-on-write copies of the storage.
+    */
+   void UnshareChunks();
+   /**
+    * Writes the whole storage to `stream` as a binary snapshot. Each chunk
+    * is written as a few blobs (the generations, the live bits and the slots
+    * as they are in memory), so `TValue` must be trivially copyable. The free
+    * lists are saved too, so a loaded storage hands out the same keys as
+    * this one would.
+    *
+    * Returns `false` if writing to the stream failed.
+    */
+   bool SaveSnapshot(std::ostream& stream) const;
+   /**
+    * Replaces the contents of the storage with a snapshot written by
+    * \ref SaveSnapshot(). Every key that was valid in the saved storage is
+    * valid again and the keys that were stale stay stale. The chunks are
+    * read with a few `read()` calls each, without touching the values one by
+    * one.
+    *
+    * Returns `false` and leaves the storage unchanged if the snapshot is
+    * truncated or has been written by a storage with a different layout.
+    */
+   bool LoadSnapshot(std::istream& stream);
+   /**
+    * Enables or disables tracking which chunks change, see
+    * \ref SaveDelta(). Disabled by default. Enabling it starts with all the
+    * chunks clean, so it should be enabled right after the storage is
+    * created or a full snapshot is taken.
+    */
+   void SetDirtyChunkTracking(bool enable);
+   inline bool IsDirtyChunkTracking() const { return m_isTrackingDirtyChunks; }
+   /**
+    * Marks the chunk of the value with the given key as changed. The
+    * insertions and removals mark their chunks on their own, but writes to
+    * the values through the pointers can't be seen by the storage and must
+    * be reported with this function.
+    */
+   inline void MarkDirty(KeyType key) { MarkChunkDirty(static_cast<SizeType>(key & ChunkIndexMask)); }
+   /**
+    * Returns the number of chunks that changed since dirty chunk tracking was
+    * enabled or since the last \ref SaveDelta().
+    */
+   SizeType DirtyChunkCount() const;
+   /**
+    * Writes the chunks that changed since dirty chunk tracking was enabled or
+    * since the last call, together with the state of the storage that is
+    * not kept in the chunks, and marks all the chunks clean.
+    *
+    * Applied with \ref ApplyDelta() to a storage that is in the state this
+    * storage was in at the start of the epoch (e.g. loaded from a snapshot
+    * taken then), the delta brings it to the current state of this storage.
+    * Moving, swapping or assigning the storage is not tracked, a full
+    * snapshot has to be taken afterwards.
+    *
+    * Returns `false` if writing to the stream failed, the chunks are marked
+    * clean anyway. Returns `false` without writing anything if dirty chunk
+    * tracking is disabled.
+    */
+   bool SaveDelta(std::ostream& stream);
+   /**
+    * Applies a delta written by \ref SaveDelta(). The chunks of the delta
+    * replace the chunks with the same index. With dirty chunk tracking
+    * enabled, they are marked as dirty here too, so that the deltas can be
+    * passed on.
+    *
+    * Returns `false` and leaves the storage unchanged if the delta is
+    * truncated, has been written by a storage with a different layout or
+    * does not match the state of this storage.
+    */
+   bool ApplyDelta(std::istream& stream);
+   
+   TValue* GetPtr(TKey key) const;
+   /**
+    * Same as \ref GetPtr(), but copies the chunk of the value first if it is
+    * shared with a copy-on-write copy, so that the value can be written.
+    */
+   TValue* GetMutablePtr(TKey key);
+   void GetPtrBatch(const TKey* keys, size_t count, TValue** outPtrs) const;
+   inline void GetPtrBatch(const TKey* keys, size_t count, const TValue** outPtrs) const { GetPtrBatch(keys, count, const_cast<TValue**>(outPtrs)); }
+
+   SizeType GetIndexByKey(KeyType key) const;
+   KeyType GetKeyByIndex(SizeType index) const;
+
+   bool FindNextKey(TKey& key) const;
+   KeyType IncrementKey(TKey key) const;
+
+   template<typename TFunc>
+   void ForEachSlot(TFunc func) const;
+
+   template<typename TFunc, typename TExecutor>
+   void ParallelForEachSlot(TFunc func, TExecutor&& executor) const;
+
+   /**
+    * Calls `func(span)` with a \ref ChunkSpanTpl "ChunkSpan" for each chunk
+    * with live elements, in the order of the chunk indices.
+    */
+   template<typename TFunc>
+   void ForEachChunk(TFunc func);
+   template<typename TFunc>
+   void ForEachChunk(TFunc func) const;
+
+   void AllocateChunk();
+   static void InitializeChunk(Chunk* chunk);
+   void AppendChunkToFreeList(Chunk* chunk, IndexType chunkIndex);
+   void RemoveChunkFromFreeList(Chunk* chunk, IndexType chunkIndex, SizeType occupancy);
+   KeyType ReserveSlot(ValueType*& outPtr);
+   KeyType ReserveSlotNoAlloc(ValueType*& outPtr);
+   bool FreeSlot(KeyType key);
+   void FreeSlotByIndex(IndexType chunkIndex, IndexType slotIndex);
+   /**
+    * Reserves up to `count` slots. Empty chunks are claimed as a whole, their
+    * slots are handed out in order and their live bits are set a word at a
+    * time. Returns the number of reserved slots, which is less than `count`
+    * only if the max. capacity has been reached.
+    */
+   SizeType ReserveSlots(SizeType count, KeyType* outKeys, ValueType** outPtrs);
+   /**
+    * Frees the slots of all valid keys in `keys`. The keys are grouped by
+    * chunk first, so that each chunk is updated in one go. Returns the
+    * number of freed slots.
+    */
+   SizeType FreeSlots(const KeyType* keys, SizeType count);
+   
+   void Swap(ChunkedSlotMapStorage& other);
+   void Clear();
+   
+   Iterator Begin() { UnshareChunks(); Iterator it(this, 0, 0); it.FindFirst(); return it; }
+   constexpr Iterator End() { return Iterator(this); }
+   
+   ConstIterator Begin() const { ConstIterator it(this, 0, 0); it.FindFirst(); return it; }
    constexpr ConstIterator End() const { return ConstIterator(this); }
 
+   /**
+    * Returns an iterator to the first element of the chunk `chunkIndex`. The
+    * iterator compares equal to \ref End() once it has visited the elements
+    * of the chunk.
+    */
+   Iterator ChunkBegin(SizeType chunkIndex) { UnshareChunks(); Iterator it(this, chunkIndex, 0, chunkIndex + 1); it.FindFirst(); return it; }
+   ConstIterator ChunkBegin(SizeType chunkIndex) const { ConstIterator it(this, chunkIndex, 0, chunkIndex + 1); it.FindFirst(); return it; }
+
+   using ChunkRangeIterator = impl::ChunkRangeIterator<ChunkedSlotMapStorage*, Iterator>;
+   using ConstChunkRangeIterator = impl::ChunkRangeIterator<const ChunkedSlotMapStorage*, ConstIterator>;
+
+   /**
+    * Returns a random access range of the used chunks, each of them an
+    * \ref IteratorRange of the elements of the chunk. Unlike the iterators
+    * from \ref Begin(), the chunks can be split between threads, e.g. by
+    * `std::for_each(std::execution::par, ...)`.
+    */
+   IteratorRange<ChunkRangeIterator> ChunkRanges()
+   {
+      UnshareChunks();
+      return { ChunkRangeIterator(this, 0), ChunkRangeIterator(this, m_maxUsedChunk) };
+   }
+   IteratorRange<ConstChunkRangeIterator> ChunkRanges() const
+   {
+      return { ConstChunkRangeIterator(this, 0), ConstChunkRangeIterator(this, m_maxUsedChunk) };
+   }
+
 private:
    using ChunkAllocator = typename std::allocator_traits<TAllocator>::template rebind_alloc<Chunk>;
    using ChunkPtrAllocator = typename std::allocator_traits<TAllocator>::template rebind_alloc<Chunk*>;
+   using GenerationAllocator = typename std::allocator_traits<TAllocator>::template rebind_alloc<GenerationType>;
+   using FlagAllocator = typename std::allocator_traits<TAllocator>::template rebind_alloc<uint8_t>;
+   // The number of storages that share a chunk.
+   using ShareCount = std::atomic<uint32_t>;
+   using ShareCountAllocator = typename std::allocator_traits<TAllocator>::template rebind_alloc<ShareCount>;
+   using ShareCountPtrAllocator = typename std::allocator_traits<TAllocator>::template rebind_alloc<ShareCount*>;
+
+   template<typename TFunc>
+   void ForEachSlotInChunks(SizeType beginChunk, SizeType endChunk, TFunc& func) const;
+
+   static inline constexpr KeyType MakeKey(GenerationType generation, SizeType slotIndex, SizeType chunkIndex)
+   {
+      return (static_cast<KeyType>(generation) << GenerationShift) |
+         (static_cast<KeyType>(slotIndex) << SlotIndexShift) |
+         static_cast<KeyType>(chunkIndex);
+   }
+
+   static inline constexpr GenerationType NextGeneration(GenerationType generation)
+   {
+      // Zero is skipped, so that a key is never equal to InvalidKey.
+      const GenerationType next = static_cast<GenerationType>((generation + 1) & GenerationMask);
+      return next != 0 ? next : 1;
+   }
+
+   // A chunk with retired slots is never empty, so that it is not released
+   // and its retired slots are not handed out again.
+   static inline bool IsChunkEmpty(const Chunk* chunk)
+   {
+      return (chunk->m_retiredSlotCount == 0) && (chunk->m_liveCount == 0);
+   }
+
+   // The retired slots count as occupied, they are never handed out.
+   static inline SizeType GetOccupancy(const Chunk* chunk)
+   {
+      return static_cast<SizeType>(chunk->m_liveCount + chunk->m_retiredSlotCount);
+   }
+
+   static inline constexpr SizeType GetOccupancyBucket(SizeType occupancy)
+   {
+      return occupancy * OccupancyBucketCount / ChunkSlots;
+   }
+
+   // Moves a chunk in the free list after its occupancy has changed from
+   // `previousOccupancy` and the chunk still has free slots.
+   inline void UpdateChunkInFreeList(Chunk* chunk, IndexType chunkIndex, SizeType previousOccupancy)
+   {
+      if ((m_allocationPolicy == ChunkAllocationPolicy::FullestFirst) &&
+         (GetOccupancyBucket(previousOccupancy) != GetOccupancyBucket(GetOccupancy(chunk))))
+      {
+         RemoveChunkFromFreeList(chunk, chunkIndex, previousOccupancy);
+         AppendChunkToFreeList(chunk, chunkIndex);
+      }
+   }
+
+   // Records that the chunk has changed since the last delta.
+   inline void MarkChunkDirty(SizeType chunkIndex)
+   {
+      if (m_isTrackingDirtyChunks)
+      {
+         if (chunkIndex >= m_dirtyChunks.size())
+         {
+            m_dirtyChunks.resize(std::max<SizeType>(chunkIndex + 1, m_chunks.size()), 0);
+         }
+         m_dirtyChunks[chunkIndex] = 1;
+      }
+   }
+
+   // Tells whether `key` refers to a live slot of `chunk`. Unlike GetPtr(),
+   // doesn't report the failed lookups to the stats.
+   inline bool IsLiveSlot(const Chunk& chunk, KeyType key) const
+   {
+      const KeyType slotIndex = (key >> SlotIndexShift) & SlotIndexMask;
+      return (slotIndex < ChunkSlots) && chunk.m_liveBits.test(slotIndex) &&
+         (chunk.m_generations[slotIndex] == static_cast<GenerationType>((key >> GenerationShift) & GenerationMask));
+   }
+
+   inline bool IsChunkShared(SizeType chunkIndex) const
+   {
+      return (m_sharedChunkCount > 0) && (chunkIndex < m_chunkShares.size()) && m_chunkShares[chunkIndex];
+   }
+
+   // Returns the chunk to be changed, after copying it if it is shared with
+   // copy-on-write copies.
+   inline Chunk* GetWritableChunk(SizeType chunkIndex)
+   {
+      return IsChunkShared(chunkIndex) ? UnshareChunk(chunkIndex) : m_chunks[chunkIndex];
+   }
+
+   inline bool IsGenerationExhausted(GenerationType generation) const
+   {
+      return (generation == GenerationMask) && (m_overflowPolicy != GenerationOverflowPolicy::Wrap);
+   }
+
+   // NextGeneration() that reports the wraps to the stats policy.
+   inline GenerationType AdvanceGeneration(GenerationType generation)
+   {
+      if (generation == GenerationMask)
+      {
+         m_stats.OnGenerationWrap();
+      }
+      return NextGeneration(generation);
+   }
+
+   inline void UpdateStats() { m_stats.OnSizeChanged(m_size, FreeSlotCount()); }
+
+   Chunk* NewChunk(SizeType chunkIndex);
+   template<typename... TArgs>
+   Chunk* ConstructChunk(TArgs&&... args);
+   void DeleteChunk(Chunk* chunk);
+   void ReleaseChunk(SizeType chunkIndex);
+   void ShareChunks(const ChunkedSlotMapStorage& other);
+   Chunk* UnshareChunk(SizeType chunkIndex);
+   bool UnshareChunkForClear(SizeType chunkIndex);
+   bool ReleaseChunkShare(SizeType chunkIndex);
+   void ReleaseSharedChunks();
+   Chunk* AcquireChunk(IndexType& outChunkIndex);
+   SizeType ReleaseChunks(SizeType keepEmptyChunks);
+   void ReleaseChunksIfNeeded();
+   SizeType ClaimSlotRun(Chunk* chunk, IndexType chunkIndex, SizeType count, KeyType* outKeys, ValueType** outPtrs);
+   SizeType FreeSlotRuns(const KeyType* keys, SizeType count);
+   SizeType FreeSlotRun(Chunk* chunk, IndexType chunkIndex, const KeyType* keys, SizeType count);
+   void RebuildChunkFreeList();
+   void ResetChunkFreeList();
+   IndexType FindFullestFreeChunk() const;
+   void RetireSlot(Chunk* chunk, SizeType slotIndex);
+   void RetireChunkIfNeeded(IndexType chunkIndex);
+   Chunk* GetRetiredChunk();
+   void DeleteChunks();
+   void ClearRetired();
+   void WriteSnapshotHeader(std::ostream& stream, uint64_t magic) const;
+   void WriteChunk(std::ostream& stream, SizeType chunkIndex) const;
+   Chunk* ReadChunk(std::istream& stream, bool isUsed);
+
+   // Marks the retired slots in place of the next free slot index.
+   static constexpr IndexType RetiredSlot = -2;
+
+   // The number of occupancy buckets of ChunkAllocationPolicy::FullestFirst.
+   static constexpr SizeType OccupancyBucketCount = std::min<SizeType>(16, ChunkSlots);
+
+   static constexpr std::array<IndexType, OccupancyBucketCount> MakeEmptyBuckets()
+   {
+      std::array<IndexType, OccupancyBucketCount> buckets = {};
+      for (IndexType& bucket : buckets)
+      {
+         bucket = -1;
+      }
+      return buckets;
+   }
+
+   bool ReadSnapshotHeader(
+      std::istream& stream,
+      uint64_t magic,
+      impl::SnapshotHeader& outHeader,
+      std::array<IndexType, OccupancyBucketCount>& outFreeChunkBuckets);
+   void SetSnapshotState(const impl::SnapshotHeader& header, const std::array<IndexType, OccupancyBucketCount>& freeChunkBuckets);
 
    SizeType m_size = 0;
+   // With ChunkAllocationPolicy::FullestFirst, the head of the fullest
+   // non-empty bucket.
    IndexType m_firstFreeChunk = -1;
    SizeType m_maxUsedChunk = 0;
+   SizeType m_emptyChunkLimit = 0;
+   SizeType m_retiredSlotCount = 0;
+   SizeType m_retiredChunkCount = 0;
+   GenerationOverflowPolicy m_overflowPolicy = GenerationOverflowPolicy::Wrap;
+   ChunkAllocationPolicy m_allocationPolicy = ChunkAllocationPolicy::MostRecentlyFreed;
+   // Heads of the doubly linked lists of the chunks with free slots by their
+   // occupancy, only used with ChunkAllocationPolicy::FullestFirst.
+   std::array<IndexType, OccupancyBucketCount> m_freeChunkBuckets = MakeEmptyBuckets();
+   // The chunk that all retired chunk indices point to, created with the
+   // first retired chunk.
+   Chunk* m_retiredChunk = nullptr;
+   TAllocator m_allocator;
    std::vector<Chunk*, ChunkPtrAllocator> m_chunks;
+   // The highest generation of each released chunk, indexed by chunk index.
+   std::vector<GenerationType, GenerationAllocator> m_releasedGenerations;
+   bool m_isTrackingDirtyChunks = false;
+   // Nonzero for the chunks changed since the last delta, indexed by chunk
+   // index. Grows on demand, the missing entries are clean.
+   std::vector<uint8_t, FlagAllocator> m_dirtyChunks;
+   bool m_isCopyOnWrite = false;
+   // The share counts of the chunks shared with copy-on-write copies, indexed
+   // by chunk index. Copying the storage shares its chunks too, so these are
+   // changed by the copy constructor of the copy.
+   mutable std::vector<ShareCount*, ShareCountPtrAllocator> m_chunkShares;
+   mutable SizeType m_sharedChunkCount = 0;
+   TStats m_stats;
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Dynamically allocated SlotMap storage that keeps the values packed in a
+ * single array.
+ *
+ * A key refers to a slot of a sparse array, which holds the index of the
+ * value in the dense array of values and the generation of the slot. The
+ * dense array is kept without holes: erasing a value moves the last value in
+ * its place (swap and pop). A second array holds the key of each value in
+ * the dense order, so that the slot of the moved value can be updated and
+ * the iteration has the keys at hand.
+ *
+ * Iteration is a plain loop over the dense array, without any live bits to
+ * scan, and lookups are still *O(1)*. The price is that the values move:
+ *
+ * - Pointers and references to the elements are **not** stable. They are
+ *   invalidated by erasing any element and by insertions that grow the
+ *   storage. The keys stay valid.
+ * - The arguments of \ref SlotMap::Emplace() must not refer to elements of
+ *   the same slotmap.
+ * - The elements must not be erased while iterating with
+ *   \ref FindNextKey() / \ref IncrementKey() or with the iterators.
+ * - `TValue` must be move constructible and move assignable.
+ *
+ * The index used by \ref GetKeyByIndex() and \ref GetIndexByKey() is the
+ * position in the dense array.
+ */
+template<
+   typename TValue,
+   typename TKey = uint32_t,
+   typename TAllocator = std::allocator<TValue>>
+class DenseSlotMapStorage
+{
+public:
+   using ValueType = TValue;
+   using KeyType = TKey;
+   using GenerationType = uint8_t;
+   using AllocatorType = TAllocator;
+
+   using SizeType = size_t;
+   using IndexType = ptrdiff_t;
+
+   static_assert(std::is_unsigned_v<KeyType>, "Slotmap key type must be an unsigned integer type.");
+   static_assert(sizeof(KeyType) > sizeof(GenerationType), "The size of slotmap key type must be greater than the size of generation type.");
+
+   static constexpr KeyType InvalidKey = static_cast<KeyType>(0);
+
+   static constexpr int GenerationBitSize = sizeof(GenerationType) * CHAR_BIT;
+   static constexpr int SlotIndexBitSize = static_cast<int>(sizeof(KeyType) * CHAR_BIT) - GenerationBitSize;
+
+   static constexpr KeyType SlotIndexMask = (static_cast<KeyType>(1) << SlotIndexBitSize) - 1;
+   static constexpr KeyType GenerationShift = SlotIndexBitSize;
+   static constexpr KeyType GenerationMask = (static_cast<KeyType>(1) << GenerationBitSize) - 1;
+
+   /**
+    * Initial capacity of the dense array once the first element is inserted.
+    */
+   static constexpr SizeType MinCapacity = 16;
+
+   template<bool IsConst>
+   class IteratorTpl
+   {
+      friend class DenseSlotMapStorage;
+
+   public:
+      using StoragePtr = std::conditional_t<IsConst, const DenseSlotMapStorage*, DenseSlotMapStorage*>;
+      using ReferenceType = std::conditional_t<IsConst, const ValueType&, ValueType&>;
+      using PointerType = std::conditional_t<IsConst, const ValueType*, ValueType*>;
+
+      using iterator_category = std::forward_iterator_tag;
+      using value_type = std::pair<KeyType, ReferenceType>;
+      using difference_type = std::ptrdiff_t;
+      using reference = value_type;
+      using pointer = impl::ArrowProxy<value_type>;
+
+      IteratorTpl() = default;
+
+   private:
+      constexpr IteratorTpl(StoragePtr storage, SizeType index) : m_storage(storage), m_index(index) {}
+      constexpr IteratorTpl(StoragePtr storage) : m_storage(storage) {}
+
+   public:
+      inline bool operator==(const IteratorTpl& other) const { return m_key == other.m_key; }
+      inline bool operator!=(const IteratorTpl& other) const { return m_key != other.m_key; }
+
+      inline IteratorTpl& operator++() { Advance(); return *this; }
+      inline IteratorTpl operator++(int) { const IteratorTpl it(*this); Advance(); return it; }
+
+      inline KeyType GetKey() const { return m_key; }
+      inline PointerType GetPtr() const { return m_ptr; }
+
+      inline reference operator*() const { return reference(m_key, *m_ptr); }
+      inline pointer operator->() const { return pointer(**this); }
+
+      inline bool Advance() { ++m_index; return FindNext(); }
+
+   private:
+      bool FindNext();
+
+      StoragePtr m_storage = nullptr;
+      SizeType m_index = 0;
+
+      KeyType m_key = std::numeric_limits<KeyType>::max();
+      PointerType m_ptr = nullptr;
+   };
+
+   using Iterator = IteratorTpl<false>;
+   using ConstIterator = IteratorTpl<true>;
+
+   DenseSlotMapStorage() = default;
+   /**
+    * Constructs an empty storage that allocates its memory with `allocator`.
+    */
+   explicit DenseSlotMapStorage(const TAllocator& allocator);
+   DenseSlotMapStorage(const DenseSlotMapStorage& other);
+   DenseSlotMapStorage(DenseSlotMapStorage&& other);
+
+   ~DenseSlotMapStorage();
+
+   DenseSlotMapStorage& operator=(const DenseSlotMapStorage&) = delete;
+   DenseSlotMapStorage& operator=(DenseSlotMapStorage&& other);
+
+   inline TAllocator GetAllocator() const { return m_allocator; }
+
+   inline SizeType Size() const { return m_size; }
+   inline SizeType Capacity() const { return m_capacity; }
+   /**
+    * One less than the number of slot indices, so that the iteration cursor
+    * past the last element still fits in the slot index bits.
+    */
+   inline static constexpr SizeType MaxCapacity() { return static_cast<SizeType>(SlotIndexMask); }
+
+   bool Reserve(size_t capacity);
+   /**
+    * Shrinks the dense array to the number of elements and returns the number
+    * of released slots. The sparse array can't shrink, since the slot index
+    * is a part of the key.
+    */
+   SizeType ShrinkToFit();
+
+   TValue* GetPtr(TKey key) const;
+   void GetPtrBatch(const TKey* keys, size_t count, TValue** outPtrs) const;
+   inline void GetPtrBatch(const TKey* keys, size_t count, const TValue** outPtrs) const { GetPtrBatch(keys, count, const_cast<TValue**>(outPtrs)); }
+
+   SizeType GetIndexByKey(KeyType key) const;
+   KeyType GetKeyByIndex(SizeType index) const;
+
+   /**
+    * The iteration cursor is the position in the dense array, stored in the
+    * slot index bits of a key with generation 0, which no valid key has.
+    */
+   bool FindNextKey(TKey& key) const;
+   KeyType IncrementKey(TKey key) const;
+
+   template<typename TFunc>
+   void ForEachSlot(TFunc func) const;
+
+   template<typename TFunc, typename TExecutor>
+   void ParallelForEachSlot(TFunc func, TExecutor&& executor) const;
+
+   KeyType ReserveSlot(ValueType*& outPtr);
+   KeyType ReserveSlotNoAlloc(ValueType*& outPtr);
+   bool FreeSlot(KeyType key);
+
+   void Swap(DenseSlotMapStorage& other);
+   void Clear();
+
+   Iterator Begin() { Iterator it(this, 0); it.FindNext(); return it; }
+   constexpr Iterator End() { return Iterator(this); }
+
+   ConstIterator Begin() const { ConstIterator it(this, 0); it.FindNext(); return it; }
+   constexpr ConstIterator End() const { return ConstIterator(this); }
+
+private:
+   struct Slot
+   {
+      // The index of the value in the dense array if the slot is live, the
+      // next free slot otherwise.
+      KeyType m_index;
+      GenerationType m_generation;
+   };
+
+   using KeyAllocator = typename std::allocator_traits<TAllocator>::template rebind_alloc<KeyType>;
+   using SlotAllocator = typename std::allocator_traits<TAllocator>::template rebind_alloc<Slot>;
+
+   static constexpr KeyType NoFreeSlot = std::numeric_limits<KeyType>::max();
+
+   static inline constexpr KeyType MakeKey(GenerationType generation, SizeType slotIndex)
+   {
+      return (static_cast<KeyType>(generation) << GenerationShift) | static_cast<KeyType>(slotIndex);
+   }
+
+   /**
+    * Returns the position of the value of `key` in the dense array, or
+    * \ref Size() if the key is invalid.
+    */
+   inline SizeType FindIndex(KeyType key) const
+   {
+      const SizeType slotIndex = static_cast<SizeType>(key & SlotIndexMask);
+      if (slotIndex >= m_slots.size())
+      {
+         return m_size;
+      }
+
+      const SizeType index = m_slots[slotIndex].m_index;
+      return ((index < m_size) && (m_keys[index] == key)) ? index : m_size;
+   }
+
+   void Reallocate(SizeType capacity);
+
+   SizeType m_size = 0;
+   SizeType m_capacity = 0;
+   KeyType m_firstFreeSlot = NoFreeSlot;
+   TAllocator m_allocator;
+   TValue* m_values = nullptr;
+   // The key of each value, in the dense order.
+   std::vector<KeyType, KeyAllocator> m_keys;
+   std::vector<Slot, SlotAllocator> m_slots;
 };
 
 
@@ -488,6 +1669,7 @@ public:
    using SizeType = typename TStorage::SizeType;
    using Iterator = typename TStorage::Iterator;
    using ConstIterator = typename TStorage::ConstIterator;
+   using StorageType = TStorage;
 
    /**
     * A key that is always guaranteed to be invalid.
@@ -500,6 +1682,12 @@ public:
     * Constructs empty slot map.
     */
    SlotMap() = default;
+   /**
+    * Constructs empty slot map whose storage uses the given allocator, e.g.
+    * a `std::pmr::polymorphic_allocator` (see \ref pmr::SlotMap).
+    */
+   template<typename TAllocator, typename = std::enable_if_t<std::is_constructible_v<TStorage, const TAllocator&>>>
+   explicit SlotMap(const TAllocator& allocator) : m_storage(allocator) {}
    /**
     * Copy constructor.
     * 
@@ -557,6 +1745,51 @@ public:
     * \param capacity New capacity of the slotmap, in number of elements.
     */
    inline bool Reserve(SizeType capacity) { return m_storage.Reserve(capacity); }
+   /**
+    * Returns the memory that is not needed for the current elements to the
+    * allocator, if the storage supports it.
+    *
+    * The \ref ChunkedSlotMapStorage releases the empty chunks at the end of
+    * the storage (see \ref ChunkedSlotMapStorage::ShrinkToFit()). The other
+    * storages are left unchanged.
+    *
+    * All keys of the existing elements remain valid and the keys of erased
+    * elements remain invalid.
+    */
+   inline void ShrinkToFit()
+   {
+      if constexpr (impl::HasShrinkToFit<TStorage>::value)
+      {
+         m_storage.ShrinkToFit();
+      }
+   }
+   /**
+    * Moves up to `budget` elements to free slots closer to the beginning of
+    * the storage and releases the memory that is no longer needed, if the
+    * storage supports it (see \ref ChunkedSlotMapStorage::Compact()).
+    * Returns the number of moved elements, the other storages return 0.
+    *
+    * Each moved element gets a new key. `remap(oldKey, newKey)` is called
+    * for every moved element, so that the references held elsewhere can be
+    * updated. The old keys become invalid, as do the pointers and references
+    * to the moved elements.
+    *
+    * \param budget Max. number of elements moved by this call, which allows
+    * compacting a large slotmap in bounded time slices.
+    * \param remap Function called as `remap(KeyType oldKey, KeyType newKey)`.
+    */
+   template<typename TFunc>
+   inline SizeType Compact(SizeType budget, TFunc&& remap)
+   {
+      if constexpr (impl::HasCompact<TStorage>::value)
+      {
+         return m_storage.Compact(budget, std::forward<TFunc>(remap));
+      }
+      else
+      {
+         return 0;
+      }
+   }
    ///@}
 
    /**
@@ -585,6 +1818,24 @@ public:
     */
    template<typename... TArgs>
    TKey EmplaceNoAlloc(TArgs&&... args);
+   /**
+    * Constructs `count` new elements and stores their keys in `outKeys`.
+    *
+    * The element `i` is constructed from `factory(i)`. With the
+    * \ref ChunkedSlotMapStorage the slots are reserved in blocks, claiming
+    * whole empty chunks at once, which is much faster than calling
+    * \ref Emplace() in a loop.
+    *
+    * Has O(count) time complexity.
+    *
+    * \param count The number of elements to construct.
+    * \param factory Function object with the signature `ValueType(SizeType index)`.
+    * \param outKeys Array of at least `count` keys receiving the keys of the new elements.
+    * \return The number of constructed elements, which is less than `count`
+    *    only if the storage is full.
+    */
+   template<typename TFactory>
+   SizeType EmplaceN(SizeType count, TFactory factory, TKey* outKeys);
 
    /**
     * Erases the element with the given key.
@@ -599,6 +1850,18 @@ public:
     * \param key The key of the element to be erased.
     */
    inline bool Erase(TKey key) { return m_storage.FreeSlot(key); }
+   /**
+    * Erases the elements associated with the given keys. Invalid keys are
+    * ignored.
+    *
+    * With the \ref ChunkedSlotMapStorage the keys are grouped by chunk before
+    * the slots are freed.
+    *
+    * \param keys The keys of the elements to be erased.
+    * \param count The number of keys.
+    * \return The number of erased elements.
+    */
+   SizeType EraseN(const TKey* keys, SizeType count);
    /**
     * Exchanges the contents of the slotmap with those of `other`.
     *
@@ -616,7 +1879,8 @@ public:
     *
     * After this call, \ref Size() returns zero. Invalidates all keys.
     *
-    * Leaves the capacity unchanged. No memory is deallocated.
+    * Leaves the capacity unchanged. No memory is deallocated, see
+    * \ref ShrinkToFit().
     *
     * Has O(n) time complexity where n is the max. number of elements that the
     * slotmap contained since construction or last \ref Clear() call (i.e. not
@@ -625,6 +1889,33 @@ public:
    inline void Clear() { m_storage.Clear(); }
    ///@}
 
+   /**
+    * \name Serialization
+    */
+   ///@{
+   /**
+    * Writes all elements of the slotmap to `stream` as a binary snapshot,
+    * which can be loaded back with \ref LoadSnapshot(), if the storage
+    * supports it (see \ref ChunkedSlotMapStorage::SaveSnapshot()).
+    *
+    * The elements must be trivially copyable. The snapshot stores the memory
+    * of the storage as it is, it can only be loaded by a slotmap of the same
+    * type built for the same platform.
+    *
+    * Returns `false` if writing to the stream failed.
+    */
+   inline bool SaveSnapshot(std::ostream& stream) const { return m_storage.SaveSnapshot(stream); }
+   /**
+    * Replaces the elements of the slotmap with the elements of a snapshot
+    * written by \ref SaveSnapshot(). All keys of the saved elements are valid
+    * again and refer to the same elements.
+    *
+    * Returns `false` and leaves the slotmap unchanged if the snapshot can't
+    * be loaded.
+    */
+   inline bool LoadSnapshot(std::istream& stream) { return m_storage.LoadSnapshot(stream); }
+   ///@}
+
    /**
     * \name Element access
     */
@@ -639,7 +1930,17 @@ public:
     * \param key The key of the element to be retrieved.
     * \return A pointer to the element associated with the given key or `nullptr` is the key is invalid.
     */
-   inline TValue* GetPtr(TKey key) { return m_storage.GetPtr(key); }
+   inline TValue* GetPtr(TKey key)
+   {
+      if constexpr (impl::HasGetMutablePtr<TStorage>::value)
+      {
+         return m_storage.GetMutablePtr(key);
+      }
+      else
+      {
+         return m_storage.GetPtr(key);
+      }
+   }
    /**
     * Returns a pointer to the element associated with the given key.
     *
@@ -651,6 +1952,43 @@ public:
     * \return A pointer to the element associated with the given key or `nullptr` is the key is invalid.
     */
    inline const TValue* GetPtr(TKey key) const { return m_storage.GetPtr(key); }
+   /**
+    * Looks up pointers to values associated with `count` keys at once.
+    *
+    * Equivalent to calling \ref GetPtr() for every key, but the lookups are
+    * done in groups with software prefetching, so that the cache misses of
+    * the individual lookups overlap instead of stalling one after another.
+    * The values themselves are prefetched as well, since they are usually
+    * accessed right after the lookup. This pays off for large slotmaps and
+    * random keys.
+    *
+    * \param keys The keys to look up.
+    * \param count The number of keys.
+    * \param outPtrs Array of at least `count` pointers that receives the
+    *                pointer for each key, or `nullptr` for invalid keys.
+    */
+   inline void GetPtrBatch(const KeyType* keys, size_t count, ValueType** outPtrs)
+   {
+      m_storage.GetPtrBatch(keys, count, outPtrs);
+      if constexpr (impl::HasGetMutablePtr<TStorage>::value)
+      {
+         // The values in chunks shared with copy-on-write copies are looked
+         // up again once their chunks have been copied.
+         for (size_t i = 0; (i < count) && (m_storage.SharedChunkCount() > 0); ++i)
+         {
+            if (outPtrs[i])
+            {
+               outPtrs[i] = m_storage.GetMutablePtr(keys[i]);
+            }
+         }
+      }
+   }
+   /**
+    * Looks up pointers to values associated with `count` keys at once.
+    *
+    * See \ref GetPtrBatch(const KeyType*, size_t, ValueType**).
+    */
+   inline void GetPtrBatch(const KeyType* keys, size_t count, const ValueType** outPtrs) const { m_storage.GetPtrBatch(keys, count, outPtrs); }
    
    /**
     * Returns the key associated with the element at the given index.
@@ -661,7 +1999,7 @@ public:
     * @param index Index of the element.
     * @return Pointer to the element at the given index.
     */
-   TValue* GetPtrByIndex(SizeType index) { return m_storage.GetPtr(GetKeyByIndex(index)); }
+   TValue* GetPtrByIndex(SizeType index) { return GetPtr(GetKeyByIndex(index)); }
    /**
     * @brief Returns a pointer to the element at the given index.
     * @param index Index of the element.
@@ -715,6 +2053,52 @@ public:
     */
    template<typename TFunc>
    inline void ForEach(TFunc func) const { m_storage.ForEachSlot(func); }
+   /**
+    * Applies the given function object to each valid element in the slotmap
+    * from multiple threads of the default \ref ThreadPool.
+    *
+    * The slots are split into ranges with roughly the same number of valid
+    * elements, so the work is balanced even for unevenly occupied storages.
+    * The function object is shared by all threads and may be called
+    * concurrently, the order of the calls is unspecified. The slotmap must
+    * not be modified until the call returns.
+    *
+    * \param func The function object to be applied every element. The signature
+    *             of the function should be equivalent to `void func(TKey key, TValue& value)`.
+    */
+   template<typename TFunc>
+   inline void ParallelForEach(TFunc func) const { m_storage.ParallelForEachSlot(func, ThreadPool::GetDefault()); }
+   /**
+    * Same as \ref ParallelForEach(TFunc), but runs on the given executor.
+    *
+    * \param executor Either an executor object like \ref ThreadPool or
+    *                 \ref SequentialExecutor, or a standard execution policy
+    *                 like `std::execution::par`.
+    */
+   template<typename TFunc, typename TExecutor>
+   inline void ParallelForEach(TFunc func, TExecutor&& executor) const { m_storage.ParallelForEachSlot(func, std::forward<TExecutor>(executor)); }
+
+   /**
+    * Calls `func(span)` for each chunk with live elements. The span gives
+    * the value array, the live bits and the generations of the chunk (see
+    * \ref ChunkedSlotMapStorage::ChunkSpanTpl), so that the loop over the
+    * slots of a chunk is in user code and can be vectorized:
+    *
+    *    map.ForEachChunk([&](auto span)
+    *    {
+    *       if (span.IsFull())
+    *       {
+    *          for (size_t i = 0; i < span.GetSlotCount(); ++i) { sum += span.GetValues()[i]; }
+    *       }
+    *       ...
+    *    });
+    *
+    * Only available with \ref ChunkedSlotMapStorage.
+    */
+   template<typename TFunc>
+   inline void ForEachChunk(TFunc func) { m_storage.ForEachChunk(func); }
+   template<typename TFunc>
+   inline void ForEachChunk(TFunc func) const { m_storage.ForEachChunk(func); }
    
    /**
     * Returns an iterator to the first element in the slotmap if it's not empty,
@@ -743,9 +2127,67 @@ public:
     * Has *O(1)* time complexity.
     */
    constexpr inline ConstIterator End() const { return m_storage.End(); }
+
+   /**
+    * Same as \ref Begin() and \ref End(), for range-based for loops and the
+    * standard algorithms. The iterators are forward iterators dereferencing to
+    * a `std::pair` of the key and a reference to the value:
+    *
+    *    for (auto [key, value] : map) { ... }
+    */
+   inline Iterator begin() { return Begin(); }
+   inline ConstIterator begin() const { return Begin(); }
+   constexpr inline Iterator end() { return End(); }
+   constexpr inline ConstIterator end() const { return End(); }
+
+   /**
+    * Returns a range of the keys of the elements in the slotmap.
+    */
+   inline IteratorRange<impl::KeyIterator<ConstIterator>> Keys() const
+   {
+      return { impl::KeyIterator<ConstIterator>(Begin()), impl::KeyIterator<ConstIterator>(End()) };
+   }
+
+   /**
+    * Returns a range of the values in the slotmap.
+    */
+   inline IteratorRange<impl::ValueIterator<Iterator>> Values()
+   {
+      return { impl::ValueIterator<Iterator>(Begin()), impl::ValueIterator<Iterator>(End()) };
+   }
+   inline IteratorRange<impl::ValueIterator<ConstIterator>> Values() const
+   {
+      return { impl::ValueIterator<ConstIterator>(Begin()), impl::ValueIterator<ConstIterator>(End()) };
+   }
+
+   /**
+    * Returns a random access range of the chunks of the storage, each of them
+    * an \ref IteratorRange of the elements in the chunk, which can be split
+    * between threads:
+    *
+    *    auto chunks = map.ChunkRanges();
+    *    std::for_each(std::execution::par, chunks.begin(), chunks.end(), [](auto chunk)
+    *    {
+    *       for (auto [key, value] : chunk) { ... }
+    *    });
+    *
+    * Only available with \ref ChunkedSlotMapStorage.
+    */
+   inline auto ChunkRanges() { return m_storage.ChunkRanges(); }
+   inline auto ChunkRanges() const { return m_storage.ChunkRanges(); }
    
    ///@}
 
+   /**
+    * Returns the underlying storage, e.g. for storage-specific features like
+    * \ref ConcurrentSlotCache.
+    */
+   inline TStorage& GetStorage() { return m_storage; }
+   /**
+    * Returns the underlying storage.
+    */
+   inline const TStorage& GetStorage() const { return m_storage; }
+
 private:
    TStorage m_storage;
 };
@@ -757,6 +2199,48 @@ private:
 template<typename TValue, size_t Capacity, typename TKey = uint32_t>
 using FixedSlotMap = SlotMap<TValue, TKey, FixedSlotMapStorage<TValue, TKey, Capacity>>;
 
+/**
+ * \ref SlotMap that keeps its elements packed in a single array (see
+ * \ref DenseSlotMapStorage). The elements are not pointer-stable.
+ */
+template<typename TValue, typename TKey = uint32_t>
+using DenseSlotMap = SlotMap<TValue, TKey, DenseSlotMapStorage<TValue, TKey>>;
+
+/**
+ * \ref SlotMap with chunked storage that counts its operations in
+ * \ref AtomicStats, e.g. to export them as metrics.
+ *
+ * \code
+ * slotmap::InstrumentedSlotMap<int> map;
+ * ...
+ * const slotmap::StatsSnapshot stats = map.GetStorage().GetStats().GetSnapshot();
+ * \endcode
+ */
+template<typename TValue, typename TKey = uint32_t>
+using InstrumentedSlotMap = SlotMap<TValue, TKey, ChunkedSlotMapStorage<TValue, TKey, DefaultMaxChunkSize, std::allocator<TValue>, FixedBitSetTraits<>, 8, AtomicStats>>;
+
+
+#if SLOTMAP_PMR
+namespace pmr {
+
+
+/**
+ * \ref SlotMap with chunked storage that allocates its memory from a
+ * `std::pmr::memory_resource`, e.g. a `std::pmr::monotonic_buffer_resource`
+ * that is released at once at the end of a frame or a request.
+ *
+ * \code
+ * std::pmr::monotonic_buffer_resource resource;
+ * slotmap::pmr::SlotMap<int> map(&resource);
+ * \endcode
+ */
+template<typename TValue, typename TKey = uint32_t>
+using SlotMap = slotmap::SlotMap<TValue, TKey, ChunkedSlotMapStorage<TValue, TKey, DefaultMaxChunkSize, std::pmr::polymorphic_allocator<TValue>>>;
+
+
+} // namespace pmr
+#endif
+
 
 } // namespace slotmap
 
@@ -41,8 +41,10 @@ template<
    typename TValue,
    typename TKey,
    size_t TCapacity,
-   typename TBitset>
-FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset>::FixedSlotMapStorage()
+   typename TBitset,
+   typename TStats>
+FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset, TStats>::FixedSlotMapStorage()
+   : m_generations{}
 {
 }
 
@@ -52,11 +54,14 @@ template<
    typename TValue,
    typename TKey,
    size_t TCapacity,
-   typename TBitset>
-FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset>::FixedSlotMapStorage(const FixedSlotMapStorage& other)
+   typename TBitset,
+   typename TStats>
+FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset, TStats>::FixedSlotMapStorage(const FixedSlotMapStorage& other)
    : m_size(other.m_size)
    , m_firstFreeSlot(other.m_firstFreeSlot)
    , m_maxUsedSlot(other.m_maxUsedSlot)
+   , m_retiredSlotCount(other.m_retiredSlotCount)
+   , m_overflowPolicy(other.m_overflowPolicy)
    , m_liveBits(other.m_liveBits)
 {
    for (SizeType i = 0; i < static_cast<SizeType>(m_maxUsedSlot); ++i)
@@ -73,6 +78,8 @@ FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset>::FixedSlotMapStorage(const
          m_slots[i].m_nextFreeSlot = other.m_slots[i].m_nextFreeSlot;
       }
    }
+
+   UpdateStats();
 }
 
 
@@ -81,8 +88,9 @@ template<
    typename TValue,
    typename TKey,
    size_t TCapacity,
-   typename TBitset>
-FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset>::FixedSlotMapStorage(FixedSlotMapStorage&& other)
+   typename TBitset,
+   typename TStats>
+FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset, TStats>::FixedSlotMapStorage(FixedSlotMapStorage&& other)
 {
    *this = std::move(other);
 }
@@ -93,8 +101,9 @@ template<
    typename TValue,
    typename TKey,
    size_t TCapacity,
-   typename TBitset>
-FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset>::~FixedSlotMapStorage()
+   typename TBitset,
+   typename TStats>
+FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset, TStats>::~FixedSlotMapStorage()
 {
    Clear();
 }
@@ -105,8 +114,9 @@ template<
    typename TValue,
    typename TKey,
    size_t TCapacity,
-   typename TBitset>
-FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset>& FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset>::operator=(FixedSlotMapStorage&& other)
+   typename TBitset,
+   typename TStats>
+FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset, TStats>& FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset, TStats>::operator=(FixedSlotMapStorage&& other)
 {
    Clear();
 
@@ -133,13 +143,19 @@ FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset>& FixedSlotMapStorage<TValu
    m_size = other.m_size;
    m_maxUsedSlot = other.m_maxUsedSlot;
    m_firstFreeSlot = other.m_firstFreeSlot;
+   m_retiredSlotCount = other.m_retiredSlotCount;
+   m_overflowPolicy = other.m_overflowPolicy;
    m_liveBits = std::move(other.m_liveBits);
    
    other.m_size = 0;
    other.m_maxUsedSlot = 0;
    other.m_firstFreeSlot = -1;
+   other.m_retiredSlotCount = 0;
    other.m_liveBits.reset();
 
+   UpdateStats();
+   other.UpdateStats();
+
    return *this;
 }
 
@@ -149,8 +165,9 @@ template<
    typename TValue,
    typename TKey,
    size_t TCapacity,
-   typename TBitsetTraits>
-bool FixedSlotMapStorage<TValue, TKey, TCapacity, TBitsetTraits>::Reserve(size_t capacity)
+   typename TBitsetTraits,
+   typename TStats>
+bool FixedSlotMapStorage<TValue, TKey, TCapacity, TBitsetTraits, TStats>::Reserve(size_t capacity)
 {
    return capacity <= StaticCapacity;
 }
@@ -161,21 +178,24 @@ template<
    typename TValue,
    typename TKey,
    size_t Capacity,
-   typename TBitset>
+   typename TBitset,
+   typename TStats>
 template<typename TSelf>
-auto FixedSlotMapStorage<TValue, TKey, Capacity, TBitset>::GetPtrTpl(TSelf self, TKey key)
+auto FixedSlotMapStorage<TValue, TKey, Capacity, TBitset, TStats>::GetPtrTpl(TSelf self, TKey key)
 {
    using ReturnType = decltype(self->m_slots[0].GetPtr());
 
    const SizeType slotIndex = static_cast<SizeType>(key & SlotIndexMask);
    if ((slotIndex >= static_cast<SizeType>(self->m_maxUsedSlot)) || !self->m_liveBits.test(slotIndex))
    {
+      self->m_stats.OnLookupFailed((slotIndex >= static_cast<SizeType>(self->m_maxUsedSlot)) ? LookupFailure::OutOfRange : LookupFailure::DeadSlot);
       return static_cast<ReturnType>(nullptr);
    }
 
    const GenerationType generation = static_cast<GenerationType>((key >> GenerationShift) & GenerationMask);
    if (self->m_generations[slotIndex] != generation)
    {
+      self->m_stats.OnLookupFailed(LookupFailure::StaleGeneration);
       return static_cast<ReturnType>(nullptr);
    }
 
@@ -183,13 +203,52 @@ auto FixedSlotMapStorage<TValue, TKey, Capacity, TBitset>::GetPtrTpl(TSelf self,
 }
 
 
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t Capacity,
+   typename TBitset,
+   typename TStats>
+template<typename TSelf, typename TPtr>
+void FixedSlotMapStorage<TValue, TKey, Capacity, TBitset, TStats>::GetPtrBatchTpl(TSelf self, const TKey* keys, size_t count, TPtr* outPtrs)
+{
+   for (size_t groupBegin = 0; groupBegin < count; groupBegin += impl::LookupGroupSize)
+   {
+      const size_t groupEnd = std::min(count, groupBegin + impl::LookupGroupSize);
+
+      // Stage 1: live bits and generations.
+      for (size_t i = groupBegin; i < groupEnd; ++i)
+      {
+         const SizeType slotIndex = static_cast<SizeType>(keys[i] & SlotIndexMask);
+         if (slotIndex < static_cast<SizeType>(self->m_maxUsedSlot))
+         {
+            impl::Prefetch(impl::GetBitAddress(self->m_liveBits, slotIndex));
+            impl::Prefetch(&self->m_generations[slotIndex]);
+         }
+      }
+
+      // Stage 2: validation, values are prefetched for the caller.
+      for (size_t i = groupBegin; i < groupEnd; ++i)
+      {
+         outPtrs[i] = GetPtrTpl(self, keys[i]);
+         if (outPtrs[i])
+         {
+            impl::Prefetch(outPtrs[i]);
+         }
+      }
+   }
+}
+
+
 //////////////////////////////////////////////////////////////////////////
 template<
    typename TValue,
    typename TKey,
    size_t TCapacity,
-   typename TBitsetTraits>
-TKey FixedSlotMapStorage<TValue, TKey, TCapacity, TBitsetTraits>::GetKeyByIndex(size_t index) const
+   typename TBitsetTraits,
+   typename TStats>
+TKey FixedSlotMapStorage<TValue, TKey, TCapacity, TBitsetTraits, TStats>::GetKeyByIndex(size_t index) const
 {
    if (index >= static_cast<size_t>(m_maxUsedSlot))
    {
@@ -210,8 +269,9 @@ template<
    typename TValue,
    typename TKey,
    size_t TCapacity,
-   typename TBitsetTraits>
-size_t FixedSlotMapStorage<TValue, TKey, TCapacity, TBitsetTraits>::GetIndexByKey(TKey key) const
+   typename TBitsetTraits,
+   typename TStats>
+size_t FixedSlotMapStorage<TValue, TKey, TCapacity, TBitsetTraits, TStats>::GetIndexByKey(TKey key) const
 {
    return static_cast<size_t>(key & SlotIndexMask);
 }
@@ -222,8 +282,9 @@ template<
    typename TValue,
    typename TKey,
    size_t TCapacity,
-   typename TBitset>
-bool FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset>::FindNextKey(TKey& key) const
+   typename TBitset,
+   typename TStats>
+bool FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset, TStats>::FindNextKey(TKey& key) const
 {
    const TKey slotIndex = static_cast<TKey>(TBitset::template FindNextBitSet(m_liveBits, key & SlotIndexMask));
    if (slotIndex >= static_cast<TKey>(m_maxUsedSlot))
@@ -241,8 +302,9 @@ template<
    typename TValue,
    typename TKey,
    size_t TCapacity,
-   typename TBitset>
-TKey FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset>::IncrementKey(TKey key) const
+   typename TBitset,
+   typename TStats>
+TKey FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset, TStats>::IncrementKey(TKey key) const
 {
    assert(((key + 1) & SlotIndexMask) > (key & SlotIndexMask));
    return key + 1;
@@ -254,9 +316,10 @@ template<
    typename TValue,
    typename TKey,
    size_t TCapacity,
-   typename TBitset>
+   typename TBitset,
+   typename TStats>
 template<typename TFunc>
-void FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset>::ForEachSlot(TFunc func) const
+void FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset, TStats>::ForEachSlot(TFunc func) const
 {
    m_liveBits.ForEachSetBit(0, m_maxUsedSlot, [&](size_t index)
    {
@@ -271,8 +334,44 @@ template<
    typename TValue,
    typename TKey,
    size_t TCapacity,
-   typename TBitset>
-TKey FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset>::ReserveSlot(TValue*& outPtr)
+   typename TBitset,
+   typename TStats>
+template<typename TFunc, typename TExecutor>
+void FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset, TStats>::ParallelForEachSlot(TFunc func, TExecutor&& executor) const
+{
+   // Ranges are aligned to whole bitset words, so that every word is scanned
+   // by a single thread.
+   constexpr size_t RangeAlignment = BitsetType::BitsPerWord;
+
+   const size_t alignedSlotCount = (m_maxUsedSlot + RangeAlignment - 1) / RangeAlignment;
+   const size_t rangeCount = std::min(alignedSlotCount, impl::GetExecutorConcurrency(executor) * impl::TasksPerThread);
+   if (rangeCount <= 1)
+   {
+      ForEachSlot(func);
+      return;
+   }
+
+   impl::ExecuteParallelFor(std::forward<TExecutor>(executor), rangeCount, [&](size_t rangeIndex)
+   {
+      const size_t from = alignedSlotCount * rangeIndex / rangeCount * RangeAlignment;
+      const size_t to = std::min<size_t>(alignedSlotCount * (rangeIndex + 1) / rangeCount * RangeAlignment, m_maxUsedSlot);
+      m_liveBits.ForEachSetBit(from, to, [&](size_t index)
+      {
+         const TKey key = (static_cast<TKey>(m_generations[index]) << GenerationShift) | static_cast<TKey>(index);
+         func(key, *m_slots[index].GetPtr());
+      });
+   });
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t TCapacity,
+   typename TBitset,
+   typename TStats>
+TKey FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset, TStats>::ReserveSlot(TValue*& outPtr)
 {
    if (m_firstFreeSlot >= 0)
    {
@@ -285,10 +384,13 @@ TKey FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset>::ReserveSlot(TValue*&
       if (m_generations[slotIndex] == 0)
       {
          m_generations[slotIndex] = 1;
+         m_stats.OnGenerationWrap();
       }
       m_liveBits.set(slotIndex);
 
       ++m_size;
+      m_stats.OnInsert(1);
+      UpdateStats();
 
       return (static_cast<TKey>(m_generations[slotIndex]) << GenerationShift) | static_cast<TKey>(slotIndex);
    }
@@ -301,11 +403,14 @@ TKey FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset>::ReserveSlot(TValue*&
       if (m_generations[slotIndex] == 0)
       {
          m_generations[slotIndex] = 1;
+         m_stats.OnGenerationWrap();
       }
       m_liveBits.set(slotIndex);
 
       ++m_size;
       ++m_maxUsedSlot;
+      m_stats.OnInsert(1);
+      UpdateStats();
 
       return (static_cast<TKey>(m_generations[slotIndex]) << GenerationShift) | static_cast<TKey>(slotIndex);
    }
@@ -320,8 +425,52 @@ template<
    typename TValue,
    typename TKey,
    size_t TCapacity,
-   typename TBitset>
-bool FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset>::FreeSlot(KeyType key)
+   typename TBitset,
+   typename TStats>
+typename FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset, TStats>::SizeType
+FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset, TStats>::ReserveSlots(SizeType count, KeyType* outKeys, ValueType** outPtrs)
+{
+   SizeType reserved = 0;
+   while ((reserved < count) && (m_firstFreeSlot >= 0))
+   {
+      outKeys[reserved] = ReserveSlot(outPtrs[reserved]);
+      ++reserved;
+   }
+
+   const SizeType runBegin = static_cast<SizeType>(m_maxUsedSlot);
+   const SizeType runLength = std::min<SizeType>(count - reserved, TCapacity - runBegin);
+   for (SizeType i = 0; i < runLength; ++i)
+   {
+      const SizeType slotIndex = runBegin + i;
+      m_generations[slotIndex] = (m_generations[slotIndex] + 1) & GenerationMask;
+      if (m_generations[slotIndex] == 0)
+      {
+         m_generations[slotIndex] = 1;
+         m_stats.OnGenerationWrap();
+      }
+
+      outPtrs[reserved + i] = m_slots[slotIndex].GetPtr();
+      outKeys[reserved + i] = (static_cast<TKey>(m_generations[slotIndex]) << GenerationShift) | static_cast<TKey>(slotIndex);
+   }
+   TBitset::SetRange(m_liveBits, runBegin, runBegin + runLength);
+
+   m_maxUsedSlot += static_cast<IndexType>(runLength);
+   m_size += runLength;
+   m_stats.OnInsert(runLength);
+   UpdateStats();
+
+   return reserved + runLength;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t TCapacity,
+   typename TBitset,
+   typename TStats>
+bool FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset, TStats>::FreeSlot(KeyType key)
 {
    const SizeType slotIndex = static_cast<SizeType>(key & SlotIndexMask);
    if ((slotIndex >= static_cast<SizeType>(m_maxUsedSlot)) || !m_liveBits.test(slotIndex))
@@ -342,12 +491,22 @@ bool FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset>::FreeSlot(KeyType key
       m_slots[slotIndex].GetPtr()->~TValue();
    }
    
-   m_slots[slotIndex].m_nextFreeSlot = m_firstFreeSlot;
-   m_firstFreeSlot = static_cast<IndexType>(slotIndex);
+   if ((generation == GenerationMask) && (m_overflowPolicy != GenerationOverflowPolicy::Wrap))
+   {
+      m_slots[slotIndex].m_nextFreeSlot = RetiredSlot;
+      ++m_retiredSlotCount;
+   }
+   else
+   {
+      m_slots[slotIndex].m_nextFreeSlot = m_firstFreeSlot;
+      m_firstFreeSlot = static_cast<IndexType>(slotIndex);
+   }
 
    m_liveBits.reset(slotIndex);
    assert(m_size > 0);
    --m_size;
+   m_stats.OnErase(1);
+   UpdateStats();
    
    return true;
 }
@@ -358,8 +517,9 @@ template<
    typename TValue,
    typename TKey,
    size_t TCapacity,
-   typename TBitset>
-void FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset>::Swap(FixedSlotMapStorage& other)
+   typename TBitset,
+   typename TStats>
+void FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset, TStats>::Swap(FixedSlotMapStorage& other)
 {
    FixedSlotMapStorage tmp(std::move(other));
    other = std::move(*this);
@@ -372,8 +532,9 @@ template<
    typename TValue,
    typename TKey,
    size_t TCapacity,
-   typename TBitset>
-void FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset>::Clear()
+   typename TBitset,
+   typename TStats>
+void FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset, TStats>::Clear()
 {
    if constexpr (!std::is_trivially_destructible_v<TValue>)
    {
@@ -382,12 +543,42 @@ void FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset>::Clear()
          m_slots[slotIndex].GetPtr()->~TValue();
       });
    }
+
+   if ((m_retiredSlotCount > 0) || (m_overflowPolicy != GenerationOverflowPolicy::Wrap))
+   {
+      // The used slots stay used, so that the retired ones are not handed
+      // out again. The live slots with an exhausted generation are retired
+      // the same way as if they were erased, the others go to the free list
+      // in ascending order.
+      m_firstFreeSlot = -1;
+      for (IndexType slotIndex = m_maxUsedSlot - 1; slotIndex >= 0; --slotIndex)
+      {
+         const bool isLive = m_liveBits.test(slotIndex);
+         m_liveBits.reset(slotIndex);
+         if (isLive && (m_generations[slotIndex] == GenerationMask) && (m_overflowPolicy != GenerationOverflowPolicy::Wrap))
+         {
+            m_slots[slotIndex].m_nextFreeSlot = RetiredSlot;
+            ++m_retiredSlotCount;
+         }
+         else if (isLive || (m_slots[slotIndex].m_nextFreeSlot != RetiredSlot))
+         {
+            m_slots[slotIndex].m_nextFreeSlot = m_firstFreeSlot;
+            m_firstFreeSlot = slotIndex;
+         }
+      }
+      m_stats.OnErase(m_size);
+      m_size = 0;
+      UpdateStats();
+      return;
+   }
    
    m_maxUsedSlot = 0;
    m_firstFreeSlot = -1;
    
    //m_liveBits.reset();
+   m_stats.OnErase(m_size);
    m_size = 0;
+   UpdateStats();
 }
 
 
@@ -396,9 +587,10 @@ template<
    typename TValue,
    typename TKey,
    size_t TCapacity,
-   typename TBitset>
+   typename TBitset,
+   typename TStats>
 template<bool IsConst>
-bool FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset>::IteratorTpl<IsConst>::Advance()
+bool FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset, TStats>::IteratorTpl<IsConst>::Advance()
 {
    ++m_key;
    return FindNext();
@@ -410,9 +602,10 @@ template<
    typename TValue,
    typename TKey,
    size_t TCapacity,
-   typename TBitset>
+   typename TBitset,
+   typename TStats>
 template<bool IsConst>
-bool FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset>::IteratorTpl<IsConst>::FindNext()
+bool FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset, TStats>::IteratorTpl<IsConst>::FindNext()
 {
    if (!m_storage->FindNextKey(m_key))
    {
@@ -420,7 +613,8 @@ bool FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset>::IteratorTpl<IsConst>
       m_ptr = nullptr;
       return false;
    }
-   m_ptr = m_storage->GetPtr(m_key);
+   // The key was just made from the live slot, no need to validate it again.
+   m_ptr = m_storage->m_slots[m_key & SlotIndexMask].GetPtr();
    return true;
 }
 
@@ -429,8 +623,11 @@ bool FixedSlotMapStorage<TValue, TKey, TCapacity, TBitset>::IteratorTpl<IsConst>
 template<size_t TSlotCount, typename TValue, typename TIndexType, typename TGenerationType, typename TBitsetTraits>
 ChunkTpl<TSlotCount, TValue, TIndexType, TGenerationType, TBitsetTraits>::ChunkTpl(const ChunkTpl& other) 
    : m_nextFreeChunk(other.m_nextFreeChunk)
+   , m_prevFreeChunk(other.m_prevFreeChunk)
    , m_firstFreeSlot(other.m_firstFreeSlot)
    , m_lastFreeSlot(other.m_lastFreeSlot)
+   , m_liveCount(other.m_liveCount)
+   , m_retiredSlotCount(other.m_retiredSlotCount)
    , m_liveBits(other.m_liveBits)
 {
    for (size_t i = 0; i < TSlotCount; ++i)
@@ -450,23 +647,108 @@ ChunkTpl<TSlotCount, TValue, TIndexType, TGenerationType, TBitsetTraits>::ChunkT
 }
 
 
+//////////////////////////////////////////////////////////////////////////
+template<size_t TSlotCount, typename TValue, typename TIndexType, typename TGenerationType, typename TBitsetTraits>
+ChunkTpl<TSlotCount, TValue, TIndexType, TGenerationType, TBitsetTraits>::ChunkTpl(ChunkTpl&& other) 
+   : m_nextFreeChunk(other.m_nextFreeChunk)
+   , m_prevFreeChunk(other.m_prevFreeChunk)
+   , m_firstFreeSlot(other.m_firstFreeSlot)
+   , m_lastFreeSlot(other.m_lastFreeSlot)
+   , m_liveCount(other.m_liveCount)
+   , m_retiredSlotCount(other.m_retiredSlotCount)
+   , m_liveBits(other.m_liveBits)
+{
+   for (size_t i = 0; i < TSlotCount; ++i)
+   {
+      m_generations[i] = other.m_generations[i];
+      if (other.m_liveBits.test(i))
+      {
+         new (m_slots[i].GetPtr()) TValue(std::move(*other.m_slots[i].GetPtr()));
+      }
+      else
+      {
+         m_slots[i].m_nextFreeSlot = other.m_slots[i].m_nextFreeSlot;
+      }
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::ChunkedSlotMapStorage(const TAllocator& allocator)
+   : m_allocator(allocator)
+   , m_chunks(ChunkPtrAllocator(allocator))
+   , m_releasedGenerations(GenerationAllocator(allocator))
+   , m_dirtyChunks(FlagAllocator(allocator))
+   , m_chunkShares(ShareCountPtrAllocator(allocator))
+{
+}
+
+
 //////////////////////////////////////////////////////////////////////////
 template<
    typename TValue,
    typename TKey,
    size_t MaxChunkSize,
    typename TAllocator,
-   typename TBitsetTraits>
-ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits>::ChunkedSlotMapStorage(const ChunkedSlotMapStorage& other)
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::ChunkedSlotMapStorage(const ChunkedSlotMapStorage& other)
    : m_size(other.m_size)
    , m_firstFreeChunk(other.m_firstFreeChunk)
    , m_maxUsedChunk(other.m_maxUsedChunk)
+   , m_emptyChunkLimit(other.m_emptyChunkLimit)
+   , m_retiredSlotCount(other.m_retiredSlotCount)
+   , m_retiredChunkCount(other.m_retiredChunkCount)
+   , m_overflowPolicy(other.m_overflowPolicy)
+   , m_allocationPolicy(other.m_allocationPolicy)
+   , m_freeChunkBuckets(other.m_freeChunkBuckets)
+   , m_allocator(std::allocator_traits<TAllocator>::select_on_container_copy_construction(other.m_allocator))
+   , m_chunks(ChunkPtrAllocator(m_allocator))
+   , m_releasedGenerations(other.m_releasedGenerations.begin(), other.m_releasedGenerations.end(), GenerationAllocator(m_allocator))
+   , m_isTrackingDirtyChunks(other.m_isTrackingDirtyChunks)
+   , m_dirtyChunks(other.m_dirtyChunks.begin(), other.m_dirtyChunks.end(), FlagAllocator(m_allocator))
+   , m_isCopyOnWrite(other.m_isCopyOnWrite)
+   , m_chunkShares(ShareCountPtrAllocator(m_allocator))
 {
    m_chunks.resize(m_maxUsedChunk);
+   if (m_isCopyOnWrite && (m_allocator == other.m_allocator))
+   {
+      ShareChunks(other);
+      UpdateStats();
+      return;
+   }
+
    for (size_t i = 0; i < m_maxUsedChunk; ++i)
    {
-      m_chunks[i] = new Chunk(*other.m_chunks[i]);
+      m_chunks[i] = (other.m_chunks[i] == other.m_retiredChunk) ? GetRetiredChunk() : ConstructChunk(*other.m_chunks[i]);
    }
+   UpdateStats();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::~ChunkedSlotMapStorage()
+{
+   ReleaseSharedChunks();
+   Clear();
+   DeleteChunks();
 }
 
 
@@ -476,12 +758,19 @@ template<
    typename TKey,
    size_t MaxChunkSize,
    typename TAllocator,
-   typename TBitsetTraits>
-ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits>::ChunkedSlotMapStorage(ChunkedSlotMapStorage&& other)
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::ChunkedSlotMapStorage(ChunkedSlotMapStorage&& other)
 //   : m_size(other.m_size)
 //   , m_firstFreeChunk(other.m_firstFreeChunk)
 //   , m_maxUsedChunk(other.m_maxUsedChunk)
 //   , m_chunks(std::move(other.m_chunks))
+   : m_allocator(other.m_allocator)
+   , m_chunks(ChunkPtrAllocator(m_allocator))
+   , m_releasedGenerations(GenerationAllocator(m_allocator))
+   , m_dirtyChunks(FlagAllocator(m_allocator))
+   , m_chunkShares(ShareCountPtrAllocator(m_allocator))
 {
    //other.m_size = 0;
    //other.m_firstFreeChunk = -1;
@@ -496,17 +785,84 @@ template<
    typename TKey,
    size_t MaxChunkSize,
    typename TAllocator,
-   typename TBitsetTraits>
-ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits>& ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits>::operator=(ChunkedSlotMapStorage&& other)
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>& ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::operator=(ChunkedSlotMapStorage&& other)
 {
+   if (this == &other)
+   {
+      return *this;
+   }
+
+   ReleaseSharedChunks();
+   Clear();
+   DeleteChunks();
+
    m_size = other.m_size;
    m_firstFreeChunk = other.m_firstFreeChunk;
    m_maxUsedChunk = other.m_maxUsedChunk;
-   m_chunks = std::move(other.m_chunks);
+   m_emptyChunkLimit = other.m_emptyChunkLimit;
+   m_retiredSlotCount = other.m_retiredSlotCount;
+   m_retiredChunkCount = other.m_retiredChunkCount;
+   m_overflowPolicy = other.m_overflowPolicy;
+   m_allocationPolicy = other.m_allocationPolicy;
+   m_freeChunkBuckets = other.m_freeChunkBuckets;
+   m_releasedGenerations.assign(other.m_releasedGenerations.begin(), other.m_releasedGenerations.end());
+   m_isTrackingDirtyChunks = other.m_isTrackingDirtyChunks;
+   m_dirtyChunks.assign(other.m_dirtyChunks.begin(), other.m_dirtyChunks.end());
+   m_isCopyOnWrite = other.m_isCopyOnWrite;
+
+   bool canTakeChunks = true;
+   if constexpr (std::allocator_traits<TAllocator>::propagate_on_container_move_assignment::value)
+   {
+      m_allocator = std::move(other.m_allocator);
+   }
+   else
+   {
+      canTakeChunks = (m_allocator == other.m_allocator);
+   }
+
+   if (canTakeChunks)
+   {
+      m_chunks.assign(other.m_chunks.begin(), other.m_chunks.end());
+      m_retiredChunk = other.m_retiredChunk;
+      m_chunkShares.assign(other.m_chunkShares.begin(), other.m_chunkShares.end());
+      m_sharedChunkCount = other.m_sharedChunkCount;
+      other.m_chunks.clear();
+      other.m_retiredChunk = nullptr;
+      other.m_chunkShares.clear();
+      other.m_sharedChunkCount = 0;
+   }
+   else
+   {
+      // The chunks of `other` can't be deallocated with this allocator, the
+      // values are moved to new chunks instead. The keys stay the same.
+      other.UnshareChunks();
+      m_chunks.resize(m_maxUsedChunk);
+      for (SizeType chunkIndex = 0; chunkIndex < m_maxUsedChunk; ++chunkIndex)
+      {
+         Chunk* const otherChunk = other.m_chunks[chunkIndex];
+         m_chunks[chunkIndex] = (otherChunk == other.m_retiredChunk) ? GetRetiredChunk() : ConstructChunk(std::move(*otherChunk));
+      }
+      other.Clear();
+      if (other.m_retiredSlotCount > 0)
+      {
+         // The retired slots now belong to this storage.
+         other.DeleteChunks();
+      }
+   }
 
    other.m_size = 0;
-   other.m_firstFreeChunk = -1;
+   other.ResetChunkFreeList();
    other.m_maxUsedChunk = 0;
+   other.m_retiredSlotCount = 0;
+   other.m_retiredChunkCount = 0;
+   other.m_releasedGenerations.clear();
+   other.m_dirtyChunks.clear();
+
+   UpdateStats();
+   other.UpdateStats();
 
    return *this;
 }
@@ -518,8 +874,10 @@ template<
    typename TKey,
    size_t MaxChunkSize,
    typename TAllocator,
-   typename TBitsetTraits>
-bool ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits>::Reserve(size_t capacity)
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+bool ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::Reserve(size_t capacity)
 {
    if (capacity <= Capacity())
    {
@@ -542,9 +900,10 @@ bool ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits
    m_chunks.reserve(chunkCount);
    while (m_chunks.size() < chunkCount)
    {
-      m_chunks.push_back(new Chunk());
+      m_chunks.push_back(NewChunk(m_chunks.size()));
       //AllocateChunk();
    }
+   UpdateStats();
    
    return true;
 }
@@ -556,29 +915,16 @@ template<
    typename TKey,
    size_t MaxChunkSize,
    typename TAllocator,
-   typename TBitsetTraits>
-TValue* ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits>::GetPtr(TKey key) const
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+typename ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::SizeType
+ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::ShrinkToFit()
 {
-   const KeyType chunkIndex = key & ChunkIndexMask;
-   if (chunkIndex >= m_maxUsedChunk)
-   {
-      return nullptr;
-   }
-   
-   Chunk& chunk = *m_chunks[chunkIndex];
-   const KeyType slotIndex = (key >> SlotIndexShift) & SlotIndexMask;
-   if ((slotIndex >= ChunkSlots) || !chunk.m_liveBits.test(slotIndex))
-   {
-      return nullptr;
-   }
-
-   const GenerationType generation = (key >> GenerationShift) & GenerationMask;
-   if (chunk.m_generations[slotIndex] != generation)
-   {
-      return nullptr;
-   }
-
-   return chunk.m_slots[slotIndex].GetPtr();
+   const SizeType released = ReleaseChunks(0);
+   m_chunks.shrink_to_fit();
+   UpdateStats();
+   return released;
 }
 
 
@@ -588,42 +934,99 @@ template<
    typename TKey,
    size_t MaxChunkSize,
    typename TAllocator,
-   typename TBitsetTraits>
-typename ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits>::SizeType 
-ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits>::GetIndexByKey(TKey key) const
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+template<typename TFunc>
+typename ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::SizeType
+ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::Compact(SizeType budget, TFunc&& remap)
 {
-   const KeyType chunkIndex = key & ChunkIndexMask;
-   const KeyType slotIndex = (key >> SlotIndexShift) & SlotIndexMask;
+   SizeType moved = 0;
+   SizeType targetIndex = 0;
+   SizeType sourceIndex = m_maxUsedChunk;
+   while ((moved < budget) && (sourceIndex > targetIndex))
+   {
+      --sourceIndex;
+      Chunk* const source = GetWritableChunk(sourceIndex);
 
-   return static_cast<SizeType>(chunkIndex * ChunkSlots + slotIndex);
-}
+      SizeType sourceSlot = TBitsetTraits::FindNextBitSet(source->m_liveBits, 0);
+      while ((moved < budget) && (sourceSlot < ChunkSlots))
+      {
+         while ((targetIndex < sourceIndex) && (m_chunks[targetIndex]->m_firstFreeSlot < 0))
+         {
+            ++targetIndex;
+         }
+         if (targetIndex >= sourceIndex)
+         {
+            break;
+         }
 
+         Chunk* const target = GetWritableChunk(targetIndex);
+         MarkChunkDirty(targetIndex);
+         MarkChunkDirty(sourceIndex);
+         const SizeType targetSlot = target->m_firstFreeSlot;
+         Slot* const to = target->m_slots + targetSlot;
+         target->m_firstFreeSlot = to->m_nextFreeSlot;
+         if (target->m_firstFreeSlot < 0)
+         {
+            target->m_lastFreeSlot = -1;
+         }
+         target->m_generations[targetSlot] = AdvanceGeneration(target->m_generations[targetSlot]);
 
-//////////////////////////////////////////////////////////////////////////
-template<
-   typename TValue,
-   typename TKey,
-   size_t MaxChunkSize,
-   typename TAllocator,
-   typename TBitsetTraits>
-TKey ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits>::GetKeyByIndex(SizeType index) const
-{
-   const SizeType chunkIndex = index / ChunkSlots;
-   if (chunkIndex > m_maxUsedChunk)
-   {
-      return InvalidKey;
+         Slot* const from = source->m_slots + sourceSlot;
+         new (to->GetPtr()) TValue(std::move(*from->GetPtr()));
+         if constexpr (!std::is_trivially_destructible_v<TValue>)
+         {
+            from->GetPtr()->~TValue();
+         }
+         target->m_liveBits.set(targetSlot);
+         source->m_liveBits.reset(sourceSlot);
+         ++target->m_liveCount;
+         --source->m_liveCount;
+
+         const GenerationType sourceGeneration = source->m_generations[sourceSlot];
+         if (IsGenerationExhausted(sourceGeneration))
+         {
+            RetireSlot(source, sourceSlot);
+         }
+         else
+         {
+            from->m_nextFreeSlot = source->m_firstFreeSlot;
+            source->m_firstFreeSlot = sourceSlot;
+            if (source->m_lastFreeSlot < 0)
+            {
+               source->m_lastFreeSlot = sourceSlot;
+            }
+         }
+         ++moved;
+
+         remap(MakeKey(sourceGeneration, sourceSlot, sourceIndex), MakeKey(target->m_generations[targetSlot], targetSlot, targetIndex));
+
+         sourceSlot = (sourceSlot + 1 < ChunkSlots) ? TBitsetTraits::FindNextBitSet(source->m_liveBits, sourceSlot + 1) : ChunkSlots;
+      }
+
+      SLOTMAP_CHUNK_INVARIANTS(source);
+      if (sourceSlot < ChunkSlots)
+      {
+         // Out of budget or out of free slots in front of the chunk.
+         break;
+      }
    }
 
-   const SizeType slotIndex = index % ChunkSlots;
-   Chunk& chunk = *m_chunks[chunkIndex];
-   if (!chunk.m_liveBits.test(slotIndex))
+   if (moved > 0)
    {
-      return InvalidKey;
+      // The chunks that filled up and the chunks that got free slots are
+      // fixed up in the free list in one go.
+      RebuildChunkFreeList();
+      for (SizeType chunkIndex = sourceIndex; chunkIndex < m_maxUsedChunk; ++chunkIndex)
+      {
+         RetireChunkIfNeeded(chunkIndex);
+      }
    }
+   ReleaseChunks(0);
+   UpdateStats();
 
-   return (static_cast<KeyType>(chunk.m_generations[slotIndex]) << GenerationShift) |
-      (static_cast<KeyType>(slotIndex) << SlotIndexShift) |
-      static_cast<KeyType>(chunkIndex);
+   return moved;
 }
 
 
@@ -633,29 +1036,21 @@ template<
    typename TKey,
    size_t MaxChunkSize,
    typename TAllocator,
-   typename TBitsetTraits>
-bool ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits>::FindNextKey(TKey& key) const
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::RebuildChunkFreeList()
 {
-   KeyType chunkIndex = key & ChunkIndexMask;
-   KeyType slotIndex = (key >> SlotIndexShift) & SlotIndexMask;
-
-   for (; chunkIndex < m_maxUsedChunk; ++chunkIndex)
+   // Lower chunks come first, so that new values fill the front of the
+   // storage.
+   ResetChunkFreeList();
+   for (SizeType chunkIndex = m_maxUsedChunk; chunkIndex-- > 0;)
    {
-      Chunk& chunk = *m_chunks[chunkIndex];
-      slotIndex = static_cast<KeyType>(TBitsetTraits::template FindNextBitSet(chunk.m_liveBits, slotIndex));
-
-      if (slotIndex < ChunkSlots)
+      if (m_chunks[chunkIndex]->m_firstFreeSlot >= 0)
       {
-         key = (static_cast<KeyType>(chunk.m_generations[slotIndex]) << GenerationShift) |
-            (static_cast<KeyType>(slotIndex) << SlotIndexShift) |
-            chunkIndex;
-         return true;
+         AppendChunkToFreeList(GetWritableChunk(chunkIndex), chunkIndex);
       }
-
-      slotIndex = 0;
    }
-   
-   return false;
 }
 
 
@@ -665,20 +1060,34 @@ template<
    typename TKey,
    size_t MaxChunkSize,
    typename TAllocator,
-   typename TBitsetTraits>
-TKey ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits>::IncrementKey(TKey key) const
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+TValue* ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::GetPtr(TKey key) const
 {
    const KeyType chunkIndex = key & ChunkIndexMask;
-   KeyType slotIndex = (key >> SlotIndexShift) & SlotIndexMask;
-
-   ++slotIndex;
-
-   if (slotIndex < ChunkSlots)
+   if (chunkIndex >= m_maxUsedChunk)
    {
-      return (slotIndex << SlotIndexShift) | chunkIndex;
+      m_stats.OnLookupFailed(LookupFailure::OutOfRange);
+      return nullptr;
    }
    
-   return chunkIndex + 1;
+   Chunk& chunk = *m_chunks[chunkIndex];
+   const KeyType slotIndex = (key >> SlotIndexShift) & SlotIndexMask;
+   if ((slotIndex >= ChunkSlots) || !chunk.m_liveBits.test(slotIndex))
+   {
+      m_stats.OnLookupFailed((slotIndex >= ChunkSlots) ? LookupFailure::OutOfRange : LookupFailure::DeadSlot);
+      return nullptr;
+   }
+
+   const GenerationType generation = (key >> GenerationShift) & GenerationMask;
+   if (chunk.m_generations[slotIndex] != generation)
+   {
+      m_stats.OnLookupFailed(LookupFailure::StaleGeneration);
+      return nullptr;
+   }
+
+   return chunk.m_slots[slotIndex].GetPtr();
 }
 
 
@@ -688,21 +1097,18 @@ template<
    typename TKey,
    size_t MaxChunkSize,
    typename TAllocator,
-   typename TBitsetTraits>
-template<typename TFunc>
-void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits>::ForEachSlot(TFunc func) const
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+TValue* ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::GetMutablePtr(TKey key)
 {
-   for (size_t chunkIndex = 0; chunkIndex < m_maxUsedChunk; ++chunkIndex)
+   TValue* const ptr = GetPtr(key);
+   if (!ptr || (m_sharedChunkCount == 0))
    {
-      const Chunk* chunk = m_chunks[chunkIndex];
-      chunk->m_liveBits.ForEachSetBit([&](size_t slotIndex)
-      {
-         const TKey key = (static_cast<KeyType>(chunk->m_generations[slotIndex]) << GenerationShift) |
-            (static_cast<KeyType>(slotIndex) << SlotIndexShift) |
-            static_cast<KeyType>(chunkIndex);
-         func(key, *chunk->m_slots[slotIndex].GetPtr());
-      });
+      return ptr;
    }
+
+   return GetWritableChunk(key & ChunkIndexMask)->m_slots[(key >> SlotIndexShift) & SlotIndexMask].GetPtr();
 }
 
 
@@ -712,50 +1118,71 @@ template<
    typename TKey,
    size_t MaxChunkSize,
    typename TAllocator,
-   typename TBitsetTraits>
-void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits>::AllocateChunk()
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::GetPtrBatch(const TKey* keys, size_t count, TValue** outPtrs) const
 {
-   Chunk* chunk = nullptr;
-   IndexType chunkIndex = -1;
+   Chunk* chunks[impl::LookupGroupSize];
 
-   if (m_maxUsedChunk < m_chunks.size())
-   {
-      chunkIndex = m_maxUsedChunk;
-      chunk = m_chunks[m_maxUsedChunk];
-   }
-   else
+   for (size_t groupBegin = 0; groupBegin < count; groupBegin += impl::LookupGroupSize)
    {
-      chunk = new Chunk();
-      chunkIndex = static_cast<IndexType>(m_chunks.size());
-      m_chunks.push_back(chunk);
-   }
+      const size_t groupSize = std::min(count - groupBegin, impl::LookupGroupSize);
+      const TKey* groupKeys = keys + groupBegin;
+      TValue** groupPtrs = outPtrs + groupBegin;
 
-   ++m_maxUsedChunk;
+      // Stage 1: chunk pointers.
+      for (size_t i = 0; i < groupSize; ++i)
+      {
+         const KeyType chunkIndex = groupKeys[i] & ChunkIndexMask;
+         if (chunkIndex < m_maxUsedChunk)
+         {
+            impl::Prefetch(&m_chunks[chunkIndex]);
+         }
+      }
 
-   InitializeChunk(chunk);
-   AppendChunkToFreeList(chunk, chunkIndex);
-   
-   SLOTMAP_CHUNK_INVARIANTS(chunk);
-}
+      // Stage 2: live bits and generations.
+      for (size_t i = 0; i < groupSize; ++i)
+      {
+         const KeyType chunkIndex = groupKeys[i] & ChunkIndexMask;
+         const KeyType slotIndex = (groupKeys[i] >> SlotIndexShift) & SlotIndexMask;
+         chunks[i] = ((chunkIndex < m_maxUsedChunk) && (slotIndex < ChunkSlots)) ? m_chunks[chunkIndex] : nullptr;
+         if (chunks[i])
+         {
+            impl::Prefetch(impl::GetBitAddress(chunks[i]->m_liveBits, slotIndex));
+            impl::Prefetch(&chunks[i]->m_generations[slotIndex]);
+         }
+      }
 
+      // Stage 3: validation, values are prefetched for the caller.
+      for (size_t i = 0; i < groupSize; ++i)
+      {
+         groupPtrs[i] = nullptr;
 
-//////////////////////////////////////////////////////////////////////////
-template<
-   typename TValue,
-   typename TKey,
-   size_t MaxChunkSize,
-   typename TAllocator,
-   typename TBitsetTraits>
-void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits>::InitializeChunk(Chunk* chunk)
-{
-   chunk->m_liveBits.reset();
-   for (size_t i = 0; i < ChunkSlots - 1; ++i)
-   {
-      chunk->m_slots[i].m_nextFreeSlot = i + 1;
+         Chunk* chunk = chunks[i];
+         if (!chunk)
+         {
+            m_stats.OnLookupFailed(LookupFailure::OutOfRange);
+            continue;
+         }
+
+         const KeyType slotIndex = (groupKeys[i] >> SlotIndexShift) & SlotIndexMask;
+         const GenerationType generation = (groupKeys[i] >> GenerationShift) & GenerationMask;
+         if (!chunk->m_liveBits.test(slotIndex))
+         {
+            m_stats.OnLookupFailed(LookupFailure::DeadSlot);
+         }
+         else if (chunk->m_generations[slotIndex] != generation)
+         {
+            m_stats.OnLookupFailed(LookupFailure::StaleGeneration);
+         }
+         else
+         {
+            groupPtrs[i] = chunk->m_slots[slotIndex].GetPtr();
+            impl::Prefetch(groupPtrs[i]);
+         }
+      }
    }
-   chunk->m_slots[ChunkSlots - 1].m_nextFreeSlot = -1;
-   chunk->m_firstFreeSlot = 0;
-   chunk->m_lastFreeSlot = ChunkSlots - 1;
 }
 
 
@@ -765,11 +1192,16 @@ template<
    typename TKey,
    size_t MaxChunkSize,
    typename TAllocator,
-   typename TBitsetTraits>
-void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits>::AppendChunkToFreeList(Chunk* chunk, IndexType chunkIndex)
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+typename ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::SizeType 
+ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::GetIndexByKey(TKey key) const
 {
-   chunk->m_nextFreeChunk = m_firstFreeChunk;
-   m_firstFreeChunk = chunkIndex;
+   const KeyType chunkIndex = key & ChunkIndexMask;
+   const KeyType slotIndex = (key >> SlotIndexShift) & SlotIndexMask;
+
+   return static_cast<SizeType>(chunkIndex * ChunkSlots + slotIndex);
 }
 
 
@@ -779,16 +1211,27 @@ template<
    typename TKey,
    size_t MaxChunkSize,
    typename TAllocator,
-   typename TBitsetTraits>
-TKey ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits>::ReserveSlot(ValueType*& outPtr)
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+TKey ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::GetKeyByIndex(SizeType index) const
 {
-   if (m_firstFreeChunk < 0)
+   const SizeType chunkIndex = index / ChunkSlots;
+   if (chunkIndex > m_maxUsedChunk)
    {
-      AllocateChunk();
+      return InvalidKey;
    }
-   assert(m_firstFreeChunk >= 0);
 
-   return ReserveSlotNoAlloc(outPtr);
+   const SizeType slotIndex = index % ChunkSlots;
+   Chunk& chunk = *m_chunks[chunkIndex];
+   if (!chunk.m_liveBits.test(slotIndex))
+   {
+      return InvalidKey;
+   }
+
+   return (static_cast<KeyType>(chunk.m_generations[slotIndex]) << GenerationShift) |
+      (static_cast<KeyType>(slotIndex) << SlotIndexShift) |
+      static_cast<KeyType>(chunkIndex);
 }
 
 
@@ -798,45 +1241,34 @@ template<
    typename TKey,
    size_t MaxChunkSize,
    typename TAllocator,
-   typename TBitsetTraits>
-TKey ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits>::ReserveSlotNoAlloc(ValueType*& outPtr)
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+bool ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::FindNextKey(TKey& key) const
 {
-   if (m_firstFreeChunk < 0)
-   {
-      outPtr = nullptr;
-      return InvalidKey;
-   }
+   KeyType chunkIndex = key & ChunkIndexMask;
+   KeyType slotIndex = (key >> SlotIndexShift) & SlotIndexMask;
 
-   const KeyType chunkIndex = static_cast<KeyType>(m_firstFreeChunk);
-   Chunk* chunk = m_chunks[chunkIndex];
-   assert(chunk->m_firstFreeSlot >= 0);
+   for (; chunkIndex < m_maxUsedChunk; ++chunkIndex)
+   {
+      Chunk& chunk = *m_chunks[chunkIndex];
+      if (!chunk.IsFull())
+      {
+         slotIndex = static_cast<KeyType>(TBitsetTraits::template FindNextBitSet(chunk.m_liveBits, slotIndex));
+      }
 
-   const SizeType slotIndex = chunk->m_firstFreeSlot;
-   Slot* const slot = chunk->m_slots + slotIndex;
-   outPtr = slot->GetPtr();
+      if (slotIndex < ChunkSlots)
+      {
+         key = (static_cast<KeyType>(chunk.m_generations[slotIndex]) << GenerationShift) |
+            (static_cast<KeyType>(slotIndex) << SlotIndexShift) |
+            chunkIndex;
+         return true;
+      }
 
-   chunk->m_firstFreeSlot = slot->m_nextFreeSlot;
-   if (chunk->m_firstFreeSlot < 0)
-   {
-      chunk->m_lastFreeSlot = -1;
-      m_firstFreeChunk = chunk->m_nextFreeChunk;
-   }
-   
-   ++chunk->m_generations[slotIndex];
-   if (chunk->m_generations[slotIndex] == 0)
-   {
-      chunk->m_generations[slotIndex] = 1;
+      slotIndex = 0;
    }
-   assert(!chunk->m_liveBits[slotIndex]);
-   chunk->m_liveBits.set(slotIndex);
-
-   ++m_size;
    
-   SLOTMAP_CHUNK_INVARIANTS(chunk);
-
-   return (static_cast<KeyType>(chunk->m_generations[slotIndex]) << GenerationShift) |
-      (static_cast<KeyType>(slotIndex) << SlotIndexShift) |
-      chunkIndex;
+   return false;
 }
 
 
@@ -846,52 +1278,22 @@ template<
    typename TKey,
    size_t MaxChunkSize,
    typename TAllocator,
-   typename TBitsetTraits>
-bool ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits>::FreeSlot(KeyType key)
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+TKey ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::IncrementKey(TKey key) const
 {
    const KeyType chunkIndex = key & ChunkIndexMask;
-   if (chunkIndex >= m_maxUsedChunk)
-   {
-      return false;
-   }
-
-   Chunk& chunk = *m_chunks[chunkIndex];
-   const KeyType slotIndex = (key >> SlotIndexShift) & SlotIndexMask;
-   if ((slotIndex >= ChunkSlots) || !chunk.m_liveBits.test(slotIndex))
-   {
-      return false;
-   }
-
-   const GenerationType generation = (key >> GenerationShift) & GenerationMask;
-   if (chunk.m_generations[slotIndex] != generation)
-   {
-      return false;
-   }
+   KeyType slotIndex = (key >> SlotIndexShift) & SlotIndexMask;
 
-   Slot* const slot = chunk.m_slots + slotIndex;
-   if constexpr (!std::is_trivially_destructible_v<TValue>)
-   {
-      slot->GetPtr()->~TValue();
-   }
+   ++slotIndex;
 
-   slot->m_nextFreeSlot = chunk.m_firstFreeSlot;
-   const bool isChunkInFreeList = (chunk.m_firstFreeSlot >= 0);
-   chunk.m_firstFreeSlot = slotIndex;
-   if (!isChunkInFreeList)
+   if (slotIndex < ChunkSlots)
    {
-      chunk.m_lastFreeSlot = slotIndex;
-      chunk.m_nextFreeChunk = m_firstFreeChunk;
-      m_firstFreeChunk = chunkIndex;
+      return (slotIndex << SlotIndexShift) | chunkIndex;
    }
-
-   assert(chunk.m_liveBits[slotIndex]);
-   chunk.m_liveBits.reset(slotIndex);
-   assert(m_size > 0);
-   --m_size;
-
-   SLOTMAP_CHUNK_INVARIANTS(&chunk);
    
-   return true;
+   return chunkIndex + 1;
 }
 
 
@@ -901,37 +1303,48 @@ template<
    typename TKey,
    size_t MaxChunkSize,
    typename TAllocator,
-   typename TBitsetTraits>
-void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits>::FreeSlotByIndex(IndexType chunkIndex, IndexType slotIndex)
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+template<typename TFunc>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::ForEachSlot(TFunc func) const
 {
-   Chunk* const chunk = m_chunks[chunkIndex];
+   ForEachSlotInChunks(0, m_maxUsedChunk, func);
+}
 
-   assert(chunk->m_liveBits[slotIndex]);
-   chunk->m_liveBits.reset(slotIndex);
 
-   Slot* const slot = chunk->m_slots + slotIndex;
-   if constexpr (!std::is_trivially_destructible_v<TValue>)
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+template<typename TFunc, typename TExecutor>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::ParallelForEachSlot(TFunc func, TExecutor&& executor) const
+{
+   const size_t rangeCount = std::min(m_maxUsedChunk, impl::GetExecutorConcurrency(executor) * impl::TasksPerThread);
+   if (rangeCount <= 1)
    {
-      slot->GetPtr()->~TValue();
+      ForEachSlot(func);
+      return;
    }
 
-   slot->m_nextFreeSlot = -1;
-   if (chunk->m_lastFreeSlot < 0)
+   // Visiting a chunk costs a scan of its live bits on top of the calls for
+   // the live slots.
+   constexpr size_t ChunkScanCost = ChunkSlots / (sizeof(uint64_t) * CHAR_BIT) + 1;
+
+   const std::vector<size_t> bounds = impl::SplitByWeight(m_maxUsedChunk, rangeCount, [this](size_t chunkIndex)
    {
-      assert(chunk->m_firstFreeSlot < 0);
-      chunk->m_firstFreeSlot = slotIndex;
-   }
-   else
+      return static_cast<size_t>(m_chunks[chunkIndex]->m_liveCount) + ChunkScanCost;
+   });
+
+   impl::ExecuteParallelFor(std::forward<TExecutor>(executor), bounds.size() - 1, [&](size_t rangeIndex)
    {
-      assert(chunk->m_firstFreeSlot >= 0);
-      chunk->m_slots[chunk->m_lastFreeSlot].m_nextFreeSlot = slotIndex;
-   }
-   chunk->m_lastFreeSlot = slotIndex;
-   
-   assert(m_size > 0);
-   --m_size;
-   
-   SLOTMAP_CHUNK_INVARIANTS(chunk);
+      ForEachSlotInChunks(bounds[rangeIndex], bounds[rangeIndex + 1], func);
+   });
 }
 
 
@@ -941,13 +1354,36 @@ template<
    typename TKey,
    size_t MaxChunkSize,
    typename TAllocator,
-   typename TBitsetTraits>
-void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits>::Swap(ChunkedSlotMapStorage& other)
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+template<typename TFunc>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::ForEachSlotInChunks(SizeType beginChunk, SizeType endChunk, TFunc& func) const
 {
-   std::swap(m_size, other.m_size);
-   std::swap(m_firstFreeChunk, other.m_firstFreeChunk);
-   std::swap(m_maxUsedChunk, other.m_maxUsedChunk);
-   std::swap(m_chunks, other.m_chunks);
+   for (size_t chunkIndex = beginChunk; chunkIndex < endChunk; ++chunkIndex)
+   {
+      const Chunk* chunk = m_chunks[chunkIndex];
+      const auto visitSlot = [&](size_t slotIndex)
+      {
+         const TKey key = (static_cast<KeyType>(chunk->m_generations[slotIndex]) << GenerationShift) |
+            (static_cast<KeyType>(slotIndex) << SlotIndexShift) |
+            static_cast<KeyType>(chunkIndex);
+         func(key, *chunk->m_slots[slotIndex].GetPtr());
+      };
+
+      if (chunk->IsFull())
+      {
+         assert(TBitsetTraits::Count(chunk->m_liveBits) == ChunkSlots);
+         for (size_t slotIndex = 0; slotIndex < ChunkSlots; ++slotIndex)
+         {
+            visitSlot(slotIndex);
+         }
+      }
+      else
+      {
+         TBitsetTraits::ForEachSetBit(chunk->m_liveBits, visitSlot);
+      }
+   }
 }
 
 
@@ -957,35 +1393,22 @@ template<
    typename TKey,
    size_t MaxChunkSize,
    typename TAllocator,
-   typename TBitsetTraits>
-void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits>::Clear()
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+template<typename TFunc>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::ForEachChunk(TFunc func)
 {
-   if (m_maxUsedChunk == 0)
-   {
-      return;
-   }
-   
-   if constexpr (!std::is_trivially_destructible_v<TValue>)
+   UnshareChunks();
+
+   for (SizeType chunkIndex = 0; chunkIndex < m_maxUsedChunk; ++chunkIndex)
    {
-      for (SizeType chunkIndex = 0; chunkIndex < m_maxUsedChunk; ++chunkIndex)
+      Chunk* const chunk = m_chunks[chunkIndex];
+      if (chunk->m_liveCount > 0)
       {
-         Chunk* const chunk = m_chunks[chunkIndex];
-			
-         TBitsetTraits::ForEachSetBit(chunk->m_liveBits, [&](size_t slotIndex)
-         {
-            Slot* const slot = chunk->m_slots + slotIndex;
-            slot->GetPtr()->~TValue();
-         });
-         
-         chunk->m_liveBits.reset();
+         func(ChunkSpan(chunk, chunkIndex));
       }
    }
-   
-   m_size = 0;
-   m_firstFreeChunk = -1;
-   m_maxUsedChunk = 0;
-
-   assert(m_size == 0);
 }
 
 
@@ -995,13 +1418,20 @@ template<
    typename TKey,
    size_t MaxChunkSize,
    typename TAllocator,
-   typename TBitsetTraits>
-template<bool IsConst>
-bool ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits>::IteratorTpl<IsConst>::Advance()
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+template<typename TFunc>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::ForEachChunk(TFunc func) const
 {
-   ++m_slotIndex;
-
-   return FindNext();
+   for (SizeType chunkIndex = 0; chunkIndex < m_maxUsedChunk; ++chunkIndex)
+   {
+      const Chunk* const chunk = m_chunks[chunkIndex];
+      if (chunk->m_liveCount > 0)
+      {
+         func(ConstChunkSpan(chunk, chunkIndex));
+      }
+   }
 }
 
 
@@ -1011,19 +1441,18 @@ template<
    typename TKey,
    size_t MaxChunkSize,
    typename TAllocator,
-   typename TBitsetTraits>
-template<bool IsConst>
-void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits>::IteratorTpl<IsConst>::FindFirst()
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::AllocateChunk()
 {
-   if (m_chunkIndex < m_storage->m_maxUsedChunk)
-   {
-      FindNext();
-      return;
-   }
+   IndexType chunkIndex = -1;
+   Chunk* const chunk = AcquireChunk(chunkIndex);
 
-   m_key = std::numeric_limits<KeyType>::max();
-   m_ptr = nullptr;
-   return;
+   InitializeChunk(chunk);
+   AppendChunkToFreeList(chunk, chunkIndex);
+   
+   SLOTMAP_CHUNK_INVARIANTS(chunk);
 }
 
 
@@ -1033,24 +1462,2452 @@ template<
    typename TKey,
    size_t MaxChunkSize,
    typename TAllocator,
-   typename TBitsetTraits>
-template<bool IsConst>
-bool ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits>::IteratorTpl<IsConst>::FindNext()
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+typename ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::Chunk*
+ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::AcquireChunk(IndexType& outChunkIndex)
 {
-   do
-   {
+   Chunk* chunk = nullptr;
+
+   if (m_maxUsedChunk < m_chunks.size())
+   {
+      outChunkIndex = m_maxUsedChunk;
+      chunk = GetWritableChunk(m_maxUsedChunk);
+   }
+   else
+   {
+      chunk = NewChunk(m_chunks.size());
+      outChunkIndex = static_cast<IndexType>(m_chunks.size());
+      m_chunks.push_back(chunk);
+   }
+
+   ++m_maxUsedChunk;
+   MarkChunkDirty(outChunkIndex);
+
+   return chunk;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+typename ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::Chunk*
+ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::NewChunk(SizeType chunkIndex)
+{
+   Chunk* const chunk = ConstructChunk();
+
+   // A chunk with this index might have been released before, the keys into
+   // the released chunk must not become valid again.
+   if (chunkIndex < m_releasedGenerations.size())
+   {
+      std::fill(chunk->m_generations, chunk->m_generations + ChunkSlots, m_releasedGenerations[chunkIndex]);
+   }
+   MarkChunkDirty(chunkIndex);
+
+   return chunk;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+template<typename... TArgs>
+typename ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::Chunk*
+ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::ConstructChunk(TArgs&&... args)
+{
+   ChunkAllocator allocator(m_allocator);
+   Chunk* const chunk = std::allocator_traits<ChunkAllocator>::allocate(allocator, 1);
+   std::allocator_traits<ChunkAllocator>::construct(allocator, chunk, std::forward<TArgs>(args)...);
+   m_stats.OnChunkAllocated();
+   return chunk;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::DeleteChunk(Chunk* chunk)
+{
+   ChunkAllocator allocator(m_allocator);
+   std::allocator_traits<ChunkAllocator>::destroy(allocator, chunk);
+   std::allocator_traits<ChunkAllocator>::deallocate(allocator, chunk, 1);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::ReleaseChunk(SizeType chunkIndex)
+{
+   Chunk* const chunk = m_chunks[chunkIndex];
+   if (chunk == m_retiredChunk)
+   {
+      return;
+   }
+
+   // A chunk still used by copy-on-write copies is left to them.
+   if ((chunkIndex < m_chunkShares.size()) && m_chunkShares[chunkIndex] && !ReleaseChunkShare(chunkIndex))
+   {
+      return;
+   }
+   DeleteChunk(chunk);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::ShareChunks(const ChunkedSlotMapStorage& other)
+{
+   m_chunkShares.resize(m_maxUsedChunk, nullptr);
+   if (other.m_chunkShares.size() < m_maxUsedChunk)
+   {
+      other.m_chunkShares.resize(m_maxUsedChunk, nullptr);
+   }
+
+   ShareCountAllocator allocator(m_allocator);
+   for (SizeType chunkIndex = 0; chunkIndex < m_maxUsedChunk; ++chunkIndex)
+   {
+      Chunk* const chunk = other.m_chunks[chunkIndex];
+      if (chunk == other.m_retiredChunk)
+      {
+         m_chunks[chunkIndex] = GetRetiredChunk();
+         continue;
+      }
+
+      ShareCount*& share = other.m_chunkShares[chunkIndex];
+      if (!share)
+      {
+         share = std::allocator_traits<ShareCountAllocator>::allocate(allocator, 1);
+         std::allocator_traits<ShareCountAllocator>::construct(allocator, share, 1u);
+         ++other.m_sharedChunkCount;
+      }
+      share->fetch_add(1, std::memory_order_relaxed);
+
+      m_chunks[chunkIndex] = chunk;
+      m_chunkShares[chunkIndex] = share;
+      ++m_sharedChunkCount;
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+typename ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::Chunk*
+ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::UnshareChunk(SizeType chunkIndex)
+{
+   Chunk* const chunk = m_chunks[chunkIndex];
+
+   // Nothing can share the chunk again once only this storage holds it.
+   if (m_chunkShares[chunkIndex]->load(std::memory_order_acquire) == 1)
+   {
+      ReleaseChunkShare(chunkIndex);
+      return chunk;
+   }
+
+   Chunk* const copy = ConstructChunk(*chunk);
+   m_chunks[chunkIndex] = copy;
+   if (ReleaseChunkShare(chunkIndex))
+   {
+      // The copies have released the chunk in the meantime.
+      if constexpr (!std::is_trivially_destructible_v<TValue>)
+      {
+         TBitsetTraits::ForEachSetBit(chunk->m_liveBits, [&](size_t slotIndex)
+         {
+            chunk->m_slots[slotIndex].GetPtr()->~TValue();
+         });
+      }
+      DeleteChunk(chunk);
+   }
+
+   return copy;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+bool ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::UnshareChunkForClear(SizeType chunkIndex)
+{
+   if (!IsChunkShared(chunkIndex))
+   {
+      return true;
+   }
+
+   Chunk* const chunk = m_chunks[chunkIndex];
+   if (m_chunkShares[chunkIndex]->load(std::memory_order_acquire) == 1)
+   {
+      ReleaseChunkShare(chunkIndex);
+      return true;
+   }
+
+   // The values are about to be cleared, so only the state of the slots is
+   // copied and the values are left to the copies.
+   Chunk* const copy = ConstructChunk();
+   copy->m_firstFreeSlot = chunk->m_firstFreeSlot;
+   copy->m_lastFreeSlot = chunk->m_lastFreeSlot;
+   copy->m_liveCount = chunk->m_liveCount;
+   copy->m_retiredSlotCount = chunk->m_retiredSlotCount;
+   copy->m_liveBits = chunk->m_liveBits;
+   for (SizeType slotIndex = 0; slotIndex < ChunkSlots; ++slotIndex)
+   {
+      copy->m_generations[slotIndex] = chunk->m_generations[slotIndex];
+      if (!chunk->m_liveBits.test(slotIndex))
+      {
+         copy->m_slots[slotIndex].m_nextFreeSlot = chunk->m_slots[slotIndex].m_nextFreeSlot;
+      }
+   }
+
+   m_chunks[chunkIndex] = copy;
+   if (ReleaseChunkShare(chunkIndex))
+   {
+      // The copies have released the chunk in the meantime, its values are
+      // cleared in place.
+      m_chunks[chunkIndex] = chunk;
+      DeleteChunk(copy);
+      return true;
+   }
+   return false;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+bool ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::ReleaseChunkShare(SizeType chunkIndex)
+{
+   ShareCount* const share = m_chunkShares[chunkIndex];
+   m_chunkShares[chunkIndex] = nullptr;
+   --m_sharedChunkCount;
+   if (share->fetch_sub(1, std::memory_order_acq_rel) > 1)
+   {
+      return false;
+   }
+
+   ShareCountAllocator allocator(m_allocator);
+   std::allocator_traits<ShareCountAllocator>::destroy(allocator, share);
+   std::allocator_traits<ShareCountAllocator>::deallocate(allocator, share, 1);
+   return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::ReleaseSharedChunks()
+{
+   // The chunks still used by the copies are swapped for the retired chunk,
+   // which is skipped when the chunks are cleared and deleted.
+   for (SizeType chunkIndex = 0; (m_sharedChunkCount > 0) && (chunkIndex < m_chunkShares.size()); ++chunkIndex)
+   {
+      if (m_chunkShares[chunkIndex] && !ReleaseChunkShare(chunkIndex))
+      {
+         m_chunks[chunkIndex] = GetRetiredChunk();
+      }
+   }
+   m_chunkShares.clear();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::UnshareChunks()
+{
+   for (SizeType chunkIndex = 0; (m_sharedChunkCount > 0) && (chunkIndex < m_chunkShares.size()); ++chunkIndex)
+   {
+      if (m_chunkShares[chunkIndex])
+      {
+         UnshareChunk(chunkIndex);
+      }
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+ChunkOccupancyHistogram ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::OccupancyHistogram() const
+{
+   ChunkOccupancyHistogram histogram;
+   histogram.m_chunkSlots = ChunkSlots;
+
+   for (SizeType chunkIndex = 0; chunkIndex < m_chunks.size(); ++chunkIndex)
+   {
+      if (m_chunks[chunkIndex] == m_retiredChunk)
+      {
+         continue;
+      }
+
+      const size_t liveCount = ChunkOccupancy(chunkIndex);
+      ++histogram.m_chunkCounts[ChunkOccupancyHistogram::GetBucket(liveCount, ChunkSlots)];
+      ++histogram.m_chunkCount;
+      histogram.m_liveSlotCount += liveCount;
+   }
+
+   return histogram;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+typename ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::SizeType
+ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::ReleaseChunks(SizeType keepEmptyChunks)
+{
+   SizeType chunkCount = m_maxUsedChunk;
+   while ((chunkCount > 0) && IsChunkEmpty(m_chunks[chunkCount - 1]))
+   {
+      --chunkCount;
+   }
+
+   chunkCount = std::min<SizeType>(chunkCount + keepEmptyChunks, m_chunks.size());
+   if (chunkCount >= m_chunks.size())
+   {
+      return 0;
+   }
+
+   if (chunkCount < m_maxUsedChunk)
+   {
+      // Unlink the released chunks from the free list.
+      if (m_allocationPolicy == ChunkAllocationPolicy::FullestFirst)
+      {
+         for (SizeType chunkIndex = chunkCount; chunkIndex < m_maxUsedChunk; ++chunkIndex)
+         {
+            if (m_chunks[chunkIndex]->m_firstFreeSlot >= 0)
+            {
+               Chunk* const chunk = GetWritableChunk(chunkIndex);
+               RemoveChunkFromFreeList(chunk, chunkIndex, GetOccupancy(chunk));
+            }
+         }
+      }
+      else
+      {
+         IndexType* link = &m_firstFreeChunk;
+         IndexType linkChunkIndex = -1;
+         while (*link >= 0)
+         {
+            if (static_cast<SizeType>(*link) >= chunkCount)
+            {
+               const IndexType nextFreeChunk = m_chunks[*link]->m_nextFreeChunk;
+               if (linkChunkIndex >= 0)
+               {
+                  link = &GetWritableChunk(linkChunkIndex)->m_nextFreeChunk;
+                  MarkChunkDirty(linkChunkIndex);
+               }
+               *link = nextFreeChunk;
+            }
+            else
+            {
+               linkChunkIndex = *link;
+               link = &m_chunks[*link]->m_nextFreeChunk;
+            }
+         }
+      }
+      m_maxUsedChunk = chunkCount;
+   }
+
+   if (m_releasedGenerations.size() < m_chunks.size())
+   {
+      m_releasedGenerations.resize(m_chunks.size(), 0);
+   }
+
+   for (SizeType chunkIndex = chunkCount; chunkIndex < m_chunks.size(); ++chunkIndex)
+   {
+      const Chunk* const chunk = m_chunks[chunkIndex];
+      m_releasedGenerations[chunkIndex] = *std::max_element(chunk->m_generations, chunk->m_generations + ChunkSlots);
+      ReleaseChunk(chunkIndex);
+   }
+
+   const SizeType released = m_chunks.size() - chunkCount;
+   m_chunks.resize(chunkCount);
+
+   return released;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::ReleaseChunksIfNeeded()
+{
+   // Count the empty chunks at the end, but only up to the limit.
+   SizeType emptyChunks = m_chunks.size() - m_maxUsedChunk;
+   for (SizeType chunkIndex = m_maxUsedChunk; (chunkIndex > 0) && (emptyChunks <= m_emptyChunkLimit); --chunkIndex)
+   {
+      if (!IsChunkEmpty(m_chunks[chunkIndex - 1]))
+      {
+         break;
+      }
+      ++emptyChunks;
+   }
+
+   if (emptyChunks > m_emptyChunkLimit)
+   {
+      ReleaseChunks(m_emptyChunkLimit / 2);
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::InitializeChunk(Chunk* chunk)
+{
+   chunk->m_liveBits.reset();
+   for (size_t i = 0; i < ChunkSlots - 1; ++i)
+   {
+      chunk->m_slots[i].m_nextFreeSlot = i + 1;
+   }
+   chunk->m_slots[ChunkSlots - 1].m_nextFreeSlot = -1;
+   chunk->m_firstFreeSlot = 0;
+   chunk->m_lastFreeSlot = ChunkSlots - 1;
+   chunk->m_liveCount = 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::AppendChunkToFreeList(Chunk* chunk, IndexType chunkIndex)
+{
+   MarkChunkDirty(chunkIndex);
+   if (m_allocationPolicy == ChunkAllocationPolicy::MostRecentlyFreed)
+   {
+      chunk->m_nextFreeChunk = m_firstFreeChunk;
+      m_firstFreeChunk = chunkIndex;
+      return;
+   }
+
+   IndexType& bucket = m_freeChunkBuckets[GetOccupancyBucket(GetOccupancy(chunk))];
+   chunk->m_prevFreeChunk = -1;
+   chunk->m_nextFreeChunk = bucket;
+   if (bucket >= 0)
+   {
+      GetWritableChunk(bucket)->m_prevFreeChunk = chunkIndex;
+      MarkChunkDirty(bucket);
+   }
+   bucket = chunkIndex;
+
+   m_firstFreeChunk = FindFullestFreeChunk();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::RemoveChunkFromFreeList(Chunk* chunk, IndexType chunkIndex, SizeType occupancy)
+{
+   if (m_allocationPolicy == ChunkAllocationPolicy::MostRecentlyFreed)
+   {
+      // Only the head is ever removed from the singly linked list.
+      assert(chunkIndex == m_firstFreeChunk);
+      m_firstFreeChunk = chunk->m_nextFreeChunk;
+      return;
+   }
+
+   // The occupancy the chunk was linked with selects its bucket.
+   MarkChunkDirty(chunkIndex);
+   if (chunk->m_prevFreeChunk >= 0)
+   {
+      GetWritableChunk(chunk->m_prevFreeChunk)->m_nextFreeChunk = chunk->m_nextFreeChunk;
+      MarkChunkDirty(chunk->m_prevFreeChunk);
+   }
+   else
+   {
+      assert(m_freeChunkBuckets[GetOccupancyBucket(occupancy)] == chunkIndex);
+      m_freeChunkBuckets[GetOccupancyBucket(occupancy)] = chunk->m_nextFreeChunk;
+   }
+   if (chunk->m_nextFreeChunk >= 0)
+   {
+      GetWritableChunk(chunk->m_nextFreeChunk)->m_prevFreeChunk = chunk->m_prevFreeChunk;
+      MarkChunkDirty(chunk->m_nextFreeChunk);
+   }
+   chunk->m_prevFreeChunk = -1;
+   chunk->m_nextFreeChunk = -1;
+
+   m_firstFreeChunk = FindFullestFreeChunk();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+typename ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::IndexType
+ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::FindFullestFreeChunk() const
+{
+   for (SizeType bucket = OccupancyBucketCount; bucket-- > 0;)
+   {
+      if (m_freeChunkBuckets[bucket] >= 0)
+      {
+         return m_freeChunkBuckets[bucket];
+      }
+   }
+   return -1;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::ResetChunkFreeList()
+{
+   m_firstFreeChunk = -1;
+   m_freeChunkBuckets = MakeEmptyBuckets();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::SetChunkAllocationPolicy(ChunkAllocationPolicy policy)
+{
+   if (policy == m_allocationPolicy)
+   {
+      return;
+   }
+
+   m_allocationPolicy = policy;
+   RebuildChunkFreeList();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+bool ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::SaveSnapshot(std::ostream& stream) const
+{
+   static_assert(std::is_trivially_copyable_v<TValue>, "Only the slotmaps of trivially copyable values can be saved as snapshots.");
+
+   WriteSnapshotHeader(stream, impl::SnapshotHeader::Magic);
+   for (SizeType chunkIndex = 0; chunkIndex < m_chunks.size(); ++chunkIndex)
+   {
+      WriteChunk(stream, chunkIndex);
+   }
+   stream.write(reinterpret_cast<const char*>(m_releasedGenerations.data()), m_releasedGenerations.size() * sizeof(GenerationType));
+
+   return stream.good();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+bool ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::LoadSnapshot(std::istream& stream)
+{
+   static_assert(std::is_trivially_copyable_v<TValue>, "Only the slotmaps of trivially copyable values can be loaded from snapshots.");
+
+   // The snapshot is loaded into a new storage, which takes the place of this
+   // one only once the whole snapshot has been read.
+   ChunkedSlotMapStorage loaded(m_allocator);
+   impl::SnapshotHeader header = {};
+   std::array<IndexType, OccupancyBucketCount> freeChunkBuckets = {};
+   if (!ReadSnapshotHeader(stream, impl::SnapshotHeader::Magic, header, freeChunkBuckets))
+   {
+      return false;
+   }
+
+   loaded.m_chunks.reserve(header.m_chunkCount);
+   SizeType size = 0;
+   for (SizeType chunkIndex = 0; chunkIndex < header.m_chunkCount; ++chunkIndex)
+   {
+      Chunk* const chunk = loaded.ReadChunk(stream, chunkIndex < header.m_maxUsedChunk);
+      if (!chunk)
+      {
+         return false;
+      }
+      loaded.m_chunks.push_back(chunk);
+      if ((chunkIndex < header.m_maxUsedChunk) && (chunk != loaded.m_retiredChunk))
+      {
+         size += static_cast<SizeType>(chunk->m_liveCount);
+      }
+   }
+
+   loaded.m_releasedGenerations.resize(header.m_releasedGenerationCount);
+   stream.read(reinterpret_cast<char*>(loaded.m_releasedGenerations.data()), loaded.m_releasedGenerations.size() * sizeof(GenerationType));
+   if (!stream || (size != header.m_size))
+   {
+      return false;
+   }
+
+   loaded.SetSnapshotState(header, freeChunkBuckets);
+   // The loaded state is the base of the next delta, and the copies of the
+   // storage keep sharing its chunks as before.
+   loaded.m_isTrackingDirtyChunks = m_isTrackingDirtyChunks;
+   loaded.m_isCopyOnWrite = m_isCopyOnWrite;
+
+   Swap(loaded);
+   return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::SetDirtyChunkTracking(bool enable)
+{
+   m_isTrackingDirtyChunks = enable;
+   m_dirtyChunks.clear();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+typename ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::SizeType
+ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::DirtyChunkCount() const
+{
+   const SizeType chunkCount = std::min(m_dirtyChunks.size(), m_chunks.size());
+   return static_cast<SizeType>(std::count_if(m_dirtyChunks.begin(), m_dirtyChunks.begin() + chunkCount, [](uint8_t isDirty) { return isDirty != 0; }));
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+bool ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::SaveDelta(std::ostream& stream)
+{
+   static_assert(std::is_trivially_copyable_v<TValue>, "Only the slotmaps of trivially copyable values can be saved as deltas.");
+
+   // Without tracking there is no way to tell which chunks the delta needs.
+   if (!m_isTrackingDirtyChunks)
+   {
+      return false;
+   }
+
+   // The chunks past the end have been released, the chunk count in the
+   // header drops them.
+   const SizeType chunkCount = std::min(m_dirtyChunks.size(), m_chunks.size());
+   const uint64_t recordCount = DirtyChunkCount();
+
+   WriteSnapshotHeader(stream, impl::SnapshotHeader::DeltaMagic);
+   stream.write(reinterpret_cast<const char*>(&recordCount), sizeof(recordCount));
+   for (SizeType chunkIndex = 0; chunkIndex < chunkCount; ++chunkIndex)
+   {
+      if (m_dirtyChunks[chunkIndex])
+      {
+         const uint64_t recordIndex = chunkIndex;
+         stream.write(reinterpret_cast<const char*>(&recordIndex), sizeof(recordIndex));
+         WriteChunk(stream, chunkIndex);
+      }
+   }
+   stream.write(reinterpret_cast<const char*>(m_releasedGenerations.data()), m_releasedGenerations.size() * sizeof(GenerationType));
+
+   std::fill(m_dirtyChunks.begin(), m_dirtyChunks.end(), static_cast<uint8_t>(0));
+   return stream.good();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+bool ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::ApplyDelta(std::istream& stream)
+{
+   static_assert(std::is_trivially_copyable_v<TValue>, "Only the slotmaps of trivially copyable values can apply deltas.");
+
+   impl::SnapshotHeader header = {};
+   std::array<IndexType, OccupancyBucketCount> freeChunkBuckets = {};
+   uint64_t recordCount = 0;
+   if (!ReadSnapshotHeader(stream, impl::SnapshotHeader::DeltaMagic, header, freeChunkBuckets) ||
+      !stream.read(reinterpret_cast<char*>(&recordCount), sizeof(recordCount)) ||
+      (recordCount > header.m_chunkCount))
+   {
+      return false;
+   }
+
+   // The whole delta is read before anything changes.
+   std::vector<std::pair<SizeType, Chunk*>> records;
+   records.reserve(recordCount);
+   const auto deleteRecords = [&]()
+   {
+      for (const auto& record : records)
+      {
+         if (record.second != m_retiredChunk)
+         {
+            DeleteChunk(record.second);
+         }
+      }
+   };
+
+   for (uint64_t i = 0; i < recordCount; ++i)
+   {
+      uint64_t chunkIndex = 0;
+      Chunk* chunk = nullptr;
+      if (!stream.read(reinterpret_cast<char*>(&chunkIndex), sizeof(chunkIndex)) ||
+         (chunkIndex >= header.m_chunkCount) ||
+         (!records.empty() && (chunkIndex <= records.back().first)) ||
+         !(chunk = ReadChunk(stream, chunkIndex < header.m_maxUsedChunk)))
+      {
+         deleteRecords();
+         return false;
+      }
+      records.emplace_back(static_cast<SizeType>(chunkIndex), chunk);
+   }
+
+   // The chunks that stay used and the chunks of the delta have to add up
+   // to the size of the delta, otherwise the delta was not written from the
+   // state of this storage.
+   const SizeType keptChunkCount = std::min(m_maxUsedChunk, static_cast<SizeType>(header.m_maxUsedChunk));
+   SizeType size = 0;
+   for (SizeType chunkIndex = 0; chunkIndex < keptChunkCount; ++chunkIndex)
+   {
+      size += static_cast<SizeType>(m_chunks[chunkIndex]->m_liveCount);
+   }
+   for (const auto& record : records)
+   {
+      if (record.first < header.m_maxUsedChunk)
+      {
+         size += static_cast<SizeType>(record.second->m_liveCount);
+         if (record.first < keptChunkCount)
+         {
+            size -= static_cast<SizeType>(m_chunks[record.first]->m_liveCount);
+         }
+      }
+   }
+
+   std::vector<GenerationType, GenerationAllocator> releasedGenerations(header.m_releasedGenerationCount, 0, GenerationAllocator(m_allocator));
+   if (!stream.read(reinterpret_cast<char*>(releasedGenerations.data()), releasedGenerations.size() * sizeof(GenerationType)) ||
+      (size != header.m_size))
+   {
+      deleteRecords();
+      return false;
+   }
+
+   // The chunks released since the last delta go first, so that the chunks
+   // created since then start from the right generations.
+   m_releasedGenerations.swap(releasedGenerations);
+   while (m_chunks.size() > header.m_chunkCount)
+   {
+      ReleaseChunk(m_chunks.size() - 1);
+      m_chunks.pop_back();
+   }
+   while (m_chunks.size() < header.m_chunkCount)
+   {
+      m_chunks.push_back(NewChunk(m_chunks.size()));
+   }
+
+   for (const auto& record : records)
+   {
+      ReleaseChunk(record.first);
+      m_chunks[record.first] = record.second;
+      MarkChunkDirty(record.first);
+   }
+
+   SetSnapshotState(header, freeChunkBuckets);
+
+   return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::WriteSnapshotHeader(std::ostream& stream, uint64_t magic) const
+{
+   impl::SnapshotHeader header = {};
+   header.m_magic = magic;
+   header.m_version = impl::SnapshotHeader::Version;
+   header.m_keySize = sizeof(KeyType);
+   header.m_valueSize = sizeof(ValueType);
+   header.m_generationBitSize = GenerationBitSize;
+   header.m_chunkSlots = ChunkSlots;
+   header.m_chunkSize = sizeof(Chunk);
+   header.m_chunkCount = m_chunks.size();
+   header.m_maxUsedChunk = m_maxUsedChunk;
+   header.m_size = m_size;
+   header.m_firstFreeChunk = m_firstFreeChunk;
+   header.m_retiredSlotCount = m_retiredSlotCount;
+   header.m_retiredChunkCount = m_retiredChunkCount;
+   header.m_releasedGenerationCount = m_releasedGenerations.size();
+   header.m_emptyChunkLimit = m_emptyChunkLimit;
+   header.m_overflowPolicy = static_cast<uint32_t>(m_overflowPolicy);
+   header.m_allocationPolicy = static_cast<uint32_t>(m_allocationPolicy);
+   stream.write(reinterpret_cast<const char*>(&header), sizeof(header));
+   stream.write(reinterpret_cast<const char*>(m_freeChunkBuckets.data()), sizeof(m_freeChunkBuckets));
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+bool ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::ReadSnapshotHeader(
+   std::istream& stream,
+   uint64_t magic,
+   impl::SnapshotHeader& outHeader,
+   std::array<IndexType, OccupancyBucketCount>& outFreeChunkBuckets)
+{
+   const impl::SnapshotHeader& header = outHeader;
+   if (!stream.read(reinterpret_cast<char*>(&outHeader), sizeof(outHeader)) ||
+      (header.m_magic != magic) ||
+      (header.m_version != impl::SnapshotHeader::Version) ||
+      (header.m_keySize != sizeof(KeyType)) ||
+      (header.m_valueSize != sizeof(ValueType)) ||
+      (header.m_generationBitSize != GenerationBitSize) ||
+      (header.m_chunkSlots != ChunkSlots) ||
+      (header.m_chunkSize != sizeof(Chunk)) ||
+      (header.m_chunkCount > MaxChunkCount) ||
+      (header.m_maxUsedChunk > header.m_chunkCount) ||
+      (header.m_firstFreeChunk >= static_cast<int64_t>(header.m_maxUsedChunk)) ||
+      (header.m_releasedGenerationCount > MaxChunkCount) ||
+      (header.m_overflowPolicy > static_cast<uint32_t>(GenerationOverflowPolicy::RetireChunk)) ||
+      (header.m_allocationPolicy > static_cast<uint32_t>(ChunkAllocationPolicy::FullestFirst)))
+   {
+      return false;
+   }
+
+   if (!stream.read(reinterpret_cast<char*>(outFreeChunkBuckets.data()), sizeof(outFreeChunkBuckets)))
+   {
+      return false;
+   }
+   return std::all_of(outFreeChunkBuckets.begin(), outFreeChunkBuckets.end(), [&](IndexType chunkIndex)
+   {
+      return static_cast<int64_t>(chunkIndex) < static_cast<int64_t>(header.m_maxUsedChunk);
+   });
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::SetSnapshotState(const impl::SnapshotHeader& header, const std::array<IndexType, OccupancyBucketCount>& freeChunkBuckets)
+{
+   m_size = static_cast<SizeType>(header.m_size);
+   m_firstFreeChunk = static_cast<IndexType>(header.m_firstFreeChunk);
+   m_maxUsedChunk = static_cast<SizeType>(header.m_maxUsedChunk);
+   m_retiredSlotCount = static_cast<SizeType>(header.m_retiredSlotCount);
+   m_retiredChunkCount = static_cast<SizeType>(header.m_retiredChunkCount);
+   m_emptyChunkLimit = static_cast<SizeType>(header.m_emptyChunkLimit);
+   m_overflowPolicy = static_cast<GenerationOverflowPolicy>(header.m_overflowPolicy);
+   m_allocationPolicy = static_cast<ChunkAllocationPolicy>(header.m_allocationPolicy);
+   m_freeChunkBuckets = freeChunkBuckets;
+   UpdateStats();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::WriteChunk(std::ostream& stream, SizeType chunkIndex) const
+{
+   const Chunk* const chunk = m_chunks[chunkIndex];
+
+   impl::SnapshotChunkHeader chunkHeader = {};
+   chunkHeader.m_nextFreeChunk = chunk->m_nextFreeChunk;
+   chunkHeader.m_prevFreeChunk = chunk->m_prevFreeChunk;
+   chunkHeader.m_firstFreeSlot = chunk->m_firstFreeSlot;
+   chunkHeader.m_lastFreeSlot = chunk->m_lastFreeSlot;
+   chunkHeader.m_liveCount = chunk->m_liveCount;
+   chunkHeader.m_retiredSlotCount = chunk->m_retiredSlotCount;
+   chunkHeader.m_isRetired = (chunk == m_retiredChunk) ? 1 : 0;
+   stream.write(reinterpret_cast<const char*>(&chunkHeader), sizeof(chunkHeader));
+   if (chunkHeader.m_isRetired)
+   {
+      return;
+   }
+
+   // The chunks past the used ones only need their generations, so that the
+   // stale keys into them stay stale. The free slots keep the links of the
+   // free list of the chunk.
+   stream.write(reinterpret_cast<const char*>(chunk->m_generations), sizeof(chunk->m_generations));
+   if (chunkIndex < m_maxUsedChunk)
+   {
+      stream.write(reinterpret_cast<const char*>(&chunk->m_liveBits), sizeof(chunk->m_liveBits));
+      stream.write(reinterpret_cast<const char*>(chunk->m_slots), sizeof(chunk->m_slots));
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+typename ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::Chunk*
+ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::ReadChunk(std::istream& stream, bool isUsed)
+{
+   impl::SnapshotChunkHeader chunkHeader = {};
+   if (!stream.read(reinterpret_cast<char*>(&chunkHeader), sizeof(chunkHeader)))
+   {
+      return nullptr;
+   }
+   if (chunkHeader.m_isRetired)
+   {
+      return GetRetiredChunk();
+   }
+
+   Chunk* const chunk = ConstructChunk();
+   stream.read(reinterpret_cast<char*>(chunk->m_generations), sizeof(chunk->m_generations));
+   if (isUsed)
+   {
+      stream.read(reinterpret_cast<char*>(&chunk->m_liveBits), sizeof(chunk->m_liveBits));
+      stream.read(reinterpret_cast<char*>(chunk->m_slots), sizeof(chunk->m_slots));
+      chunk->m_nextFreeChunk = static_cast<IndexType>(chunkHeader.m_nextFreeChunk);
+      chunk->m_prevFreeChunk = static_cast<IndexType>(chunkHeader.m_prevFreeChunk);
+      chunk->m_firstFreeSlot = static_cast<IndexType>(chunkHeader.m_firstFreeSlot);
+      chunk->m_lastFreeSlot = static_cast<IndexType>(chunkHeader.m_lastFreeSlot);
+      chunk->m_liveCount = static_cast<IndexType>(chunkHeader.m_liveCount);
+      chunk->m_retiredSlotCount = static_cast<IndexType>(chunkHeader.m_retiredSlotCount);
+   }
+   if (!stream)
+   {
+      DeleteChunk(chunk);
+      return nullptr;
+   }
+
+   return chunk;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+TKey ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::ReserveSlot(ValueType*& outPtr)
+{
+   if (m_firstFreeChunk < 0)
+   {
+      AllocateChunk();
+   }
+   assert(m_firstFreeChunk >= 0);
+
+   return ReserveSlotNoAlloc(outPtr);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+TKey ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::ReserveSlotNoAlloc(ValueType*& outPtr)
+{
+   if (m_firstFreeChunk < 0)
+   {
+      outPtr = nullptr;
+      return InvalidKey;
+   }
+
+   const KeyType chunkIndex = static_cast<KeyType>(m_firstFreeChunk);
+   Chunk* chunk = GetWritableChunk(chunkIndex);
+   assert(chunk->m_firstFreeSlot >= 0);
+   MarkChunkDirty(chunkIndex);
+
+   const SizeType slotIndex = chunk->m_firstFreeSlot;
+   Slot* const slot = chunk->m_slots + slotIndex;
+   outPtr = slot->GetPtr();
+
+   const SizeType occupancy = GetOccupancy(chunk);
+   ++chunk->m_liveCount;
+   chunk->m_firstFreeSlot = slot->m_nextFreeSlot;
+   if (chunk->m_firstFreeSlot < 0)
+   {
+      chunk->m_lastFreeSlot = -1;
+      RemoveChunkFromFreeList(chunk, chunkIndex, occupancy);
+   }
+   else
+   {
+      UpdateChunkInFreeList(chunk, chunkIndex, occupancy);
+   }
+   
+   chunk->m_generations[slotIndex] = AdvanceGeneration(chunk->m_generations[slotIndex]);
+   assert(!chunk->m_liveBits[slotIndex]);
+   chunk->m_liveBits.set(slotIndex);
+
+   ++m_size;
+   m_stats.OnInsert(1);
+   UpdateStats();
+   
+   SLOTMAP_CHUNK_INVARIANTS(chunk);
+
+   return (static_cast<KeyType>(chunk->m_generations[slotIndex]) << GenerationShift) |
+      (static_cast<KeyType>(slotIndex) << SlotIndexShift) |
+      chunkIndex;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+bool ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::FreeSlot(KeyType key)
+{
+   const KeyType chunkIndex = key & ChunkIndexMask;
+   if (chunkIndex >= m_maxUsedChunk)
+   {
+      return false;
+   }
+
+   if (!IsLiveSlot(*m_chunks[chunkIndex], key))
+   {
+      return false;
+   }
+
+   const KeyType slotIndex = (key >> SlotIndexShift) & SlotIndexMask;
+   const GenerationType generation = (key >> GenerationShift) & GenerationMask;
+   Chunk& chunk = *GetWritableChunk(chunkIndex);
+   Slot* const slot = chunk.m_slots + slotIndex;
+   if constexpr (!std::is_trivially_destructible_v<TValue>)
+   {
+      slot->GetPtr()->~TValue();
+   }
+
+   MarkChunkDirty(chunkIndex);
+   assert(chunk.m_liveBits[slotIndex]);
+   chunk.m_liveBits.reset(slotIndex);
+   const SizeType occupancy = GetOccupancy(&chunk);
+   --chunk.m_liveCount;
+   assert(m_size > 0);
+   --m_size;
+   m_stats.OnErase(1);
+
+   if (IsGenerationExhausted(generation))
+   {
+      RetireSlot(&chunk, slotIndex);
+      RetireChunkIfNeeded(chunkIndex);
+      UpdateStats();
+      return true;
+   }
+
+   slot->m_nextFreeSlot = chunk.m_firstFreeSlot;
+   const bool isChunkInFreeList = (chunk.m_firstFreeSlot >= 0);
+   chunk.m_firstFreeSlot = slotIndex;
+   if (!isChunkInFreeList)
+   {
+      chunk.m_lastFreeSlot = slotIndex;
+      AppendChunkToFreeList(&chunk, chunkIndex);
+   }
+   else
+   {
+      UpdateChunkInFreeList(&chunk, chunkIndex, occupancy);
+   }
+
+   SLOTMAP_CHUNK_INVARIANTS(&chunk);
+
+   if ((m_emptyChunkLimit > 0) && IsChunkEmpty(&chunk))
+   {
+      ReleaseChunksIfNeeded();
+   }
+   UpdateStats();
+   
+   return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::FreeSlotByIndex(IndexType chunkIndex, IndexType slotIndex)
+{
+   Chunk* const chunk = GetWritableChunk(chunkIndex);
+   MarkChunkDirty(chunkIndex);
+
+   assert(chunk->m_liveBits[slotIndex]);
+   chunk->m_liveBits.reset(slotIndex);
+   const SizeType occupancy = GetOccupancy(chunk);
+   --chunk->m_liveCount;
+
+   Slot* const slot = chunk->m_slots + slotIndex;
+   if constexpr (!std::is_trivially_destructible_v<TValue>)
+   {
+      slot->GetPtr()->~TValue();
+   }
+
+   assert(m_size > 0);
+   --m_size;
+   m_stats.OnErase(1);
+
+   if (IsGenerationExhausted(chunk->m_generations[slotIndex]))
+   {
+      RetireSlot(chunk, slotIndex);
+      RetireChunkIfNeeded(chunkIndex);
+      UpdateStats();
+      return;
+   }
+
+   slot->m_nextFreeSlot = -1;
+   if (chunk->m_lastFreeSlot < 0)
+   {
+      assert(chunk->m_firstFreeSlot < 0);
+      chunk->m_firstFreeSlot = slotIndex;
+      chunk->m_lastFreeSlot = slotIndex;
+      AppendChunkToFreeList(chunk, chunkIndex);
+   }
+   else
+   {
+      assert(chunk->m_firstFreeSlot >= 0);
+      chunk->m_slots[chunk->m_lastFreeSlot].m_nextFreeSlot = slotIndex;
+      chunk->m_lastFreeSlot = slotIndex;
+      UpdateChunkInFreeList(chunk, chunkIndex, occupancy);
+   }
+   UpdateStats();
+   
+   SLOTMAP_CHUNK_INVARIANTS(chunk);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+typename ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::SizeType
+ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::ReserveSlots(SizeType count, KeyType* outKeys, ValueType** outPtrs)
+{
+   SizeType reserved = 0;
+   while (reserved < count)
+   {
+      if (m_firstFreeChunk < 0)
+      {
+         if (m_maxUsedChunk >= MaxChunkCount)
+         {
+            break;
+         }
+
+         IndexType chunkIndex = -1;
+         Chunk* const chunk = AcquireChunk(chunkIndex);
+         reserved += ClaimSlotRun(chunk, chunkIndex, count - reserved, outKeys + reserved, outPtrs + reserved);
+         continue;
+      }
+
+      const IndexType chunkIndex = m_firstFreeChunk;
+      Chunk* const chunk = GetWritableChunk(chunkIndex);
+      assert(chunk->m_firstFreeSlot >= 0);
+
+      // An empty chunk does not need its free list, the slots are handed out
+      // in order instead.
+      if (IsChunkEmpty(chunk))
+      {
+         RemoveChunkFromFreeList(chunk, chunkIndex, 0);
+         reserved += ClaimSlotRun(chunk, chunkIndex, count - reserved, outKeys + reserved, outPtrs + reserved);
+         continue;
+      }
+
+      const SizeType occupancy = GetOccupancy(chunk);
+      MarkChunkDirty(chunkIndex);
+      while ((reserved < count) && (chunk->m_firstFreeSlot >= 0))
+      {
+         const SizeType slotIndex = chunk->m_firstFreeSlot;
+         Slot* const slot = chunk->m_slots + slotIndex;
+         chunk->m_firstFreeSlot = slot->m_nextFreeSlot;
+
+         chunk->m_generations[slotIndex] = AdvanceGeneration(chunk->m_generations[slotIndex]);
+         assert(!chunk->m_liveBits[slotIndex]);
+         chunk->m_liveBits.set(slotIndex);
+
+         outPtrs[reserved] = slot->GetPtr();
+         outKeys[reserved] = MakeKey(chunk->m_generations[slotIndex], slotIndex, chunkIndex);
+         ++chunk->m_liveCount;
+         ++reserved;
+         ++m_size;
+      }
+
+      if (chunk->m_firstFreeSlot < 0)
+      {
+         chunk->m_lastFreeSlot = -1;
+         RemoveChunkFromFreeList(chunk, chunkIndex, occupancy);
+      }
+      else
+      {
+         UpdateChunkInFreeList(chunk, chunkIndex, occupancy);
+      }
+
+      SLOTMAP_CHUNK_INVARIANTS(chunk);
+   }
+
+   m_stats.OnInsert(reserved);
+   UpdateStats();
+
+   return reserved;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+typename ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::SizeType
+ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::ClaimSlotRun(Chunk* chunk, IndexType chunkIndex, SizeType count, KeyType* outKeys, ValueType** outPtrs)
+{
+   const SizeType runLength = std::min<SizeType>(count, ChunkSlots);
+   MarkChunkDirty(chunkIndex);
+
+   for (SizeType slotIndex = 0; slotIndex < runLength; ++slotIndex)
+   {
+      chunk->m_generations[slotIndex] = AdvanceGeneration(chunk->m_generations[slotIndex]);
+
+      outPtrs[slotIndex] = chunk->m_slots[slotIndex].GetPtr();
+      outKeys[slotIndex] = MakeKey(chunk->m_generations[slotIndex], slotIndex, chunkIndex);
+   }
+
+   chunk->m_liveBits.reset();
+   TBitsetTraits::SetRange(chunk->m_liveBits, 0, runLength);
+   chunk->m_liveCount = static_cast<IndexType>(runLength);
+
+   if (runLength < ChunkSlots)
+   {
+      for (SizeType slotIndex = runLength; slotIndex < ChunkSlots - 1; ++slotIndex)
+      {
+         chunk->m_slots[slotIndex].m_nextFreeSlot = slotIndex + 1;
+      }
+      chunk->m_slots[ChunkSlots - 1].m_nextFreeSlot = -1;
+      chunk->m_firstFreeSlot = runLength;
+      chunk->m_lastFreeSlot = ChunkSlots - 1;
+      AppendChunkToFreeList(chunk, chunkIndex);
+   }
+   else
+   {
+      chunk->m_firstFreeSlot = -1;
+      chunk->m_lastFreeSlot = -1;
+   }
+
+   m_size += runLength;
+
+   SLOTMAP_CHUNK_INVARIANTS(chunk);
+
+   return runLength;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+typename ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::SizeType
+ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::FreeSlots(const KeyType* keys, SizeType count)
+{
+   // Keys that already come in long runs from the same chunk (e.g. keys
+   // returned by ReserveSlots()) are freed in the given order.
+   SizeType runCount = (count > 0) ? 1 : 0;
+   for (SizeType i = 1; i < count; ++i)
+   {
+      if ((keys[i] & ChunkIndexMask) != (keys[i - 1] & ChunkIndexMask))
+      {
+         ++runCount;
+      }
+   }
+
+   if (runCount * impl::MinFreeSlotRunLength <= count)
+   {
+      return FreeSlotRuns(keys, count);
+   }
+
+   std::vector<KeyType> sortedKeys;
+   if (count >= m_maxUsedChunk)
+   {
+      // Counting sort by the chunk index, keys of unused chunks are dropped.
+      std::vector<SizeType> offsets(m_maxUsedChunk + 1, 0);
+      for (SizeType i = 0; i < count; ++i)
+      {
+         const SizeType chunkIndex = keys[i] & ChunkIndexMask;
+         if (chunkIndex < m_maxUsedChunk)
+         {
+            ++offsets[chunkIndex + 1];
+         }
+      }
+      for (SizeType chunkIndex = 1; chunkIndex <= m_maxUsedChunk; ++chunkIndex)
+      {
+         offsets[chunkIndex] += offsets[chunkIndex - 1];
+      }
+
+      sortedKeys.resize(offsets[m_maxUsedChunk]);
+      for (SizeType i = 0; i < count; ++i)
+      {
+         const SizeType chunkIndex = keys[i] & ChunkIndexMask;
+         if (chunkIndex < m_maxUsedChunk)
+         {
+            sortedKeys[offsets[chunkIndex]++] = keys[i];
+         }
+      }
+   }
+   else
+   {
+      sortedKeys.assign(keys, keys + count);
+      std::sort(sortedKeys.begin(), sortedKeys.end(), [](KeyType a, KeyType b)
+      {
+         return (a & ChunkIndexMask) < (b & ChunkIndexMask);
+      });
+   }
+
+   return FreeSlotRuns(sortedKeys.data(), sortedKeys.size());
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+typename ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::SizeType
+ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::FreeSlotRuns(const KeyType* keys, SizeType count)
+{
+   SizeType freed = 0;
+   SizeType runBegin = 0;
+   while (runBegin < count)
+   {
+      const KeyType chunkIndex = keys[runBegin] & ChunkIndexMask;
+      SizeType runEnd = runBegin + 1;
+      while ((runEnd < count) && ((keys[runEnd] & ChunkIndexMask) == chunkIndex))
+      {
+         ++runEnd;
+      }
+
+      // A shared chunk is only copied if one of the keys is live in it.
+      if ((chunkIndex < m_maxUsedChunk) &&
+          (!IsChunkShared(chunkIndex) || std::any_of(keys + runBegin, keys + runEnd, [&](KeyType key) { return IsLiveSlot(*m_chunks[chunkIndex], key); })))
+      {
+         freed += FreeSlotRun(GetWritableChunk(chunkIndex), chunkIndex, keys + runBegin, runEnd - runBegin);
+      }
+      runBegin = runEnd;
+   }
+
+   assert(m_size >= freed);
+   m_size -= freed;
+
+   if ((m_emptyChunkLimit > 0) && (freed > 0))
+   {
+      ReleaseChunksIfNeeded();
+   }
+   m_stats.OnErase(freed);
+   UpdateStats();
+
+   return freed;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+typename ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::SizeType
+ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::FreeSlotRun(Chunk* chunk, IndexType chunkIndex, const KeyType* keys, SizeType count)
+{
+   const bool isChunkInFreeList = (chunk->m_firstFreeSlot >= 0);
+   const SizeType occupancy = GetOccupancy(chunk);
+   IndexType firstFreeSlot = chunk->m_firstFreeSlot;
+   IndexType lastFreeSlot = chunk->m_lastFreeSlot;
+   SizeType freed = 0;
+   SizeType retired = 0;
+
+   for (SizeType i = 0; i < count; ++i)
+   {
+      const KeyType key = keys[i];
+      const KeyType slotIndex = (key >> SlotIndexShift) & SlotIndexMask;
+      if ((slotIndex >= ChunkSlots) || !chunk->m_liveBits.test(slotIndex))
+      {
+         continue;
+      }
+
+      const GenerationType generation = (key >> GenerationShift) & GenerationMask;
+      if (chunk->m_generations[slotIndex] != generation)
+      {
+         continue;
+      }
+
+      Slot* const slot = chunk->m_slots + slotIndex;
+      if constexpr (!std::is_trivially_destructible_v<TValue>)
+      {
+         slot->GetPtr()->~TValue();
+      }
+
+      MarkChunkDirty(chunkIndex);
+      chunk->m_liveBits.reset(slotIndex);
+      ++freed;
+
+      if (IsGenerationExhausted(generation))
+      {
+         RetireSlot(chunk, slotIndex);
+         ++retired;
+         continue;
+      }
+
+      slot->m_nextFreeSlot = firstFreeSlot;
+      firstFreeSlot = slotIndex;
+      if (lastFreeSlot < 0)
+      {
+         lastFreeSlot = slotIndex;
+      }
+   }
+
+   chunk->m_firstFreeSlot = firstFreeSlot;
+   chunk->m_lastFreeSlot = lastFreeSlot;
+   chunk->m_liveCount -= static_cast<IndexType>(freed);
+   if (!isChunkInFreeList && (freed > retired))
+   {
+      AppendChunkToFreeList(chunk, chunkIndex);
+   }
+   else if (isChunkInFreeList)
+   {
+      UpdateChunkInFreeList(chunk, chunkIndex, occupancy);
+   }
+
+   SLOTMAP_CHUNK_INVARIANTS(chunk);
+
+   if (retired > 0)
+   {
+      RetireChunkIfNeeded(chunkIndex);
+   }
+
+   return freed;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::RetireSlot(Chunk* chunk, SizeType slotIndex)
+{
+   // The slot is left out of the free list for good.
+   chunk->m_slots[slotIndex].m_nextFreeSlot = RetiredSlot;
+   ++chunk->m_retiredSlotCount;
+   ++m_retiredSlotCount;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::RetireChunkIfNeeded(IndexType chunkIndex)
+{
+   Chunk* const chunk = m_chunks[chunkIndex];
+   if ((m_overflowPolicy != GenerationOverflowPolicy::RetireChunk) ||
+      (static_cast<SizeType>(chunk->m_retiredSlotCount) < ChunkSlots) ||
+      (chunk == m_retiredChunk))
+   {
+      return;
+   }
+
+   // All slots are retired, so the chunk is not in the free list. Its index
+   // keeps pointing to an empty chunk, which fails all the keys.
+   assert(chunk->m_firstFreeSlot < 0);
+   ReleaseChunk(chunkIndex);
+   m_chunks[chunkIndex] = GetRetiredChunk();
+   MarkChunkDirty(chunkIndex);
+   ++m_retiredChunkCount;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+typename ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::Chunk*
+ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::GetRetiredChunk()
+{
+   if (!m_retiredChunk)
+   {
+      m_retiredChunk = ConstructChunk();
+      m_retiredChunk->m_retiredSlotCount = ChunkSlots;
+      std::fill(m_retiredChunk->m_generations, m_retiredChunk->m_generations + ChunkSlots, static_cast<GenerationType>(GenerationMask));
+      for (SizeType slotIndex = 0; slotIndex < ChunkSlots; ++slotIndex)
+      {
+         m_retiredChunk->m_slots[slotIndex].m_nextFreeSlot = RetiredSlot;
+      }
+   }
+   return m_retiredChunk;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::DeleteChunks()
+{
+   for (Chunk* chunk : m_chunks)
+   {
+      if (chunk != m_retiredChunk)
+      {
+         DeleteChunk(chunk);
+      }
+   }
+   m_chunks.clear();
+
+   if (m_retiredChunk)
+   {
+      DeleteChunk(m_retiredChunk);
+      m_retiredChunk = nullptr;
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::ClearRetired()
+{
+   // The used chunks stay used and only the slots that are not retired are
+   // put back to the free lists, so that the retired slots are never handed
+   // out again. The live slots with an exhausted generation are retired the
+   // same way as if they were erased.
+   ResetChunkFreeList();
+   for (SizeType chunkIndex = m_maxUsedChunk; chunkIndex-- > 0;)
+   {
+      if (m_chunks[chunkIndex] == m_retiredChunk)
+      {
+         continue;
+      }
+
+      const bool hasValues = UnshareChunkForClear(chunkIndex);
+      Chunk* const chunk = m_chunks[chunkIndex];
+      MarkChunkDirty(chunkIndex);
+      chunk->m_firstFreeSlot = -1;
+      chunk->m_lastFreeSlot = -1;
+      for (IndexType slotIndex = static_cast<IndexType>(ChunkSlots) - 1; slotIndex >= 0; --slotIndex)
+      {
+         Slot* const slot = chunk->m_slots + slotIndex;
+         if (chunk->m_liveBits.test(slotIndex))
+         {
+            if constexpr (!std::is_trivially_destructible_v<TValue>)
+            {
+               if (hasValues)
+               {
+                  slot->GetPtr()->~TValue();
+               }
+            }
+            if (IsGenerationExhausted(chunk->m_generations[slotIndex]))
+            {
+               RetireSlot(chunk, slotIndex);
+               continue;
+            }
+         }
+         else if (slot->m_nextFreeSlot == RetiredSlot)
+         {
+            continue;
+         }
+
+         slot->m_nextFreeSlot = chunk->m_firstFreeSlot;
+         chunk->m_firstFreeSlot = slotIndex;
+         if (chunk->m_lastFreeSlot < 0)
+         {
+            chunk->m_lastFreeSlot = slotIndex;
+         }
+      }
+      chunk->m_liveBits.reset();
+      chunk->m_liveCount = 0;
+
+      if (chunk->m_firstFreeSlot >= 0)
+      {
+         AppendChunkToFreeList(chunk, chunkIndex);
+      }
+
+      SLOTMAP_CHUNK_INVARIANTS(chunk);
+      RetireChunkIfNeeded(chunkIndex);
+   }
+
+   m_size = 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::Swap(ChunkedSlotMapStorage& other)
+{
+   std::swap(m_size, other.m_size);
+   std::swap(m_firstFreeChunk, other.m_firstFreeChunk);
+   std::swap(m_maxUsedChunk, other.m_maxUsedChunk);
+   std::swap(m_emptyChunkLimit, other.m_emptyChunkLimit);
+   std::swap(m_retiredSlotCount, other.m_retiredSlotCount);
+   std::swap(m_retiredChunkCount, other.m_retiredChunkCount);
+   std::swap(m_overflowPolicy, other.m_overflowPolicy);
+   std::swap(m_allocationPolicy, other.m_allocationPolicy);
+   std::swap(m_freeChunkBuckets, other.m_freeChunkBuckets);
+   std::swap(m_retiredChunk, other.m_retiredChunk);
+   if constexpr (std::allocator_traits<TAllocator>::propagate_on_container_swap::value)
+   {
+      std::swap(m_allocator, other.m_allocator);
+   }
+   else
+   {
+      assert(m_allocator == other.m_allocator);
+   }
+   m_chunks.swap(other.m_chunks);
+   m_releasedGenerations.swap(other.m_releasedGenerations);
+   std::swap(m_isTrackingDirtyChunks, other.m_isTrackingDirtyChunks);
+   m_dirtyChunks.swap(other.m_dirtyChunks);
+   std::swap(m_isCopyOnWrite, other.m_isCopyOnWrite);
+   m_chunkShares.swap(other.m_chunkShares);
+   std::swap(m_sharedChunkCount, other.m_sharedChunkCount);
+
+   // The stats stay with the storage objects.
+   UpdateStats();
+   other.UpdateStats();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::Clear()
+{
+   if (m_maxUsedChunk == 0)
+   {
+      return;
+   }
+
+   m_stats.OnErase(m_size);
+   if ((m_retiredSlotCount > 0) || (m_overflowPolicy != GenerationOverflowPolicy::Wrap))
+   {
+      ClearRetired();
+      UpdateStats();
+      return;
+   }
+   
+   // The chunks shared with copy-on-write copies are left to them, the
+   // values are not copied only to be destroyed.
+   if (!std::is_trivially_destructible_v<TValue> || (m_sharedChunkCount > 0))
+   {
+      for (SizeType chunkIndex = 0; chunkIndex < m_maxUsedChunk; ++chunkIndex)
+      {
+         const bool hasValues = UnshareChunkForClear(chunkIndex);
+         Chunk* const chunk = m_chunks[chunkIndex];
+
+         if constexpr (!std::is_trivially_destructible_v<TValue>)
+         {
+            if (hasValues)
+            {
+               TBitsetTraits::ForEachSetBit(chunk->m_liveBits, [&](size_t slotIndex)
+               {
+                  Slot* const slot = chunk->m_slots + slotIndex;
+                  slot->GetPtr()->~TValue();
+               });
+            }
+         }
+         
+         chunk->m_liveBits.reset();
+      }
+   }
+   
+   m_size = 0;
+   ResetChunkFreeList();
+   m_maxUsedChunk = 0;
+   UpdateStats();
+
+   assert(m_size == 0);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+template<bool IsConst>
+bool ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::IteratorTpl<IsConst>::Advance()
+{
+   ++m_slotIndex;
+
+   return FindNext();
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+template<bool IsConst>
+void ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::IteratorTpl<IsConst>::FindFirst()
+{
+   if (m_chunkIndex < std::min<SizeType>(m_endChunkIndex, m_storage->m_maxUsedChunk))
+   {
+      FindNext();
+      return;
+   }
+
+   m_key = std::numeric_limits<KeyType>::max();
+   m_ptr = nullptr;
+   return;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<
+   typename TValue,
+   typename TKey,
+   size_t MaxChunkSize,
+   typename TAllocator,
+   typename TBitsetTraits,
+   int TGenerationBitSize,
+   typename TStats>
+template<bool IsConst>
+bool ChunkedSlotMapStorage<TValue, TKey, MaxChunkSize, TAllocator, TBitsetTraits, TGenerationBitSize, TStats>::IteratorTpl<IsConst>::FindNext()
+{
+   const SizeType endChunkIndex = std::min<SizeType>(m_endChunkIndex, m_storage->m_maxUsedChunk);
+   do
+   {
       auto* chunk = m_storage->m_chunks[m_chunkIndex];
-      m_slotIndex = chunk->m_liveBits.FindNextBitSet(m_slotIndex);
+      if (!chunk->IsFull())
+      {
+         m_slotIndex = chunk->m_liveBits.FindNextBitSet(m_slotIndex);
+      }
       if (m_slotIndex < ChunkSlots)
       {
-         m_key = (static_cast<KeyType>(chunk->m_generations[m_slotIndex]) << GenerationShift) |
-            (static_cast<KeyType>(m_slotIndex) << SlotIndexShift) |
-            static_cast<KeyType>(m_chunkIndex);
-         m_ptr = chunk->m_slots[m_slotIndex].GetPtr();
-         return true;
+         m_key = (static_cast<KeyType>(chunk->m_generations[m_slotIndex]) << GenerationShift) |
+            (static_cast<KeyType>(m_slotIndex) << SlotIndexShift) |
+            static_cast<KeyType>(m_chunkIndex);
+         m_ptr = chunk->m_slots[m_slotIndex].GetPtr();
+         return true;
+      }
+      m_slotIndex = 0;
+   } while (++m_chunkIndex < endChunkIndex);
+
+   m_key = std::numeric_limits<KeyType>::max();
+   m_ptr = nullptr;
+   return false;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, typename TAllocator>
+DenseSlotMapStorage<TValue, TKey, TAllocator>::DenseSlotMapStorage(const TAllocator& allocator)
+   : m_allocator(allocator)
+   , m_keys(KeyAllocator(m_allocator))
+   , m_slots(SlotAllocator(m_allocator))
+{
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, typename TAllocator>
+DenseSlotMapStorage<TValue, TKey, TAllocator>::DenseSlotMapStorage(const DenseSlotMapStorage& other)
+   : m_firstFreeSlot(other.m_firstFreeSlot)
+   , m_allocator(std::allocator_traits<TAllocator>::select_on_container_copy_construction(other.m_allocator))
+   , m_keys(other.m_keys, KeyAllocator(m_allocator))
+   , m_slots(other.m_slots, SlotAllocator(m_allocator))
+{
+   Reallocate(other.m_size);
+   for (SizeType index = 0; index < other.m_size; ++index)
+   {
+      new (m_values + index) TValue(other.m_values[index]);
+   }
+   m_size = other.m_size;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, typename TAllocator>
+DenseSlotMapStorage<TValue, TKey, TAllocator>::DenseSlotMapStorage(DenseSlotMapStorage&& other)
+   : m_allocator(other.m_allocator)
+   , m_keys(KeyAllocator(m_allocator))
+   , m_slots(SlotAllocator(m_allocator))
+{
+   Swap(other);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, typename TAllocator>
+DenseSlotMapStorage<TValue, TKey, TAllocator>::~DenseSlotMapStorage()
+{
+   Clear();
+   Reallocate(0);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, typename TAllocator>
+DenseSlotMapStorage<TValue, TKey, TAllocator>& DenseSlotMapStorage<TValue, TKey, TAllocator>::operator=(DenseSlotMapStorage&& other)
+{
+   if (this == &other)
+   {
+      return *this;
+   }
+
+   Clear();
+   Reallocate(0);
+
+   bool canTakeValues = true;
+   if constexpr (std::allocator_traits<TAllocator>::propagate_on_container_move_assignment::value)
+   {
+      m_allocator = std::move(other.m_allocator);
+   }
+   else
+   {
+      canTakeValues = (m_allocator == other.m_allocator);
+   }
+
+   m_firstFreeSlot = other.m_firstFreeSlot;
+   m_keys.assign(other.m_keys.begin(), other.m_keys.end());
+   m_slots.assign(other.m_slots.begin(), other.m_slots.end());
+
+   if (canTakeValues)
+   {
+      m_values = other.m_values;
+      m_size = other.m_size;
+      m_capacity = other.m_capacity;
+      other.m_values = nullptr;
+      other.m_size = 0;
+      other.m_capacity = 0;
+   }
+   else
+   {
+      // The values of `other` can't be deallocated with this allocator, they
+      // are moved to a new array instead. The keys stay the same.
+      Reallocate(other.m_size);
+      for (SizeType index = 0; index < other.m_size; ++index)
+      {
+         new (m_values + index) TValue(std::move(other.m_values[index]));
+      }
+      m_size = other.m_size;
+      other.Clear();
+   }
+
+   other.m_firstFreeSlot = NoFreeSlot;
+   other.m_keys.clear();
+   other.m_slots.clear();
+
+   return *this;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, typename TAllocator>
+bool DenseSlotMapStorage<TValue, TKey, TAllocator>::Reserve(size_t capacity)
+{
+   if (capacity <= m_capacity)
+   {
+      return true;
+   }
+
+   if (capacity > MaxCapacity())
+   {
+      return false;
+   }
+
+   Reallocate(capacity);
+   m_keys.reserve(capacity);
+   m_slots.reserve(capacity);
+   return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, typename TAllocator>
+typename DenseSlotMapStorage<TValue, TKey, TAllocator>::SizeType
+DenseSlotMapStorage<TValue, TKey, TAllocator>::ShrinkToFit()
+{
+   const SizeType released = m_capacity - m_size;
+   if (released > 0)
+   {
+      Reallocate(m_size);
+   }
+   m_keys.shrink_to_fit();
+   return released;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, typename TAllocator>
+TValue* DenseSlotMapStorage<TValue, TKey, TAllocator>::GetPtr(TKey key) const
+{
+   const SizeType index = FindIndex(key);
+   return (index < m_size) ? m_values + index : nullptr;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, typename TAllocator>
+void DenseSlotMapStorage<TValue, TKey, TAllocator>::GetPtrBatch(const TKey* keys, size_t count, TValue** outPtrs) const
+{
+   for (size_t groupBegin = 0; groupBegin < count; groupBegin += impl::LookupGroupSize)
+   {
+      const size_t groupSize = std::min(count - groupBegin, impl::LookupGroupSize);
+      const TKey* groupKeys = keys + groupBegin;
+      TValue** groupPtrs = outPtrs + groupBegin;
+
+      // Stage 1: the slots.
+      for (size_t i = 0; i < groupSize; ++i)
+      {
+         const SizeType slotIndex = static_cast<SizeType>(groupKeys[i] & SlotIndexMask);
+         if (slotIndex < m_slots.size())
+         {
+            impl::Prefetch(m_slots.data() + slotIndex);
+         }
       }
-      m_slotIndex = 0;
-   } while (++m_chunkIndex < m_storage->m_maxUsedChunk);
+
+      // Stage 2: the keys and the values in the dense arrays.
+      for (size_t i = 0; i < groupSize; ++i)
+      {
+         const SizeType slotIndex = static_cast<SizeType>(groupKeys[i] & SlotIndexMask);
+         if (slotIndex < m_slots.size())
+         {
+            const SizeType index = m_slots[slotIndex].m_index;
+            if (index < m_size)
+            {
+               impl::Prefetch(m_keys.data() + index);
+               impl::Prefetch(m_values + index);
+            }
+         }
+      }
+
+      // Stage 3: validate the keys.
+      for (size_t i = 0; i < groupSize; ++i)
+      {
+         groupPtrs[i] = GetPtr(groupKeys[i]);
+      }
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, typename TAllocator>
+typename DenseSlotMapStorage<TValue, TKey, TAllocator>::SizeType
+DenseSlotMapStorage<TValue, TKey, TAllocator>::GetIndexByKey(KeyType key) const
+{
+   return FindIndex(key);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, typename TAllocator>
+TKey DenseSlotMapStorage<TValue, TKey, TAllocator>::GetKeyByIndex(SizeType index) const
+{
+   return (index < m_size) ? m_keys[index] : InvalidKey;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, typename TAllocator>
+bool DenseSlotMapStorage<TValue, TKey, TAllocator>::FindNextKey(TKey& key) const
+{
+   SizeType index = static_cast<SizeType>(key & SlotIndexMask);
+   if (((key >> GenerationShift) & GenerationMask) != 0)
+   {
+      // A key rather than a cursor.
+      index = FindIndex(key);
+   }
+
+   if (index >= m_size)
+   {
+      return false;
+   }
+
+   key = m_keys[index];
+   return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, typename TAllocator>
+TKey DenseSlotMapStorage<TValue, TKey, TAllocator>::IncrementKey(TKey key) const
+{
+   SizeType index = static_cast<SizeType>(key & SlotIndexMask);
+   if (((key >> GenerationShift) & GenerationMask) != 0)
+   {
+      index = FindIndex(key);
+   }
+
+   return (index < m_size) ? static_cast<KeyType>(index + 1) : static_cast<KeyType>(m_size);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, typename TAllocator>
+template<typename TFunc>
+void DenseSlotMapStorage<TValue, TKey, TAllocator>::ForEachSlot(TFunc func) const
+{
+   const KeyType* const keys = m_keys.data();
+   for (SizeType index = 0; index < m_size; ++index)
+   {
+      func(keys[index], m_values[index]);
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, typename TAllocator>
+template<typename TFunc, typename TExecutor>
+void DenseSlotMapStorage<TValue, TKey, TAllocator>::ParallelForEachSlot(TFunc func, TExecutor&& executor) const
+{
+   // Every element costs the same, the array is split into equal ranges of
+   // whole cache lines.
+   constexpr size_t RangeAlignment = std::max<size_t>(impl::CacheLineSize / sizeof(TValue), 1);
+
+   const size_t alignedCount = (m_size + RangeAlignment - 1) / RangeAlignment;
+   const size_t rangeCount = std::min(alignedCount, impl::GetExecutorConcurrency(executor) * impl::TasksPerThread);
+   if (rangeCount <= 1)
+   {
+      ForEachSlot(func);
+      return;
+   }
+
+   impl::ExecuteParallelFor(std::forward<TExecutor>(executor), rangeCount, [&](size_t rangeIndex)
+   {
+      const size_t from = alignedCount * rangeIndex / rangeCount * RangeAlignment;
+      const size_t to = std::min<size_t>(alignedCount * (rangeIndex + 1) / rangeCount * RangeAlignment, m_size);
+      for (size_t index = from; index < to; ++index)
+      {
+         func(m_keys[index], m_values[index]);
+      }
+   });
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, typename TAllocator>
+TKey DenseSlotMapStorage<TValue, TKey, TAllocator>::ReserveSlot(ValueType*& outPtr)
+{
+   if (m_size >= MaxCapacity())
+   {
+      outPtr = nullptr;
+      return InvalidKey;
+   }
+
+   if (m_size == m_capacity)
+   {
+      Reallocate(std::min(std::max(m_capacity * 2, MinCapacity), MaxCapacity()));
+   }
+   if (m_keys.size() == m_keys.capacity())
+   {
+      m_keys.reserve(m_capacity);
+   }
+   if ((m_firstFreeSlot == NoFreeSlot) && (m_slots.size() == m_slots.capacity()))
+   {
+      m_slots.reserve(std::min(std::max(m_slots.size() * 2, MinCapacity), MaxCapacity()));
+   }
+
+   return ReserveSlotNoAlloc(outPtr);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, typename TAllocator>
+TKey DenseSlotMapStorage<TValue, TKey, TAllocator>::ReserveSlotNoAlloc(ValueType*& outPtr)
+{
+   const bool needsNewSlot = (m_firstFreeSlot == NoFreeSlot);
+   if ((m_size >= m_capacity) ||
+      (m_keys.size() >= m_keys.capacity()) ||
+      (needsNewSlot && (m_slots.size() >= m_slots.capacity())))
+   {
+      outPtr = nullptr;
+      return InvalidKey;
+   }
+
+   SizeType slotIndex = 0;
+   if (needsNewSlot)
+   {
+      slotIndex = m_slots.size();
+      m_slots.push_back(Slot{ 0, 0 });
+   }
+   else
+   {
+      slotIndex = m_firstFreeSlot;
+      m_firstFreeSlot = m_slots[slotIndex].m_index;
+   }
+
+   Slot& slot = m_slots[slotIndex];
+   ++slot.m_generation;
+   if (slot.m_generation == 0)
+   {
+      slot.m_generation = 1;
+   }
+   slot.m_index = static_cast<KeyType>(m_size);
+
+   const KeyType key = MakeKey(slot.m_generation, slotIndex);
+   m_keys.push_back(key);
+   outPtr = m_values + m_size;
+   ++m_size;
+
+   return key;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, typename TAllocator>
+bool DenseSlotMapStorage<TValue, TKey, TAllocator>::FreeSlot(KeyType key)
+{
+   const SizeType index = FindIndex(key);
+   if (index >= m_size)
+   {
+      return false;
+   }
+
+   const SizeType lastIndex = m_size - 1;
+   if (index != lastIndex)
+   {
+      // Move the last value into the hole, the last one is destroyed below.
+      m_values[index] = std::move(m_values[lastIndex]);
+   }
+   if constexpr (!std::is_trivially_destructible_v<TValue>)
+   {
+      m_values[lastIndex].~TValue();
+   }
+
+   if (index != lastIndex)
+   {
+      const KeyType movedKey = m_keys[lastIndex];
+      m_keys[index] = movedKey;
+      m_slots[movedKey & SlotIndexMask].m_index = static_cast<KeyType>(index);
+   }
+   m_keys.pop_back();
+
+   const SizeType slotIndex = static_cast<SizeType>(key & SlotIndexMask);
+   m_slots[slotIndex].m_index = m_firstFreeSlot;
+   m_firstFreeSlot = static_cast<KeyType>(slotIndex);
+
+   --m_size;
+
+   return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, typename TAllocator>
+void DenseSlotMapStorage<TValue, TKey, TAllocator>::Swap(DenseSlotMapStorage& other)
+{
+   std::swap(m_size, other.m_size);
+   std::swap(m_capacity, other.m_capacity);
+   std::swap(m_firstFreeSlot, other.m_firstFreeSlot);
+   if constexpr (std::allocator_traits<TAllocator>::propagate_on_container_swap::value)
+   {
+      std::swap(m_allocator, other.m_allocator);
+   }
+   else
+   {
+      assert(m_allocator == other.m_allocator);
+   }
+   std::swap(m_values, other.m_values);
+   m_keys.swap(other.m_keys);
+   m_slots.swap(other.m_slots);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, typename TAllocator>
+void DenseSlotMapStorage<TValue, TKey, TAllocator>::Clear()
+{
+   for (SizeType index = 0; index < m_size; ++index)
+   {
+      if constexpr (!std::is_trivially_destructible_v<TValue>)
+      {
+         m_values[index].~TValue();
+      }
+
+      // The generations are kept, so that the old keys stay invalid.
+      const SizeType slotIndex = static_cast<SizeType>(m_keys[index] & SlotIndexMask);
+      m_slots[slotIndex].m_index = m_firstFreeSlot;
+      m_firstFreeSlot = static_cast<KeyType>(slotIndex);
+   }
+
+   m_keys.clear();
+   m_size = 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, typename TAllocator>
+void DenseSlotMapStorage<TValue, TKey, TAllocator>::Reallocate(SizeType capacity)
+{
+   assert(capacity >= m_size);
+
+   TValue* values = nullptr;
+   if (capacity > 0)
+   {
+      values = std::allocator_traits<TAllocator>::allocate(m_allocator, capacity);
+   }
+
+   for (SizeType index = 0; index < m_size; ++index)
+   {
+      new (values + index) TValue(std::move(m_values[index]));
+      if constexpr (!std::is_trivially_destructible_v<TValue>)
+      {
+         m_values[index].~TValue();
+      }
+   }
+
+   if (m_values)
+   {
+      std::allocator_traits<TAllocator>::deallocate(m_allocator, m_values, m_capacity);
+   }
+
+   m_values = values;
+   m_capacity = capacity;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, typename TAllocator>
+template<bool IsConst>
+bool DenseSlotMapStorage<TValue, TKey, TAllocator>::IteratorTpl<IsConst>::FindNext()
+{
+   if (m_index < m_storage->m_size)
+   {
+      m_key = m_storage->m_keys[m_index];
+      m_ptr = m_storage->m_values + m_index;
+      return true;
+   }
 
    m_key = std::numeric_limits<KeyType>::max();
    m_ptr = nullptr;
@@ -1073,6 +3930,11 @@ TKey SlotMap<TValue, TKey, TStorage>::Emplace(TArgs&&... args)
 
    new (ptr) TValue(std::forward<TArgs>(args)...);
 
+   if constexpr (impl::HasCommitSlot<TStorage>::value)
+   {
+      m_storage.CommitSlot(key);
+   }
+
    return key;
 }
 
@@ -1091,6 +3953,88 @@ TKey SlotMap<TValue, TKey, TStorage>::EmplaceNoAlloc(TArgs&&... args)
    }
 
    new (ptr) TValue(std::forward<TArgs>(args)...);
+
+   if constexpr (impl::HasCommitSlot<TStorage>::value)
+   {
+      m_storage.CommitSlot(key);
+   }
+
+   return key;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, typename TStorage>
+template<typename TFactory>
+typename SlotMap<TValue, TKey, TStorage>::SizeType
+SlotMap<TValue, TKey, TStorage>::EmplaceN(SizeType count, TFactory factory, TKey* outKeys)
+{
+   if constexpr (impl::HasReserveSlots<TStorage>::value && !impl::HasCommitSlot<TStorage>::value)
+   {
+      TValue* ptrs[impl::EmplaceBlockSize];
+      SizeType emplaced = 0;
+      while (emplaced < count)
+      {
+         const SizeType blockSize = std::min<SizeType>(count - emplaced, impl::EmplaceBlockSize);
+         const SizeType reserved = m_storage.ReserveSlots(blockSize, outKeys + emplaced, ptrs);
+         for (SizeType i = 0; i < reserved; ++i)
+         {
+            new (ptrs[i]) TValue(factory(emplaced + i));
+         }
+
+         emplaced += reserved;
+         if (reserved < blockSize)
+         {
+            break;
+         }
+      }
+      return emplaced;
+   }
+   else
+   {
+      for (SizeType i = 0; i < count; ++i)
+      {
+         TValue* ptr = nullptr;
+         const TKey key = m_storage.ReserveSlot(ptr);
+         if (!ptr)
+         {
+            return i;
+         }
+
+         new (ptr) TValue(factory(i));
+
+         if constexpr (impl::HasCommitSlot<TStorage>::value)
+         {
+            m_storage.CommitSlot(key);
+         }
+         outKeys[i] = key;
+      }
+      return count;
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TValue, typename TKey, typename TStorage>
+typename SlotMap<TValue, TKey, TStorage>::SizeType
+SlotMap<TValue, TKey, TStorage>::EraseN(const TKey* keys, SizeType count)
+{
+   if constexpr (impl::HasFreeSlots<TStorage>::value)
+   {
+      return m_storage.FreeSlots(keys, count);
+   }
+   else
+   {
+      SizeType erased = 0;
+      for (SizeType i = 0; i < count; ++i)
+      {
+         if (m_storage.FreeSlot(keys[i]))
+         {
+            ++erased;
+         }
+      }
+      return erased;
+   }
 }
 
 
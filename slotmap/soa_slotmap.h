@@ -0,0 +1,329 @@
+// vim: et:ts=3:sw=3:sts=3
+// Copyright (c) 2024, Jan Milik (jan.milik@gmail.com).
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#pragma once
+
+#include <cstdint>
+#include <tuple>
+#include <utility>
+#include <vector>
+
+#include "slotmap.h"
+
+
+namespace slotmap {
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Default max. size of a chunk of the \ref SoaChunkedSlotMapStorage. It is
+ * larger than \ref DefaultMaxChunkSize, so that the per-field arrays are long
+ * enough to be worth a vectorized loop even with many fields.
+ */
+constexpr size_t DefaultSoaChunkSize = 16 * 1024;
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Chunk of a \ref SoaChunkedSlotMapStorage.
+ *
+ * Each field has its own cache-line aligned array of `TSlotCount` elements.
+ * The free slots are linked through a separate array of slot indices, since
+ * there is no single value storage to reuse for the link.
+ */
+template<size_t TSlotCount, typename TIndexType, typename TGenerationType, typename TBitsetTraits, typename... TFields>
+struct SoaChunkTpl
+{
+   template<typename TField>
+   struct alignas(std::max(alignof(TField), impl::CacheLineSize)) FieldArray
+   {
+      uint8_t m_storage[sizeof(TField) * TSlotCount];
+
+      inline TField* GetPtr() { return reinterpret_cast<TField*>(m_storage); }
+      inline const TField* GetPtr() const { return reinterpret_cast<const TField*>(m_storage); }
+   };
+
+   using SlotIndexType = std::conditional_t<(TSlotCount <= INT16_MAX), int16_t, int32_t>;
+   using BitsetType = typename TBitsetTraits::template BitsetType<TSlotCount>;
+
+   SoaChunkTpl() = default;
+   /**
+    * Copies the live values of `other` into the new chunk.
+    */
+   SoaChunkTpl(const SoaChunkTpl& other);
+
+   TIndexType m_nextFreeChunk = -1;
+   SlotIndexType m_firstFreeSlot = -1;
+
+   BitsetType m_liveBits;
+   TGenerationType m_generations[TSlotCount];
+   SlotIndexType m_nextFreeSlots[TSlotCount];
+   std::tuple<FieldArray<TFields>...> m_fields;
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Dynamically allocated slotmap storage that keeps each field of the
+ * elements in its own array (structure of arrays).
+ *
+ * An element consists of one value of each of `TFields`. The chunks and the
+ * keys work the same way as in the \ref ChunkedSlotMapStorage, but instead of
+ * an array of values, a chunk holds one array per field. A pass that reads
+ * only a few fields of each element therefore only loads the cache lines of
+ * those fields, and the per-field arrays of a chunk can be processed with
+ * vectorized loops (see \ref ForEachChunk()).
+ *
+ * Since the values of an element are not stored together, this storage can't
+ * be plugged into \ref SlotMap and has the container interface itself. The
+ * fields are accessed by index, `GetPtr<I>(key)` returns a pointer to the
+ * field `I` of an element.
+ *
+ * Like in the \ref ChunkedSlotMapStorage, the chunks are never moved, so
+ * the pointers to the fields stay valid until the element is erased.
+ */
+template<typename TKey, typename... TFields>
+class SoaChunkedSlotMapStorage
+{
+public:
+   using KeyType = TKey;
+   using GenerationType = uint8_t;
+   using BitsetTraits = FixedBitSetTraits<>;
+
+   using SizeType = size_t;
+   using IndexType = ptrdiff_t;
+
+   template<size_t I>
+   using FieldType = std::tuple_element_t<I, std::tuple<TFields...>>;
+
+   static constexpr SizeType FieldCount = sizeof...(TFields);
+
+   static_assert(FieldCount > 0, "SoA slotmap must have at least one field.");
+   static_assert(std::is_unsigned_v<KeyType>, "Slotmap key type must be an unsigned integer type.");
+   static_assert(sizeof(KeyType) > sizeof(GenerationType), "The size of slotmap key type must be greater than the size of generation type.");
+
+   static constexpr KeyType InvalidKey = static_cast<KeyType>(0);
+
+private:
+   template<size_t TSlotCount>
+   using ChunkFor = SoaChunkTpl<TSlotCount, IndexType, GenerationType, BitsetTraits, TFields...>;
+
+public:
+   static constexpr size_t MaxChunkSlots = impl::GetChunkMaxSlotsFor<MinChunkSlots, DefaultSoaChunkSize, DefaultSoaChunkSize, ChunkFor>();
+   static constexpr int GenerationBitSize = sizeof(GenerationType) * CHAR_BIT;
+   static constexpr int SlotIndexBitSize = std::min(
+      impl::GetIndexBitSize(MaxChunkSlots),
+      static_cast<int>(sizeof(KeyType) * CHAR_BIT - GenerationBitSize - 1));
+   static constexpr int ChunkIndexBitSize = (sizeof(TKey) * CHAR_BIT) - GenerationBitSize - SlotIndexBitSize;
+
+   static constexpr KeyType ChunkSlots = std::min<KeyType>(static_cast<KeyType>(MaxChunkSlots), static_cast<KeyType>(1) << SlotIndexBitSize);
+   static_assert(ChunkSlots > 0, "Chunk must contain more than 0 slots.");
+
+   static constexpr KeyType ChunkIndexMask = (static_cast<KeyType>(1) << ChunkIndexBitSize) - 1;
+   static constexpr KeyType MaxChunkCount = ChunkIndexMask;
+
+   static constexpr KeyType SlotIndexShift = ChunkIndexBitSize;
+   static constexpr KeyType SlotIndexMask = (static_cast<KeyType>(1) << SlotIndexBitSize) - 1;
+
+   static constexpr KeyType GenerationShift = ChunkIndexBitSize + SlotIndexBitSize;
+   static constexpr KeyType GenerationMask = (static_cast<KeyType>(1) << GenerationBitSize) - 1;
+
+   static_assert(SlotIndexBitSize > 0);
+   static_assert(ChunkIndexBitSize > 0);
+
+   using Chunk = ChunkFor<ChunkSlots>;
+   using BitsetType = typename Chunk::BitsetType;
+
+   /**
+    * View of the field arrays of one chunk.
+    *
+    * The arrays have \ref GetSlotCount() elements, including the slots that
+    * are not live. For fields of trivially destructible types these hold
+    * zeros or the values of erased elements, so a vectorized loop can process
+    * whole arrays and ignore the results for slots that are not live (see
+    * \ref GetLiveBits()). The other fields must only be accessed for live
+    * slots.
+    */
+   template<bool IsConst>
+   class ChunkSpanTpl
+   {
+      friend class SoaChunkedSlotMapStorage;
+
+   public:
+      using ChunkPtr = std::conditional_t<IsConst, const Chunk*, Chunk*>;
+
+      template<size_t I>
+      using FieldPtr = std::conditional_t<IsConst, const FieldType<I>*, FieldType<I>*>;
+
+      inline SizeType GetChunkIndex() const { return m_chunkIndex; }
+      inline static constexpr SizeType GetSlotCount() { return ChunkSlots; }
+      inline const BitsetType& GetLiveBits() const { return m_chunk->m_liveBits; }
+      inline bool IsLive(SizeType slotIndex) const { return m_chunk->m_liveBits.test(slotIndex); }
+      inline KeyType GetKey(SizeType slotIndex) const { return MakeKey(m_chunk->m_generations[slotIndex], slotIndex, m_chunkIndex); }
+
+      /**
+       * Returns the array of the field `I`, indexed by slot index.
+       */
+      template<size_t I>
+      inline FieldPtr<I> GetField() const { return std::get<I>(m_chunk->m_fields).GetPtr(); }
+
+   private:
+      constexpr ChunkSpanTpl(ChunkPtr chunk, SizeType chunkIndex) : m_chunk(chunk), m_chunkIndex(chunkIndex) {}
+
+      ChunkPtr m_chunk;
+      SizeType m_chunkIndex;
+   };
+
+   using ChunkSpan = ChunkSpanTpl<false>;
+   using ConstChunkSpan = ChunkSpanTpl<true>;
+
+   SoaChunkedSlotMapStorage() = default;
+   SoaChunkedSlotMapStorage(const SoaChunkedSlotMapStorage& other);
+   SoaChunkedSlotMapStorage(SoaChunkedSlotMapStorage&& other);
+
+   ~SoaChunkedSlotMapStorage();
+
+   SoaChunkedSlotMapStorage& operator=(const SoaChunkedSlotMapStorage&) = delete;
+   SoaChunkedSlotMapStorage& operator=(SoaChunkedSlotMapStorage&& other);
+
+   inline SizeType Size() const { return m_size; }
+   inline SizeType Capacity() const { return m_chunks.size() * ChunkSlots; }
+   inline static constexpr SizeType MaxCapacity() { return MaxChunkCount * ChunkSlots; }
+
+   bool Reserve(SizeType capacity);
+
+   /**
+    * Constructs a new element and returns its key.
+    *
+    * Either takes one argument per field, each field is then constructed
+    * from the corresponding argument, or no arguments, in which case all
+    * fields are value-initialized. Returns \ref InvalidKey if the max.
+    * capacity has been reached.
+    */
+   template<typename... TArgs>
+   KeyType Emplace(TArgs&&... args);
+   /**
+    * Erases the element with the given key. Returns `false` if the key is
+    * invalid.
+    */
+   bool Erase(KeyType key);
+
+   /**
+    * Returns a pointer to the field `I` of the element with the given key, or
+    * `nullptr` if the key is invalid.
+    */
+   template<size_t I>
+   inline FieldType<I>* GetPtr(KeyType key) { return GetPtrTpl<I>(this, key); }
+   template<size_t I>
+   inline const FieldType<I>* GetPtr(KeyType key) const { return GetPtrTpl<I>(this, key); }
+
+   /**
+    * Calls `func(key, fields...)` for each element.
+    *
+    * If field indices are given, only those fields are passed to `func`, in
+    * the given order, and only their arrays are read. Without field indices,
+    * all fields are passed.
+    */
+   template<size_t... TFieldIndices, typename TFunc>
+   inline void ForEach(TFunc func) { ForEachTpl(this, func, GetFieldSequence<TFieldIndices...>()); }
+   template<size_t... TFieldIndices, typename TFunc>
+   inline void ForEach(TFunc func) const { ForEachTpl(this, func, GetFieldSequence<TFieldIndices...>()); }
+
+   /**
+    * Returns the number of chunks that may contain live elements, i.e. the
+    * range of valid chunk indices for \ref GetChunkSpan().
+    */
+   inline SizeType ChunkCount() const { return m_maxUsedChunk; }
+   inline ChunkSpan GetChunkSpan(SizeType chunkIndex) { return ChunkSpan(m_chunks[chunkIndex], chunkIndex); }
+   inline ConstChunkSpan GetChunkSpan(SizeType chunkIndex) const { return ConstChunkSpan(m_chunks[chunkIndex], chunkIndex); }
+
+   /**
+    * Calls `func(span)` with a \ref ChunkSpanTpl "ChunkSpan" for each chunk
+    * that may contain live elements.
+    */
+   template<typename TFunc>
+   void ForEachChunk(TFunc func);
+   template<typename TFunc>
+   void ForEachChunk(TFunc func) const;
+
+   void Swap(SoaChunkedSlotMapStorage& other);
+   void Clear();
+
+private:
+   template<size_t... TFieldIndices>
+   static constexpr auto GetFieldSequence()
+   {
+      if constexpr (sizeof...(TFieldIndices) == 0)
+      {
+         return std::index_sequence_for<TFields...>();
+      }
+      else
+      {
+         return std::index_sequence<TFieldIndices...>();
+      }
+   }
+
+   static inline constexpr KeyType MakeKey(GenerationType generation, SizeType slotIndex, SizeType chunkIndex)
+   {
+      return (static_cast<KeyType>(generation) << GenerationShift) |
+         (static_cast<KeyType>(slotIndex) << SlotIndexShift) |
+         static_cast<KeyType>(chunkIndex);
+   }
+
+   template<size_t I, typename TSelf>
+   static inline auto GetPtrTpl(TSelf self, KeyType key);
+
+   template<typename TSelf, typename TFunc, size_t... I>
+   static void ForEachTpl(TSelf self, TFunc& func, std::index_sequence<I...>);
+
+   template<size_t... I>
+   static void ConstructFields(Chunk* chunk, SizeType slotIndex, std::index_sequence<I...>);
+   template<typename TArgsTuple, size_t... I>
+   static void ConstructFields(Chunk* chunk, SizeType slotIndex, TArgsTuple&& args, std::index_sequence<I...>);
+   template<size_t... I>
+   static void DestroyFields(Chunk* chunk, SizeType slotIndex, std::index_sequence<I...>);
+
+   void AllocateChunk();
+   static void InitializeChunk(Chunk* chunk);
+
+   SizeType m_size = 0;
+   IndexType m_firstFreeChunk = -1;
+   SizeType m_maxUsedChunk = 0;
+   std::vector<Chunk*> m_chunks;
+};
+
+
+/**
+ * Structure of arrays slotmap with 32-bit keys (see
+ * \ref SoaChunkedSlotMapStorage).
+ */
+template<typename... TFields>
+using SoaSlotMap = SoaChunkedSlotMapStorage<uint32_t, TFields...>;
+
+
+} // namespace slotmap
+
+
+#include "soa_slotmap.inl"
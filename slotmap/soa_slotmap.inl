@@ -0,0 +1,418 @@
+// vim: et:ts=3:sw=3:sts=3
+// Copyright (c) 2024, Jan Milik (jan.milik@gmail.com).
+//
+// All rights reserved.
+//
+// MIT License
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+#include <cstring>
+
+
+namespace slotmap {
+
+
+//////////////////////////////////////////////////////////////////////////
+template<size_t TSlotCount, typename TIndexType, typename TGenerationType, typename TBitsetTraits, typename... TFields>
+SoaChunkTpl<TSlotCount, TIndexType, TGenerationType, TBitsetTraits, TFields...>::SoaChunkTpl(const SoaChunkTpl& other)
+   : m_nextFreeChunk(other.m_nextFreeChunk)
+   , m_firstFreeSlot(other.m_firstFreeSlot)
+   , m_liveBits(other.m_liveBits)
+{
+   std::copy(other.m_generations, other.m_generations + TSlotCount, m_generations);
+   std::copy(other.m_nextFreeSlots, other.m_nextFreeSlots + TSlotCount, m_nextFreeSlots);
+
+   auto copyField = [&](auto& dst, const auto& src)
+   {
+      using FieldType = std::remove_const_t<std::remove_pointer_t<decltype(src.GetPtr())>>;
+      if constexpr (std::is_trivially_copyable_v<FieldType>)
+      {
+         // Copy the whole array, so that the slots that aren't live hold
+         // the same values as in `other`.
+         std::memcpy(dst.m_storage, src.m_storage, sizeof(dst.m_storage));
+      }
+      else
+      {
+         TBitsetTraits::ForEachSetBit(m_liveBits, [&](size_t slotIndex)
+         {
+            new (dst.GetPtr() + slotIndex) FieldType(src.GetPtr()[slotIndex]);
+         });
+      }
+   };
+
+   std::apply([&](auto&... dstFields)
+   {
+      std::apply([&](const auto&... srcFields)
+      {
+         (copyField(dstFields, srcFields), ...);
+      }, other.m_fields);
+   }, m_fields);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TKey, typename... TFields>
+SoaChunkedSlotMapStorage<TKey, TFields...>::SoaChunkedSlotMapStorage(const SoaChunkedSlotMapStorage& other)
+   : m_size(other.m_size)
+   , m_firstFreeChunk(other.m_firstFreeChunk)
+   , m_maxUsedChunk(other.m_maxUsedChunk)
+{
+   m_chunks.resize(m_maxUsedChunk);
+   for (SizeType chunkIndex = 0; chunkIndex < m_maxUsedChunk; ++chunkIndex)
+   {
+      m_chunks[chunkIndex] = new Chunk(*other.m_chunks[chunkIndex]);
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TKey, typename... TFields>
+SoaChunkedSlotMapStorage<TKey, TFields...>::SoaChunkedSlotMapStorage(SoaChunkedSlotMapStorage&& other)
+{
+   Swap(other);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TKey, typename... TFields>
+SoaChunkedSlotMapStorage<TKey, TFields...>::~SoaChunkedSlotMapStorage()
+{
+   Clear();
+
+   for (Chunk* chunk : m_chunks)
+   {
+      delete chunk;
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TKey, typename... TFields>
+SoaChunkedSlotMapStorage<TKey, TFields...>& SoaChunkedSlotMapStorage<TKey, TFields...>::operator=(SoaChunkedSlotMapStorage&& other)
+{
+   if (this != &other)
+   {
+      SoaChunkedSlotMapStorage empty;
+      Swap(empty);
+      Swap(other);
+   }
+   return *this;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TKey, typename... TFields>
+bool SoaChunkedSlotMapStorage<TKey, TFields...>::Reserve(SizeType capacity)
+{
+   if (capacity <= Capacity())
+   {
+      return true;
+   }
+
+   if (capacity > MaxCapacity())
+   {
+      return false;
+   }
+
+   const SizeType chunkCount = (capacity + ChunkSlots - 1) / ChunkSlots;
+   m_chunks.reserve(chunkCount);
+   while (m_chunks.size() < chunkCount)
+   {
+      m_chunks.push_back(new Chunk());
+   }
+
+   return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TKey, typename... TFields>
+template<typename... TArgs>
+TKey SoaChunkedSlotMapStorage<TKey, TFields...>::Emplace(TArgs&&... args)
+{
+   static_assert((sizeof...(TArgs) == 0) || (sizeof...(TArgs) == FieldCount),
+      "Emplace() takes either no arguments or one argument per field.");
+
+   if (m_firstFreeChunk < 0)
+   {
+      if (m_maxUsedChunk >= MaxChunkCount)
+      {
+         return InvalidKey;
+      }
+      AllocateChunk();
+   }
+   assert(m_firstFreeChunk >= 0);
+
+   const SizeType chunkIndex = static_cast<SizeType>(m_firstFreeChunk);
+   Chunk* const chunk = m_chunks[chunkIndex];
+   assert(chunk->m_firstFreeSlot >= 0);
+
+   const SizeType slotIndex = static_cast<SizeType>(chunk->m_firstFreeSlot);
+   if constexpr (sizeof...(TArgs) == 0)
+   {
+      ConstructFields(chunk, slotIndex, std::index_sequence_for<TFields...>());
+   }
+   else
+   {
+      ConstructFields(chunk, slotIndex, std::forward_as_tuple(std::forward<TArgs>(args)...), std::index_sequence_for<TFields...>());
+   }
+
+   chunk->m_firstFreeSlot = chunk->m_nextFreeSlots[slotIndex];
+   if (chunk->m_firstFreeSlot < 0)
+   {
+      m_firstFreeChunk = chunk->m_nextFreeChunk;
+   }
+
+   ++chunk->m_generations[slotIndex];
+   if (chunk->m_generations[slotIndex] == 0)
+   {
+      chunk->m_generations[slotIndex] = 1;
+   }
+   assert(!chunk->m_liveBits[slotIndex]);
+   chunk->m_liveBits.set(slotIndex);
+
+   ++m_size;
+
+   return MakeKey(chunk->m_generations[slotIndex], slotIndex, chunkIndex);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TKey, typename... TFields>
+bool SoaChunkedSlotMapStorage<TKey, TFields...>::Erase(KeyType key)
+{
+   const KeyType chunkIndex = key & ChunkIndexMask;
+   if (chunkIndex >= m_maxUsedChunk)
+   {
+      return false;
+   }
+
+   Chunk* const chunk = m_chunks[chunkIndex];
+   const KeyType slotIndex = (key >> SlotIndexShift) & SlotIndexMask;
+   if ((slotIndex >= ChunkSlots) || !chunk->m_liveBits.test(slotIndex))
+   {
+      return false;
+   }
+
+   const GenerationType generation = (key >> GenerationShift) & GenerationMask;
+   if (chunk->m_generations[slotIndex] != generation)
+   {
+      return false;
+   }
+
+   DestroyFields(chunk, slotIndex, std::index_sequence_for<TFields...>());
+
+   const bool isChunkInFreeList = (chunk->m_firstFreeSlot >= 0);
+   chunk->m_nextFreeSlots[slotIndex] = chunk->m_firstFreeSlot;
+   chunk->m_firstFreeSlot = static_cast<typename Chunk::SlotIndexType>(slotIndex);
+   if (!isChunkInFreeList)
+   {
+      chunk->m_nextFreeChunk = m_firstFreeChunk;
+      m_firstFreeChunk = chunkIndex;
+   }
+
+   chunk->m_liveBits.reset(slotIndex);
+   assert(m_size > 0);
+   --m_size;
+
+   return true;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TKey, typename... TFields>
+template<size_t I, typename TSelf>
+inline auto SoaChunkedSlotMapStorage<TKey, TFields...>::GetPtrTpl(TSelf self, KeyType key)
+{
+   using ResultType = std::conditional_t<std::is_const_v<std::remove_pointer_t<TSelf>>, const FieldType<I>*, FieldType<I>*>;
+
+   const KeyType chunkIndex = key & ChunkIndexMask;
+   if (chunkIndex >= self->m_maxUsedChunk)
+   {
+      return static_cast<ResultType>(nullptr);
+   }
+
+   Chunk* const chunk = self->m_chunks[chunkIndex];
+   const KeyType slotIndex = (key >> SlotIndexShift) & SlotIndexMask;
+   if ((slotIndex >= ChunkSlots) || !chunk->m_liveBits.test(slotIndex))
+   {
+      return static_cast<ResultType>(nullptr);
+   }
+
+   const GenerationType generation = (key >> GenerationShift) & GenerationMask;
+   if (chunk->m_generations[slotIndex] != generation)
+   {
+      return static_cast<ResultType>(nullptr);
+   }
+
+   return static_cast<ResultType>(std::get<I>(chunk->m_fields).GetPtr() + slotIndex);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TKey, typename... TFields>
+template<typename TSelf, typename TFunc, size_t... I>
+void SoaChunkedSlotMapStorage<TKey, TFields...>::ForEachTpl(TSelf self, TFunc& func, std::index_sequence<I...>)
+{
+   using ChunkPtr = std::conditional_t<std::is_const_v<std::remove_pointer_t<TSelf>>, const Chunk*, Chunk*>;
+
+   for (SizeType chunkIndex = 0; chunkIndex < self->m_maxUsedChunk; ++chunkIndex)
+   {
+      const ChunkPtr chunk = self->m_chunks[chunkIndex];
+      BitsetTraits::ForEachSetBit(chunk->m_liveBits, [&](size_t slotIndex)
+      {
+         func(MakeKey(chunk->m_generations[slotIndex], slotIndex, chunkIndex), std::get<I>(chunk->m_fields).GetPtr()[slotIndex]...);
+      });
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TKey, typename... TFields>
+template<typename TFunc>
+void SoaChunkedSlotMapStorage<TKey, TFields...>::ForEachChunk(TFunc func)
+{
+   for (SizeType chunkIndex = 0; chunkIndex < m_maxUsedChunk; ++chunkIndex)
+   {
+      func(ChunkSpan(m_chunks[chunkIndex], chunkIndex));
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TKey, typename... TFields>
+template<typename TFunc>
+void SoaChunkedSlotMapStorage<TKey, TFields...>::ForEachChunk(TFunc func) const
+{
+   for (SizeType chunkIndex = 0; chunkIndex < m_maxUsedChunk; ++chunkIndex)
+   {
+      func(ConstChunkSpan(m_chunks[chunkIndex], chunkIndex));
+   }
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TKey, typename... TFields>
+void SoaChunkedSlotMapStorage<TKey, TFields...>::Swap(SoaChunkedSlotMapStorage& other)
+{
+   std::swap(m_size, other.m_size);
+   std::swap(m_firstFreeChunk, other.m_firstFreeChunk);
+   std::swap(m_maxUsedChunk, other.m_maxUsedChunk);
+   m_chunks.swap(other.m_chunks);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TKey, typename... TFields>
+void SoaChunkedSlotMapStorage<TKey, TFields...>::Clear()
+{
+   if constexpr (!(std::is_trivially_destructible_v<TFields> && ...))
+   {
+      for (SizeType chunkIndex = 0; chunkIndex < m_maxUsedChunk; ++chunkIndex)
+      {
+         Chunk* const chunk = m_chunks[chunkIndex];
+         BitsetTraits::ForEachSetBit(chunk->m_liveBits, [&](size_t slotIndex)
+         {
+            DestroyFields(chunk, slotIndex, std::index_sequence_for<TFields...>());
+         });
+      }
+   }
+
+   // The chunks are reinitialized once they are used again, see
+   // AllocateChunk(). The generations are kept, so that the old keys stay
+   // invalid.
+   m_size = 0;
+   m_firstFreeChunk = -1;
+   m_maxUsedChunk = 0;
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TKey, typename... TFields>
+template<size_t... I>
+void SoaChunkedSlotMapStorage<TKey, TFields...>::ConstructFields(Chunk* chunk, SizeType slotIndex, std::index_sequence<I...>)
+{
+   (new (std::get<I>(chunk->m_fields).GetPtr() + slotIndex) FieldType<I>(), ...);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TKey, typename... TFields>
+template<typename TArgsTuple, size_t... I>
+void SoaChunkedSlotMapStorage<TKey, TFields...>::ConstructFields(Chunk* chunk, SizeType slotIndex, TArgsTuple&& args, std::index_sequence<I...>)
+{
+   (new (std::get<I>(chunk->m_fields).GetPtr() + slotIndex) FieldType<I>(std::get<I>(std::forward<TArgsTuple>(args))), ...);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TKey, typename... TFields>
+template<size_t... I>
+void SoaChunkedSlotMapStorage<TKey, TFields...>::DestroyFields(Chunk* chunk, SizeType slotIndex, std::index_sequence<I...>)
+{
+   auto destroy = [](auto* ptr)
+   {
+      using T = std::remove_pointer_t<decltype(ptr)>;
+      if constexpr (!std::is_trivially_destructible_v<T>)
+      {
+         ptr->~T();
+      }
+   };
+
+   (destroy(std::get<I>(chunk->m_fields).GetPtr() + slotIndex), ...);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TKey, typename... TFields>
+void SoaChunkedSlotMapStorage<TKey, TFields...>::AllocateChunk()
+{
+   if (m_maxUsedChunk >= m_chunks.size())
+   {
+      // Value-initialized, so that the field arrays start zeroed.
+      m_chunks.push_back(new Chunk());
+   }
+
+   const SizeType chunkIndex = m_maxUsedChunk++;
+   Chunk* const chunk = m_chunks[chunkIndex];
+
+   InitializeChunk(chunk);
+   chunk->m_nextFreeChunk = m_firstFreeChunk;
+   m_firstFreeChunk = static_cast<IndexType>(chunkIndex);
+}
+
+
+//////////////////////////////////////////////////////////////////////////
+template<typename TKey, typename... TFields>
+void SoaChunkedSlotMapStorage<TKey, TFields...>::InitializeChunk(Chunk* chunk)
+{
+   using SlotIndexType = typename Chunk::SlotIndexType;
+
+   chunk->m_liveBits.reset();
+   for (SizeType i = 0; i < ChunkSlots - 1; ++i)
+   {
+      chunk->m_nextFreeSlots[i] = static_cast<SlotIndexType>(i + 1);
+   }
+   chunk->m_nextFreeSlots[ChunkSlots - 1] = -1;
+   chunk->m_firstFreeSlot = 0;
+}
+
+
+} // namespace slotmap
@@ -0,0 +1,194 @@
+// vim: et:ts=3:sw=3:sts=3
+// Copyright (c) 2024, Jan Milik (jan.milik@gmail.com).
+// 
+// All rights reserved.
+//
+// MIT License
+// 
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+// 
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+// 
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+#include "parallel.h"
+
+
+namespace slotmap {
+
+
+/**
+ * Reason of a failed key lookup, reported to the stats policy of a storage.
+ */
+enum class LookupFailure
+{
+   /// The chunk or the slot index of the key has never been used.
+   OutOfRange,
+   /// The slot of the key holds no element, it has been erased.
+   DeadSlot,
+   /// The slot of the key holds a newer element, the key is stale.
+   StaleGeneration,
+};
+
+/// Number of \ref LookupFailure values.
+constexpr size_t LookupFailureCount = 3;
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Default stats policy of the storages, all of its hooks are empty and
+ * compile away.
+ *
+ * A stats policy is the `TStats` parameter of \ref ChunkedSlotMapStorage and
+ * \ref FixedSlotMapStorage. The storage calls its hooks from the slow paths
+ * (allocation, generation wrap, failed lookups) and once per insert or erase,
+ * the hot path of a successful lookup calls none of them.
+ */
+struct NoStats
+{
+   /// Called after `count` elements have been inserted.
+   inline void OnInsert(size_t /*count*/) {}
+   /// Called after `count` elements have been erased.
+   inline void OnErase(size_t /*count*/) {}
+   /// Called after the size or the capacity of the storage has changed.
+   inline void OnSizeChanged(size_t /*size*/, size_t /*freeSlotCount*/) {}
+   /// Called when a lookup of a key fails. Might be called by several
+   /// concurrent readers.
+   inline void OnLookupFailed(LookupFailure /*failure*/) const {}
+   /// Called after the storage has allocated the memory of a chunk.
+   inline void OnChunkAllocated() {}
+   /// Called when the generation of a slot wraps around, the keys handed out
+   /// by the slot before start to repeat.
+   inline void OnGenerationWrap() {}
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Copy of the counters of \ref AtomicStats.
+ */
+struct StatsSnapshot
+{
+   uint64_t m_insertCount = 0;
+   uint64_t m_eraseCount = 0;
+   /// Failed lookups by \ref LookupFailure.
+   uint64_t m_failedLookupCounts[LookupFailureCount] = {};
+   uint64_t m_chunkAllocationCount = 0;
+   uint64_t m_generationWrapCount = 0;
+   uint64_t m_size = 0;
+   uint64_t m_peakSize = 0;
+   /// Slots that can be reused without allocating, i.e. the capacity without
+   /// the live and the retired slots.
+   uint64_t m_freeSlotCount = 0;
+
+   inline uint64_t GetFailedLookupCount(LookupFailure failure) const { return m_failedLookupCounts[static_cast<size_t>(failure)]; }
+
+   inline uint64_t GetFailedLookupCount() const
+   {
+      uint64_t count = 0;
+      for (uint64_t failureCount : m_failedLookupCounts)
+      {
+         count += failureCount;
+      }
+      return count;
+   }
+};
+
+
+//////////////////////////////////////////////////////////////////////////
+/**
+ * Stats policy that counts the operations of a storage in relaxed atomics,
+ * so that \ref GetSnapshot() can be called from another thread (e.g. by a
+ * metrics exporter) while the owner keeps modifying the storage.
+ *
+ * \ref InstrumentedSlotMap is a chunked \ref SlotMap with this policy.
+ *
+ * The counters belong to the storage object, they are not copied, moved or
+ * swapped along with its elements. The values of a snapshot are read one by
+ * one, they are not necessarily consistent with each other.
+ */
+class AtomicStats
+{
+public:
+   inline void OnInsert(size_t count) { Add(m_insertCount, count); }
+   inline void OnErase(size_t count) { Add(m_eraseCount, count); }
+
+   inline void OnSizeChanged(size_t size, size_t freeSlotCount)
+   {
+      m_size.store(size, std::memory_order_relaxed);
+      m_freeSlotCount.store(freeSlotCount, std::memory_order_relaxed);
+      if (size > m_peakSize.load(std::memory_order_relaxed))
+      {
+         m_peakSize.store(size, std::memory_order_relaxed);
+      }
+   }
+
+   inline void OnLookupFailed(LookupFailure failure) const
+   {
+      // The only counters updated by the readers, they have their own cache
+      // line.
+      m_failedLookupCounts[static_cast<size_t>(failure)].fetch_add(1, std::memory_order_relaxed);
+   }
+
+   inline void OnChunkAllocated() { Add(m_chunkAllocationCount, 1); }
+   inline void OnGenerationWrap() { Add(m_generationWrapCount, 1); }
+
+   /**
+    * Returns the current values of the counters. Can be called from any
+    * thread.
+    */
+   StatsSnapshot GetSnapshot() const
+   {
+      StatsSnapshot snapshot;
+      snapshot.m_insertCount = m_insertCount.load(std::memory_order_relaxed);
+      snapshot.m_eraseCount = m_eraseCount.load(std::memory_order_relaxed);
+      for (size_t i = 0; i < LookupFailureCount; ++i)
+      {
+         snapshot.m_failedLookupCounts[i] = m_failedLookupCounts[i].load(std::memory_order_relaxed);
+      }
+      snapshot.m_chunkAllocationCount = m_chunkAllocationCount.load(std::memory_order_relaxed);
+      snapshot.m_generationWrapCount = m_generationWrapCount.load(std::memory_order_relaxed);
+      snapshot.m_size = m_size.load(std::memory_order_relaxed);
+      snapshot.m_peakSize = m_peakSize.load(std::memory_order_relaxed);
+      snapshot.m_freeSlotCount = m_freeSlotCount.load(std::memory_order_relaxed);
+      return snapshot;
+   }
+
+private:
+   // The storage has a single writer, a read-modify-write is not needed.
+   static inline void Add(std::atomic<uint64_t>& counter, uint64_t value)
+   {
+      counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+   }
+
+   std::atomic<uint64_t> m_insertCount{0};
+   std::atomic<uint64_t> m_eraseCount{0};
+   std::atomic<uint64_t> m_chunkAllocationCount{0};
+   std::atomic<uint64_t> m_generationWrapCount{0};
+   std::atomic<uint64_t> m_size{0};
+   std::atomic<uint64_t> m_peakSize{0};
+   std::atomic<uint64_t> m_freeSlotCount{0};
+   alignas(impl::CacheLineSize) mutable std::atomic<uint64_t> m_failedLookupCounts[LookupFailureCount] = {};
+};
+
+
+} // namespace slotmap